@@ -47,7 +47,8 @@ public:
 		eAtpWrongSpeed = 7,
 		eExecError = 8,
 		eWritePrinterError = 9,
-		eRemoteControlError = 10
+		eRemoteControlError = 10,
+		eDeviceBusy = 11
 	};
 	virtual int ProcessCommandFrame(SIO_command_frame& frame, const RCPtr<SIOWrapper>& wrapper) = 0;
 	// returns:
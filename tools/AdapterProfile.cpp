@@ -0,0 +1,334 @@
+/*
+   AdapterProfile.cpp - measured timing parameters of serial adapters
+
+   Copyright (C) 2026 Matthias Reichl <hias@horus.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/select.h>
+#include <sys/sysmacros.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <termios.h>
+
+#include "AdapterProfile.h"
+#include "AtariDebug.h"
+
+AdapterProfile::AdapterProfile()
+	: fBaudrate(0),
+	  fModemGetCost(0),
+	  fDrainOvershootAvg(0),
+	  fDrainOvershootMax(0),
+	  fLoopbackLatencyMin(0),
+	  fLoopbackLatencyAvg(0),
+	  fLoopbackLatencyMax(0)
+{
+}
+
+uint64_t AdapterProfile::GetMonotonicUsec()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+bool AdapterProfile::Measure(int fd, int loopbackFd, unsigned int baudrate)
+{
+	uint8_t buf[64];
+	uint64_t start, end, sum;
+	unsigned int i;
+	int flags;
+
+	if (baudrate == 0) {
+		return false;
+	}
+	memset(buf, 0x55, sizeof(buf));
+	fBaudrate = baudrate;
+
+	// TIOCMGET, not supported by ptys
+	fModemGetCost = 0;
+	if (ioctl(fd, TIOCMGET, &flags) == 0) {
+		start = GetMonotonicUsec();
+		for (i = 0; i < eModemGetRuns; i++) {
+			ioctl(fd, TIOCMGET, &flags);
+		}
+		fModemGetCost = (GetMonotonicUsec() - start) / eModemGetRuns;
+		if (fModemGetCost == 0) {
+			fModemGetCost = 1;
+		}
+	}
+
+	// tcdrain called right after writing 1, 16 and 64 bytes
+	sum = 0;
+	fDrainOvershootMax = 0;
+	for (i = 0; i < 3 * eDrainRuns; i++) {
+		unsigned int len = (i < eDrainRuns) ? 1 : (i < 2 * eDrainRuns) ? 16 : 64;
+		uint64_t xmit = (uint64_t) len * 10 * 1000000 / baudrate;
+		uint64_t overshoot;
+
+		tcdrain(fd);
+		tcflush(fd, TCIOFLUSH);
+		start = GetMonotonicUsec();
+		if (write(fd, buf, len) != (ssize_t) len) {
+			AERROR("writing calibration data failed");
+			return false;
+		}
+		tcdrain(fd);
+		end = GetMonotonicUsec();
+
+		overshoot = (end - start > xmit) ? end - start - xmit : 0;
+		sum += overshoot;
+		if (overshoot > fDrainOvershootMax) {
+			fDrainOvershootMax = overshoot;
+		}
+		if (loopbackFd >= 0) {
+			// let the echo arrive before flushing it
+			usleep(xmit + 20000);
+			tcflush(loopbackFd, TCIFLUSH);
+		}
+	}
+	fDrainOvershootAvg = sum / (3 * eDrainRuns);
+
+	fLoopbackLatencyMin = 0;
+	fLoopbackLatencyAvg = 0;
+	fLoopbackLatencyMax = 0;
+	if (loopbackFd < 0) {
+		return true;
+	}
+
+	sum = 0;
+	for (i = 0; i < eLoopbackRuns; i++) {
+		uint64_t xmit = (uint64_t) 10 * 1000000 / baudrate;
+		uint64_t latency;
+		fd_set read_set;
+		struct timeval tv;
+		uint8_t c;
+
+		tcflush(loopbackFd, TCIFLUSH);
+		start = GetMonotonicUsec();
+		if (write(fd, buf, 1) != 1) {
+			AERROR("writing calibration data failed");
+			return false;
+		}
+		while (true) {
+			end = GetMonotonicUsec();
+			if (end - start >= eLoopbackTimeout) {
+				AWARN("no loopback detected");
+				fLoopbackLatencyMin = 0;
+				fLoopbackLatencyMax = 0;
+				return true;
+			}
+			uint64_t remain = eLoopbackTimeout - (end - start);
+			tv.tv_sec = 0;
+			tv.tv_usec = remain;
+			FD_ZERO(&read_set);
+			FD_SET(loopbackFd, &read_set);
+			if (select(loopbackFd + 1, &read_set, NULL, NULL, &tv) < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				return false;
+			}
+			if (read(loopbackFd, &c, 1) == 1) {
+				end = GetMonotonicUsec();
+				break;
+			}
+		}
+		latency = (end - start > xmit) ? end - start - xmit : 0;
+		sum += latency;
+		if (i == 0 || latency < fLoopbackLatencyMin) {
+			fLoopbackLatencyMin = latency;
+		}
+		if (latency > fLoopbackLatencyMax) {
+			fLoopbackLatencyMax = latency;
+		}
+	}
+	fLoopbackLatencyAvg = sum / eLoopbackRuns;
+	return true;
+}
+
+static bool read_sysfs_attr(const std::string& dir, const char* name, std::string& value)
+{
+	std::string path = dir + "/" + name;
+	char buf[128];
+	FILE* f = fopen(path.c_str(), "r");
+
+	if (!f) {
+		return false;
+	}
+	if (!fgets(buf, sizeof(buf), f)) {
+		fclose(f);
+		return false;
+	}
+	fclose(f);
+
+	value.clear();
+	for (char* p = buf; *p && *p != '\n'; p++) {
+		// keep the key usable as a filename
+		if ((*p >= '0' && *p <= '9') || (*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z')) {
+			value += *p;
+		} else {
+			value += '_';
+		}
+	}
+	return value.size() > 0;
+}
+
+bool AdapterProfile::GetDeviceKey(int fd, std::string& key)
+{
+	struct stat st;
+	char path[PATH_MAX];
+	char real[PATH_MAX];
+
+	if (fstat(fd, &st) || !S_ISCHR(st.st_mode)) {
+		return false;
+	}
+	snprintf(path, sizeof(path), "/sys/dev/char/%u:%u",
+		(unsigned int) major(st.st_rdev), (unsigned int) minor(st.st_rdev));
+	if (!realpath(path, real)) {
+		return false;
+	}
+
+	std::string dir(real);
+	std::string name = dir.substr(dir.rfind('/') + 1);
+
+	// walk up to the USB device
+	while (dir.size() > 1) {
+		std::string vendor, product, serial;
+		if (read_sysfs_attr(dir, "idVendor", vendor) && read_sysfs_attr(dir, "idProduct", product)) {
+			key = "usb-" + vendor + "-" + product;
+			if (read_sysfs_attr(dir, "serial", serial)) {
+				key += "-" + serial;
+			}
+			return true;
+		}
+		dir.erase(dir.rfind('/'));
+	}
+
+	key = "tty-" + name;
+	return true;
+}
+
+bool AdapterProfile::GetProfileFilename(const std::string& key, std::string& filename, bool create)
+{
+	std::string dir;
+	const char* base = getenv("XDG_CONFIG_HOME");
+
+	if (base && *base) {
+		dir = base;
+	} else {
+		base = getenv("HOME");
+		if (!base || !*base) {
+			return false;
+		}
+		dir = std::string(base) + "/.config";
+	}
+	if (create && mkdir(dir.c_str(), 0700) && errno != EEXIST) {
+		return false;
+	}
+	dir += "/atarisio";
+	if (create && mkdir(dir.c_str(), 0700) && errno != EEXIST) {
+		return false;
+	}
+	filename = dir + "/adapter-";
+
+	// the USB serial number comes straight from the device, don't
+	// let it add path components or other odd characters
+	for (std::string::const_iterator i = key.begin(); i != key.end(); ++i) {
+		char c = *i;
+		if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')
+		    || c == '.' || c == '_' || c == '-') {
+			filename += c;
+		} else {
+			filename += '_';
+		}
+	}
+	return true;
+}
+
+bool AdapterProfile::Load(const std::string& key)
+{
+	std::string filename;
+	char line[128];
+	char name[64];
+	unsigned int value;
+	FILE* f;
+
+	if (!GetProfileFilename(key, filename, false)) {
+		return false;
+	}
+	if (!(f = fopen(filename.c_str(), "r"))) {
+		return false;
+	}
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%63[a-z_] = %u", name, &value) != 2) {
+			continue;
+		}
+		if (strcmp(name, "baudrate") == 0) {
+			fBaudrate = value;
+		} else if (strcmp(name, "modem_get_cost") == 0) {
+			fModemGetCost = value;
+		} else if (strcmp(name, "drain_overshoot_avg") == 0) {
+			fDrainOvershootAvg = value;
+		} else if (strcmp(name, "drain_overshoot_max") == 0) {
+			fDrainOvershootMax = value;
+		} else if (strcmp(name, "loopback_latency_min") == 0) {
+			fLoopbackLatencyMin = value;
+		} else if (strcmp(name, "loopback_latency_avg") == 0) {
+			fLoopbackLatencyAvg = value;
+		} else if (strcmp(name, "loopback_latency_max") == 0) {
+			fLoopbackLatencyMax = value;
+		}
+	}
+	fclose(f);
+	return true;
+}
+
+bool AdapterProfile::Save(const std::string& key) const
+{
+	std::string filename;
+	FILE* f;
+	bool ok;
+
+	if (!GetProfileFilename(key, filename, true)) {
+		return false;
+	}
+	if (!(f = fopen(filename.c_str(), "w"))) {
+		return false;
+	}
+	fprintf(f, "# AtariSIO timing profile for %s, times in usec\n", key.c_str());
+	fprintf(f, "baudrate = %u\n", fBaudrate);
+	fprintf(f, "modem_get_cost = %u\n", fModemGetCost);
+	fprintf(f, "drain_overshoot_avg = %u\n", fDrainOvershootAvg);
+	fprintf(f, "drain_overshoot_max = %u\n", fDrainOvershootMax);
+	fprintf(f, "loopback_latency_min = %u\n", fLoopbackLatencyMin);
+	fprintf(f, "loopback_latency_avg = %u\n", fLoopbackLatencyAvg);
+	fprintf(f, "loopback_latency_max = %u\n", fLoopbackLatencyMax);
+	ok = !ferror(f);
+	if (fclose(f)) {
+		ok = false;
+	}
+	return ok;
+}
@@ -0,0 +1,88 @@
+#ifndef ADAPTERPROFILE_H
+#define ADAPTERPROFILE_H
+
+/*
+   AdapterProfile.h - measured timing parameters of serial adapters
+
+   Copyright (C) 2026 Matthias Reichl <hias@horus.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include <stdint.h>
+#include <string>
+
+/*
+ * USB serial adapters differ a lot in how long tcdrain overshoots,
+ * how expensive reading the modem lines is and how long bytes take
+ * to get through the adapter. Calibration measures these values,
+ * they are stored per adapter (keyed by the USB vendor/product ID
+ * and serial number from sysfs) in ~/.config/atarisio and loaded by
+ * the userspace driver at startup.
+ *
+ * The drain overshoot and the loopback latency depend on the baudrate
+ * (USB adapters flush their buffers depending on the data rate), so
+ * they are only valid at the baudrate they were measured at.
+ *
+ * All times are in usec, 0 means not measured.
+ */
+
+class AdapterProfile {
+public:
+	AdapterProfile();
+
+	// baudrate the drain and loopback times were measured at,
+	// 0 for old profiles that didn't record it
+	unsigned int fBaudrate;
+
+	// cost of a TIOCMGET ioctl
+	unsigned int fModemGetCost;
+
+	// time tcdrain returns after the data was transmitted
+	unsigned int fDrainOvershootAvg;
+	unsigned int fDrainOvershootMax;
+
+	// time a byte needs from write until it's read back through a
+	// loopback plug, minus the transmission time
+	unsigned int fLoopbackLatencyMin;
+	unsigned int fLoopbackLatencyAvg;
+	unsigned int fLoopbackLatencyMax;
+
+	// Measure the parameters on a raw configured serial port. Bytes
+	// written to fd are expected on loopbackFd (the same fd with a
+	// loopback plug, the master side of a pty), -1 skips the
+	// loopback measurement.
+	bool Measure(int fd, int loopbackFd, unsigned int baudrate);
+
+	// "usb-VVVV-PPPP[-serial]" for USB adapters, "tty-name" otherwise
+	static bool GetDeviceKey(int fd, std::string& key);
+
+	bool Load(const std::string& key);
+	bool Save(const std::string& key) const;
+
+private:
+	static bool GetProfileFilename(const std::string& key, std::string& filename, bool create);
+
+	static uint64_t GetMonotonicUsec();
+
+	enum {
+		eModemGetRuns = 200,
+		eDrainRuns = 10,
+		eLoopbackRuns = 20,
+		eLoopbackTimeout = 100000
+	};
+};
+
+#endif
@@ -74,12 +74,6 @@ int AtpSIOHandler::ProcessCommandFrame(SIO_command_frame& frame, const RCPtr<SIO
 			break;
 		}
 
-		if ((ret=wrapper->SendCommandACK())) {
-			fTracer->TraceCommandError(ret);
-			LOG_SIO_CMD_ACK_FAILED();
-			break;
-		}
-
 		unsigned int buflen = 4;
 		uint8_t buf[buflen];
 		const char* description = "[ get status ]";
@@ -105,19 +99,18 @@ int AtpSIOHandler::ProcessCommandFrame(SIO_command_frame& frame, const RCPtr<SIO
 			/*buf[1] &= ~0x40;*/
 		}
 
-		fTracer->TraceCommandOK();
-		fTracer->TraceGetStatus(myDriveNo);
-		fTracer->TraceDataBlock(buf, buflen, description);
-
-		if ((ret=wrapper->SendComplete())) {
-			LOG_SIO_COMPLETE_FAILED();
+		struct iovec iov;
+		iov.iov_base = buf;
+		iov.iov_len = buflen;
+		if ((ret=wrapper->SendResponse(true, 0, &iov, 1))) {
+			fTracer->TraceCommandError(ret);
+			LOG_SIO_RESPONSE_FAILED();
 			break;
 		}
 
-		if ((ret=wrapper->SendDataFrame(buf,4))) {
-			LOG_SIO_SEND_DATA_FAILED();
-			break;
-		}
+		fTracer->TraceCommandOK();
+		fTracer->TraceGetStatus(myDriveNo);
+		fTracer->TraceDataBlock(buf, buflen, description);
 
 		break;
 	}
@@ -144,12 +137,6 @@ int AtpSIOHandler::ProcessCommandFrame(SIO_command_frame& frame, const RCPtr<SIO
 			break;
 		}
 
-		if ((ret=wrapper->SendCommandACK())) {
-			fTracer->TraceCommandError(ret);
-			LOG_SIO_CMD_ACK_FAILED();
-			break;
-		}
-
                 unsigned int buflen = 128;
 		uint8_t buf[buflen];
 		const char* description = "[ read sector ]";
@@ -188,41 +175,30 @@ int AtpSIOHandler::ProcessCommandFrame(SIO_command_frame& frame, const RCPtr<SIO
 			delay += Atari1050Model::eSectorRetryTime;
 		}
 
+		// the wrapper ACKs the command right away and holds
+		// back complete/error until the emulated disk access
+		// is finished
+		struct iovec iov;
+		iov.iov_base = buf;
+		iov.iov_len = buflen;
+		if ((ret=wrapper->SendResponse(fLastFDCStatus == 0xff, currentTime + delay, &iov, 1))) {
+			fTracer->TraceCommandError(ret);
+			LOG_SIO_RESPONSE_FAILED();
+			break;
+		}
+
+		fLastDiskAccessTimestamp = currentTime+delay;
+
 		if (fLastFDCStatus == 0xff) {
 			fTracer->TraceCommandOK();
 		} else {
-			if (ret == 0) {
-				ret = AbstractSIOHandler::eAtpSectorStatus;
-			}
+			ret = AbstractSIOHandler::eAtpSectorStatus;
 			fTracer->TraceCommandError(ret, fLastFDCStatus);
 		}
 
 		fTracer->TraceReadSector(myDriveNo, sec);
 		fTracer->TraceAtpDelay(delay);
 		fTracer->TraceDataBlock(buf, buflen, description);
-
-		WaitUntil(currentTime + delay);
-
-		if (fLastFDCStatus == 0xff) {
-			if ((ret=wrapper->SendComplete())) {
-				LOG_SIO_COMPLETE_FAILED();
-				break;
-			}
-		} else {
-			ret = AbstractSIOHandler::eAtpSectorStatus;
-			if (wrapper->SendError()) {
-				LOG_SIO_ERROR_FAILED();
-				break;
-			}
-		}
-
-		fLastDiskAccessTimestamp = currentTime+delay;
-
-		if ((ret2=wrapper->SendDataFrame(buf, buflen))) {
-			LOG_SIO_SEND_DATA_FAILED();
-			if (ret==0) ret=ret2;
-			break;
-		}
 		break;
 	}
 	case 0x50:
@@ -0,0 +1,437 @@
+/*
+   AtrAtzImage.cpp - block compressed ATR image
+
+   Copyright (C) 2026 Matthias Reichl <hias@horus.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#ifdef USE_ZLIB
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "AtrAtzImage.h"
+#include "AtrMemoryImage.h"
+#include "SIOTracer.h"
+#include "AtariDebug.h"
+
+AtrAtzImage::AtrAtzImage()
+	: fSectorsPerChunk(AtzFile::eDefaultSectorsPerChunk),
+	  fUseCounter(0)
+{
+}
+
+AtrAtzImage::~AtrAtzImage()
+{
+	FreeImageData();
+}
+
+bool AtrAtzImage::IsAtzImageFile(const char* filename)
+{
+	return AtzFile::IsAtzFile(filename);
+}
+
+void AtrAtzImage::FreeImageData()
+{
+	ChunkMap::iterator iter;
+	for (iter = fChunks.begin(); iter != fChunks.end(); iter++) {
+		delete[] iter->second.fData;
+	}
+	fChunks.clear();
+	fAtz = 0;
+	fSectorsPerChunk = AtzFile::eDefaultSectorsPerChunk;
+	SetFormat(eNoDisk);
+}
+
+bool AtrAtzImage::CreateImage(EDiskFormat format)
+{
+	FreeImageData();
+	SetChanged(true);
+	return SetFormat(format);
+}
+
+bool AtrAtzImage::CreateImage(ESectorLength density, unsigned int sectors)
+{
+	FreeImageData();
+	SetChanged(true);
+	return SetFormat(density, sectors);
+}
+
+bool AtrAtzImage::CreateImage(ESectorLength density, unsigned int sectorsPerTrack, unsigned int tracks, unsigned int sides)
+{
+	FreeImageData();
+	SetChanged(true);
+	return SetFormat(density, sectorsPerTrack, tracks, sides);
+}
+
+bool AtrAtzImage::ReadImageFromFile(const char* filename, bool beQuiet)
+{
+	unsigned int numChunks;
+
+	FreeImageData();
+
+	if (!IsAtzImageFile(filename)) {
+		if (!beQuiet) {
+			DPRINTF("\"%s\" is not an ATZ image", filename);
+		}
+		return false;
+	}
+
+	fAtz = AtzFile::Open(filename, beQuiet);
+	if (fAtz.IsNull()) {
+		return false;
+	}
+
+	if (!SetFormatFromATRHeader(fAtz->GetATRHeader())) {
+		if (!beQuiet) {
+			AERROR("illegal ATR header");
+		}
+		goto failure;
+	}
+	fSectorsPerChunk = fAtz->GetSectorsPerChunk();
+
+	numChunks = (GetNumberOfSectors() + fSectorsPerChunk - 1) / fSectorsPerChunk;
+	if (fAtz->GetNumberOfChunks() > numChunks) {
+		if (!beQuiet) {
+			AERROR("ATZ file contains too many chunks");
+		}
+		goto failure;
+	}
+	if (fAtz->GetNumberOfChunks() < numChunks && !beQuiet) {
+		AWARN("truncated ATZ file: only got %d of %d chunks", fAtz->GetNumberOfChunks(), numChunks);
+	}
+
+	SetChanged(false);
+	return true;
+
+failure:
+	FreeImageData();
+	SetChanged(false);
+	return false;
+}
+
+ssize_t AtrAtzImage::ChunkOffset(unsigned int chunk) const
+{
+	return CalculateOffset(chunk * fSectorsPerChunk + 1);
+}
+
+void AtrAtzImage::EvictChunks() const
+{
+	ChunkMap::iterator iter, oldest;
+	unsigned int cached;
+
+	for (;;) {
+		cached = 0;
+		oldest = fChunks.end();
+		for (iter = fChunks.begin(); iter != fChunks.end(); iter++) {
+			if (iter->second.fWritten) {
+				continue;
+			}
+			cached++;
+			if (oldest == fChunks.end() || iter->second.fLastUse < oldest->second.fLastUse) {
+				oldest = iter;
+			}
+		}
+		if (cached < eMaxCachedChunks) {
+			return;
+		}
+		delete[] oldest->second.fData;
+		fChunks.erase(oldest);
+	}
+}
+
+AtrAtzImage::Chunk* AtrAtzImage::GetChunk(unsigned int chunk) const
+{
+	ChunkMap::iterator iter = fChunks.find(chunk);
+	if (iter != fChunks.end()) {
+		iter->second.fLastUse = ++fUseCounter;
+		return &iter->second;
+	}
+
+	unsigned int numSectors = GetNumberOfSectors();
+	unsigned int first = chunk * fSectorsPerChunk + 1;
+	unsigned int count = fSectorsPerChunk;
+	size_t len;
+
+	if (first > numSectors) {
+		DPRINTF("illegal chunk %d", chunk);
+		return 0;
+	}
+	if (count > numSectors - first + 1) {
+		count = numSectors - first + 1;
+	}
+	if (CalculateRangeOffset(first, count, len) < 0) {
+		DPRINTF("illegal sector range %d-%d", first, first + count - 1);
+		return 0;
+	}
+
+	EvictChunks();
+
+	uint8_t* data = new uint8_t[len];
+
+	// chunks missing in truncated or formatted images read as zero
+	if (fAtz.IsNotNull() && chunk < fAtz->GetNumberOfChunks()) {
+		if (!fAtz->ReadChunk(chunk, data, len)) {
+			AERROR("reading sectors %d-%d from ATZ image failed", first, first + count - 1);
+			delete[] data;
+			return 0;
+		}
+	} else {
+		memset(data, 0, len);
+	}
+
+	Chunk& c = fChunks[chunk];
+	c.fData = data;
+	c.fLength = len;
+	c.fWritten = false;
+	c.fDirty = false;
+	c.fLastUse = ++fUseCounter;
+	return &c;
+}
+
+bool AtrAtzImage::WriteBackChunks() const
+{
+	ChunkMap::iterator iter;
+
+	for (iter = fChunks.begin(); iter != fChunks.end(); iter++) {
+		if (iter->second.fDirty && !fAtz->WriteChunk(iter->first, iter->second.fData, iter->second.fLength)) {
+			return false;
+		}
+	}
+	if (!fAtz->CommitUpdate()) {
+		return false;
+	}
+	for (iter = fChunks.begin(); iter != fChunks.end(); iter++) {
+		iter->second.fDirty = false;
+	}
+	return true;
+}
+
+bool AtrAtzImage::WriteImageToFile(const char* filename) const
+{
+	char absPath[PATH_MAX];
+	uint8_t hdr[16];
+	bool ownFile;
+
+	if (!CreateATRHeaderFromFormat(hdr)) {
+		DPRINTF("creating ATR header failed");
+		return false;
+	}
+
+	if (!AtzFile::IsAtzFile(filename)) {
+		RCPtr<AtrMemoryImage> img = new AtrMemoryImage;
+		uint8_t buf[8192];
+		unsigned int sector;
+		unsigned int numSectors = GetNumberOfSectors();
+		unsigned int count;
+
+		if (!img->CreateImage(GetSectorLength(), GetSectorsPerTrack(), GetTracksPerSide(), GetSides())) {
+			DPRINTF("creating temporary memory image failed");
+			return false;
+		}
+		if (img->GetNumberOfSectors() != numSectors) {
+			DPRINTF("temporary memory image has wrong number of sectors");
+			return false;
+		}
+		for (sector = 1; sector <= numSectors; sector += count) {
+			count = sizeof(buf) / GetSectorLength();
+			if (count > numSectors - sector + 1) {
+				count = numSectors - sector + 1;
+			}
+			if (!ReadSectors(sector, count, buf, sizeof(buf)) || !img->WriteSectors(sector, count, buf, sizeof(buf))) {
+				DPRINTF("copying sectors %d-%d to temporary memory image failed", sector, sector + count - 1);
+				return false;
+			}
+		}
+		img->SetWriteProtect(IsWriteProtected());
+		if (!img->WriteImageToFile(filename)) {
+			return false;
+		}
+		SetChanged(false);
+		return true;
+	}
+
+	ownFile = false;
+	if (realpath(filename, absPath) != 0) {
+		if (fAtz.IsNotNull()) {
+			ownFile = strcmp(absPath, fAtz->GetFilename()) == 0;
+		} else {
+			ownFile = GetFilename() && strcmp(absPath, GetFilename()) == 0;
+		}
+	}
+
+	// append the changed chunks unless the file is getting too
+	// fragmented or the image format changed
+	if (ownFile && fAtz.IsNotNull() && !fAtz->IsReadOnly()
+	    && memcmp(hdr, fAtz->GetATRHeader(), 16) == 0
+	    && fAtz->GetUnusedBytes() <= fAtz->GetFileSize() / 2) {
+		if (WriteBackChunks()) {
+			ClearDirtySectors();
+			SetChanged(false);
+			return true;
+		}
+		DPRINTF("incremental write-back failed, writing whole image");
+	}
+
+	// the old file is replaced by renaming, so it can still
+	// be read while writing the new one
+	if (!AtzFile::Write(filename, this, hdr, fSectorsPerChunk)) {
+		return false;
+	}
+	if (ownFile) {
+		RCPtr<AtzFile> atz = AtzFile::Open(absPath);
+		if (atz.IsNull()) {
+			AERROR("re-opening \"%s\" failed", absPath);
+			return false;
+		}
+		fAtz = atz;
+		for (ChunkMap::iterator iter = fChunks.begin(); iter != fChunks.end(); iter++) {
+			iter->second.fDirty = false;
+		}
+		ClearDirtySectors();
+	}
+	SetChanged(false);
+	return true;
+}
+
+bool AtrAtzImage::ReadSector(unsigned int sector, uint8_t* buffer, unsigned int buffer_length) const
+{
+	bool ret=true;
+	unsigned int len;
+	ssize_t offset;
+
+	if ((offset=CalculateOffset(sector)) < 0 ) {
+		DPRINTF("illegal sector in ReadSector: %d", sector);
+		return false;
+	}
+
+	len=GetSectorLength(sector);
+
+	if (!buffer_length) {
+		DPRINTF("buffer length = 0");
+		return false;
+	}
+
+	if (buffer_length < len) {
+		DPRINTF("buffer length < sector length [ %d < %d ]",buffer_length, len);
+		ret = false;
+		len = buffer_length;
+	} else if (buffer_length > len) {
+		DPRINTF("buffer length > sector length [ %d > %d ]",buffer_length, len);
+		ret = false;
+	}
+
+	unsigned int chunk = (sector - 1) / fSectorsPerChunk;
+	Chunk* c = GetChunk(chunk);
+	if (!c) {
+		return false;
+	}
+	memcpy(buffer, c->fData + offset - ChunkOffset(chunk), len);
+	return ret;
+}
+
+bool AtrAtzImage::ReadSectors(unsigned int first, unsigned int count, uint8_t* buffer, size_t buffer_length) const
+{
+	ssize_t offset, chunkOffset;
+	size_t len;
+	unsigned int sector, chunk, n;
+
+	if ((offset=CalculateRangeOffset(first, count, len)) < 0 ) {
+		DPRINTF("illegal sector range in ReadSectors: %d-%d", first, first + count - 1);
+		return false;
+	}
+	if (buffer_length < len) {
+		DPRINTF("buffer too small in ReadSectors [ %d < %d ]", (int)buffer_length, (int)len);
+		return false;
+	}
+
+	// copy the range chunk by chunk
+	for (sector = first; sector < first + count; sector += n) {
+		chunk = (sector - 1) / fSectorsPerChunk;
+		n = (chunk + 1) * fSectorsPerChunk + 1 - sector;
+		if (n > first + count - sector) {
+			n = first + count - sector;
+		}
+		Chunk* c = GetChunk(chunk);
+		if (!c) {
+			return false;
+		}
+		chunkOffset = CalculateRangeOffset(sector, n, len);
+		memcpy(buffer + chunkOffset - offset, c->fData + chunkOffset - ChunkOffset(chunk), len);
+	}
+	return true;
+}
+
+const uint8_t* AtrAtzImage::GetSectorPtr(unsigned int sector, unsigned int& length) const
+{
+	length = 0;
+
+	if (CalculateOffset(sector) < 0) {
+		DPRINTF("illegal sector in GetSectorPtr: %d", sector);
+		return 0;
+	}
+
+	// cached chunks may be evicted at any time, so only
+	// written chunks can be accessed directly
+	unsigned int chunk = (sector - 1) / fSectorsPerChunk;
+	ChunkMap::const_iterator iter = fChunks.find(chunk);
+	if (iter == fChunks.end() || !iter->second.fWritten) {
+		return 0;
+	}
+	length = GetSectorLength(sector);
+	return iter->second.fData + CalculateOffset(sector) - ChunkOffset(chunk);
+}
+
+bool AtrAtzImage::WriteSector(unsigned int sector, const uint8_t* buffer, unsigned int buffer_length)
+{
+	unsigned int len;
+	ssize_t offset;
+
+	if (IsWriteProtected()) {
+		DPRINTF("attempting to write sector to write protected image");
+		return false;
+	}
+
+	if ((offset=CalculateOffset(sector)) < 0) {
+		DPRINTF("illegal sector in WriteSector: %d", sector);
+		return false;
+	}
+
+	len=GetSectorLength(sector);
+
+	if (buffer_length != len) {
+		DPRINTF("buffer length = len [ %d != %d ]", buffer_length, len);
+		return false;
+	}
+
+	unsigned int chunk = (sector - 1) / fSectorsPerChunk;
+	Chunk* c = GetChunk(chunk);
+	if (!c) {
+		return false;
+	}
+	memcpy(c->fData + offset - ChunkOffset(chunk), buffer, len);
+	c->fWritten = true;
+	c->fDirty = true;
+
+	SetChanged(true);
+	SetSectorDirty(sector);
+
+	return true;
+}
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef ATRATZIMAGE_H
+#define ATRATZIMAGE_H
+
+/*
+   AtrAtzImage.h - block compressed ATR image
+
+   Copyright (C) 2026 Matthias Reichl <hias@horus.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include <map>
+
+#include "AtrImage.h"
+#include "AtzFile.h"
+
+/*
+ * Only the chunks containing the requested sectors are decompressed,
+ * the most recently used ones are kept in memory. Written chunks stay
+ * in memory and writing back to the image file only recompresses
+ * the changed chunks and appends them to the file.
+ */
+
+class AtrAtzImage : public AtrImage {
+public:
+
+	AtrAtzImage();
+
+	virtual ~AtrAtzImage();
+
+	// returns true if filename is an ATZ image
+	static bool IsAtzImageFile(const char* filename);
+
+	// formatting hides the compressed image data
+	virtual bool CreateImage(EDiskFormat format);
+	virtual bool CreateImage(ESectorLength density, unsigned int sectors);
+	virtual bool CreateImage(ESectorLength density, unsigned int sectorsPerTrack, unsigned int tracks, unsigned int sides);
+
+	virtual bool ReadImageFromFile(const char* filename, bool beQuiet = false);
+	virtual bool WriteImageToFile(const char* filename) const;
+
+	virtual bool ReadSector(unsigned int sector,
+		       uint8_t* buffer,
+		       unsigned int buffer_length) const;
+
+	virtual bool WriteSector(unsigned int sector,
+		       const uint8_t* buffer,
+		       unsigned int buffer_length);
+
+	virtual bool ReadSectors(unsigned int first, unsigned int count,
+		       uint8_t* buffer,
+		       size_t buffer_length) const;
+
+	virtual const uint8_t* GetSectorPtr(unsigned int sector,
+		       unsigned int& length) const;
+
+private:
+	typedef AtrImage super;
+
+	enum { eMaxCachedChunks = 16 };
+
+	struct Chunk {
+		uint8_t* fData;
+		size_t fLength;
+		bool fWritten;		// kept in memory, never evicted
+		bool fDirty;		// not written back to the image file yet
+		unsigned long fLastUse;
+	};
+
+	void FreeImageData();
+
+	// decompress the chunk if it isn't cached yet, NULL on error
+	Chunk* GetChunk(unsigned int chunk) const;
+	void EvictChunks() const;
+
+	// offset of the first sector of the chunk in the image data
+	ssize_t ChunkOffset(unsigned int chunk) const;
+
+	bool WriteBackChunks() const;
+
+	mutable RCPtr<AtzFile> fAtz;
+	unsigned int fSectorsPerChunk;
+
+	typedef std::map<unsigned int, Chunk> ChunkMap;
+	mutable ChunkMap fChunks;
+	mutable unsigned long fUseCounter;
+};
+
+#endif
@@ -0,0 +1,310 @@
+/*
+   AtrDcmImage.cpp - DCM image, sectors are decoded on first access
+
+   Copyright (C) 2026 Matthias Reichl <hias@horus.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "AtrDcmImage.h"
+#include "AtrMemoryImage.h"
+#include "FileIO.h"
+#include "SIOTracer.h"
+#include "AtariDebug.h"
+
+AtrDcmImage::AtrDcmImage()
+	: fCodec(0)
+{
+}
+
+AtrDcmImage::~AtrDcmImage()
+{
+	FreeImageData();
+}
+
+bool AtrDcmImage::IsDcmImageFile(const char* filename)
+{
+	size_t len = strlen(filename);
+	if (len >= 4 && strcasecmp(filename + len - 4, ".dcm") == 0) {
+		return true;
+	}
+#ifdef USE_ZLIB
+	if (len >= 7 && strcasecmp(filename + len - 7, ".dcm.gz") == 0) {
+		return true;
+	}
+#endif
+	return false;
+}
+
+void AtrDcmImage::FreeImageData()
+{
+	SectorMap::iterator iter;
+	for (iter = fChangedSectors.begin(); iter != fChangedSectors.end(); iter++) {
+		delete[] iter->second;
+	}
+	fChangedSectors.clear();
+
+	for (unsigned int i = 0; i < fRecordState.size(); i++) {
+		delete[] fRecordState[i];
+	}
+	fRecordState.clear();
+	fSectorRecord.clear();
+	fIndex.clear();
+
+	delete fCodec;
+	fCodec = 0;
+
+	SetFormat(eNoDisk);
+}
+
+bool AtrDcmImage::CreateImage(EDiskFormat format)
+{
+	FreeImageData();
+	SetChanged(true);
+	return SetFormat(format);
+}
+
+bool AtrDcmImage::CreateImage(ESectorLength density, unsigned int sectors)
+{
+	FreeImageData();
+	SetChanged(true);
+	return SetFormat(density, sectors);
+}
+
+bool AtrDcmImage::CreateImage(ESectorLength density, unsigned int sectorsPerTrack, unsigned int tracks, unsigned int sides)
+{
+	FreeImageData();
+	SetChanged(true);
+	return SetFormat(density, sectorsPerTrack, tracks, sides);
+}
+
+bool AtrDcmImage::ReadImageFromFile(const char* filename, bool beQuiet)
+{
+	EDiskFormat format;
+	unsigned int i;
+
+	FreeImageData();
+
+	if (!IsDcmImageFile(filename)) {
+		if (!beQuiet) {
+			DPRINTF("\"%s\" is not a DCM image", filename);
+		}
+		return false;
+	}
+
+	// the DCM file is small, keep it in RAM for cheap seeks
+	fCodec = new DCMCodec(new MemoryFileIO(), 0);
+
+	if (!fCodec->BuildIndex(filename, fIndex, format, beQuiet)) {
+		goto failure;
+	}
+
+	if (!SetFormat(format)) {
+		if (!beQuiet) {
+			DPRINTF("setting image format failed!");
+		}
+		goto failure;
+	}
+
+	fSectorRecord.assign(GetNumberOfSectors() + 1, -1);
+	for (i = 0; i < fIndex.size(); i++) {
+		fSectorRecord[fIndex[i].fSector] = i;
+	}
+	fRecordState.assign(fIndex.size(), (uint8_t*) 0);
+
+	SetWriteProtect(false);
+	SetChanged(false);
+	return true;
+
+failure:
+	FreeImageData();
+	SetChanged(false);
+	return false;
+}
+
+bool AtrDcmImage::WriteImageToFile(const char* filename) const
+{
+	RCPtr<AtrMemoryImage> img = new AtrMemoryImage;
+	uint8_t buf[256];
+	unsigned int sector;
+	unsigned int numSectors = GetNumberOfSectors();
+	unsigned int len;
+
+	if (!img->CreateImage(GetSectorLength(), GetSectorsPerTrack(), GetTracksPerSide(), GetSides())) {
+		DPRINTF("creating temporary memory image failed");
+		return false;
+	}
+	if (img->GetNumberOfSectors() != numSectors) {
+		DPRINTF("temporary memory image has wrong number of sectors");
+		return false;
+	}
+
+	for (sector = 1; sector <= numSectors; sector++) {
+		len = GetSectorLength(sector);
+		if (!ReadSector(sector, buf, len) || !img->WriteSector(sector, buf, len)) {
+			DPRINTF("copying sector %d to temporary memory image failed", sector);
+			return false;
+		}
+	}
+	img->SetWriteProtect(IsWriteProtected());
+
+	// the DCM data is held in RAM, so it's safe
+	// to overwrite the file we loaded from
+	if (!img->WriteImageToFile(filename)) {
+		return false;
+	}
+	SetChanged(false);
+	return true;
+}
+
+const uint8_t* AtrDcmImage::GetRecordState(int record) const
+{
+	std::vector<int> chain;
+	const uint8_t* prevState = 0;
+	int r;
+
+	// find the newest record we already decoded (or one that
+	// doesn't depend on its predecessor), then decode forward
+	for (r = record; r >= 0 && fRecordState[r] == 0; r = fIndex[r].fPrevRecord) {
+		chain.push_back(r);
+	}
+	if (r >= 0) {
+		prevState = fRecordState[r];
+	}
+
+	while (!chain.empty()) {
+		r = chain.back();
+		chain.pop_back();
+
+		uint8_t* state = new uint8_t[GetSectorLength()];
+		if (!fCodec->DecodeRecord(fIndex[r], prevState, state)) {
+			delete[] state;
+			AERROR("decoding sector %d of DCM image failed", fIndex[r].fSector);
+			return 0;
+		}
+		fRecordState[r] = state;
+		prevState = state;
+	}
+	return prevState;
+}
+
+bool AtrDcmImage::ReadSector(unsigned int sector, uint8_t* buffer, unsigned int buffer_length) const
+{
+	bool ret=true;
+	unsigned int len;
+
+	if (sector == 0 || sector > GetNumberOfSectors()) {
+		DPRINTF("illegal sector in ReadSector: %d", sector);
+		return false;
+	}
+
+	len=GetSectorLength(sector);
+
+	if (!buffer_length) {
+		DPRINTF("buffer length = 0");
+		return false;
+	}
+
+	if (buffer_length < len) {
+		DPRINTF("buffer length < sector length [ %d < %d ]",buffer_length, len);
+		ret = false;
+		len = buffer_length;
+	} else if (buffer_length > len) {
+		DPRINTF("buffer length > sector length [ %d > %d ]",buffer_length, len);
+		ret = false;
+	}
+
+	SectorMap::const_iterator iter = fChangedSectors.find(sector);
+	if (iter != fChangedSectors.end()) {
+		memcpy(buffer, iter->second, len);
+		return ret;
+	}
+
+	// empty sectors aren't stored in DCM files
+	if (fSectorRecord.empty() || fSectorRecord[sector] < 0) {
+		memset(buffer, 0, len);
+		return ret;
+	}
+
+	const uint8_t* state = GetRecordState(fSectorRecord[sector]);
+	if (!state) {
+		return false;
+	}
+	memcpy(buffer, state, len);
+	return ret;
+}
+
+const uint8_t* AtrDcmImage::GetSectorPtr(unsigned int sector, unsigned int& length) const
+{
+	length = 0;
+
+	if (sector == 0 || sector > GetNumberOfSectors()) {
+		DPRINTF("illegal sector in GetSectorPtr: %d", sector);
+		return 0;
+	}
+
+	const uint8_t* data;
+
+	SectorMap::const_iterator iter = fChangedSectors.find(sector);
+	if (iter != fChangedSectors.end()) {
+		data = iter->second;
+	} else if (fSectorRecord.empty() || fSectorRecord[sector] < 0) {
+		return 0;
+	} else if ( (data = fRecordState[fSectorRecord[sector]]) == 0) {
+		// not decoded yet, ReadSector does that
+		return 0;
+	}
+
+	length = GetSectorLength(sector);
+	return data;
+}
+
+bool AtrDcmImage::WriteSector(unsigned int sector, const uint8_t* buffer, unsigned int buffer_length)
+{
+	unsigned int len;
+
+	if (IsWriteProtected()) {
+		DPRINTF("attempting to write sector to write protected image");
+		return false;
+	}
+
+	if (sector == 0 || sector > GetNumberOfSectors()) {
+		DPRINTF("illegal sector in WriteSector: %d", sector);
+		return false;
+	}
+
+	len=GetSectorLength(sector);
+
+	if (buffer_length != len) {
+		DPRINTF("buffer length = len [ %d != %d ]", buffer_length, len);
+		return false;
+	}
+
+	uint8_t*& data = fChangedSectors[sector];
+	if (!data) {
+		data = new uint8_t[len];
+	}
+	memcpy(data, buffer, len);
+
+	SetChanged(true);
+	SetSectorDirty(sector);
+
+	return true;
+}
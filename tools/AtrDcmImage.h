@@ -0,0 +1,88 @@
+#ifndef ATRDCMIMAGE_H
+#define ATRDCMIMAGE_H
+
+/*
+   AtrDcmImage.h - DCM image, sectors are decoded on first access
+
+   Copyright (C) 2026 Matthias Reichl <hias@horus.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include <map>
+#include <vector>
+
+#include "AtrImage.h"
+#include "DCMCodec.h"
+
+/*
+ * Loading only indexes the DCM records. A sector is decoded when
+ * it's first accessed, together with the records it depends on,
+ * and the decoded sectors are cached. Written sectors are kept in
+ * memory until the image is written back.
+ */
+
+class AtrDcmImage : public AtrImage {
+public:
+
+	AtrDcmImage();
+
+	virtual ~AtrDcmImage();
+
+	// returns true if filename is a (possibly gzip compressed) DCM image
+	static bool IsDcmImageFile(const char* filename);
+
+	// formatting hides the DCM image data
+	virtual bool CreateImage(EDiskFormat format);
+	virtual bool CreateImage(ESectorLength density, unsigned int sectors);
+	virtual bool CreateImage(ESectorLength density, unsigned int sectorsPerTrack, unsigned int tracks, unsigned int sides);
+
+	virtual bool ReadImageFromFile(const char* filename, bool beQuiet = false);
+	virtual bool WriteImageToFile(const char* filename) const;
+
+	virtual bool ReadSector(unsigned int sector,
+		       uint8_t* buffer,
+		       unsigned int buffer_length) const;
+
+	virtual bool WriteSector(unsigned int sector,
+		       const uint8_t* buffer,
+		       unsigned int buffer_length);
+
+	virtual const uint8_t* GetSectorPtr(unsigned int sector,
+		       unsigned int& length) const;
+
+private:
+	typedef AtrImage super;
+
+	void FreeImageData();
+
+	// decoder state after the given record, decodes the
+	// record (and the ones it depends on) if necessary
+	const uint8_t* GetRecordState(int record) const;
+
+	DCMCodec* fCodec;
+	DCMCodec::Index fIndex;
+
+	// last record of each sector, -1 for sectors not in the file
+	std::vector<int> fSectorRecord;
+
+	// decoded records, 0 if not decoded yet
+	mutable std::vector<uint8_t*> fRecordState;
+
+	typedef std::map<unsigned int, uint8_t*> SectorMap;
+	SectorMap fChangedSectors;
+};
+
+#endif
@@ -0,0 +1,557 @@
+/*
+   AtrDiImage.cpp - access uncompressed DI (XL/ST) images via mmap
+
+   Copyright (C) 2026 Matthias Reichl <hias@horus.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include "AtrDiImage.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "OS.h"
+#include "AtrMemoryImage.h"
+#include "SIOTracer.h"
+#include "AtariDebug.h"
+
+static const uint8_t zeroSector[256] = { 0 };
+
+AtrDiImage::AtrDiImage()
+	: fMappedFilename(0)
+{
+	fLayout.fMapBase = 0;
+	fLayout.fMapLength = 0;
+	fLayout.fChecksumOffset = 0;
+}
+
+AtrDiImage::~AtrDiImage()
+{
+	FreeImageData();
+}
+
+bool AtrDiImage::IsDiImageFile(const char* filename)
+{
+	size_t len = strlen(filename);
+
+	return len >= 3 && strcasecmp(filename + len - 3, ".di") == 0;
+}
+
+void AtrDiImage::FreeImageData()
+{
+	SectorMap::iterator iter;
+	for (iter = fAddedSectors.begin(); iter != fAddedSectors.end(); iter++) {
+		delete[] iter->second;
+	}
+	fAddedSectors.clear();
+
+	if (fLayout.fMapBase) {
+		munmap(fLayout.fMapBase, fLayout.fMapLength);
+		fLayout.fMapBase = 0;
+		fLayout.fMapLength = 0;
+	}
+	fLayout.fChecksumOffset = 0;
+	fLayout.fSectorOffset.clear();
+
+	if (fMappedFilename) {
+		free(fMappedFilename);
+		fMappedFilename = 0;
+	}
+	SetFormat(eNoDisk);
+}
+
+bool AtrDiImage::CreateImage(EDiskFormat format)
+{
+	FreeImageData();
+	SetChanged(true);
+	if (!SetFormat(format)) {
+		return false;
+	}
+	fLayout.fSectorOffset.assign(GetNumberOfSectors() + 1, 0);
+	return true;
+}
+
+bool AtrDiImage::CreateImage(ESectorLength density, unsigned int sectors)
+{
+	FreeImageData();
+	SetChanged(true);
+	if (!SetFormat(density, sectors)) {
+		return false;
+	}
+	fLayout.fSectorOffset.assign(GetNumberOfSectors() + 1, 0);
+	return true;
+}
+
+bool AtrDiImage::CreateImage(ESectorLength density, unsigned int sectorsPerTrack, unsigned int tracks, unsigned int sides)
+{
+	FreeImageData();
+	SetChanged(true);
+	if (!SetFormat(density, sectorsPerTrack, tracks, sides)) {
+		return false;
+	}
+	fLayout.fSectorOffset.assign(GetNumberOfSectors() + 1, 0);
+	return true;
+}
+
+bool AtrDiImage::MapFile(const char* absPath, Layout& layout, bool beQuiet)
+{
+	struct stat statbuf;
+	void* base;
+	const uint8_t* p;
+	size_t len, pos, offset;
+	unsigned int totalSectors, sector, sectorLength;
+	int fd;
+
+	fd = open(absPath, O_RDONLY);
+	if (fd < 0) {
+		if (!beQuiet) {
+			AERROR("cannot open \"%s\" for reading", absPath);
+		}
+		return false;
+	}
+	if (fstat(fd, &statbuf) || !S_ISREG(statbuf.st_mode) || statbuf.st_size == 0) {
+		if (!beQuiet) {
+			AERROR("cannot stat \"%s\"", absPath);
+		}
+		close(fd);
+		return false;
+	}
+	len = statbuf.st_size;
+
+	base = mmap(0, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		if (!beQuiet) {
+			DPRINTF("mmap of \"%s\" failed: %s", absPath, strerror(errno));
+		}
+		return false;
+	}
+	layout.fMapBase = (uint8_t*) base;
+	layout.fMapLength = len;
+	p = layout.fMapBase;
+
+	if (len < 4 || p[0] != 'D' || p[1] != 'I') {
+		if (!beQuiet) {
+			AERROR("not an DI file!");
+		}
+		goto failure;
+	}
+	if ((p[2] | (p[3] << 8)) != 0x0220) {
+		if (!beQuiet) {
+			AERROR("illegal version in DI image: %04x", p[2] | (p[3] << 8));
+		}
+		goto failure;
+	}
+
+	// skip creator string
+	pos = 4;
+	while (pos < len && p[pos]) {
+		pos++;
+	}
+	pos++;
+
+	// image header
+	if (pos + 9 > len) {
+		goto failure_eof;
+	}
+	layout.fTracksPerSide = p[pos + 1];
+	layout.fSectorsPerTrack = (p[pos + 2] << 8) | p[pos + 3];
+	layout.fSides = p[pos + 4] + 1;
+	sectorLength = (p[pos + 6] << 8) | p[pos + 7];
+	pos += 9;
+
+	totalSectors = layout.fSectorsPerTrack * layout.fTracksPerSide * layout.fSides;
+	if (totalSectors == 0 || totalSectors > 65535) {
+		if (!beQuiet) {
+			AERROR("illegal number of sectors in DI image header: %d", totalSectors);
+		}
+		goto failure;
+	}
+
+	switch (sectorLength) {
+	case 128:
+		layout.fDensity = e128BytesPerSector;
+		break;
+	case 256:
+		layout.fDensity = e256BytesPerSector;
+		break;
+	default:
+		if (!beQuiet) {
+			AERROR("illegal sector length in DI image header: %d", sectorLength);
+		}
+		goto failure;
+	}
+
+	// sector (checksum) map
+	if (pos + totalSectors > len) {
+		goto failure_eof;
+	}
+	layout.fChecksumOffset = pos;
+	offset = pos + totalSectors;
+
+	layout.fSectorOffset.assign(totalSectors + 1, 0);
+	for (sector = 1; sector <= totalSectors; sector++) {
+		if (p[layout.fChecksumOffset + sector - 1]) {
+			// boot sectors of DD disks are stored with 128 bytes
+			unsigned int l = (sectorLength == 256 && sector <= 3) ? 128 : sectorLength;
+			if (offset + l > len) {
+				goto failure_eof;
+			}
+			layout.fSectorOffset[sector] = offset;
+			offset += l;
+		}
+	}
+	return true;
+
+failure_eof:
+	if (!beQuiet) {
+		AERROR("error reading DI file: unexpected EOF");
+	}
+failure:
+	munmap(layout.fMapBase, layout.fMapLength);
+	layout.fMapBase = 0;
+	layout.fMapLength = 0;
+	layout.fSectorOffset.clear();
+	return false;
+}
+
+void AtrDiImage::SetLayout(Layout& layout) const
+{
+	if (fLayout.fMapBase) {
+		munmap(fLayout.fMapBase, fLayout.fMapLength);
+	}
+	fLayout.fMapBase = layout.fMapBase;
+	fLayout.fMapLength = layout.fMapLength;
+	fLayout.fChecksumOffset = layout.fChecksumOffset;
+	fLayout.fSectorOffset.swap(layout.fSectorOffset);
+	layout.fMapBase = 0;
+
+	SectorMap::iterator iter;
+	for (iter = fAddedSectors.begin(); iter != fAddedSectors.end(); iter++) {
+		delete[] iter->second;
+	}
+	fAddedSectors.clear();
+}
+
+bool AtrDiImage::ReadImageFromFile(const char* filename, bool beQuiet)
+{
+	char absPath[PATH_MAX];
+	Layout layout;
+
+	FreeImageData();
+
+	if (!IsDiImageFile(filename)) {
+		if (!beQuiet) {
+			DPRINTF("\"%s\" is not an uncompressed DI image", filename);
+		}
+		return false;
+	}
+	if (realpath(filename, absPath) == 0) {
+		if (!beQuiet) {
+			AERROR("cannot find \"%s\"", filename);
+		}
+		return false;
+	}
+	if (!MapFile(absPath, layout, beQuiet)) {
+		SetChanged(false);
+		return false;
+	}
+	if (!SetFormat(layout.fDensity, layout.fSectorsPerTrack, layout.fTracksPerSide, layout.fSides)
+	    || GetNumberOfSectors() + 1 != layout.fSectorOffset.size()) {
+		if (!beQuiet) {
+			DPRINTF("setting image format failed!");
+		}
+		munmap(layout.fMapBase, layout.fMapLength);
+		FreeImageData();
+		SetChanged(false);
+		return false;
+	}
+	SetLayout(layout);
+	fMappedFilename = strdup(absPath);
+
+	SetWriteProtect(false);
+	SetChanged(false);
+	return true;
+}
+
+bool AtrDiImage::IsMappedFile(const char* filename, char* absPath) const
+{
+	if (realpath(filename, absPath) == 0) {
+		return false;
+	}
+	return fMappedFilename && strcmp(absPath, fMappedFilename) == 0;
+}
+
+bool AtrDiImage::CanWriteInPlace() const
+{
+	unsigned int numSectors = GetNumberOfSectors();
+	unsigned int sector;
+
+	// sectors which became empty would have to be removed
+	for (sector = 1; sector <= numSectors; sector++) {
+		if (SectorIsDirty(sector) && fLayout.fSectorOffset[sector]
+		    && fLayout.fMapBase[fLayout.fChecksumOffset + sector - 1] == 0) {
+			return false;
+		}
+	}
+
+	// and non-empty new sectors inserted
+	SectorMap::const_iterator iter;
+	for (iter = fAddedSectors.begin(); iter != fAddedSectors.end(); iter++) {
+		unsigned int len = GetSectorLength(iter->first);
+		if (AtrMemoryImage::CalculateDiSectorChecksum(iter->second, len)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool AtrDiImage::WriteBackInPlace() const
+{
+	unsigned int numSectors = GetNumberOfSectors();
+	unsigned int sector, len;
+	size_t offset;
+	int fd;
+
+	fd = open(fMappedFilename, O_WRONLY);
+	if (fd < 0) {
+		AERROR("cannot open \"%s\" for writing", fMappedFilename);
+		return false;
+	}
+
+	for (sector = 1; sector <= numSectors; sector++) {
+		if (!SectorIsDirty(sector) || !(offset = fLayout.fSectorOffset[sector])) {
+			continue;
+		}
+		len = GetSectorLength(sector);
+		if (pwrite(fd, fLayout.fMapBase + offset, len, offset) != (ssize_t) len) {
+			AERROR("error writing sector %d to \"%s\"", sector, fMappedFilename);
+			goto failure;
+		}
+	}
+
+	// sector contents are written before their checksums
+	if (pwrite(fd, fLayout.fMapBase + fLayout.fChecksumOffset, numSectors, fLayout.fChecksumOffset) != (ssize_t) numSectors) {
+		AERROR("error writing sector map to \"%s\"", fMappedFilename);
+		goto failure;
+	}
+
+	if (close(fd)) {
+		AERROR("error closing \"%s\"", fMappedFilename);
+		return false;
+	}
+	return true;
+
+failure:
+	close(fd);
+	return false;
+}
+
+RCPtr<AtrMemoryImage> AtrDiImage::CreateMemoryImage() const
+{
+	RCPtr<AtrMemoryImage> img = new AtrMemoryImage;
+	unsigned int numSectors = GetNumberOfSectors();
+	unsigned int sector, len;
+	const uint8_t* data;
+
+	if (!img->CreateImage(GetSectorLength(), GetSectorsPerTrack(), GetTracksPerSide(), GetSides())
+	    || img->GetNumberOfSectors() != numSectors) {
+		DPRINTF("creating temporary memory image failed");
+		return RCPtr<AtrMemoryImage>();
+	}
+	for (sector = 1; sector <= numSectors; sector++) {
+		if ((data = GetSectorPtr(sector, len)) == 0 || !img->WriteSector(sector, data, len)) {
+			DPRINTF("copying sector %d to temporary memory image failed", sector);
+			return RCPtr<AtrMemoryImage>();
+		}
+	}
+	img->SetWriteProtect(IsWriteProtected());
+	return img;
+}
+
+bool AtrDiImage::WriteImageToNewFile(const char* filename, bool ownFile) const
+{
+	char tmpPath[PATH_MAX];
+	RCPtr<AtrMemoryImage> img = CreateMemoryImage();
+
+	if (img.IsNull()) {
+		return false;
+	}
+	if (!ownFile) {
+		return img->WriteImageToFile(filename);
+	}
+
+	// writing over the mapped file would change the unmodified
+	// pages of the mapping, so write a new file and rename it
+	const char* base = strrchr(fMappedFilename, DIR_SEPARATOR);
+	base = base ? base + 1 : fMappedFilename;
+	if (snprintf(tmpPath, PATH_MAX, "%.*s.tmp%d-%s", (int)(base - fMappedFilename), fMappedFilename,
+	    (int) getpid(), base) >= PATH_MAX) {
+		AERROR("filename \"%s\" too long", fMappedFilename);
+		return false;
+	}
+	if (!img->WriteImageToFile(tmpPath)) {
+		unlink(tmpPath);
+		return false;
+	}
+	if (rename(tmpPath, fMappedFilename)) {
+		AERROR("cannot rename \"%s\" to \"%s\"", tmpPath, fMappedFilename);
+		unlink(tmpPath);
+		return false;
+	}
+
+	Layout layout;
+	if (!MapFile(fMappedFilename, layout, false)
+	    || layout.fSectorOffset.size() != GetNumberOfSectors() + 1) {
+		AERROR("re-mapping \"%s\" failed", fMappedFilename);
+		if (layout.fMapBase) {
+			munmap(layout.fMapBase, layout.fMapLength);
+		}
+		// keep serving from the old mapping, but don't write
+		// into the new file at the old offsets
+		free(fMappedFilename);
+		fMappedFilename = 0;
+		return true;
+	}
+	SetLayout(layout);
+	return true;
+}
+
+bool AtrDiImage::WriteImageToFile(const char* filename) const
+{
+	char absPath[PATH_MAX];
+	bool ownFile;
+
+	if (fLayout.fSectorOffset.empty()) {
+		DPRINTF("no image data");
+		return false;
+	}
+
+	ownFile = IsMappedFile(filename, absPath);
+
+	if (ownFile && CanWriteInPlace()) {
+		if (!WriteBackInPlace()) {
+			return false;
+		}
+	} else if (!WriteImageToNewFile(filename, ownFile)) {
+		return false;
+	}
+	if (ownFile) {
+		ClearDirtySectors();
+	}
+	SetChanged(false);
+	return true;
+}
+
+bool AtrDiImage::ReadSector(unsigned int sector, uint8_t* buffer, unsigned int buffer_length) const
+{
+	const uint8_t* data;
+	unsigned int len;
+
+	if ((data = GetSectorPtr(sector, len)) == 0) {
+		DPRINTF("illegal sector in ReadSector: %d", sector);
+		return false;
+	}
+
+	if (!buffer_length) {
+		DPRINTF("buffer length = 0");
+		return false;
+	}
+
+	if (buffer_length != len) {
+		DPRINTF("buffer length != sector length [ %d != %d ]",buffer_length, len);
+		memcpy(buffer, data, buffer_length < len ? buffer_length : len);
+		return false;
+	}
+
+	memcpy(buffer, data, len);
+	return true;
+}
+
+bool AtrDiImage::WriteSector(unsigned int sector, const uint8_t* buffer, unsigned int buffer_length)
+{
+	unsigned int len;
+	uint8_t checksum;
+	size_t offset;
+
+	if (IsWriteProtected()) {
+		DPRINTF("attempting to write sector to write protected image");
+		return false;
+	}
+
+	if (CalculateOffset(sector) < 0) {
+		DPRINTF("illegal sector in WriteSector: %d", sector);
+		return false;
+	}
+
+	len = GetSectorLength(sector);
+
+	if (buffer_length != len) {
+		DPRINTF("buffer length = len [ %d != %d ]", buffer_length, len);
+		return false;
+	}
+
+	checksum = AtrMemoryImage::CalculateDiSectorChecksum(buffer, len);
+
+	if ((offset = fLayout.fSectorOffset[sector])) {
+		memcpy(fLayout.fMapBase + offset, buffer, len);
+		fLayout.fMapBase[fLayout.fChecksumOffset + sector - 1] = checksum;
+	} else {
+		SectorMap::iterator iter = fAddedSectors.find(sector);
+		if (iter != fAddedSectors.end()) {
+			memcpy(iter->second, buffer, len);
+		} else if (checksum) {
+			uint8_t* data = new uint8_t[len];
+			memcpy(data, buffer, len);
+			fAddedSectors[sector] = data;
+		}
+	}
+
+	SetChanged(true);
+	SetSectorDirty(sector);
+	return true;
+}
+
+const uint8_t* AtrDiImage::GetSectorPtr(unsigned int sector, unsigned int& length) const
+{
+	size_t offset;
+
+	if (CalculateOffset(sector) < 0 || sector >= fLayout.fSectorOffset.size()) {
+		DPRINTF("illegal sector in GetSectorPtr: %d", sector);
+		length = 0;
+		return 0;
+	}
+
+	length = GetSectorLength(sector);
+
+	if ((offset = fLayout.fSectorOffset[sector])) {
+		return fLayout.fMapBase + offset;
+	}
+	SectorMap::const_iterator iter = fAddedSectors.find(sector);
+	if (iter != fAddedSectors.end()) {
+		return iter->second;
+	}
+	return zeroSector;
+}
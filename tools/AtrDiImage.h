@@ -0,0 +1,113 @@
+#ifndef ATRDIIMAGE_H
+#define ATRDIIMAGE_H
+
+/*
+   AtrDiImage.h - access uncompressed DI (XL/ST) images via mmap
+
+   Copyright (C) 2026 Matthias Reichl <hias@horus.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include <map>
+#include <vector>
+
+#include "AtrImage.h"
+
+class AtrMemoryImage;
+
+/*
+ * DI files only contain the non-empty sectors, a sector map holds
+ * a checksum for each sector (0 for empty sectors). The image file
+ * is mapped MAP_PRIVATE and sectors present in the file are served
+ * from the mapping. Sectors not present in the file are kept in
+ * memory once they are written.
+ *
+ * Writing back to the image file only updates the changed sectors
+ * and their checksums in place. If a sector has to be added to or
+ * removed from the file the whole file is rewritten.
+ */
+
+class AtrDiImage : public AtrImage {
+public:
+
+	AtrDiImage();
+
+	virtual ~AtrDiImage();
+
+	// returns true if filename is an uncompressed DI image
+	static bool IsDiImageFile(const char* filename);
+
+	// formatting drops the file mapping, all sectors are empty
+	virtual bool CreateImage(EDiskFormat format);
+	virtual bool CreateImage(ESectorLength density, unsigned int sectors);
+	virtual bool CreateImage(ESectorLength density, unsigned int sectorsPerTrack, unsigned int tracks, unsigned int sides);
+
+	virtual bool ReadImageFromFile(const char* filename, bool beQuiet = false);
+	virtual bool WriteImageToFile(const char* filename) const;
+
+	virtual bool ReadSector(unsigned int sector,
+		       uint8_t* buffer,
+		       unsigned int buffer_length) const;
+
+	virtual bool WriteSector(unsigned int sector,
+		       const uint8_t* buffer,
+		       unsigned int buffer_length);
+
+	virtual const uint8_t* GetSectorPtr(unsigned int sector,
+		       unsigned int& length) const;
+
+private:
+	typedef AtrImage super;
+
+	struct Layout {
+		uint8_t* fMapBase;
+		size_t fMapLength;
+		size_t fChecksumOffset;
+		// file offset of each sector, 0 if it's not in the file
+		std::vector<uint32_t> fSectorOffset;
+
+		ESectorLength fDensity;
+		unsigned int fSectorsPerTrack;
+		unsigned int fTracksPerSide;
+		unsigned int fSides;
+	};
+
+	void FreeImageData();
+
+	// map the file and build the sector offset table
+	static bool MapFile(const char* absPath, Layout& layout, bool beQuiet);
+	void SetLayout(Layout& layout) const;
+
+	bool IsMappedFile(const char* filename, char* absPath) const;
+
+	// true if changed sectors can be written to the file in place
+	bool CanWriteInPlace() const;
+	bool WriteBackInPlace() const;
+
+	// write the whole image, replace the mapped file by renaming
+	bool WriteImageToNewFile(const char* filename, bool ownFile) const;
+
+	RCPtr<AtrMemoryImage> CreateMemoryImage() const;
+
+	mutable Layout fLayout;
+	mutable char* fMappedFilename;
+
+	// written sectors that aren't in the file
+	typedef std::map<unsigned int, uint8_t*> SectorMap;
+	mutable SectorMap fAddedSectors;
+};
+
+#endif
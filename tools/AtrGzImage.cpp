@@ -0,0 +1,358 @@
+/*
+   AtrGzImage.cpp - gzip compressed ATR/XFD image, decompressed on demand
+
+   Copyright (C) 2026 Matthias Reichl <hias@horus.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#ifdef USE_ZLIB
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include "AtrGzImage.h"
+#include "AtrMemoryImage.h"
+#include "SIOTracer.h"
+#include "AtariDebug.h"
+
+AtrGzImage::AtrGzImage()
+	: fDataOffset(0)
+{
+}
+
+AtrGzImage::~AtrGzImage()
+{
+	FreeImageData();
+}
+
+bool AtrGzImage::IsGzImageFile(const char* filename)
+{
+	size_t len = strlen(filename);
+	if (len < 7) {
+		return false;
+	}
+	return strcasecmp(filename + len - 7, ".atr.gz") == 0
+		|| strcasecmp(filename + len - 7, ".xfd.gz") == 0;
+}
+
+void AtrGzImage::FreeImageData()
+{
+	SectorMap::iterator iter;
+	for (iter = fChangedSectors.begin(); iter != fChangedSectors.end(); iter++) {
+		delete[] iter->second;
+	}
+	fChangedSectors.clear();
+	fGzIndex = 0;
+	fDataOffset = 0;
+	SetFormat(eNoDisk);
+}
+
+bool AtrGzImage::CreateImage(EDiskFormat format)
+{
+	FreeImageData();
+	SetChanged(true);
+	return SetFormat(format);
+}
+
+bool AtrGzImage::CreateImage(ESectorLength density, unsigned int sectors)
+{
+	FreeImageData();
+	SetChanged(true);
+	return SetFormat(density, sectors);
+}
+
+bool AtrGzImage::CreateImage(ESectorLength density, unsigned int sectorsPerTrack, unsigned int tracks, unsigned int sides)
+{
+	FreeImageData();
+	SetChanged(true);
+	return SetFormat(density, sectorsPerTrack, tracks, sides);
+}
+
+bool AtrGzImage::ReadImageFromFile(const char* filename, bool beQuiet)
+{
+	bool isXfd;
+	size_t imgSize;
+
+	FreeImageData();
+
+	if (!IsGzImageFile(filename)) {
+		if (!beQuiet) {
+			DPRINTF("\"%s\" is not a gzip compressed ATR or XFD image", filename);
+		}
+		return false;
+	}
+	isXfd = strcasecmp(filename + strlen(filename) - 7, ".xfd.gz") == 0;
+
+	fGzIndex = GzIndex::Open(filename, beQuiet);
+	if (fGzIndex.IsNull()) {
+		return false;
+	}
+
+	if (isXfd) {
+		ESectorLength seclen;
+		unsigned int numSecs;
+
+		imgSize = fGzIndex->GetUncompressedSize();
+		if ( (imgSize & 0x7f) || imgSize < 384 ) {
+			if (!beQuiet) {
+				AERROR("illegal image size %d", (int)imgSize);
+			}
+			goto failure;
+		}
+		if (imgSize & 0x80) {
+			seclen = e256BytesPerSector;
+			numSecs = (imgSize - 384) / 256 + 3;
+		} else {
+			seclen = e128BytesPerSector;
+			numSecs = imgSize / 128;
+		}
+		if (!SetFormat(seclen, numSecs) || imgSize != GetImageSize()) {
+			if (!beQuiet) {
+				DPRINTF("setting image size failed!");
+			}
+			goto failure;
+		}
+		SetWriteProtect(false);
+		fDataOffset = 0;
+	} else {
+		uint8_t hdr[16];
+
+		if (fGzIndex->Read(0, hdr, 16) != 16) {
+			if (!beQuiet) {
+				AERROR("cannot read ATR-header");
+			}
+			goto failure;
+		}
+		if (!SetFormatFromATRHeader(hdr)) {
+			if (!beQuiet) {
+				AERROR("illegal ATR header");
+			}
+			goto failure;
+		}
+		fDataOffset = 16;
+
+		imgSize = fGzIndex->GetUncompressedSize() - 16;
+		if (imgSize < GetImageSize() && !beQuiet) {
+			AWARN("truncated ATR file: only got %d of %d bytes", (int)imgSize, (int)GetImageSize());
+		}
+	}
+
+	SetChanged(false);
+	return true;
+
+failure:
+	FreeImageData();
+	SetChanged(false);
+	return false;
+}
+
+bool AtrGzImage::WriteImageToFile(const char* filename) const
+{
+	char absPath[PATH_MAX];
+	char tmpPath[PATH_MAX];
+	RCPtr<AtrMemoryImage> img = new AtrMemoryImage;
+	uint8_t buf[8192];
+	unsigned int sector;
+	unsigned int numSectors = GetNumberOfSectors();
+	unsigned int count;
+
+	if (!img->CreateImage(GetSectorLength(), GetSectorsPerTrack(), GetTracksPerSide(), GetSides())) {
+		DPRINTF("creating temporary memory image failed");
+		return false;
+	}
+	if (img->GetNumberOfSectors() != numSectors) {
+		DPRINTF("temporary memory image has wrong number of sectors");
+		return false;
+	}
+
+	for (sector = 1; sector <= numSectors; sector += count) {
+		count = sizeof(buf) / 256;
+		if (count > numSectors - sector + 1) {
+			count = numSectors - sector + 1;
+		}
+		if (!ReadSectors(sector, count, buf, sizeof(buf)) || !img->WriteSectors(sector, count, buf, sizeof(buf))) {
+			DPRINTF("copying sectors %d-%d to temporary memory image failed", sector, sector + count - 1);
+			return false;
+		}
+	}
+	img->SetWriteProtect(IsWriteProtected());
+
+	if (fGzIndex.IsNull() || realpath(filename, absPath) == 0
+	    || strcmp(absPath, fGzIndex->GetFilename())) {
+		if (!img->WriteImageToFile(filename)) {
+			return false;
+		}
+		SetChanged(false);
+		return true;
+	}
+
+	// don't overwrite the file we are reading from, write a new
+	// one (keeping the extension so the format is retained)
+	const char* base = strrchr(absPath, '/');
+	base = base ? base + 1 : absPath;
+	if (snprintf(tmpPath, PATH_MAX, "%.*s.tmp%d-%s", (int)(base - absPath), absPath, (int) getpid(), base) >= PATH_MAX) {
+		AERROR("filename \"%s\" too long", absPath);
+		return false;
+	}
+
+	if (!img->WriteImageToFile(tmpPath)) {
+		unlink(tmpPath);
+		return false;
+	}
+	if (rename(tmpPath, absPath)) {
+		AERROR("cannot rename \"%s\" to \"%s\"", tmpPath, absPath);
+		unlink(tmpPath);
+		return false;
+	}
+	SetChanged(false);
+	return true;
+}
+
+bool AtrGzImage::ReadSector(unsigned int sector, uint8_t* buffer, unsigned int buffer_length) const
+{
+	bool ret=true;
+	unsigned int len;
+	ssize_t offset;
+	ssize_t s;
+
+	if ((offset=CalculateOffset(sector)) < 0 ) {
+		DPRINTF("illegal sector in ReadSector: %d", sector);
+		return false;
+	}
+
+	len=GetSectorLength(sector);
+
+	if (!buffer_length) {
+		DPRINTF("buffer length = 0");
+		return false;
+	}
+
+	if (buffer_length < len) {
+		DPRINTF("buffer length < sector length [ %d < %d ]",buffer_length, len);
+		ret = false;
+		len = buffer_length;
+	} else if (buffer_length > len) {
+		DPRINTF("buffer length > sector length [ %d > %d ]",buffer_length, len);
+		ret = false;
+	}
+
+	SectorMap::const_iterator iter = fChangedSectors.find(sector);
+	if (iter != fChangedSectors.end()) {
+		memcpy(buffer, iter->second, len);
+		return ret;
+	}
+
+	s = 0;
+	if (fGzIndex.IsNotNull()) {
+		s = fGzIndex->Read(fDataOffset + offset, buffer, len);
+		if (s < 0) {
+			AERROR("reading sector %d from compressed image failed", sector);
+			return false;
+		}
+	}
+	// sectors missing in truncated images read as zero
+	if ((unsigned int) s < len) {
+		memset(buffer + s, 0, len - s);
+	}
+	return ret;
+}
+
+bool AtrGzImage::ReadSectors(unsigned int first, unsigned int count, uint8_t* buffer, size_t buffer_length) const
+{
+	ssize_t offset;
+	size_t len;
+	ssize_t s = 0;
+
+	if ((offset=CalculateRangeOffset(first, count, len)) < 0 ) {
+		DPRINTF("illegal sector range in ReadSectors: %d-%d", first, first + count - 1);
+		return false;
+	}
+	if (buffer_length < len) {
+		DPRINTF("buffer too small in ReadSectors [ %d < %d ]", (int)buffer_length, (int)len);
+		return false;
+	}
+
+	// decompress the whole range at once, then apply the changes
+	if (fGzIndex.IsNotNull()) {
+		s = fGzIndex->Read(fDataOffset + offset, buffer, len);
+		if (s < 0) {
+			AERROR("reading sectors %d-%d from compressed image failed", first, first + count - 1);
+			return false;
+		}
+	}
+	if ((size_t) s < len) {
+		memset(buffer + s, 0, len - s);
+	}
+
+	SectorMap::const_iterator iter = fChangedSectors.lower_bound(first);
+	for (; iter != fChangedSectors.end() && iter->first < first + count; iter++) {
+		memcpy(buffer + CalculateOffset(iter->first) - offset, iter->second, GetSectorLength(iter->first));
+	}
+	return true;
+}
+
+const uint8_t* AtrGzImage::GetSectorPtr(unsigned int sector, unsigned int& length) const
+{
+	length = 0;
+
+	// decompressed spans may be released at any time, so only
+	// changed sectors can be accessed directly
+	SectorMap::const_iterator iter = fChangedSectors.find(sector);
+	if (iter == fChangedSectors.end()) {
+		return 0;
+	}
+	length = GetSectorLength(sector);
+	return iter->second;
+}
+
+bool AtrGzImage::WriteSector(unsigned int sector, const uint8_t* buffer, unsigned int buffer_length)
+{
+	unsigned int len;
+
+	if (IsWriteProtected()) {
+		DPRINTF("attempting to write sector to write protected image");
+		return false;
+	}
+
+	if (CalculateOffset(sector) < 0) {
+		DPRINTF("illegal sector in WriteSector: %d", sector);
+		return false;
+	}
+
+	len=GetSectorLength(sector);
+
+	if (buffer_length != len) {
+		DPRINTF("buffer length = len [ %d != %d ]", buffer_length, len);
+		return false;
+	}
+
+	uint8_t*& data = fChangedSectors[sector];
+	if (!data) {
+		data = new uint8_t[len];
+	}
+	memcpy(data, buffer, len);
+
+	SetChanged(true);
+	SetSectorDirty(sector);
+
+	return true;
+}
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef ATRGZIMAGE_H
+#define ATRGZIMAGE_H
+
+/*
+   AtrGzImage.h - gzip compressed ATR/XFD image, decompressed on demand
+
+   Copyright (C) 2026 Matthias Reichl <hias@horus.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include <map>
+
+#include "AtrImage.h"
+#include "GzIndex.h"
+
+/*
+ * Sectors are read through a GzIndex, so only the parts of the
+ * file around the requested sectors are decompressed. Written
+ * sectors are kept in memory until the image is written back.
+ *
+ * Writing back to the image file writes a new file and renames
+ * it over the old one, the old (still open) file stays valid for
+ * unchanged sectors.
+ */
+
+class AtrGzImage : public AtrImage {
+public:
+
+	AtrGzImage();
+
+	virtual ~AtrGzImage();
+
+	// returns true if filename is a gzip compressed ATR or XFD image
+	static bool IsGzImageFile(const char* filename);
+
+	// formatting hides the compressed image data
+	virtual bool CreateImage(EDiskFormat format);
+	virtual bool CreateImage(ESectorLength density, unsigned int sectors);
+	virtual bool CreateImage(ESectorLength density, unsigned int sectorsPerTrack, unsigned int tracks, unsigned int sides);
+
+	virtual bool ReadImageFromFile(const char* filename, bool beQuiet = false);
+	virtual bool WriteImageToFile(const char* filename) const;
+
+	virtual bool ReadSector(unsigned int sector,
+		       uint8_t* buffer,
+		       unsigned int buffer_length) const;
+
+	virtual bool WriteSector(unsigned int sector,
+		       const uint8_t* buffer,
+		       unsigned int buffer_length);
+
+	virtual bool ReadSectors(unsigned int first, unsigned int count,
+		       uint8_t* buffer,
+		       size_t buffer_length) const;
+
+	virtual const uint8_t* GetSectorPtr(unsigned int sector,
+		       unsigned int& length) const;
+
+private:
+	typedef AtrImage super;
+
+	void FreeImageData();
+
+	RCPtr<GzIndex> fGzIndex;
+	size_t fDataOffset;	// 16 for ATR, 0 for XFD
+
+	typedef std::map<unsigned int, uint8_t*> SectorMap;
+	SectorMap fChangedSectors;
+};
+
+#endif
@@ -23,17 +23,30 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 
+#include "SIOChecksum.h"
 #include "AtariDebug.h"
 #include "SIOTracer.h"
 
 AtrImage::AtrImage()
+	: fDirtyMap(0),
+	  fNumberOfDirtySectors(0),
+	  fSectorChecksums(0)
 {
 	Init();
 }
 
 AtrImage::~AtrImage()
 {
+	if (fDirtyMap) {
+		delete[] fDirtyMap;
+		fDirtyMap = 0;
+	}
+	if (fSectorChecksums) {
+		delete[] fSectorChecksums;
+		fSectorChecksums = 0;
+	}
 }
 
 void AtrImage::Init()
@@ -46,6 +59,60 @@ void AtrImage::Init()
 	fImageConfig.fSides = 0;
 	fImageConfig.fImageSize = 0;
 	SetWriteProtect(false);
+	InitDirtyMap();
+}
+
+void AtrImage::InitDirtyMap()
+{
+	if (fDirtyMap) {
+		delete[] fDirtyMap;
+	}
+	// always allocate at least one word so SectorIsDirty needs no NULL check
+	unsigned int words = (fImageConfig.fNumberOfSectors + 31) / 32 + 1;
+	fDirtyMap = new uint32_t[words];
+	memset(fDirtyMap, 0, words * sizeof(uint32_t));
+	fNumberOfDirtySectors = 0;
+
+	// the format changed, checksums are recalculated on demand
+	if (fSectorChecksums) {
+		delete[] fSectorChecksums;
+		fSectorChecksums = 0;
+	}
+}
+
+bool AtrImage::GetSectorChecksum(unsigned int sector, uint8_t& checksum) const
+{
+	if ( (sector == 0) || (sector > fImageConfig.fNumberOfSectors) ) {
+		return false;
+	}
+	if (!fSectorChecksums) {
+		fSectorChecksums = new uint16_t[fImageConfig.fNumberOfSectors];
+		memset(fSectorChecksums, 0, fImageConfig.fNumberOfSectors * sizeof(uint16_t));
+	}
+	if (!fSectorChecksums[sector-1]) {
+		unsigned int len;
+		const uint8_t* data = GetSectorPtr(sector, len);
+		if (data) {
+			checksum = CalculateSIOChecksum(data, len);
+		} else {
+			uint8_t buf[e8kPerSector];
+			len = GetSectorLength(sector);
+			if (len > e8kPerSector || !ReadSector(sector, buf, len)) {
+				return false;
+			}
+			checksum = CalculateSIOChecksum(buf, len);
+		}
+		fSectorChecksums[sector-1] = 0x100 | checksum;
+	}
+	checksum = fSectorChecksums[sector-1] & 0xff;
+	return true;
+}
+
+void AtrImage::ClearDirtySectors() const
+{
+	unsigned int words = (fImageConfig.fNumberOfSectors + 31) / 32 + 1;
+	memset(fDirtyMap, 0, words * sizeof(uint32_t));
+	fNumberOfDirtySectors = 0;
 }
 
 bool AtrImage::SetFormat(EDiskFormat format)
@@ -92,6 +159,7 @@ bool AtrImage::SetFormat(EDiskFormat format)
 		return false;
 		break;
 	}
+	InitDirtyMap();
 	return true;
 }
 
@@ -169,6 +237,7 @@ bool AtrImage::SetFormat(ESectorLength density, uint32_t numberOfSectors)
 	}
 	fImageConfig.DetermineDiskFormatFromLayout();
 	fImageConfig.CalculateImageSize();
+	InitDirtyMap();
 	return true;
 }
 		
@@ -192,6 +261,8 @@ bool AtrImage::SetFormat(ESectorLength density, unsigned int sectors, unsigned i
 
 	fImageConfig.CalculateImageSize();
 
+	InitDirtyMap();
+
 	return true;
 }
 
@@ -338,11 +409,88 @@ bool AtrImage::CreateATRHeaderFromFormat(uint8_t* hdr) const
 	return true;
 }
 
+#ifndef WINVER
+bool AtrImage::WriteDirtySectorsToFile(int fd, const uint8_t* data, bool isXfd) const
+{
+	size_t dataOffset = 0;
+	unsigned int numSectors = fImageConfig.fNumberOfSectors;
+	unsigned int sector, endSector;
+	size_t start, end, pos;
+	ssize_t s;
+
+	if (!isXfd) {
+		uint8_t hdr[16];
+		if (!CreateATRHeaderFromFormat(hdr)) {
+			DPRINTF("CreateATRHeaderFromFormat failed");
+			return false;
+		}
+		if (pwrite(fd, hdr, 16, 0) != 16) {
+			AERROR("cannot write ATR header");
+			return false;
+		}
+		dataOffset = 16;
+	}
+
+	sector = 1;
+	while (sector <= numSectors) {
+		if (!SectorIsDirty(sector)) {
+			sector++;
+			continue;
+		}
+		endSector = sector;
+		while (endSector < numSectors && SectorIsDirty(endSector+1)) {
+			endSector++;
+		}
+
+		start = CalculateOffset(sector);
+		end = CalculateOffset(endSector) + fImageConfig.GetSectorLength(endSector);
+
+		pos = start;
+		while (pos < end) {
+			s = pwrite(fd, data + pos, end - pos, dataOffset + pos);
+			if (s <= 0) {
+				if (s < 0 && errno == EINTR) {
+					continue;
+				}
+				AERROR("error writing sectors %d-%d", sector, endSector);
+				return false;
+			}
+			pos += s;
+		}
+		sector = endSector + 1;
+	}
+	return true;
+}
+#endif
+
 bool AtrImage::IsAtrMemoryImage() const
 {
 	return false;
 }
 
+bool AtrImage::IsAtrOverlayImage() const
+{
+	return false;
+}
+
+bool AtrImage::IsAtrSparseImage() const
+{
+	return false;
+}
+
+void AtrImage::SyncedFileWasUpdated(time_t, time_t) const
+{
+}
+
+void AtrImage::SetJournaled(bool)
+{
+}
+
+bool AtrImage::ImageFileChanged() const
+{
+	return false;
+}
+
 bool AtrImage::IsAtrImage() const
 {
 	return true;
@@ -22,6 +22,7 @@
 */
 
 #include <unistd.h>
+#include <time.h>
 
 #include "DiskImage.h"
 
@@ -42,6 +43,9 @@ public:
 	unsigned int GetSectorLength() const;
 	unsigned int GetSectorLength(unsigned int sector) const;
 
+	ssize_t CalculateOffset(unsigned int sector) const;
+	// -1 = error
+
 	EDiskFormat fDiskFormat;
 
 	ESectorLength fSectorLength;
@@ -65,7 +69,7 @@ public:
 	virtual unsigned int GetSectorLength(unsigned int sectorNumber) const { return fImageConfig.GetSectorLength(sectorNumber); }
 	virtual unsigned int GetNumberOfSectors() const { return fImageConfig.fNumberOfSectors; }
 
-	const AtrImageConfig& GetImageConfig() { return fImageConfig; }
+	const AtrImageConfig& GetImageConfig() const { return fImageConfig; }
 
 	EDiskFormat GetDiskFormat() const { return fImageConfig.fDiskFormat; }
 
@@ -89,10 +93,33 @@ public:
 
 	virtual bool IsAtrImage() const;
 	virtual bool IsAtrMemoryImage() const;
+	virtual bool IsAtrOverlayImage() const;
+	virtual bool IsAtrSparseImage() const;
 
 	virtual bool ReadImageFromFile(const char* filename, bool beQuiet = false);
 	virtual bool WriteImageToFile(const char* filename) const;
 
+	// the image file was changed from oldMTime to newMTime by
+	// writing some of the dirty sectors into it (autosave journal)
+	virtual void SyncedFileWasUpdated(time_t oldMTime, time_t newMTime) const;
+
+	// a journal writes dirty sectors into the image file in the
+	// background, so its modification time changes underneath us
+	virtual void SetJournaled(bool journaled);
+
+	// true if another program changed the image file since it was
+	// read, for images which keep reading sectors from the file
+	virtual bool ImageFileChanged() const;
+
+	// dirty sectors have been changed since the image was last
+	// read from or written to its (uncompressed) image file
+	inline bool SectorIsDirty(unsigned int sector) const;
+	inline unsigned int GetNumberOfDirtySectors() const;
+
+	// SIO checksum of a sector. It's calculated on first use and
+	// cached until the sector is written.
+	bool GetSectorChecksum(unsigned int sector, uint8_t& checksum) const;
+
 protected:
 	bool SetFormat(EDiskFormat format);
 	// note: only 1..65535 sectors are allowed
@@ -105,27 +132,85 @@ protected:
 	ssize_t CalculateOffset(unsigned int sector) const;
 	// -1 = error
 
+	// offset of the first sector and total length of a range of
+	// sectors, they are stored contiguously in ATR/XFD files.
+	// -1 = error
+	ssize_t CalculateRangeOffset(unsigned int first, unsigned int count, size_t& length) const;
+
+	inline void SetSectorDirty(unsigned int sector);
+	void ClearDirtySectors() const;
+
+#ifndef WINVER
+	// write the ATR header (not for XFD) and all dirty sectors into
+	// an existing image file. Adjacent dirty sectors are coalesced
+	// into a single write.
+	bool WriteDirtySectorsToFile(int fd, const uint8_t* data, bool isXfd) const;
+#endif
+
 private:
 
 	void Init(); /* reset all data to zero */
 
+	void InitDirtyMap();
+
 	AtrImageConfig fImageConfig;
+
+	mutable uint32_t* fDirtyMap;
+	mutable unsigned int fNumberOfDirtySectors;
+
+	// 0x100 | checksum, 0 = not calculated yet. Allocated on first use.
+	mutable uint16_t* fSectorChecksums;
 };
 
-inline ssize_t AtrImage::CalculateOffset(unsigned int sector) const
+inline bool AtrImage::SectorIsDirty(unsigned int sector) const
+{
+	if ( (sector == 0) || (sector > fImageConfig.fNumberOfSectors) ) {
+		return false;
+	}
+	return (fDirtyMap[(sector-1) >> 5] & (1U << ((sector-1) & 31))) != 0;
+}
+
+inline unsigned int AtrImage::GetNumberOfDirtySectors() const
+{
+	return fNumberOfDirtySectors;
+}
+
+inline void AtrImage::SetSectorDirty(unsigned int sector)
 {
 	if ( (sector == 0) || (sector > fImageConfig.fNumberOfSectors) ) {
+		return;
+	}
+	if (fSectorChecksums) {
+		fSectorChecksums[sector-1] = 0;
+	}
+	uint32_t mask = 1U << ((sector-1) & 31);
+	uint32_t& word = fDirtyMap[(sector-1) >> 5];
+	if (!(word & mask)) {
+		word |= mask;
+		fNumberOfDirtySectors++;
+	}
+}
+
+inline ssize_t AtrImage::CalculateOffset(unsigned int sector) const
+{
+	return fImageConfig.CalculateOffset(sector);
+}
+
+inline ssize_t AtrImage::CalculateRangeOffset(unsigned int first, unsigned int count, size_t& length) const
+{
+	ssize_t offset, lastOffset;
+
+	if (count == 0 || count > GetNumberOfSectors()) {
 		return -1;
 	}
-	if (fImageConfig.fSectorLength == e256BytesPerSector) {
-		if (sector <= 3) {
-			return (sector-1)*128;
-		} else {
-			return 384 + (sector-4)*256;
-		}
-	} else {
-		return fImageConfig.GetSectorLength(sector) * (sector - 1);
+	if ((offset = CalculateOffset(first)) < 0) {
+		return -1;
 	}
+	if ((lastOffset = CalculateOffset(first + count - 1)) < 0) {
+		return -1;
+	}
+	length = lastOffset - offset + GetSectorLength(first + count - 1);
+	return offset;
 }
 
 inline AtrImageConfig::AtrImageConfig()
@@ -237,4 +322,20 @@ inline void AtrImageConfig::CalculateImageSize()
 	}
 }
 
+inline ssize_t AtrImageConfig::CalculateOffset(unsigned int sector) const
+{
+	if ( (sector == 0) || (sector > fNumberOfSectors) ) {
+		return -1;
+	}
+	if (fSectorLength == e256BytesPerSector) {
+		if (sector <= 3) {
+			return (sector-1)*128;
+		} else {
+			return 384 + (sector-4)*256;
+		}
+	} else {
+		return GetSectorLength(sector) * (sector - 1);
+	}
+}
+
 #endif
@@ -0,0 +1,553 @@
+/*
+   AtrMappedImage.cpp - access uncompressed ATR/XFD images via mmap
+
+   Copyright (C) 2026 Matthias Reichl <hias@horus.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include "AtrMappedImage.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "AtrMemoryImage.h"
+#include "SIOTracer.h"
+#include "AtariDebug.h"
+
+AtrMappedImage::AtrMappedImage()
+	: fMapBase(0),
+	  fMapLength(0),
+	  fData(0),
+	  fIsXfd(false),
+	  fMappedFilename(0),
+	  fMappedFd(-1),
+	  fMappedFileSize(0),
+	  fMappedFileMTime(0),
+	  fMappedFileChanged(false),
+	  fJournaled(false)
+{
+}
+
+AtrMappedImage::~AtrMappedImage()
+{
+	UnmapImage();
+}
+
+bool AtrMappedImage::IsMappableFile(const char* filename)
+{
+	size_t len = strlen(filename);
+
+	if (len < 4) {
+		return false;
+	}
+	return (strcasecmp(filename+len-4,".atr") == 0)
+		|| (strcasecmp(filename+len-4,".xfd") == 0);
+}
+
+void AtrMappedImage::UnmapImage()
+{
+	if (fMapBase) {
+		munmap(fMapBase, fMapLength);
+		fMapBase = 0;
+		fMapLength = 0;
+		fData = 0;
+	}
+	if (fMappedFilename) {
+		free(fMappedFilename);
+		fMappedFilename = 0;
+	}
+	if (fMappedFd >= 0) {
+		close(fMappedFd);
+		fMappedFd = -1;
+	}
+	fMappedFileChanged = false;
+	fIsXfd = false;
+	SetFormat(eNoDisk);
+}
+
+bool AtrMappedImage::MapAnonymous()
+{
+	size_t imgSize;
+	void* base;
+
+	SetWriteProtect(false);
+
+	if ((imgSize = GetImageSize()) == 0) {
+		DPRINTF("GetImageSize = 0");
+		return false;
+	}
+
+	base = mmap(0, imgSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED) {
+		DPRINTF("anonymous mmap failed: %s", strerror(errno));
+		UnmapImage();
+		return false;
+	}
+	fMapBase = (uint8_t*) base;
+	fMapLength = imgSize;
+	fData = fMapBase;
+	return true;
+}
+
+bool AtrMappedImage::CreateImage(EDiskFormat format)
+{
+	UnmapImage();
+	SetChanged(true);
+	if (!SetFormat(format)) {
+		DPRINTF("SetFormat failed");
+		return false;
+	}
+	return MapAnonymous();
+}
+
+bool AtrMappedImage::CreateImage(ESectorLength density, unsigned int sectors)
+{
+	UnmapImage();
+	SetChanged(true);
+	if (!SetFormat(density, sectors)) {
+		DPRINTF("SetFormat failed");
+		return false;
+	}
+	return MapAnonymous();
+}
+
+bool AtrMappedImage::CreateImage(ESectorLength density, unsigned int sectorsPerTrack, unsigned int tracks, unsigned int sides)
+{
+	UnmapImage();
+	SetChanged(true);
+	if (!SetFormat(density, sectorsPerTrack, tracks, sides)) {
+		DPRINTF("SetFormat failed");
+		return false;
+	}
+	return MapAnonymous();
+}
+
+bool AtrMappedImage::ReadImageFromFile(const char* filename, bool beQuiet)
+{
+	char absPath[PATH_MAX];
+	struct stat statbuf;
+	size_t imgSize;
+	size_t dataOffset;
+	void* base;
+	int fd;
+
+	UnmapImage();
+
+	if (!IsMappableFile(filename)) {
+		if (!beQuiet) {
+			DPRINTF("\"%s\" is not an uncompressed ATR or XFD image", filename);
+		}
+		return false;
+	}
+
+	if (realpath(filename, absPath) == 0) {
+		if (!beQuiet) {
+			AERROR("cannot find \"%s\"", filename);
+		}
+		return false;
+	}
+
+	fIsXfd = strcasecmp(absPath + strlen(absPath) - 4, ".xfd") == 0;
+
+	fd = open(absPath, O_RDONLY);
+	if (fd < 0) {
+		if (!beQuiet) {
+			AERROR("cannot open \"%s\" for reading", absPath);
+		}
+		return false;
+	}
+
+	if (fstat(fd, &statbuf) || !S_ISREG(statbuf.st_mode)) {
+		if (!beQuiet) {
+			AERROR("cannot stat \"%s\"", absPath);
+		}
+		goto failure;
+	}
+
+	if (fIsXfd) {
+		ESectorLength seclen;
+		unsigned int numSecs;
+
+		imgSize = statbuf.st_size;
+		if ( (imgSize & 0x7f) || imgSize < 384 ) {
+			if (!beQuiet) {
+				AERROR("illegal image size %d", (int)imgSize);
+			}
+			goto failure;
+		}
+		if (imgSize & 0x80) {
+			seclen = e256BytesPerSector;
+			numSecs = (imgSize - 384) / 256 + 3;
+		} else {
+			seclen = e128BytesPerSector;
+			numSecs = imgSize / 128;
+		}
+		if (!SetFormat(seclen, numSecs) || imgSize != GetImageSize()) {
+			if (!beQuiet) {
+				DPRINTF("setting image size failed!");
+			}
+			goto failure;
+		}
+		SetWriteProtect(false);
+		dataOffset = 0;
+	} else {
+		uint8_t hdr[16];
+
+		if (pread(fd, hdr, 16, 0) != 16) {
+			if (!beQuiet) {
+				AERROR("cannot read ATR-header");
+			}
+			goto failure;
+		}
+		if (!SetFormatFromATRHeader(hdr)) {
+			if (!beQuiet) {
+				AERROR("illegal ATR header");
+			}
+			goto failure;
+		}
+		dataOffset = 16;
+	}
+
+	if ((imgSize = GetImageSize()) == 0) {
+		if (!beQuiet) {
+			DPRINTF("GetImageSize = 0");
+		}
+		goto failure;
+	}
+
+	// truncated images are handled by AtrMemoryImage, accessing
+	// a mapping beyond the end of file would result in SIGBUS
+	if ((size_t)statbuf.st_size < dataOffset + imgSize) {
+		if (!beQuiet) {
+			DPRINTF("image file truncated, cannot map it");
+		}
+		goto failure;
+	}
+
+	fMapLength = dataOffset + imgSize;
+	base = mmap(0, fMapLength, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	if (base == MAP_FAILED) {
+		if (!beQuiet) {
+			DPRINTF("mmap of \"%s\" failed: %s", absPath, strerror(errno));
+		}
+		fMapLength = 0;
+		goto failure;
+	}
+
+	fMapBase = (uint8_t*) base;
+	fData = fMapBase + dataOffset;
+	fMappedFilename = strdup(absPath);
+	fMappedFd = fd;
+	fMappedFileSize = statbuf.st_size;
+	fMappedFileMTime = statbuf.st_mtime;
+
+	SetChanged(false);
+	return true;
+
+failure:
+	close(fd);
+	SetChanged(false);
+	UnmapImage();
+	return false;
+}
+
+bool AtrMappedImage::IsMappedFile(const char* filename) const
+{
+	char absPath[PATH_MAX];
+
+	if (!fMappedFilename) {
+		return false;
+	}
+	if (realpath(filename, absPath) == 0) {
+		return false;
+	}
+	return strcmp(absPath, fMappedFilename) == 0;
+}
+
+bool AtrMappedImage::CheckMappedFile() const
+{
+	struct stat statbuf;
+
+	if (fMappedFd < 0) {
+		// anonymous mapping
+		return true;
+	}
+	if (fMappedFileChanged) {
+		return false;
+	}
+	if (fstat(fMappedFd, &statbuf) == 0 && statbuf.st_size == fMappedFileSize
+	    && (fJournaled || statbuf.st_mtime == fMappedFileMTime)) {
+		return true;
+	}
+	AERROR("\"%s\" was changed by another program, please reload it", fMappedFilename);
+	fMappedFileChanged = true;
+	return false;
+}
+
+void AtrMappedImage::SyncedFileWasUpdated(time_t oldMTime, time_t newMTime) const
+{
+	if (fMappedFd >= 0 && fMappedFileMTime == oldMTime) {
+		fMappedFileMTime = newMTime;
+	}
+}
+
+void AtrMappedImage::SetJournaled(bool journaled)
+{
+	fJournaled = journaled;
+}
+
+bool AtrMappedImage::ImageFileChanged() const
+{
+	return !CheckMappedFile();
+}
+
+bool AtrMappedImage::WriteImageToFile(const char* filename) const
+{
+	if (!fData) {
+		DPRINTF("no fData");
+		return false;
+	}
+	if (!CheckMappedFile()) {
+		return false;
+	}
+
+	if (IsMappedFile(filename)) {
+		return WriteBackToMappedFile();
+	} else {
+		return WriteImageToOtherFile(filename);
+	}
+}
+
+bool AtrMappedImage::WriteBackToMappedFile() const
+{
+	struct stat statbuf, mappedStatbuf;
+	int fd;
+
+	// journaled writes have been accounted for by now, any other
+	// change would be overwritten partially
+	if (fstat(fMappedFd, &mappedStatbuf) || mappedStatbuf.st_mtime != fMappedFileMTime) {
+		AERROR("\"%s\" was changed by another program, please reload it", fMappedFilename);
+		fMappedFileChanged = true;
+		return false;
+	}
+
+	// don't truncate the file, otherwise accessing unchanged
+	// pages of the mapping would result in SIGBUS
+	fd = open(fMappedFilename, O_WRONLY);
+	if (fd < 0) {
+		AERROR("cannot open \"%s\" for writing", fMappedFilename);
+		return false;
+	}
+	if (fstat(fd, &statbuf) || statbuf.st_dev != mappedStatbuf.st_dev
+	    || statbuf.st_ino != mappedStatbuf.st_ino) {
+		AERROR("\"%s\" was replaced by another file", fMappedFilename);
+		close(fd);
+		return false;
+	}
+
+	if (!WriteDirtySectorsToFile(fd, fData, fIsXfd)) {
+		AERROR("cannot write image to \"%s\"", fMappedFilename);
+		close(fd);
+		return false;
+	}
+
+	if (close(fd)) {
+		AERROR("error closing \"%s\"", fMappedFilename);
+		return false;
+	}
+	if (fstat(fMappedFd, &statbuf) == 0) {
+		fMappedFileMTime = statbuf.st_mtime;
+	}
+	ClearDirtySectors();
+	SetChanged(false);
+	return true;
+}
+
+bool AtrMappedImage::WriteImageToOtherFile(const char* filename) const
+{
+	RCPtr<AtrMemoryImage> img = new AtrMemoryImage;
+	unsigned int numSectors = GetNumberOfSectors();
+
+	if (!img->CreateImage(GetSectorLength(), GetSectorsPerTrack(), GetTracksPerSide(), GetSides())) {
+		DPRINTF("creating temporary memory image failed");
+		return false;
+	}
+	if (img->GetNumberOfSectors() != numSectors) {
+		DPRINTF("temporary memory image has wrong number of sectors");
+		return false;
+	}
+
+	if (!img->WriteSectors(1, numSectors, fData, GetImageSize())) {
+		DPRINTF("copying sectors to temporary memory image failed");
+		return false;
+	}
+	img->SetWriteProtect(IsWriteProtected());
+
+	if (!img->WriteImageToFile(filename)) {
+		return false;
+	}
+	SetChanged(false);
+	return true;
+}
+
+bool AtrMappedImage::ReadSector(unsigned int sector, uint8_t* buffer, unsigned int buffer_length) const
+{
+	bool ret=true;
+	unsigned int len;
+	ssize_t offset;
+
+	if ((offset=CalculateOffset(sector)) < 0 ) {
+		DPRINTF("illegal sector in ReadSector: %d", sector);
+		return false;
+	}
+
+	len=GetSectorLength(sector);
+
+	if (!buffer_length) {
+		DPRINTF("buffer length = 0");
+		return false;
+	}
+
+	if (buffer_length < len) {
+		DPRINTF("buffer length < sector length [ %d < %d ]",buffer_length, len);
+		ret = false;
+		len = buffer_length;
+	} else if (buffer_length > len) {
+		DPRINTF("buffer length > sector length [ %d > %d ]",buffer_length, len);
+		ret = false;
+	}
+
+	if (!CheckMappedFile()) {
+		return false;
+	}
+	memcpy(buffer, fData+offset, len);
+
+	return ret;
+}
+
+bool AtrMappedImage::ReadSectors(unsigned int first, unsigned int count, uint8_t* buffer, size_t buffer_length) const
+{
+	ssize_t offset;
+	size_t len;
+
+	if ((offset=CalculateRangeOffset(first, count, len)) < 0 ) {
+		DPRINTF("illegal sector range in ReadSectors: %d-%d", first, first + count - 1);
+		return false;
+	}
+	if (buffer_length < len) {
+		DPRINTF("buffer too small in ReadSectors [ %d < %d ]", (int)buffer_length, (int)len);
+		return false;
+	}
+
+	if (!CheckMappedFile()) {
+		return false;
+	}
+	memcpy(buffer, fData+offset, len);
+
+	return true;
+}
+
+bool AtrMappedImage::WriteSectors(unsigned int first, unsigned int count, const uint8_t* buffer, size_t buffer_length)
+{
+	ssize_t offset;
+	size_t len;
+
+	if (IsWriteProtected()) {
+		DPRINTF("attempting to write sectors to write protected image");
+		return false;
+	}
+
+	if ((offset=CalculateRangeOffset(first, count, len)) < 0 ) {
+		DPRINTF("illegal sector range in WriteSectors: %d-%d", first, first + count - 1);
+		return false;
+	}
+	if (buffer_length < len) {
+		DPRINTF("buffer too small in WriteSectors [ %d < %d ]", (int)buffer_length, (int)len);
+		return false;
+	}
+
+	// faulting in a page beyond the end of file results in SIGBUS
+	if (!CheckMappedFile()) {
+		return false;
+	}
+	SetChanged(true);
+	for (unsigned int sector = first; sector < first + count; sector++) {
+		SetSectorDirty(sector);
+	}
+	memcpy(fData+offset, buffer, len);
+
+	return true;
+}
+
+const uint8_t* AtrMappedImage::GetSectorPtr(unsigned int sector, unsigned int& length) const
+{
+	ssize_t offset;
+
+	if ((offset=CalculateOffset(sector)) < 0 ) {
+		DPRINTF("illegal sector in GetSectorPtr: %d", sector);
+		length = 0;
+		return 0;
+	}
+
+	if (!CheckMappedFile()) {
+		length = 0;
+		return 0;
+	}
+	length = GetSectorLength(sector);
+
+	return fData + offset;
+}
+
+bool AtrMappedImage::WriteSector(unsigned int sector, const uint8_t* buffer, unsigned int buffer_length)
+{
+	unsigned int len;
+	ssize_t offset;
+
+	if (IsWriteProtected()) {
+		DPRINTF("attempting to write sector to write protected image");
+		return false;
+	}
+
+	if ((offset=CalculateOffset(sector)) < 0 ) {
+		DPRINTF("illegal sector in WriteSector: %d", sector);
+		return false;
+	}
+
+	len=GetSectorLength(sector);
+
+	if (buffer_length != len) {
+		DPRINTF("buffer length = len [ %d != %d ]", buffer_length, len);
+		return false;
+	}
+
+	// faulting in a page beyond the end of file results in SIGBUS
+	if (!CheckMappedFile()) {
+		return false;
+	}
+	SetChanged(true);
+	SetSectorDirty(sector);
+	memcpy(fData+offset, buffer, len);
+
+	return true;
+}
@@ -0,0 +1,119 @@
+#ifndef ATRMAPPEDIMAGE_H
+#define ATRMAPPEDIMAGE_H
+
+/*
+   AtrMappedImage.h - access uncompressed ATR/XFD images via mmap
+
+   Copyright (C) 2026 Matthias Reichl <hias@horus.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include "AtrImage.h"
+
+/*
+ * The image file is mapped MAP_PRIVATE: unchanged sectors are served
+ * directly from the page cache (and shared with other processes using
+ * the same file), written sectors stay private until the image is
+ * written back.
+ *
+ * MAP_PRIVATE doesn't protect against other programs: until a page is
+ * written it shows the current file contents, and accessing it after
+ * the file was truncated results in SIGBUS. Size and modification time
+ * of the file are checked before each access, once another program
+ * changed the file the image refuses to read or write it back and has
+ * to be reloaded. A change in the same second or between the check and
+ * the access can't be detected.
+ */
+
+class AtrMappedImage : public AtrImage {
+public:
+
+	AtrMappedImage();
+
+	virtual ~AtrMappedImage();
+
+	// returns true if filename is an uncompressed ATR or XFD image
+	static bool IsMappableFile(const char* filename);
+
+	// creating an image (eg when the Atari formats the disk) replaces
+	// the file mapping with an anonymous one
+	virtual bool CreateImage(EDiskFormat format);
+	virtual bool CreateImage(ESectorLength density, unsigned int sectors);
+	virtual bool CreateImage(ESectorLength density, unsigned int sectorsPerTrack, unsigned int tracks, unsigned int sides);
+
+	void UnmapImage();
+
+	virtual bool ReadImageFromFile(const char* filename, bool beQuiet = false);
+	virtual bool WriteImageToFile(const char* filename) const;
+
+	virtual bool ReadSector(unsigned int sector,
+		       uint8_t* buffer,
+		       unsigned int buffer_length) const;
+
+	virtual bool WriteSector(unsigned int sector,
+		       const uint8_t* buffer,
+		       unsigned int buffer_length);
+
+	virtual bool ReadSectors(unsigned int first, unsigned int count,
+		       uint8_t* buffer,
+		       size_t buffer_length) const;
+
+	virtual bool WriteSectors(unsigned int first, unsigned int count,
+		       const uint8_t* buffer,
+		       size_t buffer_length);
+
+	virtual const uint8_t* GetSectorPtr(unsigned int sector,
+		       unsigned int& length) const;
+
+	virtual void SyncedFileWasUpdated(time_t oldMTime, time_t newMTime) const;
+	virtual void SetJournaled(bool journaled);
+	virtual bool ImageFileChanged() const;
+
+private:
+	bool MapAnonymous();
+
+	bool IsMappedFile(const char* filename) const;
+
+	// false if another program changed the mapped file
+	bool CheckMappedFile() const;
+
+	// write changes back into the mapped file, without truncating it
+	bool WriteBackToMappedFile() const;
+
+	// write image to a different file via a temporary AtrMemoryImage
+	bool WriteImageToOtherFile(const char* filename) const;
+
+	typedef AtrImage super;
+
+	uint8_t* fMapBase;
+	size_t fMapLength;
+
+	uint8_t* fData; // start of sector data inside mapping
+
+	bool fIsXfd;
+	char* fMappedFilename;
+
+	// the mapped file is kept open to check it's unchanged
+	int fMappedFd;
+	off_t fMappedFileSize;
+	mutable time_t fMappedFileMTime;
+	mutable bool fMappedFileChanged;
+
+	// modification time is updated by the journal, don't check it
+	bool fJournaled;
+};
+
+#endif
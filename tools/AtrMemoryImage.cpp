@@ -24,6 +24,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #ifdef USE_ZLIB
 #include <zlib.h>
@@ -32,6 +35,8 @@
 #include <ctype.h>
 
 #include "DCMCodec.h"
+#include "AtzFile.h"
+#include "ImageFormat.h"
 #include "SIOTracer.h"
 #include "AtariDebug.h"
 #include "Dos2xUtils.h"
@@ -40,7 +45,12 @@
 #include "winver.h"
 
 AtrMemoryImage::AtrMemoryImage()
-	: fData(0)
+	: fData(0),
+	  fSectors(0),
+	  fPreparedStore(0),
+	  fSyncedFilename(0),
+	  fSyncedFileSize(0),
+	  fSyncedFileMTime(0)
 {
 }
 
@@ -55,9 +65,242 @@ void AtrMemoryImage::FreeImageData()
 		delete[] fData;
 		fData=0;
 	}
+	ReleaseSectors();
+	SetSyncedFile(0);
 	SetFormat(eNoDisk);
 }
 
+void AtrMemoryImage::ReleaseSectors()
+{
+	if (!fSectors) {
+		return;
+	}
+	SectorStore* store = fPreparedStore ? fPreparedStore : fSectorStore.GetRealPointer();
+	unsigned int numSectors = GetNumberOfSectors();
+	for (unsigned int i = 0; i < numSectors; i++) {
+		store->Release(fSectors[i]);
+	}
+	delete[] fSectors;
+	fSectors = 0;
+	fPreparedStore = 0;
+}
+
+bool AtrMemoryImage::InternImageData()
+{
+	return InternImageData(fSectorStore.GetRealPointer());
+}
+
+bool AtrMemoryImage::InternImageData(SectorStore* store)
+{
+	if (!fData || !store) {
+		return true;
+	}
+	unsigned int numSectors = GetNumberOfSectors();
+	unsigned int sector;
+	fSectors = new const uint8_t*[numSectors];
+	memset(fSectors, 0, numSectors * sizeof(uint8_t*));
+
+	for (sector = 1; sector <= numSectors; sector++) {
+		fSectors[sector-1] = store->Intern(
+			fData + CalculateOffset(sector), GetSectorLength(sector));
+		if (!fSectors[sector-1]) {
+			DPRINTF("interning sector %d failed", sector);
+			while (--sector) {
+				store->Release(fSectors[sector-1]);
+			}
+			delete[] fSectors;
+			fSectors = 0;
+			return false;
+		}
+	}
+	delete[] fData;
+	fData = 0;
+	return true;
+}
+
+bool AtrMemoryImage::FlattenImageData()
+{
+	if (!fSectors) {
+		return true;
+	}
+	const uint8_t* data = LockImageData();
+	if (!data) {
+		return false;
+	}
+	ReleaseSectors();
+	fData = (uint8_t*) data;
+	return true;
+}
+
+const uint8_t* AtrMemoryImage::LockImageData() const
+{
+	if (!fSectors) {
+		return fData;
+	}
+	size_t imgSize = GetImageSize();
+	unsigned int numSectors = GetNumberOfSectors();
+	unsigned int sector;
+	uint8_t* data = new uint8_t[imgSize];
+	if (!data) {
+		DPRINTF("cannot alloc image data");
+		return 0;
+	}
+	for (sector = 1; sector <= numSectors; sector++) {
+		memcpy(data + CalculateOffset(sector), fSectors[sector-1], GetSectorLength(sector));
+	}
+	return data;
+}
+
+void AtrMemoryImage::UnlockImageData(const uint8_t* data) const
+{
+	if (data && data != fData) {
+		delete[] data;
+	}
+}
+
+bool AtrMemoryImage::WriteImageData(const RCPtr<FileIO>& fileio, size_t imgSize) const
+{
+	if (!fSectors) {
+		return fileio->WriteBlock(fData, imgSize) == imgSize;
+	}
+	// sectors are stored in file order
+	unsigned int numSectors = GetNumberOfSectors();
+	unsigned int sector, len;
+	for (sector = 1; sector <= numSectors; sector++) {
+		len = GetSectorLength(sector);
+		if (fileio->WriteBlock(fSectors[sector-1], len) != len) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool AtrMemoryImage::SetSectorStore(const RCPtr<SectorStore>& store)
+{
+	if (fPreparedStore && fPreparedStore == store.GetRealPointer()) {
+		// the data is already in the store
+		fSectorStore = store;
+		fPreparedStore = 0;
+		return true;
+	}
+	if (store == fSectorStore && !fPreparedStore) {
+		return true;
+	}
+	if (!FlattenImageData()) {
+		return false;
+	}
+	fSectorStore = store;
+	return InternImageData();
+}
+
+bool AtrMemoryImage::PrepareSectorStore(SectorStore* store)
+{
+	if (fSectors || fSectorStore.IsNotNull()) {
+		DPRINTF("image data is already in a sector store");
+		return false;
+	}
+	if (!InternImageData(store)) {
+		return false;
+	}
+	if (fSectors) {
+		fPreparedStore = store;
+	}
+	return true;
+}
+
+void AtrMemoryImage::SetSyncedFile(const char* filename) const
+{
+	char absPath[PATH_MAX];
+	struct stat statbuf;
+	size_t expectedSize;
+
+	if (fSyncedFilename) {
+		free(fSyncedFilename);
+		fSyncedFilename = 0;
+	}
+	if (!filename || !HasImageData()) {
+		return;
+	}
+	if (realpath(filename, absPath) == 0 || stat(absPath, &statbuf)) {
+		return;
+	}
+
+	// only accept plain files with the exact size, this rules out
+	// eg gzip compressed files with an .atr extension
+	expectedSize = GetImageSize();
+	if (DetermineImageTypeFromFilename(absPath) == eAtrImageType) {
+		expectedSize += 16;
+	}
+	if (!S_ISREG(statbuf.st_mode) || (size_t)statbuf.st_size != expectedSize) {
+		return;
+	}
+
+	fSyncedFilename = strdup(absPath);
+	fSyncedFileSize = statbuf.st_size;
+	fSyncedFileMTime = statbuf.st_mtime;
+	ClearDirtySectors();
+}
+
+bool AtrMemoryImage::IsSyncedFile(const char* filename) const
+{
+	char absPath[PATH_MAX];
+	struct stat statbuf;
+
+	if (!fSyncedFilename) {
+		return false;
+	}
+	if (realpath(filename, absPath) == 0 || strcmp(absPath, fSyncedFilename)) {
+		return false;
+	}
+	// check if somebody else modified the file in the meantime
+	if (stat(absPath, &statbuf)
+	    || statbuf.st_size != fSyncedFileSize
+	    || statbuf.st_mtime != fSyncedFileMTime) {
+		return false;
+	}
+	return true;
+}
+
+void AtrMemoryImage::SyncedFileWasUpdated(time_t oldMTime, time_t newMTime) const
+{
+	// the sectors are still dirty, so writing them back again
+	// brings the file completely in sync
+	if (fSyncedFilename && fSyncedFileMTime == oldMTime) {
+		fSyncedFileMTime = newMTime;
+	}
+}
+
+bool AtrMemoryImage::WriteDirtySectorsToSyncedFile(bool isXfd) const
+{
+#ifdef WINVER
+	(void) isXfd;
+	return false;
+#else
+	const uint8_t* data = LockImageData();
+	if (!data) {
+		return false;
+	}
+	int fd = open(fSyncedFilename, O_WRONLY);
+	if (fd < 0) {
+		UnlockImageData(data);
+		return false;
+	}
+	if (!WriteDirtySectorsToFile(fd, data, isXfd)) {
+		UnlockImageData(data);
+		close(fd);
+		return false;
+	}
+	UnlockImageData(data);
+	if (close(fd)) {
+		return false;
+	}
+	char* filename = strdup(fSyncedFilename);
+	SetSyncedFile(filename);
+	free(filename);
+	return true;
+#endif
+}
+
 bool AtrMemoryImage::CreateImage(EDiskFormat format)
 {
 	size_t imgSize;
@@ -78,7 +321,7 @@ bool AtrMemoryImage::CreateImage(EDiskFormat format)
 
 	if (fData) {
 		memset (fData, 0, imgSize);
-		return true;
+		return InternImageData();
 	} else {
 		DPRINTF("cannot alloc fData");
 		FreeImageData();
@@ -106,7 +349,7 @@ bool AtrMemoryImage::CreateImage(ESectorLength density, unsigned int sectors)
 
 	if (fData) {
 		memset (fData, 0, imgSize);
-		return true;
+		return InternImageData();
 	} else {
 		DPRINTF("cannot alloc fData");
 		FreeImageData();
@@ -134,7 +377,7 @@ bool AtrMemoryImage::CreateImage(ESectorLength density, unsigned int sectorsPerT
 
 	if (fData) {
 		memset (fData, 0, imgSize);
-		return true;
+		return InternImageData();
 	} else {
 		DPRINTF("cannot alloc fData");
 		FreeImageData();
@@ -146,7 +389,26 @@ bool AtrMemoryImage::CreateImage(ESectorLength density, unsigned int sectorsPerT
 bool AtrMemoryImage::ReadImageFromFile(const char* filename, bool beQuiet)
 {
 	bool ret;
-	EImageType imageType = DetermineImageTypeFromFilename(filename);
+	EImageType imageType;
+	RCPtr<FileIO> fileio;
+
+#ifdef USE_ZLIB
+	fileio = new GZFileIO();
+#else
+	fileio = new StdFileIO();
+#endif
+
+	// open the file only once, the header tells us the format
+	if (!fileio->OpenRead(filename)) {
+		if (!beQuiet) {
+			AERROR("cannot open \"%s\" for reading",filename);
+		}
+		return false;
+	}
+	imageType = DetermineImageTypeFromFile(fileio, filename);
+	if (imageType == eAtzImageType || imageType == eUnknownImageType) {
+		fileio->Close();
+	}
 
 	if (imageType == eUnknownImageType) {
 		if (!beQuiet) {
@@ -160,9 +422,13 @@ bool AtrMemoryImage::ReadImageFromFile(const char* filename, bool beQuiet)
 	case eXfdGzImageType:
 	case eDcmGzImageType:
 	case eDiGzImageType:
+	case eAtzImageType:
 		if (!beQuiet) {
 			AERROR("cannot read compressed file - zlib support disabled at compiletime!");
 		}
+		if (fileio->IsOpen()) {
+			fileio->Close();
+		}
 		return false;
 	default: break;
 	}
@@ -171,20 +437,25 @@ bool AtrMemoryImage::ReadImageFromFile(const char* filename, bool beQuiet)
 	switch (imageType) {
 	case eAtrImageType:
 	case eAtrGzImageType:
-		ret = ReadImageFromAtrFile(filename, beQuiet);
+		ret = ReadImageFromAtrFile(fileio, beQuiet);
 		break;
 	case eXfdImageType:
 	case eXfdGzImageType:
-		ret = ReadImageFromXfdFile(filename, beQuiet);
+		ret = ReadImageFromXfdFile(fileio, beQuiet);
 		break;
 	case eDcmImageType:
 	case eDcmGzImageType:
-		ret = ReadImageFromDcmFile(filename, beQuiet);
+		ret = ReadImageFromDcmFile(fileio, beQuiet);
 		break;
 	case eDiImageType:
 	case eDiGzImageType:
-		ret = ReadImageFromDiFile(filename, beQuiet);
+		ret = ReadImageFromDiFile(fileio, beQuiet);
+		break;
+#ifdef USE_ZLIB
+	case eAtzImageType:
+		ret = ReadImageFromAtzFile(filename, beQuiet);
 		break;
+#endif
 	case eUnknownImageType:
 		{
 			char p[PATH_MAX];
@@ -234,8 +505,24 @@ bool AtrMemoryImage::ReadImageFromFile(const char* filename, bool beQuiet)
 		if (!beQuiet) {
 			DPRINTF("unsupported image type!");
 		}
+		if (fileio->IsOpen()) {
+			fileio->Close();
+		}
 		return false;
 	}
+	if (fileio->IsOpen()) {
+		fileio->Close();
+	}
+	if (ret && !InternImageData()) {
+		FreeImageData();
+		ret = false;
+	}
+	if (ret) {
+		ClearDirtySectors();
+		if (imageType == eAtrImageType || imageType == eXfdImageType) {
+			SetSyncedFile(filename);
+		}
+	}
 	return ret;
 }
 
@@ -255,12 +542,21 @@ bool AtrMemoryImage::WriteImageToFile(const char* filename) const
 	case eXfdGzImageType:
 	case eDcmGzImageType:
 	case eDiGzImageType:
+	case eAtzImageType:
 		AERROR("cannot write compressed file - zlib support disabled at compiletime!");
 		return false;
 	default: break;
 	}
 #endif
 
+	if ((imageType == eAtrImageType || imageType == eXfdImageType) && IsSyncedFile(filename)) {
+		if (WriteDirtySectorsToSyncedFile(imageType == eXfdImageType)) {
+			SetChanged(false);
+			return true;
+		}
+		DPRINTF("incremental write-back failed, writing whole image");
+	}
+
 	switch (imageType) {
 	case eAtrImageType:
 	case eAtrGzImageType:
@@ -278,6 +574,11 @@ bool AtrMemoryImage::WriteImageToFile(const char* filename) const
 	case eDiGzImageType:
 		ret = WriteImageToDiFile(filename, imageType==eDiGzImageType);
 		break;
+#ifdef USE_ZLIB
+	case eAtzImageType:
+		ret = WriteImageToAtzFile(filename);
+		break;
+#endif
 	case eUnknownImageType:
 		DPRINTF("unknown image type!");
 		return false;
@@ -285,31 +586,19 @@ bool AtrMemoryImage::WriteImageToFile(const char* filename) const
 		DPRINTF("unsupported image type!");
 		return false;
 	}
+	if (ret && (imageType == eAtrImageType || imageType == eXfdImageType)) {
+		SetSyncedFile(filename);
+	}
 	return ret;
 }
 
-bool AtrMemoryImage::ReadImageFromAtrFile(const char* filename, bool beQuiet)
+bool AtrMemoryImage::ReadImageFromAtrFile(const RCPtr<FileIO>& fileio, bool beQuiet)
 {
 	uint8_t hdr[16];
 	size_t imgSize, s;
 
-	RCPtr<FileIO> fileio;
-
-#ifdef USE_ZLIB
-	fileio = new GZFileIO();
-#else
-	fileio = new StdFileIO();
-#endif
-
 	FreeImageData();
 
-	if (!fileio->OpenRead(filename)) {
-		if (!beQuiet) {
-			AERROR("cannot open \"%s\" for reading",filename);
-		}
-		return false;
-	}
-
 	if ( fileio->ReadBlock(hdr, 16) != 16 ) {
 		if (!beQuiet) {
 			AERROR("cannot read ATR-header");
@@ -348,13 +637,11 @@ bool AtrMemoryImage::ReadImageFromAtrFile(const char* filename, bool beQuiet)
 
 	SetChanged(false);
 
-	fileio->Close();
 	return true;
 
 failure:
 	SetChanged(false);
 	FreeImageData();
-	fileio->Close();
 	return false;
 }
 
@@ -365,8 +652,8 @@ bool AtrMemoryImage::WriteImageToAtrFile(const char* filename, bool useGz) const
 
 	RCPtr<FileIO> fileio;
 
-	if (! fData) {
-		DPRINTF("no fData");
+	if (!HasImageData()) {
+		DPRINTF("no image data");
 		return false;
 	}
 
@@ -399,7 +686,7 @@ bool AtrMemoryImage::WriteImageToAtrFile(const char* filename, bool useGz) const
 		AERROR("cannot write ATR header");
 		goto failure;
 	}
-	if (fileio->WriteBlock(fData,imgSize) != imgSize) {
+	if (!WriteImageData(fileio, imgSize)) {
 		AERROR("cannot write ATR image");
 		goto failure;
 	}
@@ -413,29 +700,14 @@ failure:
 	return false;
 }
 
-bool AtrMemoryImage::ReadImageFromXfdFile(const char* filename, bool beQuiet)
+bool AtrMemoryImage::ReadImageFromXfdFile(const RCPtr<FileIO>& fileio, bool beQuiet)
 {
 	size_t imgSize, s;
 	uint32_t numSecs;
 	ESectorLength seclen;
 
-	RCPtr<FileIO> fileio;
-
-#ifdef USE_ZLIB
-	fileio = new GZFileIO();
-#else
-	fileio = new StdFileIO();
-#endif
-
 	FreeImageData();
 
-	if (!fileio->OpenRead(filename)) {
-		if (!beQuiet) {
-			AERROR("cannot open \"%s\" for reading",filename);
-		}
-		return false;
-	}
-
 	imgSize = fileio->GetFileLength();
 
 	if ( (imgSize & 0x7f) || imgSize < 384 ) {
@@ -478,13 +750,11 @@ bool AtrMemoryImage::ReadImageFromXfdFile(const char* filename, bool beQuiet)
 
 	SetChanged(false);
 
-	fileio->Close();
 	return true;
 
 failure:
 	SetChanged(false);
 	FreeImageData();
-	fileio->Close();
 	return false;
 }
 
@@ -493,8 +763,8 @@ bool AtrMemoryImage::WriteImageToXfdFile(const char* filename, bool useGz) const
 	size_t imgSize;
 	RCPtr<FileIO> fileio;
 
-	if (! fData) {
-		DPRINTF("no fData");
+	if (!HasImageData()) {
+		DPRINTF("no image data");
 		return false;
 	}
 
@@ -518,7 +788,7 @@ bool AtrMemoryImage::WriteImageToXfdFile(const char* filename, bool useGz) const
 		AERROR("cannot open \"%s\" for writing",filename);
 		return false;
 	}
-	if (fileio->WriteBlock(fData,imgSize) != imgSize) {
+	if (!WriteImageData(fileio, imgSize)) {
 		AERROR("cannot write XFD image");
 		goto failure;
 	}
@@ -532,23 +802,17 @@ failure:
 	return false;
 }
 
-bool AtrMemoryImage::ReadImageFromDcmFile(const char* filename, bool beQuiet)
+bool AtrMemoryImage::ReadImageFromDcmFile(const RCPtr<FileIO>& fileio, bool beQuiet)
 {
 	DCMCodec* dcmcodec;
-	RCPtr<FileIO> fileio;
 
-#ifdef USE_ZLIB
-	fileio = new GZFileIO();
-#else
-	fileio = new StdFileIO();
-#endif
-       	dcmcodec = new DCMCodec(fileio, this);
+	dcmcodec = new DCMCodec(fileio, this);
 
 	FreeImageData();
 
 	bool ret;
 
-	if ((ret=dcmcodec->Load(filename, beQuiet))) {
+	if ((ret=dcmcodec->Decode(beQuiet))) {
 		SetChanged(false);
 	}
 
@@ -583,7 +847,7 @@ bool AtrMemoryImage::WriteImageToDcmFile(const char* filename, bool useGz) const
 	return ret;
 }
 
-uint8_t AtrMemoryImage::CalculateDiSectorChecksum(uint8_t* buf, unsigned int len) const
+uint8_t AtrMemoryImage::CalculateDiSectorChecksum(const uint8_t* buf, unsigned int len)
 {
 	uint16_t chksum = 0;
 	unsigned int i;
@@ -596,7 +860,7 @@ uint8_t AtrMemoryImage::CalculateDiSectorChecksum(uint8_t* buf, unsigned int len
 	return chksum;
 }
 
-bool AtrMemoryImage::ReadImageFromDiFile(const char* filename, bool beQuiet)
+bool AtrMemoryImage::ReadImageFromDiFile(const RCPtr<FileIO>& fileio, bool beQuiet)
 {
 	uint8_t buf[256];
 	uint8_t* map;
@@ -610,23 +874,8 @@ bool AtrMemoryImage::ReadImageFromDiFile(const char* filename, bool beQuiet)
 
 	unsigned int sector;
 
-	RCPtr<FileIO> fileio;
-
-#ifdef USE_ZLIB
-	fileio = new GZFileIO();
-#else
-	fileio = new StdFileIO();
-#endif
-
 	FreeImageData();
 
-	if (!fileio->OpenRead(filename)) {
-		if (!beQuiet) {
-			AERROR("cannot open \"%s\" for reading",filename);
-		}
-		return false;
-	}
-
 	{
 		// check header
 		if (fileio->ReadBlock(buf,2) != 2) {
@@ -759,7 +1008,6 @@ bool AtrMemoryImage::ReadImageFromDiFile(const char* filename, bool beQuiet)
 
 	SetChanged(false);
 
-	fileio->Close();
 	return true;
 
 failure_eof:
@@ -770,7 +1018,6 @@ failure_eof:
 failure:
 	SetChanged(false);
 	FreeImageData();
-	fileio->Close();
 	return false;
 }
 
@@ -787,8 +1034,8 @@ bool AtrMemoryImage::WriteImageToDiFile(const char* filename, bool useGz) const
 
 	RCPtr<FileIO> fileio;
 
-	if (! fData) {
-		DPRINTF("no fData");
+	if (!HasImageData()) {
+		DPRINTF("no image data");
 		return false;
 	}
 
@@ -883,6 +1130,85 @@ failure:
 	return false;
 }
 
+#ifdef USE_ZLIB
+bool AtrMemoryImage::ReadImageFromAtzFile(const char* filename, bool beQuiet)
+{
+	RCPtr<AtzFile> atz;
+	unsigned int chunk, spc, numSectors, first, count;
+	ssize_t offset;
+	size_t imgSize, len;
+
+	FreeImageData();
+
+	atz = AtzFile::Open(filename, beQuiet);
+	if (atz.IsNull()) {
+		return false;
+	}
+
+	if (!SetFormatFromATRHeader(atz->GetATRHeader())) {
+		if (!beQuiet) {
+			AERROR("illegal ATR header");
+		}
+		goto failure;
+	}
+
+	if ((imgSize = GetImageSize()) == 0) {
+		if (!beQuiet) {
+			DPRINTF("GetImageSize = 0");
+		}
+		goto failure;
+	}
+	fData = new uint8_t[imgSize];
+	memset(fData, 0, imgSize);
+
+	spc = atz->GetSectorsPerChunk();
+	numSectors = GetNumberOfSectors();
+	for (chunk = 0; chunk < atz->GetNumberOfChunks(); chunk++) {
+		first = chunk * spc + 1;
+		if (first > numSectors) {
+			break;
+		}
+		count = spc;
+		if (count > numSectors - first + 1) {
+			count = numSectors - first + 1;
+		}
+		offset = CalculateRangeOffset(first, count, len);
+		if (offset < 0 || !atz->ReadChunk(chunk, fData + offset, len)) {
+			if (!beQuiet) {
+				AERROR("reading sectors %d-%d from ATZ file failed", first, first + count - 1);
+			}
+			goto failure;
+		}
+	}
+	if (chunk * spc < numSectors && !beQuiet) {
+		AWARN("truncated ATZ file: only got %d of %d sectors", chunk * spc, numSectors);
+	}
+
+	SetChanged(false);
+	return true;
+
+failure:
+	FreeImageData();
+	SetChanged(false);
+	return false;
+}
+
+bool AtrMemoryImage::WriteImageToAtzFile(const char* filename) const
+{
+	uint8_t hdr[16];
+
+	if (!CreateATRHeaderFromFormat(hdr)) {
+		DPRINTF("creating ATR header failed");
+		return false;
+	}
+	if (!AtzFile::Write(filename, this, hdr)) {
+		return false;
+	}
+	SetChanged(false);
+	return true;
+}
+#endif
+
 bool AtrMemoryImage::ReadSector(unsigned int sector,uint8_t* buffer,unsigned int buffer_length) const
 {
 	bool ret=true;
@@ -910,11 +1236,33 @@ bool AtrMemoryImage::ReadSector(unsigned int sector,uint8_t* buffer,unsigned int
 		ret = false;
 	}
 
-	memcpy(buffer, fData+offset, len);
+	if (fSectors) {
+		memcpy(buffer, fSectors[sector-1], len);
+	} else {
+		memcpy(buffer, fData+offset, len);
+	}
 
 	return ret;
 }
 
+const uint8_t* AtrMemoryImage::GetSectorPtr(unsigned int sector, unsigned int& length) const
+{
+	ssize_t offset;
+
+	if ((offset=CalculateOffset(sector)) < 0 ) {
+		DPRINTF("illegal sector in GetSectorPtr: %d", sector);
+		length = 0;
+		return 0;
+	}
+
+	length = GetSectorLength(sector);
+
+	if (fSectors) {
+		return fSectors[sector-1];
+	}
+	return fData + offset;
+}
+
 bool AtrMemoryImage::WriteSector(unsigned int sector, const uint8_t* buffer, unsigned int buffer_length)
 {
 	unsigned int len;
@@ -937,9 +1285,76 @@ bool AtrMemoryImage::WriteSector(unsigned int sector, const uint8_t* buffer, uns
 		return false;
 	}
 
+	if (fSectors) {
+		const uint8_t* data = fSectorStore->Intern(buffer, len);
+		if (!data) {
+			DPRINTF("interning sector %d failed", sector);
+			return false;
+		}
+		fSectorStore->Release(fSectors[sector-1]);
+		fSectors[sector-1] = data;
+	} else {
+		memcpy(fData+offset, buffer, len);
+	}
 	SetChanged(true);
+	SetSectorDirty(sector);
+
+	return true;
+}
+
+bool AtrMemoryImage::ReadSectors(unsigned int first, unsigned int count, uint8_t* buffer, size_t buffer_length) const
+{
+	ssize_t offset;
+	size_t len;
+
+	if (fSectors) {
+		return super::ReadSectors(first, count, buffer, buffer_length);
+	}
+
+	if ((offset=CalculateRangeOffset(first, count, len)) < 0 ) {
+		DPRINTF("illegal sector range in ReadSectors: %d-%d", first, first + count - 1);
+		return false;
+	}
+	if (buffer_length < len) {
+		DPRINTF("buffer too small in ReadSectors [ %d < %d ]", (int)buffer_length, (int)len);
+		return false;
+	}
+
+	memcpy(buffer, fData+offset, len);
+
+	return true;
+}
+
+bool AtrMemoryImage::WriteSectors(unsigned int first, unsigned int count, const uint8_t* buffer, size_t buffer_length)
+{
+	ssize_t offset;
+	size_t len;
+
+	if (fSectors) {
+		return super::WriteSectors(first, count, buffer, buffer_length);
+	}
+
+	if (IsWriteProtected()) {
+		DPRINTF("attempting to write sectors to write protected image");
+		return false;
+	}
+
+	if ((offset=CalculateRangeOffset(first, count, len)) < 0 ) {
+		DPRINTF("illegal sector range in WriteSectors: %d-%d", first, first + count - 1);
+		return false;
+	}
+	if (buffer_length < len) {
+		DPRINTF("buffer too small in WriteSectors [ %d < %d ]", (int)buffer_length, (int)len);
+		return false;
+	}
+
 	memcpy(fData+offset, buffer, len);
 
+	SetChanged(true);
+	for (unsigned int sector = first; sector < first + count; sector++) {
+		SetSectorDirty(sector);
+	}
+
 	return true;
 }
 
@@ -956,6 +1371,31 @@ void AtrMemoryImage::SetWriteProtect(bool on)
 	super::SetWriteProtect(on);
 }
 
+AtrMemoryImage::EImageType AtrMemoryImage::DetermineImageTypeFromFile(const RCPtr<FileIO>& fileio, const char* filename) const
+{
+	bool compressed;
+
+	switch (ImageFormat::ProbeFile(fileio, filename, compressed)) {
+	case ImageFormat::eAtrFormat:
+		return compressed ? eAtrGzImageType : eAtrImageType;
+	case ImageFormat::eXfdFormat:
+		return compressed ? eXfdGzImageType : eXfdImageType;
+	case ImageFormat::eDcmFormat:
+		return compressed ? eDcmGzImageType : eDcmImageType;
+	case ImageFormat::eDiFormat:
+		return compressed ? eDiGzImageType : eDiImageType;
+	case ImageFormat::eAtzFormat:
+		if (!compressed) {
+			return eAtzImageType;
+		}
+		break;
+	default:
+		break;
+	}
+	// other files are put into a new image
+	return eUnknownImageType;
+}
+
 AtrMemoryImage::EImageType AtrMemoryImage::DetermineImageTypeFromFilename(const char* filename) const
 {
 	size_t len = strlen(filename);
@@ -979,6 +1419,9 @@ AtrMemoryImage::EImageType AtrMemoryImage::DetermineImageTypeFromFilename(const
 	if (strcasecmp(filename+len-4,".dcm") == 0) {
 		return eDcmImageType;
 	}
+	if (strcasecmp(filename+len-4,".atz") == 0) {
+		return eAtzImageType;
+	}
 
 	if (len < 6) {
 		return eUnknownImageType;
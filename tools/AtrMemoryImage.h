@@ -21,7 +21,12 @@
    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
 */
 
+#include <time.h>
+#include <sys/types.h>
+
 #include "AtrImage.h"
+#include "SectorStore.h"
+#include "FileIO.h"
 
 class AtrMemoryImage : public AtrImage {
 public:
@@ -48,9 +53,38 @@ public:
 		       const uint8_t* buffer,
 		       unsigned int buffer_length);
 
+	bool ReadSectors(unsigned int first, unsigned int count,
+		       uint8_t* buffer,
+		       size_t buffer_length) const;
+
+	bool WriteSectors(unsigned int first, unsigned int count,
+		       const uint8_t* buffer,
+		       size_t buffer_length);
+
+	const uint8_t* GetSectorPtr(unsigned int sector,
+		       unsigned int& length) const;
+
 	virtual bool IsAtrMemoryImage() const;
 	virtual void SetWriteProtect(bool on);
 
+	// keep sector data in a (shared) sector store instead of a
+	// private buffer, identical sectors are only stored once.
+	// Existing image data is moved into/out of the store.
+	bool SetSectorStore(const RCPtr<SectorStore>& store);
+	inline RCPtr<SectorStore> GetSectorStore() const;
+
+	// move the image data into store without taking a reference
+	// to it, RCPtr isn't thread safe. Used by the image loader
+	// thread, SetSectorStore(store) must be called in the main
+	// thread before the image is used and store must be kept
+	// alive until then.
+	bool PrepareSectorStore(SectorStore* store);
+
+	virtual void SyncedFileWasUpdated(time_t oldMTime, time_t newMTime) const;
+
+	// checksum of a sector in the DI sector map, 0 for empty sectors
+	static uint8_t CalculateDiSectorChecksum(const uint8_t* buf, unsigned int len);
+
 	friend class DCMCodec;
 
 protected:
@@ -66,31 +100,77 @@ private:
 		eDcmGzImageType = 5,
 		eDiImageType = 6,
 		eDiGzImageType = 7,
+		eAtzImageType = 8,
 		eUnknownImageType=99
 	};
 
 	EImageType DetermineImageTypeFromFilename(const char* filename) const;
+	// probe the header of the opened file
+	EImageType DetermineImageTypeFromFile(const RCPtr<FileIO>& fileio, const char* filename) const;
 
-	bool ReadImageFromAtrFile(const char* filename, bool beQuiet);
+	bool ReadImageFromAtrFile(const RCPtr<FileIO>& fileio, bool beQuiet);
 	bool WriteImageToAtrFile(const char* filename, const bool useGz) const;
 
-	bool ReadImageFromXfdFile(const char* filename, bool beQuiet);
+	bool ReadImageFromXfdFile(const RCPtr<FileIO>& fileio, bool beQuiet);
 	bool WriteImageToXfdFile(const char* filename, const bool useGz) const;
 
-	bool ReadImageFromDcmFile(const char* filename, bool beQuiet);
+	bool ReadImageFromDcmFile(const RCPtr<FileIO>& fileio, bool beQuiet);
 	bool WriteImageToDcmFile(const char* filename, const bool useGz) const;
 
-	bool ReadImageFromDiFile(const char* filename, bool beQuiet);
+	bool ReadImageFromDiFile(const RCPtr<FileIO>& fileio, bool beQuiet);
 	bool WriteImageToDiFile(const char* filename, const bool useGz) const;
 
-	uint8_t CalculateDiSectorChecksum(uint8_t* buf, unsigned int len) const;
+	bool ReadImageFromAtzFile(const char* filename, bool beQuiet);
+	bool WriteImageToAtzFile(const char* filename) const;
 
 	bool SetSectorInUse(unsigned int sector, bool inUse);
 
+	// remember the uncompressed ATR/XFD file which matches the
+	// current image data plus dirty sectors, so write-back to
+	// it only needs to write the dirty sectors.
+	void SetSyncedFile(const char* filename) const;
+	bool IsSyncedFile(const char* filename) const;
+	bool WriteDirtySectorsToSyncedFile(bool isXfd) const;
+
+	// move image data between fData and fSectors
+	bool InternImageData();
+	bool InternImageData(SectorStore* store);
+	bool FlattenImageData();
+	void ReleaseSectors();
+
+	inline bool HasImageData() const;
+
+	// returns fData or a temporary copy of the interned sectors,
+	// the latter must be freed with UnlockImageData
+	const uint8_t* LockImageData() const;
+	void UnlockImageData(const uint8_t* data) const;
+
+	bool WriteImageData(const RCPtr<FileIO>& fileio, size_t imgSize) const;
+
 	typedef AtrImage super;
 
 	uint8_t *fData;
 
+	// sector data in store, indexed by sector-1, fData is 0 then
+	const uint8_t** fSectors;
+	RCPtr<SectorStore> fSectorStore;
+	// store used by PrepareSectorStore, fSectorStore is NULL then
+	SectorStore* fPreparedStore;
+
+	mutable char* fSyncedFilename;
+	mutable off_t fSyncedFileSize;
+	mutable time_t fSyncedFileMTime;
+
 };
 
+inline RCPtr<SectorStore> AtrMemoryImage::GetSectorStore() const
+{
+	return fSectorStore;
+}
+
+inline bool AtrMemoryImage::HasImageData() const
+{
+	return fData || fSectors;
+}
+
 #endif
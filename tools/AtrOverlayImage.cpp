@@ -0,0 +1,250 @@
+/*
+   AtrOverlayImage.cpp - copy-on-write overlay on top of a read-only
+   base image
+
+   Copyright (C) 2026 Matthias Reichl <hias@horus.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "AtrOverlayImage.h"
+#include "AtrMemoryImage.h"
+#include "SIOTracer.h"
+#include "AtariDebug.h"
+
+AtrOverlayImage::AtrOverlayImage(const RCPtr<const AtrImage>& base)
+	: fBaseImage(base),
+	  fHideBaseImage(false)
+{
+	SetFormatFromBaseImage();
+	if (fBaseImage) {
+		SetWriteProtect(fBaseImage->IsWriteProtected());
+		if (fBaseImage->GetFilename()) {
+			SetFilename(fBaseImage->GetFilename());
+		}
+	}
+}
+
+AtrOverlayImage::~AtrOverlayImage()
+{
+	FreeDelta();
+}
+
+void AtrOverlayImage::FreeDelta()
+{
+	DeltaMap::iterator iter;
+	for (iter = fDelta.begin(); iter != fDelta.end(); iter++) {
+		delete[] iter->second;
+	}
+	fDelta.clear();
+}
+
+bool AtrOverlayImage::SetFormatFromBaseImage()
+{
+	if (fBaseImage.IsNull()) {
+		return SetFormat(eNoDisk);
+	}
+	const AtrImageConfig& config = fBaseImage->GetImageConfig();
+	return SetFormat(config.fSectorLength, config.fSectorsPerTrack,
+		config.fTracksPerSide, config.fSides);
+}
+
+void AtrOverlayImage::DiscardChanges()
+{
+	FreeDelta();
+	fHideBaseImage = false;
+	SetFormatFromBaseImage();
+	SetChanged(false);
+}
+
+bool AtrOverlayImage::CreateImage(EDiskFormat format)
+{
+	FreeDelta();
+	fHideBaseImage = true;
+	SetChanged(true);
+	return SetFormat(format);
+}
+
+bool AtrOverlayImage::CreateImage(ESectorLength density, unsigned int sectors)
+{
+	FreeDelta();
+	fHideBaseImage = true;
+	SetChanged(true);
+	return SetFormat(density, sectors);
+}
+
+bool AtrOverlayImage::CreateImage(ESectorLength density, unsigned int sectorsPerTrack, unsigned int tracks, unsigned int sides)
+{
+	FreeDelta();
+	fHideBaseImage = true;
+	SetChanged(true);
+	return SetFormat(density, sectorsPerTrack, tracks, sides);
+}
+
+bool AtrOverlayImage::ReadImageFromFile(const char* filename, bool beQuiet)
+{
+	if (!beQuiet) {
+		DPRINTF("cannot read \"%s\" into overlay image", filename);
+	}
+	return false;
+}
+
+bool AtrOverlayImage::WriteImageToFile(const char* filename) const
+{
+	char absPath[PATH_MAX];
+	RCPtr<AtrMemoryImage> img = new AtrMemoryImage;
+	uint8_t buf[8192];
+	unsigned int sector;
+	unsigned int numSectors = GetNumberOfSectors();
+	unsigned int len;
+
+	if (fBaseImage && fBaseImage->GetFilename() &&
+	    realpath(filename, absPath) &&
+	    strcmp(absPath, fBaseImage->GetFilename()) == 0) {
+		AERROR("cannot overwrite base image \"%s\" of overlay", absPath);
+		return false;
+	}
+
+	if (!img->CreateImage(GetSectorLength(), GetSectorsPerTrack(), GetTracksPerSide(), GetSides())) {
+		DPRINTF("creating temporary memory image failed");
+		return false;
+	}
+	if (img->GetNumberOfSectors() != numSectors) {
+		DPRINTF("temporary memory image has wrong number of sectors");
+		return false;
+	}
+
+	for (sector = 1; sector <= numSectors; sector++) {
+		len = GetSectorLength(sector);
+		if (!ReadSector(sector, buf, len) || !img->WriteSector(sector, buf, len)) {
+			DPRINTF("copying sector %d to temporary memory image failed", sector);
+			return false;
+		}
+	}
+	img->SetWriteProtect(IsWriteProtected());
+
+	if (!img->WriteImageToFile(filename)) {
+		return false;
+	}
+	SetChanged(false);
+	return true;
+}
+
+bool AtrOverlayImage::ReadSector(unsigned int sector, uint8_t* buffer, unsigned int buffer_length) const
+{
+	bool ret=true;
+	unsigned int len;
+
+	if (sector == 0 || sector > GetNumberOfSectors()) {
+		DPRINTF("illegal sector in ReadSector: %d", sector);
+		return false;
+	}
+
+	len=GetSectorLength(sector);
+
+	if (!buffer_length) {
+		DPRINTF("buffer length = 0");
+		return false;
+	}
+
+	if (buffer_length < len) {
+		DPRINTF("buffer length < sector length [ %d < %d ]",buffer_length, len);
+		ret = false;
+		len = buffer_length;
+	} else if (buffer_length > len) {
+		DPRINTF("buffer length > sector length [ %d > %d ]",buffer_length, len);
+		ret = false;
+	}
+
+	DeltaMap::const_iterator iter = fDelta.find(sector);
+	if (iter != fDelta.end()) {
+		memcpy(buffer, iter->second, len);
+		return ret;
+	}
+
+	if (fHideBaseImage || fBaseImage.IsNull()) {
+		memset(buffer, 0, len);
+		return ret;
+	}
+
+	if (!fBaseImage->ReadSector(sector, buffer, len)) {
+		return false;
+	}
+	return ret;
+}
+
+const uint8_t* AtrOverlayImage::GetSectorPtr(unsigned int sector, unsigned int& length) const
+{
+	length = 0;
+
+	if (sector == 0 || sector > GetNumberOfSectors()) {
+		DPRINTF("illegal sector in GetSectorPtr: %d", sector);
+		return 0;
+	}
+
+	DeltaMap::const_iterator iter = fDelta.find(sector);
+	if (iter != fDelta.end()) {
+		length = GetSectorLength(sector);
+		return iter->second;
+	}
+
+	if (fHideBaseImage || fBaseImage.IsNull()) {
+		return 0;
+	}
+
+	return fBaseImage->GetSectorPtr(sector, length);
+}
+
+bool AtrOverlayImage::WriteSector(unsigned int sector, const uint8_t* buffer, unsigned int buffer_length)
+{
+	unsigned int len;
+
+	if (IsWriteProtected()) {
+		DPRINTF("attempting to write sector to write protected image");
+		return false;
+	}
+
+	if (sector == 0 || sector > GetNumberOfSectors()) {
+		DPRINTF("illegal sector in WriteSector: %d", sector);
+		return false;
+	}
+
+	len=GetSectorLength(sector);
+
+	if (buffer_length != len) {
+		DPRINTF("buffer length = len [ %d != %d ]", buffer_length, len);
+		return false;
+	}
+
+	uint8_t*& data = fDelta[sector];
+	if (!data) {
+		data = new uint8_t[len];
+	}
+	memcpy(data, buffer, len);
+
+	SetChanged(true);
+	SetSectorDirty(sector);
+
+	return true;
+}
+
+bool AtrOverlayImage::IsAtrOverlayImage() const
+{
+	return true;
+}
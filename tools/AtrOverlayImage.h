@@ -0,0 +1,98 @@
+#ifndef ATROVERLAYIMAGE_H
+#define ATROVERLAYIMAGE_H
+
+/*
+   AtrOverlayImage.h - copy-on-write overlay on top of a read-only
+   base image
+
+   Copyright (C) 2026 Matthias Reichl <hias@horus.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include <map>
+
+#include "AtrImage.h"
+
+/*
+ * Sectors written by the Atari are kept in a sparse delta, all other
+ * sectors are read from the base image. The base image is never
+ * modified and can be shared by several overlays (drives).
+ *
+ * Writing the overlay into a file writes base plus delta, writing
+ * it into the file of the base image is refused.
+ */
+
+class AtrOverlayImage : public AtrImage {
+public:
+
+	AtrOverlayImage(const RCPtr<const AtrImage>& base);
+
+	virtual ~AtrOverlayImage();
+
+	// formatting hides the base image, until the changes are discarded
+	virtual bool CreateImage(EDiskFormat format);
+	virtual bool CreateImage(ESectorLength density, unsigned int sectors);
+	virtual bool CreateImage(ESectorLength density, unsigned int sectorsPerTrack, unsigned int tracks, unsigned int sides);
+
+	// not supported, the overlay is created from an existing base image
+	virtual bool ReadImageFromFile(const char* filename, bool beQuiet = false);
+	virtual bool WriteImageToFile(const char* filename) const;
+
+	virtual bool ReadSector(unsigned int sector,
+		       uint8_t* buffer,
+		       unsigned int buffer_length) const;
+
+	virtual bool WriteSector(unsigned int sector,
+		       const uint8_t* buffer,
+		       unsigned int buffer_length);
+
+	virtual const uint8_t* GetSectorPtr(unsigned int sector,
+		       unsigned int& length) const;
+
+	virtual bool IsAtrOverlayImage() const;
+
+	// throw away the delta and return to the contents of the base image
+	void DiscardChanges();
+
+	inline RCPtr<const AtrImage> GetBaseImage() const;
+	inline unsigned int GetNumberOfChangedSectors() const;
+
+private:
+	typedef AtrImage super;
+
+	void FreeDelta();
+	bool SetFormatFromBaseImage();
+
+	RCPtr<const AtrImage> fBaseImage;
+
+	// base image is hidden after the overlay has been formatted
+	bool fHideBaseImage;
+
+	typedef std::map<unsigned int, uint8_t*> DeltaMap;
+	DeltaMap fDelta;
+};
+
+inline RCPtr<const AtrImage> AtrOverlayImage::GetBaseImage() const
+{
+	return fBaseImage;
+}
+
+inline unsigned int AtrOverlayImage::GetNumberOfChangedSectors() const
+{
+	return fDelta.size();
+}
+
+#endif
@@ -124,15 +124,11 @@ int AtrSIOHandler::ProcessCommandFrame(SIO_command_frame& frame, const RCPtr<SIO
 				break;
 			}
 			reset_baudrate = true;
-			ret = wrapper->SendCommandACKXF551();
-		} else {
-			ret = wrapper->SendCommandACK();
-		}
-
-		if (ret) {
-			fTracer->TraceCommandError(ret);
-			LOG_SIO_CMD_ACK_FAILED();
-			break;
+			if ((ret = wrapper->SendCommandACKXF551())) {
+				fTracer->TraceCommandError(ret);
+				LOG_SIO_CMD_ACK_FAILED();
+				break;
+			}
 		}
 
 		size_t buflen = 4;
@@ -166,24 +162,35 @@ int AtrSIOHandler::ProcessCommandFrame(SIO_command_frame& frame, const RCPtr<SIO
 			fBuffer[0] |= 0x08;
 		}
 
+		if (!hi_cmd) {
+			// ACK, complete and status are sent in one go,
+			// trace afterwards to keep the response fast
+			struct iovec iov;
+			iov.iov_base = fBuffer;
+			iov.iov_len = buflen;
+			if ((ret = wrapper->SendResponse(true, 0, &iov, 1))) {
+				fTracer->TraceCommandError(ret);
+				LOG_SIO_RESPONSE_FAILED();
+				break;
+			}
+		}
+
 		fTracer->TraceCommandOK();
 		fTracer->TraceGetStatus(myDriveNo, hi_cmd);
 		fTracer->TraceDataBlock(fBuffer, buflen, description);
 
-		if ((ret=wrapper->SendComplete())) {
-			LOG_SIO_COMPLETE_FAILED();
-			break;
-		}
-
 		if (hi_cmd) {
+			if ((ret=wrapper->SendComplete())) {
+				LOG_SIO_COMPLETE_FAILED();
+				break;
+			}
+
 			ret = wrapper->SendDataFrameXF551(fBuffer, 4);
 			reset_baudrate = false;
-		} else {
-			ret = wrapper->SendDataFrame(fBuffer, 4);
-		}
-		if (ret) {
-			LOG_SIO_SEND_DATA_FAILED();
-			break;
+			if (ret) {
+				LOG_SIO_SEND_DATA_FAILED();
+				break;
+			}
 		}
 
 		break;
@@ -216,6 +223,52 @@ int AtrSIOHandler::ProcessCommandFrame(SIO_command_frame& frame, const RCPtr<SIO
 			break;
 		}
 
+		size_t buflen = fImageConfig.GetSectorLength(sec);
+
+		const char* description = 0;
+		switch (frame.command) {
+		case 0x52: description = "[ read sector ]"; break;
+		case 0xd2: description = "[ read sector XF551 ]"; break;
+		}
+
+		// send directly from memory and mapped images, XF551
+		// frames still need a copy in fBuffer
+		const uint8_t* data = 0;
+		if (!hi_cmd) {
+			unsigned int len;
+			data = fImage->GetSectorPtr(sec, len);
+			if (len != buflen) {
+				data = 0;
+			}
+		}
+
+		if (data) {
+			// the sector is resident: ACK, complete and the
+			// data frame are sent in one go, trace afterwards
+			struct iovec iov;
+			uint8_t checksum;
+			iov.iov_base = (void*) data;
+			iov.iov_len = buflen;
+			if (fImage->GetSectorChecksum(sec, checksum)) {
+				ret = wrapper->SendResponse(true, 0, &iov, 1, checksum);
+			} else {
+				ret = wrapper->SendResponse(true, 0, &iov, 1);
+			}
+			if (ret) {
+				fTracer->TraceCommandError(ret);
+				LOG_SIO_RESPONSE_FAILED();
+				break;
+			}
+			fLastFDCStatus = 0xff;
+
+			fTracer->TraceCommandOK();
+			fTracer->TraceReadSector(myDriveNo, sec, hi_cmd);
+			fTracer->TraceDataBlock(data, buflen, description);
+			break;
+		}
+
+		// reading may have to decompress data, which must not
+		// delay the ACK
 		if (hi_cmd) {
 			reset_baudrate = true;
 			ret = wrapper->SendCommandACKXF551();
@@ -228,21 +281,16 @@ int AtrSIOHandler::ProcessCommandFrame(SIO_command_frame& frame, const RCPtr<SIO
 			break;
 		}
 
-		size_t buflen = fImageConfig.GetSectorLength(sec);
-
-		const char* description = 0;
-		switch (frame.command) {
-		case 0x52: description = "[ read sector ]"; break;
-		case 0xd2: description = "[ read sector XF551 ]"; break;
-		}
+		bool readOK = fImage->ReadSector(sec, fBuffer, buflen);
+		data = fBuffer;
 
-		if (!fImage->ReadSector(sec, fBuffer, buflen)) {
+		if (!readOK) {
 			fLastFDCStatus = 0xef; // record not found;
 			ret = AbstractSIOHandler::eImageError;
 
 			fTracer->TraceCommandError(ret);
 			fTracer->TraceReadSector(myDriveNo, sec, hi_cmd);
-			fTracer->TraceDataBlock(fBuffer, buflen, description);
+			fTracer->TraceDataBlock(data, buflen, description);
 
 			if (wrapper->SendError()) {
 				LOG_SIO_ERROR_FAILED();
@@ -253,7 +301,7 @@ int AtrSIOHandler::ProcessCommandFrame(SIO_command_frame& frame, const RCPtr<SIO
 
 			fTracer->TraceCommandOK();
 			fTracer->TraceReadSector(myDriveNo, sec, hi_cmd);
-			fTracer->TraceDataBlock(fBuffer, buflen, description);
+			fTracer->TraceDataBlock(data, buflen, description);
 
 			if ((ret=wrapper->SendComplete())) {
 				LOG_SIO_COMPLETE_FAILED();
@@ -265,7 +313,15 @@ int AtrSIOHandler::ProcessCommandFrame(SIO_command_frame& frame, const RCPtr<SIO
 			ret2 = wrapper->SendDataFrameXF551(fBuffer, buflen);
 			reset_baudrate = false;
 		} else {
-			ret2 = wrapper->SendDataFrame(fBuffer, buflen);
+			struct iovec iov;
+			uint8_t checksum;
+			iov.iov_base = (void*) data;
+			iov.iov_len = buflen;
+			if (readOK && fImage->GetSectorChecksum(sec, checksum)) {
+				ret2 = wrapper->SendDataFrame(&iov, 1, checksum);
+			} else {
+				ret2 = wrapper->SendDataFrame(&iov, 1);
+			}
 		}
 		if (ret2) {
 			LOG_SIO_SEND_DATA_FAILED();
@@ -374,6 +430,10 @@ int AtrSIOHandler::ProcessCommandFrame(SIO_command_frame& frame, const RCPtr<SIO
 			} else {
 				fLastFDCStatus = 0xff;
 
+				if (fSectorJournal && !fSectorJournal->AppendSector(sec, fBuffer, buflen)) {
+					AWARN("D%d: cannot append sector %d to journal", myDriveNo, sec);
+				}
+
 				if ((lastChanged == false) && fImage->Changed()) {
 					fTracer->IndicateDriveChanged(myDriveNo);
 				}
@@ -634,6 +694,7 @@ int AtrSIOHandler::ProcessCommandFrame(SIO_command_frame& frame, const RCPtr<SIO
 			fLastFDCStatus = 0xff;
 			fImageConfig = fImage->GetImageConfig();
 			fFormatConfig = fImageConfig;
+			UpdateJournalAfterFormat();
 
 			if ((lastChanged == false) && fImage->Changed()) {
 				fTracer->IndicateDriveChanged(myDriveNo);
@@ -715,6 +776,7 @@ int AtrSIOHandler::ProcessCommandFrame(SIO_command_frame& frame, const RCPtr<SIO
 				fLastFDCStatus = 0xff;
 				fImageConfig = fImage->GetImageConfig();
 				fFormatConfig = fImageConfig;
+				UpdateJournalAfterFormat();
 				memset(fBuffer,255,buflen);
 
 				if ((lastChanged == false) && fImage->Changed()) {
@@ -803,6 +865,7 @@ int AtrSIOHandler::ProcessCommandFrame(SIO_command_frame& frame, const RCPtr<SIO
 				fLastFDCStatus = 0xff;
 				fImageConfig = fImage->GetImageConfig();
 				fFormatConfig = fImageConfig;
+				UpdateJournalAfterFormat();
 				memset(fBuffer,255,128);
 
 				if ((lastChanged == false) && fImage->Changed()) {
@@ -1297,6 +1360,23 @@ bool AtrSIOHandler::EnableStrictFormatChecking(bool on)
 	return true;
 }
 
+void AtrSIOHandler::UpdateJournalAfterFormat()
+{
+	if (fSectorJournal.IsNull()) {
+		return;
+	}
+	if (fSectorJournal->GetImageConfig() == fImageConfig) {
+		if (fSectorJournal->AppendClearImage()) {
+			return;
+		}
+	} else {
+		AWARN("image layout of \"%s\" changed - autosave disabled",
+			fSectorJournal->GetImageFilename());
+	}
+	// changes from now on must be written back manually
+	fSectorJournal = 0;
+}
+
 bool AtrSIOHandler::VerifyPercomFormat(uint8_t tracks, uint8_t sides, uint16_t sectors, uint16_t seclen, uint32_t total_sectors) const
 {
 	if (total_sectors == 0 || total_sectors >= 65536) {
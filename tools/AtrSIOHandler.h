@@ -27,6 +27,7 @@
 #include "AtrImage.h"
 #include "SIOTracer.h"
 #include "VirtualImageObserver.h"
+#include "SectorJournal.h"
 
 class AtrSIOHandler : public AbstractSIOHandler {
 public:
@@ -54,6 +55,10 @@ public:
 	inline void SetVirtualImageObserver(RCPtr<VirtualImageObserver> observer);
 	inline RCPtr<const VirtualImageObserver> GetVirtualImageObserver() const;
 
+	// all sector writes are appended to the journal (autosave)
+	inline void SetSectorJournal(const RCPtr<SectorJournal>& journal);
+	inline RCPtr<SectorJournal> GetSectorJournal();
+
 private:
 	RCPtr<AtrImage> fImage;
 
@@ -78,8 +83,13 @@ private:
 
 	RCPtr<VirtualImageObserver> fVirtualImageObserver;
 
+	RCPtr<SectorJournal> fSectorJournal;
+
 	inline bool IsVirtualImage() const;
 
+	// called after the image has been formatted
+	void UpdateJournalAfterFormat();
+
 	bool VerifyPercomFormat(uint8_t tracks, uint8_t sides, uint16_t sectors, uint16_t seclen, uint32_t total_sectors) const;
 
 	// static temporary (sector-) buffer, for all instances
@@ -117,6 +127,16 @@ inline RCPtr<const VirtualImageObserver> AtrSIOHandler::GetVirtualImageObserver(
 	return fVirtualImageObserver;
 }
 
+inline void AtrSIOHandler::SetSectorJournal(const RCPtr<SectorJournal>& journal)
+{
+	fSectorJournal = journal;
+}
+
+inline RCPtr<SectorJournal> AtrSIOHandler::GetSectorJournal()
+{
+	return fSectorJournal;
+}
+
 inline bool AtrSIOHandler::IsVirtualImage() const
 {
 	return fVirtualImageObserver.IsNotNull();
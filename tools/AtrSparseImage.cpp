@@ -0,0 +1,557 @@
+/*
+   AtrSparseImage.cpp - RAM image which doesn't store empty pages
+
+   Copyright (C) 2026 Matthias Reichl <hias@horus.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "AtrSparseImage.h"
+#include "AtrMemoryImage.h"
+#include "AtzFile.h"
+#include "SIOTracer.h"
+#include "AtariDebug.h"
+
+// returned for sectors in empty pages, big enough for the largest sector
+static const uint8_t zeroSector[8192] = { 0 };
+
+static bool HasSuffix(const char* filename, const char* suffix)
+{
+	size_t len = strlen(filename);
+	size_t slen = strlen(suffix);
+
+	return len >= slen && strcasecmp(filename + len - slen, suffix) == 0;
+}
+
+AtrSparseImage::AtrSparseImage()
+	: fSectorsPerPage(1),
+	  fNumberOfPages(0),
+	  fResidentSize(0)
+{
+}
+
+AtrSparseImage::~AtrSparseImage()
+{
+	FreeImageData();
+}
+
+bool AtrSparseImage::IsAtrSparseImage() const
+{
+	return true;
+}
+
+void AtrSparseImage::FreeImageData()
+{
+	for (unsigned int t = 0; t < fPageTable.size(); t++) {
+		if (fPageTable[t]) {
+			for (unsigned int i = 0; i < eTableSize; i++) {
+				delete[] fPageTable[t][i];
+			}
+			delete[] fPageTable[t];
+		}
+	}
+	fPageTable.clear();
+	fNumberOfPages = 0;
+	fResidentSize = 0;
+	SetFormat(eNoDisk);
+}
+
+bool AtrSparseImage::InitPages()
+{
+	unsigned int numSectors = GetNumberOfSectors();
+
+	if (numSectors == 0) {
+		DPRINTF("no sectors");
+		return false;
+	}
+
+	fSectorsPerPage = ePageSize / GetSectorLength();
+	if (fSectorsPerPage == 0) {
+		fSectorsPerPage = 1;
+	}
+	fNumberOfPages = (numSectors + fSectorsPerPage - 1) / fSectorsPerPage;
+	fPageTable.assign((fNumberOfPages + eTableSize - 1) >> eTableBits, (uint8_t**) 0);
+	return true;
+}
+
+bool AtrSparseImage::CreateImage(EDiskFormat format)
+{
+	FreeImageData();
+	SetChanged(true);
+	if (!SetFormat(format)) {
+		DPRINTF("SetFormat failed");
+		return false;
+	}
+	return InitPages();
+}
+
+bool AtrSparseImage::CreateImage(ESectorLength density, unsigned int sectors)
+{
+	FreeImageData();
+	SetChanged(true);
+	if (!SetFormat(density, sectors)) {
+		DPRINTF("SetFormat failed");
+		return false;
+	}
+	return InitPages();
+}
+
+bool AtrSparseImage::CreateImage(ESectorLength density, unsigned int sectorsPerTrack, unsigned int tracks, unsigned int sides)
+{
+	FreeImageData();
+	SetChanged(true);
+	if (!SetFormat(density, sectorsPerTrack, tracks, sides)) {
+		DPRINTF("SetFormat failed");
+		return false;
+	}
+	return InitPages();
+}
+
+void AtrSparseImage::GetPageRange(unsigned int page, size_t& offset, size_t& length) const
+{
+	unsigned int first = page * fSectorsPerPage + 1;
+	unsigned int last = first + fSectorsPerPage - 1;
+
+	if (last > GetNumberOfSectors()) {
+		last = GetNumberOfSectors();
+	}
+	offset = CalculateOffset(first);
+	length = CalculateOffset(last) + GetSectorLength(last) - offset;
+}
+
+uint8_t* AtrSparseImage::AllocPage(unsigned int page)
+{
+	uint8_t**& table = fPageTable[page >> eTableBits];
+	size_t offset, length;
+
+	if (!table) {
+		table = new uint8_t*[eTableSize];
+		memset(table, 0, eTableSize * sizeof(uint8_t*));
+	}
+	uint8_t*& data = table[page & (eTableSize - 1)];
+	if (!data) {
+		GetPageRange(page, offset, length);
+		data = new uint8_t[length];
+		memset(data, 0, length);
+		fResidentSize += length;
+	}
+	return data;
+}
+
+void AtrSparseImage::FreePage(unsigned int page)
+{
+	uint8_t** table = fPageTable[page >> eTableBits];
+	size_t offset, length;
+
+	if (!table || !table[page & (eTableSize - 1)]) {
+		return;
+	}
+	GetPageRange(page, offset, length);
+	delete[] table[page & (eTableSize - 1)];
+	table[page & (eTableSize - 1)] = 0;
+	fResidentSize -= length;
+}
+
+bool AtrSparseImage::IsZero(const uint8_t* data, size_t len)
+{
+	return data[0] == 0 && memcmp(data, data + 1, len - 1) == 0;
+}
+
+bool AtrSparseImage::ReadSector(unsigned int sector, uint8_t* buffer, unsigned int buffer_length) const
+{
+	const uint8_t* data;
+	unsigned int len;
+
+	if ((data = GetSectorPtr(sector, len)) == 0) {
+		DPRINTF("illegal sector in ReadSector: %d", sector);
+		return false;
+	}
+
+	if (!buffer_length) {
+		DPRINTF("buffer length = 0");
+		return false;
+	}
+
+	if (buffer_length != len) {
+		DPRINTF("buffer length != sector length [ %d != %d ]",buffer_length, len);
+		memcpy(buffer, data, buffer_length < len ? buffer_length : len);
+		return false;
+	}
+
+	memcpy(buffer, data, len);
+	return true;
+}
+
+bool AtrSparseImage::ReadSectors(unsigned int first, unsigned int count, uint8_t* buffer, size_t buffer_length) const
+{
+	ssize_t offset;
+	size_t len, pos;
+	unsigned int sector, page, last;
+	size_t pageOffset, pageLength, start, end;
+	const uint8_t* data;
+
+	if ((offset=CalculateRangeOffset(first, count, len)) < 0 ) {
+		DPRINTF("illegal sector range in ReadSectors: %d-%d", first, first + count - 1);
+		return false;
+	}
+	if (buffer_length < len) {
+		DPRINTF("buffer too small in ReadSectors [ %d < %d ]", (int)buffer_length, (int)len);
+		return false;
+	}
+
+	// copy the parts of each page in the range
+	pos = 0;
+	last = first + count - 1;
+	for (sector = first; sector <= last; sector = (page + 1) * fSectorsPerPage + 1) {
+		page = GetPage(sector);
+		GetPageRange(page, pageOffset, pageLength);
+		start = offset + pos - pageOffset;
+		end = pageLength;
+		if (offset + len < pageOffset + pageLength) {
+			end = offset + len - pageOffset;
+		}
+		if ((data = GetPageData(page))) {
+			memcpy(buffer + pos, data + start, end - start);
+		} else {
+			memset(buffer + pos, 0, end - start);
+		}
+		pos += end - start;
+	}
+	return true;
+}
+
+bool AtrSparseImage::WriteSector(unsigned int sector, const uint8_t* buffer, unsigned int buffer_length)
+{
+	unsigned int len, page;
+	size_t pageOffset, pageLength;
+	uint8_t* data;
+
+	if (IsWriteProtected()) {
+		DPRINTF("attempting to write sector to write protected image");
+		return false;
+	}
+
+	if (CalculateOffset(sector) < 0) {
+		DPRINTF("illegal sector in WriteSector: %d", sector);
+		return false;
+	}
+
+	len = GetSectorLength(sector);
+
+	if (buffer_length != len) {
+		DPRINTF("buffer length = len [ %d != %d ]", buffer_length, len);
+		return false;
+	}
+
+	page = GetPage(sector);
+	GetPageRange(page, pageOffset, pageLength);
+
+	if ((data = GetPageData(page))) {
+		memcpy(data + CalculateOffset(sector) - pageOffset, buffer, len);
+		// release pages which were cleared (eg by formatting)
+		if (IsZero(data, pageLength)) {
+			FreePage(page);
+		}
+	} else if (!IsZero(buffer, len)) {
+		data = AllocPage(page);
+		memcpy(data + CalculateOffset(sector) - pageOffset, buffer, len);
+	}
+
+	SetChanged(true);
+	SetSectorDirty(sector);
+	return true;
+}
+
+const uint8_t* AtrSparseImage::GetSectorPtr(unsigned int sector, unsigned int& length) const
+{
+	ssize_t offset;
+	size_t pageOffset, pageLength;
+	unsigned int page;
+	const uint8_t* data;
+
+	if ((offset = CalculateOffset(sector)) < 0) {
+		DPRINTF("illegal sector in GetSectorPtr: %d", sector);
+		length = 0;
+		return 0;
+	}
+
+	length = GetSectorLength(sector);
+
+	page = GetPage(sector);
+	if ((data = GetPageData(page)) == 0) {
+		return zeroSector;
+	}
+	GetPageRange(page, pageOffset, pageLength);
+	return data + offset - pageOffset;
+}
+
+bool AtrSparseImage::ReadImageData(const RCPtr<FileIO>& fileio, bool beQuiet)
+{
+	std::vector<uint8_t> buf;
+	size_t offset, length, s;
+	unsigned int page;
+
+	for (page = 0; page < fNumberOfPages; page++) {
+		GetPageRange(page, offset, length);
+		if (buf.size() < length) {
+			buf.resize(length);
+		}
+		memset(&buf[0], 0, length);
+		s = fileio->ReadBlock(&buf[0], length);
+		if (!IsZero(&buf[0], length)) {
+			memcpy(AllocPage(page), &buf[0], length);
+		}
+		if (s != length) {
+			if (!beQuiet) {
+				AWARN("truncated ATR file: only got %d of %d bytes", (int)(offset + s), (int)GetImageSize());
+			}
+			break;
+		}
+	}
+	return true;
+}
+
+bool AtrSparseImage::WriteImageData(const RCPtr<FileIO>& fileio, off_t dataOffset) const
+{
+	size_t offset, length;
+	off_t pos = dataOffset;
+	off_t end = dataOffset + GetImageSize();
+	unsigned int page;
+	const uint8_t* data;
+
+	for (page = 0; page < fNumberOfPages; page++) {
+		if ((data = GetPageData(page)) == 0) {
+			continue;
+		}
+		GetPageRange(page, offset, length);
+		// skipping empty pages leaves holes in uncompressed files,
+		// gzip files get the zeros filled in by gzseek
+		if (pos != dataOffset + (off_t) offset && !fileio->Seek(dataOffset + offset)) {
+			return false;
+		}
+		if (fileio->WriteBlock(data, length) != length) {
+			return false;
+		}
+		pos = dataOffset + offset + length;
+	}
+
+	// extend the file to its full size
+	if (pos < end) {
+		if (!fileio->Seek(end - 1) || !fileio->WriteByte(0)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool AtrSparseImage::ReadImageFromAtrFile(const char* filename, bool beQuiet)
+{
+	uint8_t hdr[16];
+
+	RCPtr<FileIO> fileio;
+
+#ifdef USE_ZLIB
+	fileio = new GZFileIO();
+#else
+	fileio = new StdFileIO();
+#endif
+
+	if (!fileio->OpenRead(filename)) {
+		if (!beQuiet) {
+			AERROR("cannot open \"%s\" for reading",filename);
+		}
+		return false;
+	}
+
+	if (fileio->ReadBlock(hdr, 16) != 16) {
+		if (!beQuiet) {
+			AERROR("cannot read ATR-header");
+		}
+		goto failure;
+	}
+
+	if (!SetFormatFromATRHeader(hdr) || !InitPages()) {
+		if (!beQuiet) {
+			AERROR("illegal ATR header");
+		}
+		goto failure;
+	}
+
+	if (!ReadImageData(fileio, beQuiet)) {
+		goto failure;
+	}
+
+	fileio->Close();
+	return true;
+
+failure:
+	fileio->Close();
+	return false;
+}
+
+bool AtrSparseImage::WriteImageToAtrFile(const char* filename, bool isXfd, bool useGz) const
+{
+	uint8_t hdr[16];
+	off_t dataOffset = 0;
+
+	RCPtr<FileIO> fileio;
+
+	if (useGz) {
+#ifdef USE_ZLIB
+		fileio = new GZFileIO();
+#else
+		AERROR("cannot write compressed file - zlib support disabled at compiletime!");
+		return false;
+#endif
+	} else {
+		fileio = new StdFileIO();
+	}
+
+	if (!fileio->OpenWrite(filename)) {
+		AERROR("cannot open \"%s\" for writing",filename);
+		return false;
+	}
+	if (!isXfd) {
+		if (!CreateATRHeaderFromFormat(hdr)) {
+			DPRINTF("CreateATRHeaderFromFormat failed");
+			goto failure;
+		}
+		if (fileio->WriteBlock(hdr,16) != 16) {
+			AERROR("cannot write ATR header");
+			goto failure;
+		}
+		dataOffset = 16;
+	}
+	if (!WriteImageData(fileio, dataOffset)) {
+		AERROR("cannot write %s image", isXfd ? "XFD" : "ATR");
+		goto failure;
+	}
+	if (!fileio->Close()) {
+		AERROR("error closing \"%s\"", filename);
+		fileio->Unlink(filename);
+		return false;
+	}
+	return true;
+
+failure:
+	fileio->Close();
+	fileio->Unlink(filename);
+	return false;
+}
+
+bool AtrSparseImage::ReadImageFromOtherFile(const char* filename, bool beQuiet)
+{
+	RCPtr<AtrMemoryImage> img = new AtrMemoryImage;
+	unsigned int sector, len;
+	const uint8_t* data;
+
+	if (!img->ReadImageFromFile(filename, beQuiet)) {
+		return false;
+	}
+	if (!SetFormat(img->GetSectorLength(), img->GetSectorsPerTrack(), img->GetTracksPerSide(), img->GetSides())
+	    || GetNumberOfSectors() != img->GetNumberOfSectors()
+	    || !InitPages()) {
+		if (!beQuiet) {
+			DPRINTF("setting image format failed!");
+		}
+		return false;
+	}
+	for (sector = 1; sector <= GetNumberOfSectors(); sector++) {
+		if ((data = img->GetSectorPtr(sector, len)) == 0 || !WriteSector(sector, data, len)) {
+			if (!beQuiet) {
+				DPRINTF("copying sector %d from temporary memory image failed", sector);
+			}
+			return false;
+		}
+	}
+	SetWriteProtect(img->IsWriteProtected());
+	return true;
+}
+
+bool AtrSparseImage::WriteImageToOtherFile(const char* filename) const
+{
+	RCPtr<AtrMemoryImage> img = new AtrMemoryImage;
+	unsigned int sector, len;
+	const uint8_t* data;
+
+	if (!img->CreateImage(GetSectorLength(), GetSectorsPerTrack(), GetTracksPerSide(), GetSides())
+	    || img->GetNumberOfSectors() != GetNumberOfSectors()) {
+		DPRINTF("creating temporary memory image failed");
+		return false;
+	}
+	for (sector = 1; sector <= GetNumberOfSectors(); sector++) {
+		if ((data = GetSectorPtr(sector, len)) == 0 || !img->WriteSector(sector, data, len)) {
+			DPRINTF("copying sector %d to temporary memory image failed", sector);
+			return false;
+		}
+	}
+	img->SetWriteProtect(IsWriteProtected());
+	return img->WriteImageToFile(filename);
+}
+
+bool AtrSparseImage::ReadImageFromFile(const char* filename, bool beQuiet)
+{
+	bool ret;
+
+	FreeImageData();
+
+	if (HasSuffix(filename, ".atr") || HasSuffix(filename, ".atr.gz")) {
+		ret = ReadImageFromAtrFile(filename, beQuiet);
+	} else {
+		ret = ReadImageFromOtherFile(filename, beQuiet);
+	}
+	if (!ret) {
+		FreeImageData();
+	}
+	SetChanged(false);
+	return ret;
+}
+
+bool AtrSparseImage::WriteImageToFile(const char* filename) const
+{
+	bool ret;
+
+	if (fNumberOfPages == 0) {
+		DPRINTF("no image data");
+		return false;
+	}
+
+	if (HasSuffix(filename, ".atr")) {
+		ret = WriteImageToAtrFile(filename, false, false);
+	} else if (HasSuffix(filename, ".xfd")) {
+		ret = WriteImageToAtrFile(filename, true, false);
+	} else if (HasSuffix(filename, ".atr.gz")) {
+		ret = WriteImageToAtrFile(filename, false, true);
+	} else if (HasSuffix(filename, ".xfd.gz")) {
+		ret = WriteImageToAtrFile(filename, true, true);
+#ifdef USE_ZLIB
+	} else if (AtzFile::IsAtzFile(filename)) {
+		// AtzFile reads the sectors chunk by chunk
+		uint8_t hdr[16];
+		ret = CreateATRHeaderFromFormat(hdr) && AtzFile::Write(filename, this, hdr);
+#endif
+	} else {
+		ret = WriteImageToOtherFile(filename);
+	}
+	if (ret) {
+		SetChanged(false);
+	}
+	return ret;
+}
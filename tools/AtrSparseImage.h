@@ -0,0 +1,141 @@
+#ifndef ATRSPARSEIMAGE_H
+#define ATRSPARSEIMAGE_H
+
+/*
+   AtrSparseImage.h - RAM image which doesn't store empty pages
+
+   Copyright (C) 2026 Matthias Reichl <hias@horus.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include <vector>
+
+#include "AtrImage.h"
+#include "FileIO.h"
+
+/*
+ * The sector data is split into pages of consecutive sectors (about
+ * 4k each) which are looked up via a two level page table. Pages
+ * that only contain zeros are not allocated, so big harddisk images
+ * only take up memory for the used sectors.
+ *
+ * ATR files are read and ATR, XFD and ATZ files written directly,
+ * empty pages are skipped when writing uncompressed files so they
+ * become holes in a sparse file. Other formats are converted via
+ * a temporary AtrMemoryImage.
+ */
+
+class AtrSparseImage : public AtrImage {
+public:
+
+	AtrSparseImage();
+
+	virtual ~AtrSparseImage();
+
+	virtual bool CreateImage(EDiskFormat format);
+	virtual bool CreateImage(ESectorLength density, unsigned int sectors);
+	virtual bool CreateImage(ESectorLength density, unsigned int sectorsPerTrack, unsigned int tracks, unsigned int sides);
+
+	virtual bool IsAtrSparseImage() const;
+
+	virtual bool ReadImageFromFile(const char* filename, bool beQuiet = false);
+	virtual bool WriteImageToFile(const char* filename) const;
+
+	virtual bool ReadSector(unsigned int sector,
+		       uint8_t* buffer,
+		       unsigned int buffer_length) const;
+
+	virtual bool WriteSector(unsigned int sector,
+		       const uint8_t* buffer,
+		       unsigned int buffer_length);
+
+	virtual bool ReadSectors(unsigned int first, unsigned int count,
+		       uint8_t* buffer,
+		       size_t buffer_length) const;
+
+	virtual const uint8_t* GetSectorPtr(unsigned int sector,
+		       unsigned int& length) const;
+
+	// bytes of sector data held in memory, GetImageSize
+	// returns the logical size of the image
+	inline size_t GetResidentSize() const;
+
+private:
+	typedef AtrImage super;
+
+	enum {
+		ePageSize = 4096,
+		eTableBits = 8,
+		eTableSize = 1 << eTableBits
+	};
+
+	void FreeImageData();
+
+	// set up the (empty) page table for the current format
+	bool InitPages();
+
+	inline unsigned int GetPage(unsigned int sector) const;
+	inline uint8_t* GetPageData(unsigned int page) const;
+
+	// offset and length of the page in the image data
+	void GetPageRange(unsigned int page, size_t& offset, size_t& length) const;
+
+	// allocate a page (filled with zeros) if it doesn't exist yet
+	uint8_t* AllocPage(unsigned int page);
+	void FreePage(unsigned int page);
+
+	static bool IsZero(const uint8_t* data, size_t len);
+
+	bool ReadImageData(const RCPtr<FileIO>& fileio, bool beQuiet);
+	bool WriteImageData(const RCPtr<FileIO>& fileio, off_t dataOffset) const;
+
+	bool ReadImageFromAtrFile(const char* filename, bool beQuiet);
+	bool WriteImageToAtrFile(const char* filename, bool isXfd, bool useGz) const;
+
+	// convert other formats via AtrMemoryImage
+	bool ReadImageFromOtherFile(const char* filename, bool beQuiet);
+	bool WriteImageToOtherFile(const char* filename) const;
+
+	unsigned int fSectorsPerPage;
+	unsigned int fNumberOfPages;
+
+	// first level table, second level tables are only
+	// allocated when one of their pages is used
+	std::vector<uint8_t**> fPageTable;
+
+	size_t fResidentSize;
+};
+
+inline size_t AtrSparseImage::GetResidentSize() const
+{
+	return fResidentSize;
+}
+
+inline unsigned int AtrSparseImage::GetPage(unsigned int sector) const
+{
+	return (sector - 1) / fSectorsPerPage;
+}
+
+inline uint8_t* AtrSparseImage::GetPageData(unsigned int page) const
+{
+	uint8_t** table = fPageTable[page >> eTableBits];
+	if (!table) {
+		return 0;
+	}
+	return table[page & (eTableSize - 1)];
+}
+
+#endif
@@ -0,0 +1,460 @@
+/*
+   AtzFile.cpp - block compressed ATR container
+
+   Copyright (C) 2026 Matthias Reichl <hias@horus.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#ifdef USE_ZLIB
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "AtzFile.h"
+#include "AtrImage.h"
+#include "SIOTracer.h"
+#include "AtariDebug.h"
+
+static inline uint16_t Get16(const uint8_t* p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t Get32(const uint8_t* p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void Put16(uint8_t* p, uint16_t v)
+{
+	p[0] = v & 0xff;
+	p[1] = v >> 8;
+}
+
+static inline void Put32(uint8_t* p, uint32_t v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+	p[2] = (v >> 16) & 0xff;
+	p[3] = (v >> 24) & 0xff;
+}
+
+static bool ReadAt(int fd, void* buf, size_t len, off_t offset)
+{
+	uint8_t* p = (uint8_t*) buf;
+	ssize_t s;
+
+	while (len) {
+		s = pread(fd, p, len, offset);
+		if (s < 0 && errno == EINTR) {
+			continue;
+		}
+		if (s <= 0) {
+			return false;
+		}
+		p += s;
+		len -= s;
+		offset += s;
+	}
+	return true;
+}
+
+static bool WriteAll(int fd, const void* buf, size_t len, off_t offset)
+{
+	const uint8_t* p = (const uint8_t*) buf;
+	ssize_t s;
+
+	while (len) {
+		s = pwrite(fd, p, len, offset);
+		if (s < 0 && errno == EINTR) {
+			continue;
+		}
+		if (s <= 0) {
+			return false;
+		}
+		p += s;
+		len -= s;
+		offset += s;
+	}
+	return true;
+}
+
+AtzFile::AtzFile()
+	: fFilename(0),
+	  fFd(-1),
+	  fReadOnly(false),
+	  fFileSize(0),
+	  fSectorsPerChunk(0),
+	  fUpdatePending(false)
+{
+	memset(fATRHeader, 0, sizeof(fATRHeader));
+}
+
+AtzFile::~AtzFile()
+{
+	if (fFd >= 0) {
+		close(fFd);
+	}
+	if (fFilename) {
+		free(fFilename);
+	}
+}
+
+bool AtzFile::IsAtzFile(const char* filename)
+{
+	size_t len = strlen(filename);
+	return len >= 4 && strcasecmp(filename + len - 4, ".atz") == 0;
+}
+
+RCPtr<AtzFile> AtzFile::Open(const char* filename, bool beQuiet)
+{
+	RCPtr<AtzFile> atz = new AtzFile;
+	if (!atz->OpenFile(filename, beQuiet)) {
+		return NULL;
+	}
+	return atz;
+}
+
+bool AtzFile::OpenFile(const char* filename, bool beQuiet)
+{
+	char absPath[PATH_MAX];
+	uint8_t hdr[eHeaderSize];
+	struct stat statbuf;
+	uint32_t tableOffset, numChunks;
+	unsigned int i;
+
+	if (realpath(filename, absPath) == 0) {
+		if (!beQuiet) {
+			AERROR("cannot locate \"%s\"", filename);
+		}
+		return false;
+	}
+
+	fFd = open(absPath, O_RDWR);
+	if (fFd < 0) {
+		fFd = open(absPath, O_RDONLY);
+		fReadOnly = true;
+	}
+	if (fFd < 0) {
+		if (!beQuiet) {
+			AERROR("cannot open \"%s\"", absPath);
+		}
+		return false;
+	}
+	fFilename = strdup(absPath);
+
+	if (fstat(fFd, &statbuf)) {
+		if (!beQuiet) {
+			AERROR("cannot stat \"%s\"", absPath);
+		}
+		return false;
+	}
+	fFileSize = statbuf.st_size;
+
+	if (!ReadAt(fFd, hdr, eHeaderSize, 0) || memcmp(hdr, "ATZ1", 4) != 0) {
+		if (!beQuiet) {
+			AERROR("\"%s\" is not an ATZ file", absPath);
+		}
+		return false;
+	}
+
+	fSectorsPerChunk = Get16(hdr + 4);
+	memcpy(fATRHeader, hdr + 8, 16);
+	tableOffset = Get32(hdr + 24);
+	numChunks = Get32(hdr + 28);
+
+	if (fSectorsPerChunk == 0 || numChunks > 65535
+	    || (off_t) tableOffset + 12 * (off_t) numChunks > fFileSize) {
+		if (!beQuiet) {
+			AERROR("illegal ATZ header in \"%s\"", absPath);
+		}
+		return false;
+	}
+
+	if (numChunks) {
+		std::vector<uint8_t> table(12 * numChunks);
+		if (!ReadAt(fFd, &table[0], table.size(), tableOffset)) {
+			if (!beQuiet) {
+				AERROR("cannot read ATZ chunk table of \"%s\"", absPath);
+			}
+			return false;
+		}
+		fTable.resize(numChunks);
+		for (i = 0; i < numChunks; i++) {
+			fTable[i].fOffset = Get32(&table[12 * i]);
+			fTable[i].fCompressedLength = Get32(&table[12 * i + 4]);
+			fTable[i].fLength = Get32(&table[12 * i + 8]);
+			if ((off_t) fTable[i].fOffset + fTable[i].fCompressedLength > fFileSize) {
+				if (!beQuiet) {
+					AERROR("illegal ATZ chunk table in \"%s\"", absPath);
+				}
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+bool AtzFile::ReadChunk(unsigned int chunk, uint8_t* buf, size_t len) const
+{
+	if (chunk >= fTable.size() || len != fTable[chunk].fLength) {
+		DPRINTF("illegal ATZ chunk %d", chunk);
+		return false;
+	}
+
+	const ChunkEntry& entry = fTable[chunk];
+	std::vector<uint8_t> cbuf(entry.fCompressedLength);
+
+	if (entry.fCompressedLength &&
+	    !ReadAt(fFd, &cbuf[0], entry.fCompressedLength, entry.fOffset)) {
+		AERROR("cannot read chunk %d of \"%s\"", chunk, fFilename);
+		return false;
+	}
+
+	uLongf destLen = len;
+	if (uncompress(buf, &destLen, &cbuf[0], entry.fCompressedLength) != Z_OK
+	    || destLen != len) {
+		AERROR("cannot decompress chunk %d of \"%s\"", chunk, fFilename);
+		return false;
+	}
+	return true;
+}
+
+bool AtzFile::CompressChunk(const uint8_t* buf, size_t len, std::vector<uint8_t>& out)
+{
+	uLongf clen = compressBound(len);
+
+	out.resize(clen);
+	if (compress2(&out[0], &clen, buf, len, Z_BEST_COMPRESSION) != Z_OK) {
+		DPRINTF("compressing ATZ chunk failed");
+		return false;
+	}
+	out.resize(clen);
+	return true;
+}
+
+void AtzFile::EncodeTable(const std::vector<ChunkEntry>& table, std::vector<uint8_t>& out)
+{
+	out.resize(12 * table.size());
+	for (unsigned int i = 0; i < table.size(); i++) {
+		Put32(&out[12 * i], table[i].fOffset);
+		Put32(&out[12 * i + 4], table[i].fCompressedLength);
+		Put32(&out[12 * i + 8], table[i].fLength);
+	}
+}
+
+void AtzFile::EncodeHeader(uint8_t* hdr, unsigned int sectorsPerChunk,
+	const uint8_t* atrHeader, uint32_t tableOffset, uint32_t numChunks)
+{
+	memcpy(hdr, "ATZ1", 4);
+	Put16(hdr + 4, sectorsPerChunk);
+	Put16(hdr + 6, 0);
+	memcpy(hdr + 8, atrHeader, 16);
+	Put32(hdr + 24, tableOffset);
+	Put32(hdr + 28, numChunks);
+}
+
+bool AtzFile::GetChunkData(const AtrImage* image, unsigned int chunk,
+	unsigned int sectorsPerChunk, uint8_t* buf, size_t& len)
+{
+	unsigned int numSectors = image->GetNumberOfSectors();
+	unsigned int first = chunk * sectorsPerChunk + 1;
+	unsigned int count = sectorsPerChunk;
+	unsigned int sec;
+
+	if (first > numSectors) {
+		return false;
+	}
+	if (count > numSectors - first + 1) {
+		count = numSectors - first + 1;
+	}
+	len = 0;
+	for (sec = first; sec < first + count; sec++) {
+		len += image->GetSectorLength(sec);
+	}
+	return image->ReadSectors(first, count, buf, len);
+}
+
+bool AtzFile::Write(const char* filename, const AtrImage* image,
+	const uint8_t* atrHeader, unsigned int sectorsPerChunk)
+{
+	char tmpPath[PATH_MAX];
+	uint8_t hdr[eHeaderSize];
+	struct stat statbuf;
+	std::vector<ChunkEntry> table;
+	std::vector<uint8_t> cbuf;
+	uint8_t* buf = 0;
+	size_t len;
+	off_t pos;
+	unsigned int numChunks, chunk;
+	int fd;
+
+	if (sectorsPerChunk == 0 || sectorsPerChunk > 65535) {
+		DPRINTF("illegal number of sectors per chunk: %d", sectorsPerChunk);
+		return false;
+	}
+
+	const char* base = strrchr(filename, '/');
+	base = base ? base + 1 : filename;
+	if (snprintf(tmpPath, PATH_MAX, "%.*s.tmp%d-%s", (int)(base - filename), filename, (int) getpid(), base) >= PATH_MAX) {
+		AERROR("filename \"%s\" too long", filename);
+		return false;
+	}
+
+	fd = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0) {
+		AERROR("cannot create \"%s\"", tmpPath);
+		return false;
+	}
+
+	// the new file replaces the old one, keep its permissions
+	if (stat(filename, &statbuf) == 0 && fchmod(fd, statbuf.st_mode & 07777)) {
+		AERROR("cannot set permissions of \"%s\"", tmpPath);
+		goto failure;
+	}
+
+	numChunks = (image->GetNumberOfSectors() + sectorsPerChunk - 1) / sectorsPerChunk;
+	table.resize(numChunks);
+	buf = new uint8_t[sectorsPerChunk * image->GetSectorLength()];
+	pos = eHeaderSize;
+
+	for (chunk = 0; chunk < numChunks; chunk++) {
+		if (!GetChunkData(image, chunk, sectorsPerChunk, buf, len)) {
+			DPRINTF("reading sectors of chunk %d failed", chunk);
+			goto failure;
+		}
+		if (!CompressChunk(buf, len, cbuf)) {
+			goto failure;
+		}
+		if (!WriteAll(fd, &cbuf[0], cbuf.size(), pos)) {
+			goto failure_write;
+		}
+		table[chunk].fOffset = pos;
+		table[chunk].fCompressedLength = cbuf.size();
+		table[chunk].fLength = len;
+		pos += cbuf.size();
+	}
+
+	EncodeTable(table, cbuf);
+	if (cbuf.size() && !WriteAll(fd, &cbuf[0], cbuf.size(), pos)) {
+		goto failure_write;
+	}
+	EncodeHeader(hdr, sectorsPerChunk, atrHeader, pos, numChunks);
+	if (!WriteAll(fd, hdr, eHeaderSize, 0) || fdatasync(fd)) {
+		goto failure_write;
+	}
+	delete[] buf;
+	buf = 0;
+
+	if (close(fd)) {
+		fd = -1;
+		goto failure_write;
+	}
+	if (rename(tmpPath, filename)) {
+		AERROR("cannot rename \"%s\" to \"%s\"", tmpPath, filename);
+		unlink(tmpPath);
+		return false;
+	}
+	return true;
+
+failure_write:
+	AERROR("error writing \"%s\"", tmpPath);
+failure:
+	delete[] buf;
+	if (fd >= 0) {
+		close(fd);
+	}
+	unlink(tmpPath);
+	return false;
+}
+
+bool AtzFile::WriteAt(const void* buf, size_t len, off_t offset)
+{
+	if (!WriteAll(fFd, buf, len, offset)) {
+		AERROR("error writing \"%s\"", fFilename);
+		return false;
+	}
+	return true;
+}
+
+bool AtzFile::WriteChunk(unsigned int chunk, const uint8_t* buf, size_t len)
+{
+	std::vector<uint8_t> cbuf;
+
+	if (fReadOnly) {
+		DPRINTF("ATZ file \"%s\" is read-only", fFilename);
+		return false;
+	}
+	if (chunk >= fTable.size() || len != fTable[chunk].fLength) {
+		DPRINTF("illegal ATZ chunk %d", chunk);
+		return false;
+	}
+	if (!CompressChunk(buf, len, cbuf)) {
+		return false;
+	}
+
+	// append, the old chunk stays valid until the update is committed
+	if (!WriteAt(&cbuf[0], cbuf.size(), fFileSize)) {
+		return false;
+	}
+	fTable[chunk].fOffset = fFileSize;
+	fTable[chunk].fCompressedLength = cbuf.size();
+	fFileSize += cbuf.size();
+	fUpdatePending = true;
+	return true;
+}
+
+bool AtzFile::CommitUpdate()
+{
+	std::vector<uint8_t> tbuf;
+	uint8_t hdr[eHeaderSize];
+
+	if (!fUpdatePending) {
+		return true;
+	}
+
+	EncodeTable(fTable, tbuf);
+	if (tbuf.size() && !WriteAt(&tbuf[0], tbuf.size(), fFileSize)) {
+		return false;
+	}
+	// the chunks and the new table must be on disk before
+	// the header points to them
+	if (fdatasync(fFd)) {
+		AERROR("error syncing \"%s\"", fFilename);
+		return false;
+	}
+	EncodeHeader(hdr, fSectorsPerChunk, fATRHeader, fFileSize, fTable.size());
+	if (!WriteAt(hdr, eHeaderSize, 0)) {
+		return false;
+	}
+	if (fdatasync(fFd)) {
+		AERROR("error syncing \"%s\"", fFilename);
+		return false;
+	}
+	fFileSize += tbuf.size();
+	fUpdatePending = false;
+	return true;
+}
+
+#endif
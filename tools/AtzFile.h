@@ -0,0 +1,179 @@
+#ifndef ATZFILE_H
+#define ATZFILE_H
+
+/*
+   AtzFile.h - block compressed ATR container
+
+   Copyright (C) 2026 Matthias Reichl <hias@horus.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <vector>
+
+#include "RefCounted.h"
+#include "RCPtr.h"
+
+class AtrImage;
+
+/*
+ * ATZ file layout, all values are little endian:
+ *
+ * header (32 bytes)
+ *    0  "ATZ1"
+ *    4  uint16  sectors per chunk
+ *    6  uint16  reserved, 0
+ *    8  16 byte ATR header of the image
+ *   24  uint32  offset of the chunk table
+ *   28  uint32  number of chunks
+ *
+ * The header is followed by the chunks. Each chunk is an independent
+ * zlib stream holding the sector data (as in an ATR file) of
+ * "sectors per chunk" sectors, the last chunk may contain fewer
+ * sectors. The chunk table has 12 bytes per chunk: uint32 offset,
+ * uint32 compressed length and uint32 uncompressed length.
+ *
+ * Updated chunks are appended to the end of the file, followed by
+ * a new chunk table. The header is rewritten last, so the file is
+ * still consistent if an update is interrupted.
+ */
+
+class AtzFile : public RefCounted {
+public:
+	enum {
+		eHeaderSize = 32,
+		eDefaultSectorsPerChunk = 32
+	};
+
+	// returns true if filename has an .atz extension
+	static bool IsAtzFile(const char* filename);
+
+	// returns NULL if the file isn't a valid ATZ file
+	static RCPtr<AtzFile> Open(const char* filename, bool beQuiet = false);
+
+	// write the image into a new ATZ file. The data is written to a
+	// temporary file which is then renamed, so it's safe to replace
+	// a file that's still open.
+	static bool Write(const char* filename, const AtrImage* image,
+		const uint8_t* atrHeader,
+		unsigned int sectorsPerChunk = eDefaultSectorsPerChunk);
+
+	virtual ~AtzFile();
+
+	inline const char* GetFilename() const;
+	inline const uint8_t* GetATRHeader() const;
+	inline unsigned int GetSectorsPerChunk() const;
+	inline unsigned int GetNumberOfChunks() const;
+	inline bool IsReadOnly() const;
+
+	// uncompressed length of a chunk
+	inline size_t GetChunkLength(unsigned int chunk) const;
+
+	// len must be the uncompressed length of the chunk
+	bool ReadChunk(unsigned int chunk, uint8_t* buf, size_t len) const;
+
+	// incremental update: the chunk is compressed and appended to
+	// the file, it replaces the old one after CommitUpdate
+	bool WriteChunk(unsigned int chunk, const uint8_t* buf, size_t len);
+	bool CommitUpdate();
+
+	// space taken by replaced chunks and old chunk tables
+	inline off_t GetUnusedBytes() const;
+	inline off_t GetFileSize() const;
+
+	// helper for the writers: uncompressed data of a chunk
+	static bool GetChunkData(const AtrImage* image, unsigned int chunk,
+		unsigned int sectorsPerChunk, uint8_t* buf, size_t& len);
+
+private:
+	AtzFile();
+
+	struct ChunkEntry {
+		uint32_t fOffset;
+		uint32_t fCompressedLength;
+		uint32_t fLength;
+	};
+
+	bool OpenFile(const char* filename, bool beQuiet);
+
+	static bool CompressChunk(const uint8_t* buf, size_t len, std::vector<uint8_t>& out);
+	static void EncodeTable(const std::vector<ChunkEntry>& table, std::vector<uint8_t>& out);
+	static void EncodeHeader(uint8_t* hdr, unsigned int sectorsPerChunk,
+		const uint8_t* atrHeader, uint32_t tableOffset, uint32_t numChunks);
+
+	bool WriteAt(const void* buf, size_t len, off_t offset);
+
+	char* fFilename;
+	int fFd;
+	bool fReadOnly;
+	off_t fFileSize;
+
+	uint8_t fATRHeader[16];
+	unsigned int fSectorsPerChunk;
+
+	std::vector<ChunkEntry> fTable;
+	bool fUpdatePending;
+};
+
+inline const char* AtzFile::GetFilename() const
+{
+	return fFilename;
+}
+
+inline const uint8_t* AtzFile::GetATRHeader() const
+{
+	return fATRHeader;
+}
+
+inline unsigned int AtzFile::GetSectorsPerChunk() const
+{
+	return fSectorsPerChunk;
+}
+
+inline unsigned int AtzFile::GetNumberOfChunks() const
+{
+	return fTable.size();
+}
+
+inline bool AtzFile::IsReadOnly() const
+{
+	return fReadOnly;
+}
+
+inline size_t AtzFile::GetChunkLength(unsigned int chunk) const
+{
+	if (chunk >= fTable.size()) {
+		return 0;
+	}
+	return fTable[chunk].fLength;
+}
+
+inline off_t AtzFile::GetFileSize() const
+{
+	return fFileSize;
+}
+
+inline off_t AtzFile::GetUnusedBytes() const
+{
+	off_t used = eHeaderSize + 12 * fTable.size();
+	for (unsigned int i = 0; i < fTable.size(); i++) {
+		used += fTable[i].fCompressedLength;
+	}
+	return fFileSize - used;
+}
+
+#endif
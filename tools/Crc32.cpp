@@ -18,42 +18,354 @@
    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
 */
 
+#include <string.h>
+
 #include "Crc32.h"
 
-static unsigned long* crc32_table=0;
+#if defined(__GNUC__) && defined(__x86_64__)
+#define CRC32_HAVE_CLMUL
+#include <cpuid.h>
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#endif
 
-static unsigned long* GetCRCTable()
-{
-	if (crc32_table == 0) {
-		crc32_table = new unsigned long[256];
-		unsigned long crc;
-		for (int i=0; i<256; i++) {
+#if defined(__GNUC__) && defined(__aarch64__) && defined(__linux__)
+#define CRC32_HAVE_ARMV8
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#include <arm_acle.h>
+#ifdef __clang__
+#define CRC32_ARMV8_TARGET __attribute__((target("crc")))
+#else
+#define CRC32_ARMV8_TARGET __attribute__((target("+crc")))
+#endif
+#endif
+
+typedef uint32_t (*CRCFunction)(uint32_t crc, const uint8_t* buf, unsigned int len);
+
+namespace {
+
+// the tables are set up once, the first time they are needed.
+// gcc guards initialization of function-local statics, so this
+// is safe even if the first CRC is calculated in a worker thread.
+
+struct CRCTables {
+	uint32_t fTable[8][256];
+
+	CRCTables()
+	{
+		uint32_t crc;
+		for (unsigned int i=0; i<256; i++) {
 			crc = i;
-			for (int j=0; j<8; j++) {
-			if (crc&1) {
-				crc = (crc >> 1) ^ 0xedb88320L;
-			} else {
-				crc >>= 1;
+			for (unsigned int j=0; j<8; j++) {
+				if (crc & 1) {
+					crc = (crc >> 1) ^ 0xedb88320;
+				} else {
+					crc >>= 1;
+				}
+			}
+			fTable[0][i] = crc;
+		}
+		for (unsigned int i=0; i<256; i++) {
+			crc = fTable[0][i];
+			for (unsigned int k=1; k<8; k++) {
+				crc = (crc >> 8) ^ fTable[0][crc & 0xff];
+				fTable[k][i] = crc;
 			}
-								       }
-			crc32_table[i] = crc;
 		}
-
 	}
-	return crc32_table;
+};
+
+} // namespace
+
+static const CRCTables& GetCRCTables()
+{
+	static const CRCTables tables;
+	return tables;
 }
 
-unsigned long CRC32::CalcCRC32(unsigned long oldCRC, void *buf, unsigned int len)
+static uint32_t CalcBytewise(uint32_t crc, const uint8_t* buf, unsigned int len)
 {
-	uint8_t* myBuf = (uint8_t*) buf;
-	unsigned long crc = oldCRC ^ 0xffffffff;
-	unsigned long* crctable = GetCRCTable();
+	const uint32_t* crctable = GetCRCTables().fTable[0];
 
 	for (unsigned int i=0;i<len;i++) {
-		crc = (crc>>8) ^ crctable[(crc^myBuf[i]) & 0xff];
+		crc = (crc>>8) ^ crctable[(crc^buf[i]) & 0xff];
+	}
+	return crc;
+}
+
+static uint32_t CalcSliceBy8(uint32_t crc, const uint8_t* buf, unsigned int len)
+{
+	const CRCTables& tables = GetCRCTables();
+	const uint32_t (*t)[256] = tables.fTable;
+	uint32_t one, two;
+
+	while (len >= 8) {
+		// assembled bytewise to stay endian-neutral, the compiler
+		// turns this into plain loads on little endian machines
+		one = crc ^ (buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((uint32_t)buf[3] << 24));
+		two = buf[4] | (buf[5] << 8) | (buf[6] << 16) | ((uint32_t)buf[7] << 24);
+		crc =	t[7][one & 0xff] ^
+			t[6][(one >> 8) & 0xff] ^
+			t[5][(one >> 16) & 0xff] ^
+			t[4][one >> 24] ^
+			t[3][two & 0xff] ^
+			t[2][(two >> 8) & 0xff] ^
+			t[1][(two >> 16) & 0xff] ^
+			t[0][two >> 24];
+		buf += 8;
+		len -= 8;
+	}
+	while (len--) {
+		crc = (crc >> 8) ^ t[0][(crc ^ *buf++) & 0xff];
+	}
+	return crc;
+}
+
+#ifdef CRC32_HAVE_CLMUL
+
+// folding of 64 byte blocks with carry-less multiplication followed
+// by a Barrett reduction, as described in Intel's "Fast CRC Computation
+// for Generic Polynomials Using PCLMULQDQ Instruction".
+// The constants are the bit-reflected ones for the CRC32 polynomial.
+
+static bool CLMULAvailable()
+{
+	unsigned int eax, ebx, ecx, edx;
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+		return false;
+	}
+	return (ecx & bit_PCLMUL) && (edx & bit_SSE2);
+}
+
+__attribute__((target("pclmul")))
+static uint32_t CalcCLMULBlocks(uint32_t crc, const uint8_t* buf, unsigned int len)
+{
+	// len must be a multiple of 16 and at least 64
+	static const uint64_t __attribute__((aligned(16))) k1k2[] = { 0x0154442bd4ULL, 0x01c6e41596ULL };
+	static const uint64_t __attribute__((aligned(16))) k3k4[] = { 0x01751997d0ULL, 0x00ccaa009eULL };
+	static const uint64_t __attribute__((aligned(16))) k5k0[] = { 0x0163cd6124ULL, 0x0000000000ULL };
+	static const uint64_t __attribute__((aligned(16))) poly[] = { 0x01db710641ULL, 0x01f7011641ULL };
+
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+	x1 = _mm_loadu_si128((const __m128i*)(buf + 0x00));
+	x2 = _mm_loadu_si128((const __m128i*)(buf + 0x10));
+	x3 = _mm_loadu_si128((const __m128i*)(buf + 0x20));
+	x4 = _mm_loadu_si128((const __m128i*)(buf + 0x30));
+
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+
+	x0 = _mm_load_si128((const __m128i*)k1k2);
+
+	buf += 64;
+	len -= 64;
+
+	// fold 4 x 128 bits in parallel
+	while (len >= 64) {
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+		y5 = _mm_loadu_si128((const __m128i*)(buf + 0x00));
+		y6 = _mm_loadu_si128((const __m128i*)(buf + 0x10));
+		y7 = _mm_loadu_si128((const __m128i*)(buf + 0x20));
+		y8 = _mm_loadu_si128((const __m128i*)(buf + 0x30));
+
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+
+		buf += 64;
+		len -= 64;
+	}
+
+	// fold into 128 bits
+	x0 = _mm_load_si128((const __m128i*)k3k4);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	// remaining 16 byte blocks
+	while (len >= 16) {
+		x2 = _mm_loadu_si128((const __m128i*)buf);
+
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+		buf += 16;
+		len -= 16;
+	}
+
+	// fold 128 bits to 64 bits
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_srli_si128(x1, 8);
+	x1 = _mm_xor_si128(x1, x2);
+
+	x0 = _mm_loadl_epi64((const __m128i*)k5k0);
+
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, x3);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	// Barrett reduction to 32 bits
+	x0 = _mm_load_si128((const __m128i*)poly);
+
+	x2 = _mm_and_si128(x1, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	return _mm_cvtsi128_si32(_mm_srli_si128(x1, 4));
+}
+
+static uint32_t CalcCLMUL(uint32_t crc, const uint8_t* buf, unsigned int len)
+{
+	if (len >= 64) {
+		unsigned int blocklen = len & ~15U;
+		crc = CalcCLMULBlocks(crc, buf, blocklen);
+		buf += blocklen;
+		len -= blocklen;
 	}
+	return CalcSliceBy8(crc, buf, len);
+}
+
+#endif // CRC32_HAVE_CLMUL
+
+#ifdef CRC32_HAVE_ARMV8
+
+static bool ARMv8Available()
+{
+	return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+}
 
-	crc ^= 0xffffffff;
+CRC32_ARMV8_TARGET
+static uint32_t CalcARMv8(uint32_t crc, const uint8_t* buf, unsigned int len)
+{
+	uint64_t data;
 
+	while (len && ((uintptr_t)buf & 7)) {
+		crc = __crc32b(crc, *buf++);
+		len--;
+	}
+	while (len >= 32) {
+		memcpy(&data, buf, 8);
+		crc = __crc32d(crc, data);
+		memcpy(&data, buf + 8, 8);
+		crc = __crc32d(crc, data);
+		memcpy(&data, buf + 16, 8);
+		crc = __crc32d(crc, data);
+		memcpy(&data, buf + 24, 8);
+		crc = __crc32d(crc, data);
+		buf += 32;
+		len -= 32;
+	}
+	while (len >= 8) {
+		memcpy(&data, buf, 8);
+		crc = __crc32d(crc, data);
+		buf += 8;
+		len -= 8;
+	}
+	while (len--) {
+		crc = __crc32b(crc, *buf++);
+	}
 	return crc;
 }
+
+#endif // CRC32_HAVE_ARMV8
+
+static CRCFunction GetEngineFunction(CRC32::EEngine engine)
+{
+	switch (engine) {
+	case CRC32::eEngineBytewise:
+		return CalcBytewise;
+	case CRC32::eEngineSliceBy8:
+		return CalcSliceBy8;
+#ifdef CRC32_HAVE_CLMUL
+	case CRC32::eEngineCLMUL:
+		if (CLMULAvailable()) {
+			return CalcCLMUL;
+		}
+		break;
+#endif
+#ifdef CRC32_HAVE_ARMV8
+	case CRC32::eEngineARMv8:
+		if (ARMv8Available()) {
+			return CalcARMv8;
+		}
+		break;
+#endif
+	default:
+		break;
+	}
+	return 0;
+}
+
+static CRC32::EEngine SelectDefaultEngine()
+{
+	if (CRC32::EngineAvailable(CRC32::eEngineCLMUL)) {
+		return CRC32::eEngineCLMUL;
+	}
+	if (CRC32::EngineAvailable(CRC32::eEngineARMv8)) {
+		return CRC32::eEngineARMv8;
+	}
+	return CRC32::eEngineSliceBy8;
+}
+
+bool CRC32::EngineAvailable(EEngine engine)
+{
+	return GetEngineFunction(engine) != 0;
+}
+
+const char* CRC32::GetEngineName(EEngine engine)
+{
+	switch (engine) {
+	case eEngineBytewise: return "bytewise";
+	case eEngineSliceBy8: return "slice-by-8";
+	case eEngineCLMUL: return "clmul";
+	case eEngineARMv8: return "armv8-crc";
+	default: return "unknown";
+	}
+}
+
+CRC32::EEngine CRC32::GetDefaultEngine()
+{
+	static const EEngine engine = SelectDefaultEngine();
+	return engine;
+}
+
+unsigned long CRC32::CalcCRC32WithEngine(EEngine engine, unsigned long oldCRC, const void *buf, unsigned int len)
+{
+	CRCFunction func = GetEngineFunction(engine);
+	if (!func) {
+		return oldCRC;
+	}
+	return func(oldCRC ^ 0xffffffff, (const uint8_t*) buf, len) ^ 0xffffffff;
+}
+
+unsigned long CRC32::CalcCRC32(unsigned long oldCRC, void *buf, unsigned int len)
+{
+	static const CRCFunction func = GetEngineFunction(GetDefaultEngine());
+
+	return func(oldCRC ^ 0xffffffff, (const uint8_t*) buf, len) ^ 0xffffffff;
+}
@@ -26,9 +26,27 @@
 
 namespace CRC32 {
 
+	// calculate the (zlib compatible) CRC32 using the fastest
+	// engine available on this CPU
 	unsigned long CalcCRC32(unsigned long oldCRC, void *buf, unsigned int len);
 
+	// individual engines, mainly for cross-checking and benchmarking
+	enum EEngine {
+		eEngineBytewise,	// plain table lookup, one byte at a time
+		eEngineSliceBy8,	// portable slice-by-8
+		eEngineCLMUL,		// x86-64 carry-less multiply folding
+		eEngineARMv8,		// ARMv8 CRC32 instructions
+		eNumEngines
+	};
+
+	bool EngineAvailable(EEngine engine);
+	const char* GetEngineName(EEngine engine);
+
+	// engine used by CalcCRC32
+	EEngine GetDefaultEngine();
+
+	// returns oldCRC if the engine isn't available
+	unsigned long CalcCRC32WithEngine(EEngine engine, unsigned long oldCRC, const void *buf, unsigned int len);
 }
 
 #endif
-
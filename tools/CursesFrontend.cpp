@@ -38,6 +38,7 @@
 #include "Dos2xUtils.h"
 #include "MiscUtils.h"
 #include "CasHandler.h"
+#include "AtrSparseImage.h"
 
 CursesFrontend::CursesFrontend(RCPtr<DeviceManager>& manager, bool useColor)
 	: fDeviceManager(manager),
@@ -735,6 +736,8 @@ void CursesFrontend::DisplayDriveFilename(DeviceManager::EDriveNumber drive)
 				if (!fDeviceManager->DeviceIsActive(d)) {
 					wattrset(fDriveStatusWindow, fDriveColorInactive);
 				}
+			} else if (fDeviceManager->DriveIsLoading(d)) {
+				filename = "<loading>";
 			} else {
 				filename = "<empty>";
 			}
@@ -1166,6 +1169,10 @@ int CursesFrontend::GetCh(bool ignoreResize)
 		if (ret == 1 && GotSigWinCh() && !ignoreResize ) {
 			ch = KEY_RESIZE;
 			break;
+		} else if (ret == 2) {
+			// a background load has finished
+			DisplayDriveStatus();
+			UpdateScreen();
 		} else if (ret == 0) {
 			ch = wgetch(fInputLineWindow);
 			if (ch == KEY_RESIZE) {
@@ -1854,22 +1861,22 @@ void CursesFrontend::ProcessLoadDrive()
 		switch (densityNum) {
 		case 1:
 			waddstr(fInputLineWindow,"90k");
-			ok = fDeviceManager->CreateVirtualDrive(d, filename, e90kDisk, true);
+			ok = fDeviceManager->CreateVirtualDriveAsync(d, filename, e90kDisk, true);
 			break;
 		case 2:
 			waddstr(fInputLineWindow,"130k");
-			ok = fDeviceManager->CreateVirtualDrive(d, filename, e130kDisk, true);
+			ok = fDeviceManager->CreateVirtualDriveAsync(d, filename, e130kDisk, true);
 			break;
 		case 3:
 			waddstr(fInputLineWindow,"180k");
-			ok = fDeviceManager->CreateVirtualDrive(d, filename, e180kDisk, true);
+			ok = fDeviceManager->CreateVirtualDriveAsync(d, filename, e180kDisk, true);
 			break;
 		case 4:
 			waddstr(fInputLineWindow,"360k");
-			ok = fDeviceManager->CreateVirtualDrive(d, filename, e360kDisk, true);
+			ok = fDeviceManager->CreateVirtualDriveAsync(d, filename, e360kDisk, true);
 			break;
 		default:
-			ok = fDeviceManager->CreateVirtualDrive(d, filename, seclen, numSectors, true);
+			ok = fDeviceManager->CreateVirtualDriveAsync(d, filename, seclen, numSectors, true);
 			break;
 		}
 
@@ -1879,12 +1886,12 @@ void CursesFrontend::ProcessLoadDrive()
 			return;
 		}
 	} else {
-		if (fDeviceManager->LoadDiskImage(d, filename, false, true)) {
-			const char* fn = fDeviceManager->GetImageFilename(d);
-			if (fn == NULL) {
-				DPRINTF("getting filename of newly loaded image failed!");
-			} else {
-				fFilenameHistory.Add(fn);
+		// the image is loaded in the background, the drive
+		// status is updated by GetCh when it's finished
+		if (fDeviceManager->LoadDiskImageAsync(d, filename, true)) {
+			char absPath[PATH_MAX];
+			if (realpath(filename, absPath)) {
+				fFilenameHistory.Add(absPath);
 			}
 		}
 	}
@@ -2012,6 +2019,66 @@ void CursesFrontend::ProcessReloadDrive()
 	UpdateScreen();
 }
 
+void CursesFrontend::ProcessResetOverlayDrive()
+{
+	ShowDriveInputHint(eDriveInputHintStandard);
+	ClearInputLine();
+	waddstr(fInputLineWindow, "reset overlay drive: ");
+	ShowCursor(true);
+	UpdateScreen();
+
+	DeviceManager::EDriveNumber d = InputUsedDriveNumber();
+
+	if (d == DeviceManager::eNoDrive) {
+		AbortInput();
+		return;
+	}
+
+	ShowDriveNumber(d, false);
+
+	if (!fDeviceManager->DriveIsOverlayImage(d)) {
+		AERROR("D%d: is no overlay drive", d);
+	} else if (!fDeviceManager->ResetOverlayDrive(d)) {
+		AERROR("resetting D%d: failed", d);
+	}
+
+	ShowCursor(false);
+	DisplayDriveStatus(d);
+	ShowStandardHint();
+	UpdateScreen();
+}
+
+void CursesFrontend::ProcessShowSectorStoreStatistics()
+{
+	RCPtr<SectorStore> store = DeviceManager::GetSectorStore();
+	bool haveSparseImages = false;
+
+	for (int d = DeviceManager::eMinDriveNumber; d <= DeviceManager::eMaxDriveNumber; d++) {
+		RCPtr<AtrImage> image = fDeviceManager->GetAtrImage(DeviceManager::EDriveNumber(d));
+		if (image.IsNotNull() && image->IsAtrSparseImage()) {
+			ALOG("D%d: %lu of %lu kB in memory", d,
+				(unsigned long) (RCPtrStaticCast<AtrSparseImage>(image)->GetResidentSize() / 1024),
+				(unsigned long) (image->GetImageSize() / 1024));
+			haveSparseImages = true;
+		}
+	}
+
+	if (store.IsNull()) {
+		if (!haveSparseImages) {
+			AERROR("sector store is disabled");
+		}
+		UpdateScreen();
+		return;
+	}
+	ALOG("sector store: %u sectors in use, %u stored, %lu of %lu kB (ratio %.2f)",
+		store->GetNumberOfReferences(),
+		store->GetNumberOfEntries(),
+		(unsigned long) (store->GetStoredBytes() / 1024),
+		(unsigned long) (store->GetReferencedBytes() / 1024),
+		store->GetDedupRatio());
+	UpdateScreen();
+}
+
 bool CursesFrontend::InputCreateDriveDensity(int& densityNum, ESectorLength& seclen, bool enableQD, bool enableAutoSectors)
 {
 	int ch;
@@ -2713,6 +2780,7 @@ static const char* const helpText[] =
 		"d     display DOS 2.x directory of drive",
 		"f     format drive (clear image, write VTOC and directory)",
 		"r     reload virtual drive",
+		"R     reset overlay drive (discard all changes)",
 		"p     write protect drive(s)",
 		"P     write un-protect drive(s)",
 		"a     activate drive(s)",
@@ -2726,6 +2794,7 @@ static const char* const helpText[] =
 		"S     set high speed pokey divisor/baudrate",
 		"T     set strict/relaxed SIO timing",
 		"X     enable/disable XF551 commands",
+		"M     show memory usage of images",
 		"^L    redraw screen",
 		"h     show help screen",
 		"q     quit atariserver",
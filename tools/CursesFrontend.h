@@ -102,6 +102,8 @@ public:
 	void ProcessLoadDrive();
 	void ProcessWriteDrive();
 	void ProcessReloadDrive();
+	void ProcessResetOverlayDrive();
+	void ProcessShowSectorStoreStatistics();
 	void ProcessCreateDrive();
 	void ProcessWriteProtectDrive();
 	void ProcessUnprotectDrive();
@@ -25,30 +25,63 @@
 #include "DCMCodec.h"
 #include <stdio.h>
 #include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sched.h>
 #include "SIOTracer.h"
 #include "AtariDebug.h"
 
 //#define DDPRINTF(x...) DPRINTF(x)
 #define DDPRINTF(x...) do { } while(0)
 
-DCMCodec::DCMCodec(const RCPtr<FileIO>& ioclass, const RCPtr<AtrMemoryImage>& img)
-	: fFileIO(ioclass),
+bool DCMCodec::fMaxCompression = false;
+
+DCMCodec::DCMCodec(const RCPtr<FileIO>& ioclass, AtrMemoryImage* img)
+	: fSectorSize(0),
+	  fDiskFormat(eNoDisk),
+	  fFileIO(ioclass),
 	  fAtrMemoryImage(img)
 {
 }
 
 DCMCodec::~DCMCodec()
 {
+	// BuildIndex leaves the file open
+	if (fFileIO->IsOpen()) {
+		fFileIO->Close();
+	}
+}
+
+void DCMCodec::SetMaxCompression(bool on)
+{
+	fMaxCompression = on;
 }
 
 bool DCMCodec::Load( const char* filename, bool beQuiet)
 {
-	uint8_t	btArcType = 0;		//Block type for first block
-	uint8_t	btBlkType;		//Current block type
+	if (! fFileIO->OpenRead(filename)) {
+		if (!beQuiet) {
+			AERROR("cannot open \"%s\" for reading",filename);
+		}
+		return false;
+	}
 
-	fAlreadyFormatted = false;
-	fLastPassFlag = false;
-	fCurrentSector = 0;
+	bool ret = DecodeFile(beQuiet, NULL);
+
+	fFileIO->Close();
+	return ret;
+}
+
+bool DCMCodec::Decode(bool beQuiet)
+{
+	return DecodeFile(beQuiet, NULL);
+}
+
+bool DCMCodec::BuildIndex( const char* filename, Index& index, EDiskFormat& format, bool beQuiet)
+{
+	index.clear();
 
 	if (! fFileIO->OpenRead(filename)) {
 		if (!beQuiet) {
@@ -57,6 +90,53 @@ bool DCMCodec::Load( const char* filename, bool beQuiet)
 		return false;
 	}
 
+	if (!DecodeFile(beQuiet, &index)) {
+		fFileIO->Close();
+		index.clear();
+		return false;
+	}
+
+	format = fDiskFormat;
+	return true;
+}
+
+bool DCMCodec::DecodeRecord( const IndexEntry& entry, const uint8_t* prevState, uint8_t* state)
+{
+	uint8_t btBlkType;
+
+	if (prevState) {
+		memcpy( fCurrentBuffer, prevState, fSectorSize );
+	} else {
+		memset( fCurrentBuffer, 0, fSectorSize );
+	}
+
+	if ( !fFileIO->Seek(entry.fOffset) || !fFileIO->ReadByte(btBlkType) ) {
+		AERROR("cannot read DCM record of sector %d", entry.fSector);
+		return false;
+	}
+
+	fCurrentSector = entry.fSector;
+
+	if ( !DecodeRec(btBlkType, false) ) {
+		DPRINTF("DCM: Block %02X decode error!", btBlkType );
+		return false;
+	}
+
+	memcpy( state, fCurrentBuffer, fSectorSize );
+	return true;
+}
+
+bool DCMCodec::DecodeFile( bool beQuiet, Index* index )
+{
+	uint8_t	btArcType = 0;		//Block type for first block
+	uint8_t	btBlkType;		//Current block type
+
+	fAlreadyFormatted = false;
+	fLastPassFlag = false;
+	fCurrentSector = 0;
+
+	memset( fCurrentBuffer, 0, sizeof(fCurrentBuffer) );
+
 	fFileLength = fFileIO->GetFileLength();
 
 	for(;;) //outpass
@@ -97,6 +177,8 @@ bool DCMCodec::Load( const char* filename, bool beQuiet)
 
 		for(;;) //inpass
 		{
+			off_t recordOffset = fFileIO->Tell();
+
 			if (!fFileIO->ReadByte(btBlkType)) {
 				goto failure_EOF;
 			}
@@ -113,59 +195,7 @@ bool DCMCodec::Load( const char* filename, bool beQuiet)
 				goto failure_EOF;
 			}
 
-			bool bRes = true;
-
-			switch( btBlkType & 0x7F )
-			{
-				case eDCM_CHANGE_BEGIN:
-					bRes = DecodeRec41(beQuiet);
-					break;
-
-				case eDCM_DOS_SECTOR:
-					bRes = DecodeRec42(beQuiet);
-					break;
-
-				case eDCM_COMPRESSED:
-					bRes = DecodeRec43(beQuiet);
-					break;
-
-				case eDCM_CHANGE_END:
-					bRes = DecodeRec44(beQuiet);
-					break;
-
-				case eDCM_SAME_AS_BEFORE:
-					//not needed
-					//bRes = DecodeRec46(beQuiet);
-					break;
-
-				case eDCM_UNCOMPRESSED:
-					bRes = DecodeRec47(beQuiet);
-					break;
-
-				default:
-				{
-					switch( btBlkType )
-					{
-						case eDCM_HEADER_MULTI:
-						case eDCM_HEADER_SINGLE:
-							if (!beQuiet) {
-								DPRINTF("DCM: Trying to start section but last section never had "
-								"an end section block.");
-							}
-							break;
-
-						default:
-							if (!beQuiet) {
-								DPRINTF("DCM: unknown block type 0x%02x - file may be corrupt.",btBlkType);
-							}
-							break;
-					}
-
-					goto failure;
-				}
-			}
-
-			if ( !bRes )
+			if ( !DecodeRec(btBlkType, beQuiet) )
 			{
 				if (!beQuiet) {
 					DPRINTF("DCM: Block %02X decode error!", btBlkType );
@@ -173,15 +203,39 @@ bool DCMCodec::Load( const char* filename, bool beQuiet)
 				goto failure;
 			}
 
-			unsigned int len = fAtrMemoryImage->GetSectorLength(fCurrentSector);
+			if ( index ) {
+				if ( fCurrentSector < 1 || fCurrentSector > NumberOfSectors(fDiskFormat) ) {
+					if (!beQuiet) {
+						DPRINTF("DCM: illegal sector number %d", fCurrentSector);
+					}
+					goto failure;
+				}
 
-			bRes = fAtrMemoryImage->WriteSector(fCurrentSector, fCurrentBuffer, len);
+				IndexEntry entry;
+				entry.fOffset = recordOffset;
+				entry.fSector = fCurrentSector;
 
-			if (!bRes) {
-				if (!beQuiet) {
-					DPRINTF("DCM: writing sector %d to memory image failed!", fCurrentSector);
+				//uncompressed and RLE records replace the whole
+				//buffer, all others modify the previous sector
+				switch( btBlkType & 0x7F ) {
+				case eDCM_COMPRESSED:
+				case eDCM_UNCOMPRESSED:
+					entry.fPrevRecord = -1;
+					break;
+				default:
+					entry.fPrevRecord = int(index->size()) - 1;
+					break;
+				}
+				index->push_back(entry);
+			} else {
+				unsigned int len = fAtrMemoryImage->GetSectorLength(fCurrentSector);
+
+				if (!fAtrMemoryImage->WriteSector(fCurrentSector, fCurrentBuffer, len)) {
+					if (!beQuiet) {
+						DPRINTF("DCM: writing sector %d to memory image failed!", fCurrentSector);
+					}
+					goto failure;
 				}
-				goto failure;
 			}
 
 			if ( btBlkType & 0x80 ) {
@@ -204,7 +258,6 @@ bool DCMCodec::Load( const char* filename, bool beQuiet)
 
 	} //infinite for (outpass)
 
-	fFileIO->Close();
 	return true;
 
 failure_EOF:
@@ -212,11 +265,55 @@ failure_EOF:
 		AERROR("unexpected EOF in DCM-file");
 	}
 failure:
-	fFileIO->Close();
 	return false;
 
 }
 
+bool DCMCodec::DecodeRec( uint8_t btBlkType, bool beQuiet )
+{
+	switch( btBlkType & 0x7F )
+	{
+		case eDCM_CHANGE_BEGIN:
+			return DecodeRec41(beQuiet);
+
+		case eDCM_DOS_SECTOR:
+			return DecodeRec42(beQuiet);
+
+		case eDCM_COMPRESSED:
+			return DecodeRec43(beQuiet);
+
+		case eDCM_CHANGE_END:
+			return DecodeRec44(beQuiet);
+
+		case eDCM_SAME_AS_BEFORE:
+			//not needed
+			//return DecodeRec46(beQuiet);
+			return true;
+
+		case eDCM_UNCOMPRESSED:
+			return DecodeRec47(beQuiet);
+
+		default:
+			switch( btBlkType )
+			{
+				case eDCM_HEADER_MULTI:
+				case eDCM_HEADER_SINGLE:
+					if (!beQuiet) {
+						DPRINTF("DCM: Trying to start section but last section never had "
+						"an end section block.");
+					}
+					break;
+
+				default:
+					if (!beQuiet) {
+						DPRINTF("DCM: unknown block type 0x%02x - file may be corrupt.",btBlkType);
+					}
+					break;
+			}
+			return false;
+	}
+}
+
 bool DCMCodec::DecodeRec41(bool beQuiet)
 {
 	if (!beQuiet) {
@@ -417,13 +514,19 @@ bool DCMCodec::DecodeRecFA(bool beQuiet)
 
 	if ( !fAlreadyFormatted )
 	{
-		if (!fAtrMemoryImage->CreateImage(dformat)) {
-			if (!beQuiet) {
-				DPRINTF("DCM: cannot format memory image!");
+		fDiskFormat = dformat;
+		fSectorSize = SectorLength(dformat);
+
+		//when indexing there's no image to decode to
+		if ( fAtrMemoryImage ) {
+			if (!fAtrMemoryImage->CreateImage(dformat)) {
+				if (!beQuiet) {
+					DPRINTF("DCM: cannot format memory image!");
+				}
+				return false;
 			}
-			return false;
+			fSectorSize = fAtrMemoryImage->GetSectorLength();
 		}
-		fSectorSize = fAtrMemoryImage->GetSectorLength();
 
 		fAlreadyFormatted = true;
 	}
@@ -458,6 +561,7 @@ bool DCMCodec::ReadOffset( unsigned int& off, bool beQuiet )
 	return true;
 }
 
+
 bool DCMCodec::Save( const char* filename )
 {
 	int iDensity;
@@ -485,19 +589,55 @@ bool DCMCodec::Save( const char* filename )
 
 	int iPass = 1;
 
-	fPassBuffer = new uint8_t [ 0x6500 ];
-
 	unsigned int iFirstSector = 0;
 	unsigned int iPrevSector = 0;
-	fCurrentSector = 1;
+	unsigned int iLastUsedSector = 0;
 	unsigned int iNumSectors = fAtrMemoryImage->GetNumberOfSectors();
+	unsigned int sec;
 
-	memset( fPrevBuffer, 0, fSectorSize );
-	memset( fCurrentBuffer, 0, fSectorSize );
+	SectorRecord firstRecord;
+	const SectorRecord* pRecord;
 
-	EncodeRecFA( false, iPass, iDensity, iFirstSector );
+	// sectors shorter than fSectorSize (DD boot sectors) are zero padded
+	uint8_t* pbtSectorData = new uint8_t [ iNumSectors * fSectorSize ];
+
+	// previous non-empty sector, 0 if there is none, -1 for empty sectors
+	int* piPrevSector = new int [ iNumSectors + 1 ];
+
+	SectorRecord* pRecords = new SectorRecord [ iNumSectors + 1 ];
 
-	//here should be other compression
+	fPassBuffer = new uint8_t [ 0x6500 ];
+
+	memset( pbtSectorData, 0, iNumSectors * fSectorSize );
+
+	for ( sec = 1; sec <= iNumSectors; sec++ )
+	{
+		uint8_t* pbtSector = pbtSectorData + ( sec - 1 ) * fSectorSize;
+		unsigned int secLen = fAtrMemoryImage->GetSectorLength(sec);
+
+		if (!fAtrMemoryImage->ReadSector(sec, pbtSector, secLen )) {
+			DPRINTF("DCM: reading sector %d of memory image failed!",sec);
+			goto failure;
+		}
+
+		unsigned int i=0;
+		while ( (i < secLen) && (pbtSector[i] == 0) ) {
+			i++;
+		}
+
+		if ( i == secLen ) {
+			piPrevSector[ sec ] = -1;
+		} else {
+			piPrevSector[ sec ] = iLastUsedSector;
+			iLastUsedSector = sec;
+		}
+	}
+
+	EncodeAllSectors( pbtSectorData, piPrevSector, pRecords, iNumSectors );
+
+	fCurrentSector = 1;
+
+	EncodeRecFA( false, iPass, iDensity, iFirstSector );
 
 	while( fCurrentSector <= iNumSectors )
 	{
@@ -508,66 +648,53 @@ bool DCMCodec::Save( const char* filename )
 			if ( fCurrentSector > iNumSectors )
 				break;
 
-			unsigned int secLen = fAtrMemoryImage->GetSectorLength(fCurrentSector);
-
-			if (!fAtrMemoryImage->ReadSector(fCurrentSector, fCurrentBuffer, secLen )) {
-				DPRINTF("DCM: reading sector %d of memory image failed!",fCurrentSector);
-				goto failure;
-			}
-
-			unsigned int i=0;
-			while ( (i < secLen) && (fCurrentBuffer[i] == 0) ) {
-				i++;
+			//skip empty sectors
+			if ( piPrevSector[ fCurrentSector ] < 0 )
+			{
+				fCurrentSector++;
+				continue;
 			}
 
-			bool bSkip = (i==secLen);
-
 			//first non empty sector is marked as first, what a surprise! :)
-			if ( !bSkip && !iFirstSector )
+			if ( !iFirstSector )
 			{
 				iFirstSector = fCurrentSector;
 				iPrevSector = fCurrentSector;
 			}
 
-			//if just skipped, increment sector
-			if ( bSkip )
+			//if there is a gap, write sector number
+			if ( ( fCurrentSector - iPrevSector ) > 1 )
 			{
-				fCurrentSector++;
+				*( fCurrentPtr++ ) = fCurrentSector;
+				*( fCurrentPtr++ ) = fCurrentSector >> 8;
 			}
 			else
 			{
-				//if there is a gap, write sector number
-				if ( ( fCurrentSector - iPrevSector ) > 1 )
-				{
-					*( fCurrentPtr++ ) = fCurrentSector;
-					*( fCurrentPtr++ ) = fCurrentSector >> 8;
-				}
-				else
-				{
-					//else mark previous record
-					*fLastRec |= 0x80;
-				}
+				//else mark previous record
+				*fLastRec |= 0x80;
+			}
 
-				//first sector could be encoded with only some data
-				if ( fCurrentSector == iFirstSector )
-					EncodeRec( true );
-				else
-				{
-					//if are same, encode as record 46
-					if ( !memcmp( fPrevBuffer, fCurrentBuffer, fSectorSize ) )
-						EncodeRec46();
-					else
-						EncodeRec( false );
-				}
+			//first sector of a pass could be encoded with only some data,
+			//all others have been encoded in advance
+			if ( fCurrentSector == iFirstSector )
+			{
+				EncodeRec( firstRecord,
+					pbtSectorData + ( fCurrentSector - 1 ) * fSectorSize,
+					NULL, fSectorSize, fMaxCompression );
+				pRecord = &firstRecord;
+			}
+			else
+				pRecord = &pRecords[ fCurrentSector ];
 
-				//store this sector as previous
-				memcpy( fPrevBuffer, fCurrentBuffer, fSectorSize );
+			DDPRINTF("%d: %2x", fCurrentSector, pRecord->fType);
 
-				//and move pointers
-				iPrevSector = fCurrentSector;
-				fCurrentSector++;
-			}
+			fLastRec = fCurrentPtr;
+			*( fCurrentPtr++ ) = pRecord->fType;
+			memcpy( fCurrentPtr, pRecord->fData, pRecord->fLength );
+			fCurrentPtr += pRecord->fLength;
 
+			iPrevSector = fCurrentSector;
+			fCurrentSector++;
 		}
 
 		*fLastRec |= 0x80;
@@ -602,15 +729,124 @@ bool DCMCodec::Save( const char* filename )
 
 	fFileIO->Close();
 	delete [] fPassBuffer;
+	delete [] pRecords;
+	delete [] piPrevSector;
+	delete [] pbtSectorData;
 	return true;
 
 failure:
 	fFileIO->Close();
 	fFileIO->Unlink(filename);
 	delete [] fPassBuffer;
+	delete [] pRecords;
+	delete [] piPrevSector;
+	delete [] pbtSectorData;
 	return false;
 }
 
+void* DCMCodec::EncoderThreadFunc(void* arg)
+{
+	EncodeSectorRange( *( (EncoderJob*) arg ) );
+	return 0;
+}
+
+void DCMCodec::EncodeSectorRange(const EncoderJob& job)
+{
+	for ( unsigned int sec = job.fFirstSector; sec <= job.fLastSector; sec++ )
+	{
+		int iPrev = job.fPrevSector[ sec ];
+
+		//empty sectors and the very first sector aren't encoded in advance
+		if ( iPrev <= 0 )
+			continue;
+
+		EncodeRec( job.fRecords[ sec ],
+			job.fSectorData + ( sec - 1 ) * job.fSectorSize,
+			job.fSectorData + ( iPrev - 1 ) * job.fSectorSize,
+			job.fSectorSize, job.fMaxCompression );
+	}
+}
+
+void DCMCodec::EncodeAllSectors(const uint8_t* sectorData, const int* prevSector,
+	SectorRecord* records, unsigned int numSectors)
+{
+	enum { eMaxThreads = 16 };
+
+	EncoderJob jobs[ eMaxThreads ];
+	pthread_t threads[ eMaxThreads ];
+	bool threadStarted[ eMaxThreads ];
+
+	// each sector only depends on its predecessor, so the image can
+	// be split into chunks. Don't bother with threads for small chunks.
+	unsigned int minSectors = fMaxCompression ? 64 : 256;
+	long numCPUs = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned int numThreads = numSectors / minSectors;
+
+	if (numCPUs > 0 && numThreads > (unsigned int) numCPUs) {
+		numThreads = numCPUs;
+	}
+	if (numThreads > eMaxThreads) {
+		numThreads = eMaxThreads;
+	}
+	if (numThreads < 1) {
+		numThreads = 1;
+	}
+
+	unsigned int chunk = (numSectors + numThreads - 1) / numThreads;
+	unsigned int i;
+
+	for (i = 0; i < numThreads; i++) {
+		jobs[i].fSectorData = sectorData;
+		jobs[i].fPrevSector = prevSector;
+		jobs[i].fRecords = records;
+		jobs[i].fSectorSize = fSectorSize;
+		jobs[i].fFirstSector = i * chunk + 1;
+		jobs[i].fLastSector = (i + 1) * chunk;
+		if (jobs[i].fLastSector > numSectors) {
+			jobs[i].fLastSector = numSectors;
+		}
+		jobs[i].fMaxCompression = fMaxCompression;
+		threadStarted[i] = false;
+	}
+
+	if (numThreads > 1) {
+		pthread_attr_t attr;
+		struct sched_param param;
+		sigset_t allSignals, oldSignals;
+
+		// don't compete with the (possibly realtime) SIO code
+		pthread_attr_init(&attr);
+		pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+		param.sched_priority = 0;
+		pthread_attr_setschedparam(&attr, &param);
+
+		// signals are handled by the main thread only
+		sigfillset(&allSignals);
+		pthread_sigmask(SIG_SETMASK, &allSignals, &oldSignals);
+		for (i = 1; i < numThreads; i++) {
+			threadStarted[i] = (pthread_create(&threads[i], &attr, EncoderThreadFunc, &jobs[i]) == 0);
+		}
+		pthread_sigmask(SIG_SETMASK, &oldSignals, 0);
+
+		pthread_attr_destroy(&attr);
+	}
+
+	// the first chunk, and the chunks we couldn't start a thread for,
+	// are encoded in the calling thread
+	for (i = 0; i < numThreads; i++) {
+		if (!threadStarted[i]) {
+			EncodeSectorRange(jobs[i]);
+		}
+	}
+
+	for (i = 1; i < numThreads; i++) {
+		if (threadStarted[i]) {
+			pthread_join(threads[i], 0);
+		}
+	}
+}
+
 void DCMCodec::EncodeRecFA( bool bLast, int iPass, int iDensity, int iFirstSec )
 {
 	DDPRINTF("%d: FA pass=%d last=%d", fCurrentSector, iPass, (int)bLast);
@@ -639,70 +875,69 @@ void DCMCodec::EncodeRec45()
 	*( fCurrentPtr++ ) = eDCM_PASS_END;
 }
 
-void DCMCodec::EncodeRec46()
+static inline void UseIfSmaller( uint8_t& btType, int& iBestEnd, uint8_t* pbtBest, uint8_t btNewType, const uint8_t* pbtNew, int iNewEnd )
 {
-	DDPRINTF("%d: 46", fCurrentSector);
-	
-	fLastRec = fCurrentPtr;
-	*( fCurrentPtr++ ) = eDCM_SAME_AS_BEFORE;
+	if ( iNewEnd < 255 && iNewEnd < iBestEnd )
+	{
+		btType = btNewType;
+		iBestEnd = iNewEnd;
+		memcpy( pbtBest, pbtNew, iNewEnd );
+	}
 }
 
-void DCMCodec::EncodeRec( bool bIsFirstSector )
+void DCMCodec::EncodeRec( SectorRecord& rec, const uint8_t* pbtCur, const uint8_t* pbtPrev, int iSectorSize, bool bMaxCompression )
 {
-	fLastRec = fCurrentPtr;
-
-	uint8_t abtBuff41[ 0x300 ];
-	uint8_t abtBuff43[ 0x300 ];
-	uint8_t abtBuff44[ 0x300 ];
-	uint8_t* abtBuff47 = fCurrentBuffer;
-
-	int iEnd41 = 0x300;
-	int iEnd43 = 0x300;
-	int iEnd44 = 0x300;
+	//if are same, encode as record 46
+	if ( pbtPrev && !memcmp( pbtPrev, pbtCur, iSectorSize ) )
+	{
+		rec.fType = eDCM_SAME_AS_BEFORE;
+		rec.fLength = 0;
+		return;
+	}
 
-	int iBestMethod = eDCM_UNCOMPRESSED;
-	int iBestEnd = fSectorSize;
-	uint8_t* pbtBest = abtBuff47;
+	uint8_t abtBuff[ 0x300 ];
+	int iEnd;
 
-	EncodeRec43( abtBuff43, &iEnd43, fCurrentBuffer, fSectorSize );
+	rec.fType = eDCM_UNCOMPRESSED;
+	rec.fLength = iSectorSize;
+	memcpy( rec.fData, pbtCur, iSectorSize );
 
-	if ( !bIsFirstSector )
+	//the first sector of a pass can't refer to the previous one
+	if ( pbtPrev )
 	{
-		EncodeRec41( abtBuff41, &iEnd41, fCurrentBuffer, fPrevBuffer, fSectorSize );
-		EncodeRec44( abtBuff44, &iEnd44, fCurrentBuffer, fPrevBuffer, fSectorSize );
+		iEnd = 0x300;
+		EncodeRec41( abtBuff, &iEnd, pbtCur, pbtPrev, iSectorSize );
+		UseIfSmaller( rec.fType, rec.fLength, rec.fData, eDCM_CHANGE_BEGIN, abtBuff, iEnd );
 	}
 
-	if ( iEnd41 < 255 && iEnd41 < iBestEnd )
+	if ( bMaxCompression )
 	{
-		iBestMethod = eDCM_CHANGE_BEGIN;
-		iBestEnd = iEnd41;
-		pbtBest = abtBuff41;
-	}
+		iEnd = 0x300;
+		EncodeRec42( abtBuff, &iEnd, pbtCur, iSectorSize );
+		UseIfSmaller( rec.fType, rec.fLength, rec.fData, eDCM_DOS_SECTOR, abtBuff, iEnd );
 
-	if ( iEnd43 < 255 && iEnd43 < iBestEnd )
+		iEnd = 0x300;
+		EncodeRec43Optimal( abtBuff, &iEnd, pbtCur, iSectorSize );
+		UseIfSmaller( rec.fType, rec.fLength, rec.fData, eDCM_COMPRESSED, abtBuff, iEnd );
+	}
+	else
 	{
-		iBestMethod = eDCM_COMPRESSED;
-		iBestEnd = iEnd43;
-		pbtBest = abtBuff43;
+		iEnd = 0x300;
+		EncodeRec43( abtBuff, &iEnd, pbtCur, iSectorSize );
+		UseIfSmaller( rec.fType, rec.fLength, rec.fData, eDCM_COMPRESSED, abtBuff, iEnd );
 	}
 
-	if ( iEnd44 < 255 && iEnd44 < iBestEnd )
+	if ( pbtPrev )
 	{
-		iBestMethod = eDCM_CHANGE_END;
-		iBestEnd = iEnd44;
-		pbtBest = abtBuff44;
+		iEnd = 0x300;
+		EncodeRec44( abtBuff, &iEnd, pbtCur, pbtPrev, iSectorSize );
+		UseIfSmaller( rec.fType, rec.fLength, rec.fData, eDCM_CHANGE_END, abtBuff, iEnd );
 	}
-
-	DDPRINTF("%d: %2x", fCurrentSector, iBestMethod);
-
-	*( fCurrentPtr++ ) = iBestMethod;
-	memcpy( fCurrentPtr, pbtBest, iBestEnd );
-	fCurrentPtr += iBestEnd;
 }
 
-void DCMCodec::EncodeRec41( uint8_t* pbtDest, int* piDestLen, uint8_t* pbtSrc, uint8_t* pbtSrcOld, int iSrcLen )
+void DCMCodec::EncodeRec41( uint8_t* pbtDest, int* piDestLen, const uint8_t* pbtSrc, const uint8_t* pbtSrcOld, int iSrcLen )
 {
-	uint8_t* pbtS = pbtSrc + iSrcLen - 1;
+	const uint8_t* pbtS = pbtSrc + iSrcLen - 1;
 	pbtSrcOld += iSrcLen - 1;
 
 	uint8_t* pbtD = pbtDest;
@@ -727,10 +962,27 @@ void DCMCodec::EncodeRec41( uint8_t* pbtDest, int* piDestLen, uint8_t* pbtSrc, u
 	*piDestLen = pbtD - pbtDest;
 }
 
-void DCMCodec::EncodeRec43( uint8_t* pbtDest, int* piDestLen, uint8_t* pbtSrc, int iSrcLen )
+void DCMCodec::EncodeRec42( uint8_t* pbtDest, int* piDestLen, const uint8_t* pbtSrc, int iSrcLen )
+{
+	//only usable for 128 byte sectors where the first 123 bytes
+	//are the same as byte 123
+	if ( iSrcLen != 128 )
+		return;
+
+	for( int i = 0; i < 123; i++ )
+	{
+		if ( pbtSrc[ i ] != pbtSrc[ 123 ] )
+			return;
+	}
+
+	memcpy( pbtDest, pbtSrc + 123, 5 );
+	*piDestLen = 5;
+}
+
+void DCMCodec::EncodeRec43( uint8_t* pbtDest, int* piDestLen, const uint8_t* pbtSrc, int iSrcLen )
 {
-	uint8_t* pbtEnd = pbtSrc + iSrcLen;
-	uint8_t* pbtCur = pbtSrc;
+	const uint8_t* pbtEnd = pbtSrc + iSrcLen;
+	const uint8_t* pbtCur = pbtSrc;
 
 	uint8_t* pbtD = pbtDest;
 
@@ -738,7 +990,7 @@ void DCMCodec::EncodeRec43( uint8_t* pbtDest, int* piDestLen, uint8_t* pbtSrc, i
 	{
 		bool bFound = false;
 
-		for( uint8_t* pbtNow = pbtCur; pbtNow < ( pbtEnd - 2 ); pbtNow++ )
+		for( const uint8_t* pbtNow = pbtCur; pbtNow < ( pbtEnd - 2 ); pbtNow++ )
 		{
 
 			if ( ( *pbtNow == *(pbtNow+1) ) && ( *pbtNow == *(pbtNow+2) ) )
@@ -753,7 +1005,7 @@ void DCMCodec::EncodeRec43( uint8_t* pbtDest, int* piDestLen, uint8_t* pbtSrc, i
 				}
 
 				uint8_t bt = *pbtNow;
-				uint8_t*p;
+				const uint8_t*p;
 				for( p = pbtNow + 1; p < pbtEnd; p++ )
 				{
 					if ( *p != bt )
@@ -789,10 +1041,88 @@ void DCMCodec::EncodeRec43( uint8_t* pbtDest, int* piDestLen, uint8_t* pbtSrc, i
 	*piDestLen = pbtD - pbtDest;
 }
 
-void DCMCodec::EncodeRec44( uint8_t* pbtDest, int* piDestLen, uint8_t* pbtSrc, uint8_t* pbtSrcOld, int iSrcLen )
+void DCMCodec::EncodeRec43Optimal( uint8_t* pbtDest, int* piDestLen, const uint8_t* pbtSrc, int iSrcLen )
+{
+	//record 43 alternates uncompressed and RLE blocks, starting with an
+	//uncompressed one. Instead of greedily taking every run of 3 or more
+	//bytes find the cheapest sequence of blocks, working backwards from
+	//the end of the sector.
+	//aiCostU/aiCostR hold the cost of encoding the rest of the sector
+	//starting with an uncompressed / RLE block at that position,
+	//aiEndU/aiEndR the end offset of that block.
+
+	int aiCostU[ 0x101 ], aiCostR[ 0x101 ];
+	int aiEndU[ 0x101 ], aiEndR[ 0x101 ];
+
+	int iBestRun = INT_MAX;		//min( aiCostU[ q ] ) for q within the current run
+	int iBestRunEnd = iSrcLen;
+	int iBestNext = INT_MAX;	//min( q + aiCostR[ q ] ) for q >= p
+	int iBestNextEnd = iSrcLen;
+	int p, q;
+
+	aiCostU[ iSrcLen ] = 0;
+	aiCostR[ iSrcLen ] = 0;
+
+	for( p = iSrcLen - 1; p >= 0; p-- )
+	{
+		//RLE block up to q, followed by an uncompressed block
+		if ( p == iSrcLen - 1 || pbtSrc[ p ] != pbtSrc[ p + 1 ] || aiCostU[ p + 1 ] < iBestRun )
+		{
+			iBestRun = aiCostU[ p + 1 ];
+			iBestRunEnd = p + 1;
+		}
+		aiCostR[ p ] = 2 + iBestRun;
+		aiEndR[ p ] = iBestRunEnd;
+
+		if ( p + aiCostR[ p ] < iBestNext )
+		{
+			iBestNext = p + aiCostR[ p ];
+			iBestNextEnd = p;
+		}
+
+		//uncompressed block up to q, followed by an RLE block
+		aiCostU[ p ] = 1 - p + iBestNext;
+		aiEndU[ p ] = iBestNextEnd;
+
+		//uncompressed up to the end of the sector. The first offset
+		//is a plain byte, so this isn't possible for 256 byte sectors
+		if ( ( p > 0 || iSrcLen < 256 ) && 1 + iSrcLen - p <= aiCostU[ p ] )
+		{
+			aiCostU[ p ] = 1 + iSrcLen - p;
+			aiEndU[ p ] = iSrcLen;
+		}
+	}
+
+	uint8_t* pbtD = pbtDest;
+	bool bUncompressed = true;
+
+	p = 0;
+	while( p < iSrcLen )
+	{
+		if ( bUncompressed )
+		{
+			q = aiEndU[ p ];
+			*( pbtD++ ) = q;
+			memcpy( pbtD, pbtSrc + p, q - p );
+			pbtD += q - p;
+		}
+		else
+		{
+			q = aiEndR[ p ];
+			*( pbtD++ ) = q;
+			*( pbtD++ ) = pbtSrc[ p ];
+		}
+		p = q;
+		bUncompressed = !bUncompressed;
+	}
+
+	*piDestLen = pbtD - pbtDest;
+}
+
+void DCMCodec::EncodeRec44( uint8_t* pbtDest, int* piDestLen, const uint8_t* pbtSrc, const uint8_t* pbtSrcOld, int iSrcLen )
 {
-	uint8_t* pbtS = pbtSrc;
-	uint8_t* pbtEnd = pbtSrc + iSrcLen;
+	const uint8_t* pbtS = pbtSrc;
+	const uint8_t* pbtEnd = pbtSrc + iSrcLen;
 
 	uint8_t* pbtD = pbtDest;
 
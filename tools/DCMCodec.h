@@ -25,6 +25,7 @@
 */
 
 #include <stdio.h>
+#include <vector>
 
 #include "AtrMemoryImage.h"
 #include "FileIO.h"
@@ -32,13 +33,42 @@
 class DCMCodec
 {
 public:
-	DCMCodec(const RCPtr<FileIO>& ioclass, const RCPtr<AtrMemoryImage>& img);
+	// the codec doesn't take a reference to img, so it can also be
+	// used with images that aren't owned by an RCPtr (eg in the
+	// image loader thread). img must outlive the codec.
+	DCMCodec(const RCPtr<FileIO>& ioclass, AtrMemoryImage* img);
 	~DCMCodec();
 
 	bool Load( const char* filename, bool beQuiet);
 
+	// decode from the already opened file
+	bool Decode(bool beQuiet);
+
 	bool Save( const char* filename);
 
+	// try all record types for each sector (including DOS sector records)
+	// and use an optimal parse for RLE records. Slower, but the resulting
+	// DCM files are smaller
+	static void SetMaxCompression(bool on);
+
+	// lazy decoding: the index holds the file offset of each sector
+	// record and the record the decoder state is based on
+	struct IndexEntry {
+		off_t fOffset;
+		int fPrevRecord;	// -1: record doesn't depend on previous state
+		unsigned int fSector;
+	};
+	typedef std::vector<IndexEntry> Index;
+
+	// scan the whole file, on success it stays open for DecodeRecord.
+	// the codec may be constructed without an image for this.
+	bool BuildIndex( const char* filename, Index& index, EDiskFormat& format, bool beQuiet);
+
+	// decode a single record. prevState is the state after decoding
+	// fPrevRecord (NULL if there is none), all states hold a whole
+	// sector buffer of the image's sector size
+	bool DecodeRecord( const IndexEntry& entry, const uint8_t* prevState, uint8_t* state);
+
 private:
 	enum {
 		eDCM_CHANGE_BEGIN=0x41,
@@ -58,6 +88,8 @@ private:
 		eDCM_DENSITY_ED=2
  	};
 
+	bool DecodeFile(bool beQuiet, Index* index);
+	bool DecodeRec(uint8_t btBlkType, bool beQuiet);
 	bool DecodeRec41(bool beQuiet);
 	bool DecodeRec42(bool beQuiet);
 	bool DecodeRec43(bool beQuiet);
@@ -68,29 +100,56 @@ private:
 
 	bool ReadOffset(unsigned int& off, bool beQuiet);
 
-	void EncodeRec41( uint8_t*, int*, uint8_t*, uint8_t*, int );
-	void EncodeRec43( uint8_t*, int*, uint8_t*, int );
-	void EncodeRec44( uint8_t*, int*, uint8_t*, uint8_t*, int );
+	// encoded sector record, without the sector number / 0x80 flag
+	struct SectorRecord {
+		uint8_t fType;
+		int fLength;
+		uint8_t fData[ 0x300 ];
+	};
+
+	// sector records are encoded in parallel by multiple threads,
+	// the passes are then assembled in order from the records
+	struct EncoderJob {
+		const uint8_t* fSectorData;
+		const int* fPrevSector;
+		SectorRecord* fRecords;
+		unsigned int fSectorSize;
+		unsigned int fFirstSector;
+		unsigned int fLastSector;
+		bool fMaxCompression;
+	};
+
+	static void* EncoderThreadFunc(void* arg);
+	static void EncodeSectorRange(const EncoderJob& job);
+	void EncodeAllSectors(const uint8_t* sectorData, const int* prevSector,
+		SectorRecord* records, unsigned int numSectors);
+
+	static void EncodeRec41( uint8_t*, int*, const uint8_t*, const uint8_t*, int );
+	static void EncodeRec42( uint8_t*, int*, const uint8_t*, int );
+	static void EncodeRec43( uint8_t*, int*, const uint8_t*, int );
+	static void EncodeRec43Optimal( uint8_t*, int*, const uint8_t*, int );
+	static void EncodeRec44( uint8_t*, int*, const uint8_t*, const uint8_t*, int );
 
 	void EncodeRec45();
-	void EncodeRec46();
-	void EncodeRec( bool );
+	static void EncodeRec( SectorRecord&, const uint8_t*, const uint8_t*, int, bool );
 	void EncodeRecFA( bool, int, int, int );
 
+	static bool fMaxCompression;
+
 	bool	fLastPassFlag;
 	uint8_t	fCurrentBuffer[ 0x100 ];
-	uint8_t	fPrevBuffer[ 0x100 ];
 	uint16_t	fSectorSize;
 	uint16_t	fCurrentSector;
 	off_t 	fFileLength;
 	bool	fAlreadyFormatted;
+	EDiskFormat fDiskFormat;
 
 	uint8_t* fCurrentPtr;
 	uint8_t* fPassBuffer;
 	uint8_t* fLastRec;
 
 	RCPtr<FileIO> fFileIO;
-	RCPtr<AtrMemoryImage> fAtrMemoryImage;
+	AtrMemoryImage* fAtrMemoryImage;
 };
 
 #endif
@@ -22,6 +22,7 @@
 #include <stdlib.h>
 #include <limits.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -29,6 +30,14 @@
 #include "OS.h"
 #include "DeviceManager.h"
 #include "AtrMemoryImage.h"
+#include "AtrMappedImage.h"
+#include "AtrGzImage.h"
+#include "AtrDcmImage.h"
+#include "AtrAtzImage.h"
+#include "AtrDiImage.h"
+#include "AtrSparseImage.h"
+#include "AtrOverlayImage.h"
+#include "ImageFormat.h"
 #include "AtrSIOHandler.h"
 #ifdef ENABLE_ATP
 #include "AtpImage.h"
@@ -40,12 +49,16 @@
 #include "Dos2xUtils.h"
 #include "AtrSearchPath.h"
 #include "MyPicoDosCode.h"
+#include "SIOTracer.h"
 
 #include "AtariDebug.h"
 
+RCPtr<SectorStore> DeviceManager::fSectorStore;
+
 DeviceManager::DeviceManager(const char* devname)
         : fUseStrictFormatChecking(false),
-	  fTapeSpeedPercent(100)
+	  fTapeSpeedPercent(100),
+	  fWriteBackSerial(0)
 {
 	fSIOWrapper = SIOWrapper::CreateSIOWrapper(devname);
 	fSIOManager = new SIOManager(fSIOWrapper);
@@ -63,10 +76,22 @@ DeviceManager::DeviceManager(const char* devname)
 	}
 
 	EnableXF551Mode(false);
+
+	for (int i=0; i<=eMaxDriveNumber; i++) {
+		fLoadGeneration[i] = 0;
+		fWriteBacksPending[i] = 0;
+		fDriveWriteBackSerial[i] = 0;
+	}
 }
 
 DeviceManager::~DeviceManager()
 {
+	// autosave: like unloading, quitting discards the records that
+	// haven't been written into the images yet. Changed images were
+	// confirmed by the user before (or written back).
+	for (int i=eMinDriveNumber;i<=eMaxDriveNumber;i++) {
+		DetachSectorJournal(EDriveNumber(i), false);
+	}
 }
 
 bool DeviceManager::SetSioServerMode(SIOWrapper::ESIOServerCommandLine cmdLine)
@@ -113,11 +138,8 @@ bool DeviceManager::DriveInUse(EDriveNumber driveno) const
 	return h.IsNotNull();
 }
 
-RCPtr<DiskImage> DeviceManager::LoadDiskImage(const char* filename, bool beQuiet)
+bool DeviceManager::GetImagePath(const char* filename, char* absPath, bool beQuiet)
 {
-	RCPtr<DiskImage> image;
-
-	char absPath[PATH_MAX];
 	char myFilename[PATH_MAX];
 	bool foundFile = false;
 
@@ -133,13 +155,46 @@ RCPtr<DiskImage> DeviceManager::LoadDiskImage(const char* filename, bool beQuiet
 		if (!beQuiet) {
 			AERROR("cannot find \"%s\"", filename);
 		}
+		return false;
+	}
+	return true;
+}
+
+RCPtr<DiskImage> DeviceManager::LoadDiskImage(const char* filename, bool beQuiet)
+{
+	RCPtr<DiskImage> image;
+
+	char absPath[PATH_MAX];
+
+	if (!GetImagePath(filename, absPath, beQuiet)) {
 		return image;
 	}
 
+	image = CreateDiskImage(absPath, beQuiet, fSectorStore.IsNotNull());
+
+	if (image.IsNotNull() && image->IsAtrImage()
+	    && RCPtrStaticCast<AtrImage>(image)->IsAtrMemoryImage()) {
+		RCPtrStaticCast<AtrMemoryImage>(image)->SetSectorStore(fSectorStore);
+	}
+
+	return image;
+}
+
+RCPtr<DiskImage> DeviceManager::CreateDiskImage(const char* absPath, bool beQuiet, bool preferMemoryImage)
+{
+	RCPtr<DiskImage> image;
+	bool compressed;
+
+	// replay sector writes that didn't make it into the
+	// image file before atariserver was terminated
+	SectorJournal::Recover(absPath);
+
+	// the header decides which backend is used, the backends
+	// still check that the filename matches what they can handle
+	ImageFormat::EFormat format = ImageFormat::ProbeFile(absPath, compressed);
+
 #ifdef ENABLE_ATP
-	int len = strlen(absPath);
-	if ( (len > 4 && strcasecmp(absPath+len-4,".atp") == 0) ||
-	     (len > 7 && strcasecmp(absPath+len-7,".atp.gz") == 0)) {
+	if (format == ImageFormat::eAtpFormat) {
 		RCPtr<AtpImage> img(new AtpImage);
 		if (img->ReadImageFromFile(absPath, beQuiet)) {
 			image = img;
@@ -148,9 +203,71 @@ RCPtr<DiskImage> DeviceManager::LoadDiskImage(const char* filename, bool beQuiet
 #else
 	if (1) {
 #endif
-		RCPtr<AtrMemoryImage> img(new AtrMemoryImage);
-		if (img->ReadImageFromFile(absPath, beQuiet)) {
-			image = img;
+		// with the sector store enabled RAM images are preferred,
+		// as they share identical sectors with the other images.
+		if (!preferMemoryImage) {
+			switch (format) {
+			case ImageFormat::eAtrFormat:
+			case ImageFormat::eXfdFormat:
+				if (!compressed) {
+					// map uncompressed images
+					RCPtr<AtrMappedImage> img(new AtrMappedImage);
+					if (img->ReadImageFromFile(absPath, true)) {
+						image = img;
+					}
+#ifdef USE_ZLIB
+				} else {
+					// decompress on demand via a gzip index
+					RCPtr<AtrGzImage> img(new AtrGzImage);
+					if (img->ReadImageFromFile(absPath, true)) {
+						image = img;
+					}
+#endif
+				}
+				break;
+#ifdef USE_ZLIB
+			case ImageFormat::eAtzFormat: {
+				// only decompress the chunks that are accessed
+				RCPtr<AtrAtzImage> img(new AtrAtzImage);
+				if (img->ReadImageFromFile(absPath, true)) {
+					image = img;
+				}
+				break;
+			}
+#endif
+			case ImageFormat::eDcmFormat: {
+				// indexed, sectors are decoded on first access
+				RCPtr<AtrDcmImage> img(new AtrDcmImage);
+				if (img->ReadImageFromFile(absPath, true)) {
+					image = img;
+				}
+				break;
+			}
+			case ImageFormat::eDiFormat:
+				// only holds the non-empty sectors, map them
+				if (!compressed) {
+					RCPtr<AtrDiImage> img(new AtrDiImage);
+					if (img->ReadImageFromFile(absPath, true)) {
+						image = img;
+					}
+				}
+				break;
+			default:
+				break;
+			}
+		}
+		// everything else is loaded into RAM, without the sector
+		// store empty pages of the image aren't allocated
+		if (image.IsNull() && !preferMemoryImage) {
+			RCPtr<AtrSparseImage> img(new AtrSparseImage);
+			if (img->ReadImageFromFile(absPath, beQuiet)) {
+				image = img;
+			}
+		} else if (image.IsNull()) {
+			RCPtr<AtrMemoryImage> img(new AtrMemoryImage);
+			if (img->ReadImageFromFile(absPath, beQuiet)) {
+				image = img;
+			}
 		}
 	}
 
@@ -180,6 +297,94 @@ bool DeviceManager::LoadDiskImage(EDriveNumber driveno, const char* filename, bo
 		return false;
 	}
 
+	return InstallDiskImage(driveno, image, beQuiet, forceUnload);
+}
+
+RCPtr<const AtrImage> DeviceManager::FindOverlayBaseImage(const char* absPath) const
+{
+	for (int i=eMinDriveNumber; i<=eMaxDriveNumber; i++) {
+		RCPtr<const AtrImage> image = GetConstAtrImage(EDriveNumber(i));
+		if (image.IsNotNull() && image->IsAtrOverlayImage()) {
+			RCPtr<const AtrImage> base = RCPtrStaticCast<const AtrOverlayImage>(image)->GetBaseImage();
+			if (base.IsNotNull() && base->GetFilename() && strcmp(base->GetFilename(), absPath) == 0) {
+				// load a fresh copy if the file changed underneath the base
+				if (base->ImageFileChanged()) {
+					return NULL;
+				}
+				return base;
+			}
+		}
+	}
+	return NULL;
+}
+
+bool DeviceManager::LoadOverlayImage(EDriveNumber driveno, const char* filename, bool beQuiet, bool forceUnload)
+{
+	char absPath[PATH_MAX];
+
+	if (!DriveNumberOK(driveno)) {
+		return false;
+	}
+
+	if (DriveInUse(driveno) && ! forceUnload) {
+		if (!beQuiet) {
+			AERROR("already loaded image into D%d: - unload first",driveno);
+		}
+		return false;
+	}
+
+	if (!GetImagePath(filename, absPath, beQuiet)) {
+		return false;
+	}
+
+	RCPtr<const AtrImage> base = FindOverlayBaseImage(absPath);
+
+	if (base.IsNull()) {
+		RCPtr<DiskImage> image = LoadDiskImage(absPath, beQuiet);
+		if (image.IsNull()) {
+			return false;
+		}
+		if (!image->IsAtrImage()) {
+			if (!beQuiet) {
+				AERROR("overlays are only supported for ATR, XFD, DCM and DI images");
+			}
+			return false;
+		}
+		base = RCPtrStaticCast<AtrImage>(image);
+	}
+
+	RCPtr<AtrOverlayImage> overlay = new AtrOverlayImage(base);
+
+	return InstallDiskImage(driveno, overlay, beQuiet, forceUnload);
+}
+
+bool DeviceManager::ResetOverlayDrive(EDriveNumber driveno)
+{
+	RCPtr<AtrImage> image = GetAtrImage(driveno);
+
+	if (image.IsNull() || !image->IsAtrOverlayImage()) {
+		DPRINTF("D%d: is no overlay drive", driveno);
+		return false;
+	}
+	RCPtrStaticCast<AtrOverlayImage>(image)->DiscardChanges();
+	ALOG("reset D%d: to \"%s\"", driveno, image->GetFilename());
+
+	// the format may have changed
+	RCPtr<AbstractSIOHandler> absHandler = GetSIOHandler(driveno);
+	fSIOManager->UnregisterHandler(eSIODriveBase+driveno);
+	return InstallDiskImage(driveno, image, true, false)
+		&& SetDeviceActive(driveno, absHandler->IsActive());
+}
+
+bool DeviceManager::DriveIsOverlayImage(EDriveNumber driveno) const
+{
+	RCPtr<const AtrImage> image = GetConstAtrImage(driveno);
+
+	return image.IsNotNull() && image->IsAtrOverlayImage();
+}
+
+bool DeviceManager::InstallDiskImage(EDriveNumber driveno, const RCPtr<DiskImage>& image, bool beQuiet, bool forceUnload)
+{
 	RCPtr<AbstractSIOHandler> handler;
 
 #ifdef ENABLE_ATP
@@ -204,6 +409,7 @@ bool DeviceManager::LoadDiskImage(EDriveNumber driveno, const char* filename, bo
 		}
 		UnloadDiskImage(driveno);
 	}
+	CancelLoad(driveno);
 
 	if (!fSIOManager->RegisterHandler(eSIODriveBase+driveno, handler)) {
 		if (!beQuiet) {
@@ -212,27 +418,16 @@ bool DeviceManager::LoadDiskImage(EDriveNumber driveno, const char* filename, bo
 		return false;
 	}
 
+	AttachSectorJournal(driveno);
+
 	if (!beQuiet) {
 		ALOG("loaded D%d: from \"%s\"", driveno, image->GetFilename());
 	}
 	return true;
 }
 
-bool DeviceManager::CreateVirtualDrive(
-	EDriveNumber driveno, const char* path, ESectorLength density, unsigned int sectors,
-	bool MyDosFormat, bool forceUnload)
+bool DeviceManager::GetVirtualDrivePath(const char* path, char* absPath)
 {
-	char absPath[PATH_MAX];
-
-	if (!DriveNumberOK(driveno)) {
-		return false;
-	}
-
-	if (DriveInUse(driveno) && !forceUnload) {
-		AERROR("already loaded image into D%d: - unload first",driveno);
-		return false;
-	}
-
 	if (realpath(path,absPath) == 0) {
 		AERROR("cannot locate directory \"%s\"", path);
 		return false;
@@ -249,24 +444,33 @@ bool DeviceManager::CreateVirtualDrive(
 	}
 	int len = strlen(absPath);
 	if ((len > 0) && (absPath[len-1] != DIR_SEPARATOR)) {
+		if (len + 1 >= PATH_MAX) {
+			AERROR("path \"%s\" too long", absPath);
+			return false;
+		}
 		absPath[len] = DIR_SEPARATOR;
 		absPath[len+1] = 0;
 	}
+	return true;
+}
 
-	if (!CreateAtrMemoryImage(driveno, density, sectors, forceUnload)) {
+bool DeviceManager::BuildVirtualImage(const char* absPath, ESectorLength density, unsigned int sectors, bool MyDosFormat,
+	RCPtr<AtrMemoryImage>& image, RCPtr<VirtualImageObserver>& observer)
+{
+	RCPtr<AtrMemoryImage> img(new AtrMemoryImage);
+	RCPtr<VirtualImageObserver> obs;
+	RCPtr<Dos2xUtils> rootdir;
+
+	if (!img->CreateImage(density, sectors)) {
+		AERROR("unable to create virtual image");
 		return false;
 	}
-
-	RCPtr<AtrMemoryImage> img = RCPtrStaticCast<AtrMemoryImage>(GetAtrImage(driveno));
+	img->SetChanged(false);
 	img->SetIsVirtualImage(true);
-	RCPtr<VirtualImageObserver> observer;
-	RCPtr<Dos2xUtils> rootdir;
-	RCPtr<AtrSIOHandler> sioHandler;
 
-
-	observer = new VirtualImageObserver(img);
-	rootdir = new Dos2xUtils(img, absPath, observer);
-	observer->SetRootDirectoryObserver(rootdir);
+	obs = new VirtualImageObserver(img);
+	rootdir = new Dos2xUtils(img, absPath, obs);
+	obs->SetRootDirectoryObserver(rootdir);
 
 	img->SetFilename(absPath);
 	bool ok;
@@ -277,50 +481,385 @@ bool DeviceManager::CreateVirtualDrive(
 	}
 	if (!ok) {
 		AERROR("unable to set DOS format");
-		goto fail;
+		return false;
 	}
 	if (!rootdir->InitVTOC()) {
 		AERROR("unable to blank-init disk");
-		goto fail;
+		return false;
 	}
 
 	if (!MyPicoDosCode::GetInstance()->WriteBootCodeToImage(img)) {
 		AERROR("unable to write MyPicoDos boot sector code to image");
-		goto fail;
+		return false;
 	}
 
 	//rootdir->AddFiles(false);
 	rootdir->AddFiles(Dos2xUtils::ePicoName);
 
-	sioHandler = RCPtrStaticCast<AtrSIOHandler>(GetSIOHandler(driveno));
-	sioHandler->SetVirtualImageObserver(observer);
+	image = img;
+	observer = obs;
 	return true;
-
-fail:
-	UnloadDiskImage(driveno);
-	return false;
 }
 
 bool DeviceManager::CreateVirtualDrive(
-	EDriveNumber driveno, const char* path, EDiskFormat format, bool forceUnload)
+	EDriveNumber driveno, const char* path, ESectorLength density, unsigned int sectors,
+	bool MyDosFormat, bool forceUnload)
+{
+	char absPath[PATH_MAX];
+	RCPtr<AtrMemoryImage> img;
+	RCPtr<VirtualImageObserver> observer;
+
+	if (!DriveNumberOK(driveno)) {
+		return false;
+	}
+
+	if (DriveInUse(driveno) && !forceUnload) {
+		AERROR("already loaded image into D%d: - unload first",driveno);
+		return false;
+	}
+
+	if (!GetVirtualDrivePath(path, absPath)) {
+		return false;
+	}
+
+	if (!BuildVirtualImage(absPath, density, sectors, MyDosFormat, img, observer)) {
+		return false;
+	}
+	img->SetSectorStore(fSectorStore);
+
+	if (!InstallDiskImage(driveno, img, true, forceUnload)) {
+		return false;
+	}
+
+	RCPtrStaticCast<AtrSIOHandler>(GetSIOHandler(driveno))->SetVirtualImageObserver(observer);
+	return true;
+}
+
+bool DeviceManager::GetVirtualDriveGeometry(EDiskFormat format, ESectorLength& density, unsigned int& sectors, bool& MyDosFormat)
 {
-	// bool isMyDos = false;
 	switch (format)
 	{
 	case e90kDisk:
-		return CreateVirtualDrive(driveno, path, e128BytesPerSector, 720, false, forceUnload);
+		density = e128BytesPerSector; sectors = 720; MyDosFormat = false;
+		return true;
 	case e130kDisk:
-		return CreateVirtualDrive(driveno, path, e128BytesPerSector, 1040, false, forceUnload);
+		density = e128BytesPerSector; sectors = 1040; MyDosFormat = false;
+		return true;
 	case e180kDisk:
-		return CreateVirtualDrive(driveno, path, e256BytesPerSector, 720, false, forceUnload);
+		density = e256BytesPerSector; sectors = 720; MyDosFormat = false;
+		return true;
 	case e360kDisk:
-		return CreateVirtualDrive(driveno, path, e256BytesPerSector, 1440, true, forceUnload);
+		density = e256BytesPerSector; sectors = 1440; MyDosFormat = true;
+		return true;
 	default:
 		AERROR("illegal format in CreateVirtualDrive");
 		return false;
 	}
-	Assert(false);
-	return false;
+}
+
+bool DeviceManager::CreateVirtualDrive(
+	EDriveNumber driveno, const char* path, EDiskFormat format, bool forceUnload)
+{
+	ESectorLength density;
+	unsigned int sectors;
+	bool MyDosFormat;
+
+	if (!GetVirtualDriveGeometry(format, density, sectors, MyDosFormat)) {
+		return false;
+	}
+	return CreateVirtualDrive(driveno, path, density, sectors, MyDosFormat, forceUnload);
+}
+
+// Finish is called in the main thread when the loader returns the job
+class DeviceManager::DeviceJob : public ImageLoader::Job {
+public:
+	virtual ~DeviceJob() { }
+
+	virtual void Finish(DeviceManager& manager) = 0;
+};
+
+class DeviceManager::LoadJob : public DeviceManager::DeviceJob {
+public:
+	LoadJob(DeviceManager::EDriveNumber driveno, const char* absPath)
+		: fDrive(driveno), fGeneration(0), fIsVirtual(false),
+		  fDensity(e128BytesPerSector), fSectors(0), fMyDosFormat(false)
+	{
+		strncpy(fPath, absPath, PATH_MAX-1);
+		fPath[PATH_MAX-1] = 0;
+	}
+
+	virtual ~LoadJob() { }
+
+	virtual void Run()
+	{
+		if (fIsVirtual) {
+			RCPtr<AtrMemoryImage> img;
+			if (DeviceManager::BuildVirtualImage(fPath, fDensity, fSectors, fMyDosFormat, img, fObserver)) {
+				fImage = img;
+			}
+		} else {
+			fImage = DeviceManager::CreateDiskImage(fPath, false, fSectorStore.IsNotNull());
+		}
+		// intern the image here, doing it in FinishLoad would stall the SIO thread
+		if (fImage.IsNotNull() && fSectorStore.IsNotNull() && fImage->IsAtrImage()
+		    && RCPtrStaticCast<AtrImage>(fImage)->IsAtrMemoryImage()) {
+			RCPtrStaticCast<AtrMemoryImage>(fImage)->PrepareSectorStore(fSectorStore.GetRealPointer());
+		}
+	}
+
+	virtual void Finish(DeviceManager& manager)
+	{
+		manager.FinishLoad(this);
+	}
+
+	DeviceManager::EDriveNumber fDrive;
+	unsigned int fGeneration;
+	char fPath[PATH_MAX];
+
+	bool fIsVirtual;
+	ESectorLength fDensity;
+	unsigned int fSectors;
+	bool fMyDosFormat;
+
+	// set in the main thread, the loader thread must not change its
+	// refcount. Declared before fImage so it outlives the image.
+	RCPtr<SectorStore> fSectorStore;
+
+	RCPtr<DiskImage> fImage;
+	RCPtr<VirtualImageObserver> fObserver;
+};
+
+class DeviceManager::WriteBackJob : public DeviceManager::DeviceJob {
+public:
+	// the job takes ownership of the snapshot
+	WriteBackJob(DeviceManager::EDriveNumber driveno, AtrMemoryImage* snapshot,
+		const char* filename, unsigned int serial)
+		: fDrive(driveno), fSnapshot(snapshot), fSerial(serial), fOK(false)
+	{
+		strncpy(fFilename, filename, PATH_MAX-1);
+		fFilename[PATH_MAX-1] = 0;
+	}
+
+	virtual ~WriteBackJob()
+	{
+		delete fSnapshot;
+	}
+
+	// don't lose changes when atariserver quits
+	virtual bool MustComplete() const
+	{
+		return true;
+	}
+
+	virtual void Run()
+	{
+		char tmpPath[PATH_MAX];
+
+		// write a new file (keeping the extension so the format
+		// is retained) and rename it over the old one
+		const char* base = strrchr(fFilename, DIR_SEPARATOR);
+		base = base ? base + 1 : fFilename;
+		if (snprintf(tmpPath, PATH_MAX, "%.*s.tmp%d-%u-%s", (int)(base - fFilename), fFilename,
+		    (int) getpid(), fSerial, base) >= PATH_MAX) {
+			AERROR("filename \"%s\" too long", fFilename);
+			return;
+		}
+		if (!fSnapshot->WriteImageToFile(tmpPath)) {
+			unlink(tmpPath);
+			return;
+		}
+		if (rename(tmpPath, fFilename)) {
+			AERROR("cannot rename \"%s\" to \"%s\"", tmpPath, fFilename);
+			unlink(tmpPath);
+			return;
+		}
+		fOK = true;
+	}
+
+	virtual void Finish(DeviceManager& manager)
+	{
+		manager.FinishWriteBack(this);
+	}
+
+	DeviceManager::EDriveNumber fDrive;
+	// not reference counted, RCPtr isn't thread safe
+	AtrMemoryImage* fSnapshot;
+	char fFilename[PATH_MAX];
+	unsigned int fSerial;
+	bool fOK;
+};
+
+bool DeviceManager::StartImageLoader()
+{
+	if (fImageLoader.IsNull()) {
+		try {
+			fImageLoader = new ImageLoader(fSIOWrapper.GetRealPointer());
+		}
+		catch (ErrorObject& err) {
+			AERROR("%s", err.AsCString());
+			return false;
+		}
+	}
+	return true;
+}
+
+bool DeviceManager::StartLoadJob(EDriveNumber driveno, LoadJob* job)
+{
+	if (!StartImageLoader()) {
+		delete job;
+		return false;
+	}
+
+	// the boot code is loaded on first use, make sure that
+	// doesn't happen in the loader thread
+	if (job->fIsVirtual) {
+		MyPicoDosCode::GetInstance();
+	}
+
+	CancelLoad(driveno);
+	job->fGeneration = ++fLoadGeneration[driveno];
+	fSIOManager->SetDeviceBusy(eSIODriveBase+driveno, true);
+	fImageLoader->Submit(job);
+	return true;
+}
+
+void DeviceManager::CancelLoad(EDriveNumber driveno)
+{
+	if (fSIOManager->IsDeviceBusy(eSIODriveBase+driveno)) {
+		fLoadGeneration[driveno]++;
+		fSIOManager->SetDeviceBusy(eSIODriveBase+driveno, false);
+	}
+}
+
+bool DeviceManager::DriveIsLoading(EDriveNumber driveno) const
+{
+	if (!DriveNumberOK(driveno)) {
+		return false;
+	}
+	return fSIOManager->IsDeviceBusy(eSIODriveBase+driveno);
+}
+
+bool DeviceManager::LoadDiskImageAsync(EDriveNumber driveno, const char* filename, bool forceUnload)
+{
+	char absPath[PATH_MAX];
+
+	if (!DriveNumberOK(driveno)) {
+		return false;
+	}
+
+	if ((DriveInUse(driveno) || DriveIsLoading(driveno)) && !forceUnload) {
+		AERROR("already loaded image into D%d: - unload first",driveno);
+		return false;
+	}
+
+	if (!GetImagePath(filename, absPath, false)) {
+		return false;
+	}
+
+	if (DriveInUse(driveno)) {
+		ALOG("unloading D%d:", driveno);
+		UnloadDiskImage(driveno);
+	}
+
+	LoadJob* job = new LoadJob(driveno, absPath);
+	job->fSectorStore = fSectorStore;
+
+	if (!StartLoadJob(driveno, job)) {
+		return false;
+	}
+	ALOG("loading D%d: from \"%s\"", driveno, absPath);
+	return true;
+}
+
+bool DeviceManager::CreateVirtualDriveAsync(
+	EDriveNumber driveno, const char* path, ESectorLength density, unsigned int sectors,
+	bool MyDosFormat, bool forceUnload)
+{
+	char absPath[PATH_MAX];
+
+	if (!DriveNumberOK(driveno)) {
+		return false;
+	}
+
+	if ((DriveInUse(driveno) || DriveIsLoading(driveno)) && !forceUnload) {
+		AERROR("already loaded image into D%d: - unload first",driveno);
+		return false;
+	}
+
+	if (!GetVirtualDrivePath(path, absPath)) {
+		return false;
+	}
+
+	if (DriveInUse(driveno)) {
+		UnloadDiskImage(driveno);
+	}
+
+	LoadJob* job = new LoadJob(driveno, absPath);
+	job->fIsVirtual = true;
+	job->fDensity = density;
+	job->fSectors = sectors;
+	job->fMyDosFormat = MyDosFormat;
+	job->fSectorStore = fSectorStore;
+
+	return StartLoadJob(driveno, job);
+}
+
+bool DeviceManager::CreateVirtualDriveAsync(
+	EDriveNumber driveno, const char* path, EDiskFormat format, bool forceUnload)
+{
+	ESectorLength density;
+	unsigned int sectors;
+	bool MyDosFormat;
+
+	if (!GetVirtualDriveGeometry(format, density, sectors, MyDosFormat)) {
+		return false;
+	}
+	return CreateVirtualDriveAsync(driveno, path, density, sectors, MyDosFormat, forceUnload);
+}
+
+void DeviceManager::ProcessFinishedJobs()
+{
+	std::list<ImageLoader::Job*> jobs;
+
+	if (fImageLoader.IsNull()) {
+		return;
+	}
+	fImageLoader->GetFinishedJobs(jobs);
+
+	// output messages of the loader thread before our own ones
+	SIOTracer::GetInstance()->FlushDeferredStrings();
+
+	// we only submit DeviceJobs
+	std::list<ImageLoader::Job*>::iterator iter;
+	for (iter = jobs.begin(); iter != jobs.end(); iter++) {
+		static_cast<DeviceJob*>(*iter)->Finish(*this);
+		delete *iter;
+	}
+}
+
+void DeviceManager::FinishLoad(LoadJob* job)
+{
+	EDriveNumber driveno = job->fDrive;
+
+	if (job->fGeneration == fLoadGeneration[driveno]) {
+		fSIOManager->SetDeviceBusy(eSIODriveBase+driveno, false);
+
+		bool ok = job->fImage.IsNotNull();
+		if (ok && job->fImage->IsAtrImage()
+		    && RCPtrStaticCast<AtrImage>(job->fImage)->IsAtrMemoryImage()) {
+			// cheap if the loader already interned it into this store
+			RCPtrStaticCast<AtrMemoryImage>(job->fImage)->SetSectorStore(fSectorStore);
+		}
+		if (ok) {
+			ok = InstallDiskImage(driveno, job->fImage, job->fIsVirtual, true);
+		}
+		if (ok && job->fIsVirtual) {
+			RCPtrStaticCast<AtrSIOHandler>(GetSIOHandler(driveno))->SetVirtualImageObserver(job->fObserver);
+		}
+		if (!ok) {
+			AERROR("loading D%d: from \"%s\" failed", driveno, job->fPath);
+		}
+	}
 }
 
 bool DeviceManager::ReloadDrive(EDriveNumber driveno)
@@ -351,13 +890,27 @@ bool DeviceManager::ReloadDrive(EDriveNumber driveno)
 					} else {
 						ALOG("Reloading drive D%d:", driveno);
 
-						char* filename = strdup(diskImage->GetFilename());
+						char* filename;
+						bool overlay = DriveIsOverlayImage(driveno);
+
+						if (overlay) {
+							RCPtr<AtrOverlayImage> img = RCPtrStaticCast<AtrOverlayImage>(diskImage);
+							filename = strdup(img->GetBaseImage()->GetFilename());
+						} else {
+							filename = strdup(diskImage->GetFilename());
+						}
 
 						bool active = DeviceIsActive(driveno);
 						bool wp = DriveIsWriteProtected(driveno);
 						UnloadDiskImage(driveno);
 
-						if (!LoadDiskImage(driveno, filename, true)) {
+						bool loaded;
+						if (overlay) {
+							loaded = LoadOverlayImage(driveno, filename, true);
+						} else {
+							loaded = LoadDiskImage(driveno, filename, true);
+						}
+						if (!loaded) {
 							ALOG("ERROR reloading drive D%d:", driveno);
 							ok = false;
 						} else {
@@ -426,6 +979,16 @@ bool DeviceManager::ReloadDrive(EDriveNumber driveno)
 	return ok;
 }
 
+RCPtr<AtrImage> DeviceManager::CreateRamImage()
+{
+	if (fSectorStore.IsNotNull()) {
+		RCPtr<AtrMemoryImage> img(new AtrMemoryImage);
+		img->SetSectorStore(fSectorStore);
+		return img;
+	}
+	return new AtrSparseImage;
+}
+
 bool DeviceManager::CreateAtrMemoryImage(EDriveNumber driveno, EDiskFormat format, bool forceUnload)
 {
 	if (!DriveNumberOK(driveno)) {
@@ -437,7 +1000,7 @@ bool DeviceManager::CreateAtrMemoryImage(EDriveNumber driveno, EDiskFormat forma
 		return false;
 	}
 
-	RCPtr<AtrMemoryImage> img(new AtrMemoryImage);
+	RCPtr<AtrImage> img = CreateRamImage();
 	img->CreateImage(format);
 	img->SetChanged(false);
 
@@ -451,6 +1014,7 @@ bool DeviceManager::CreateAtrMemoryImage(EDriveNumber driveno, EDiskFormat forma
 		ALOG("unloading D%d:", driveno);
 		UnloadDiskImage(driveno);
 	}
+	CancelLoad(driveno);
 
 	if (!fSIOManager->RegisterHandler(eSIODriveBase+driveno, handler)) {
 		DPRINTF("cannot register device %d!",eSIODriveBase+driveno);
@@ -471,7 +1035,7 @@ bool DeviceManager::CreateAtrMemoryImage(EDriveNumber driveno, ESectorLength den
 		return false;
 	}
 
-	RCPtr<AtrMemoryImage> img(new AtrMemoryImage);
+	RCPtr<AtrImage> img = CreateRamImage();
 	img->CreateImage(density, sectors);
 	img->SetChanged(false);
 
@@ -485,6 +1049,7 @@ bool DeviceManager::CreateAtrMemoryImage(EDriveNumber driveno, ESectorLength den
 		ALOG("unloading D%d:", driveno);
 		UnloadDiskImage(driveno);
 	}
+	CancelLoad(driveno);
 
 	if (!fSIOManager->RegisterHandler(eSIODriveBase+driveno, handler)) {
 		DPRINTF("cannot register device %d!",eSIODriveBase+driveno);
@@ -510,9 +1075,11 @@ bool DeviceManager::UnloadDiskImage(EDriveNumber driveno)
 	}
 
 	for (int i=min; i<=max;i++) {
+		CancelLoad(EDriveNumber(i));
 		if (DriveInUse(EDriveNumber(i))) {
 			fSIOManager->UnregisterHandler(eSIODriveBase+i);
 		}
+		fDriveWriteBackSerial[i] = 0;
 	}
 	return true;
 }
@@ -612,11 +1179,15 @@ bool DeviceManager::WriteBackImage(EDriveNumber driveno)
 
 	if (driveno == eAllDrives) {
 		for (i=eMinDriveNumber;i<=eMaxDriveNumber;i++) {
-			if (DriveInUse(EDriveNumber(i))) {
+			// overlays share the filename of their base image,
+			// which must not be overwritten
+			if (DriveInUse(EDriveNumber(i)) && !DriveIsOverlayImage(EDriveNumber(i))) {
 				RCPtr<AbstractSIOHandler> absHandler = GetSIOHandler((EDriveNumber)i);
 				RCPtr<DiskImage> diskImage = absHandler->GetDiskImage();
 				if (!diskImage->IsVirtualImage() && diskImage->GetFilename() && diskImage->Changed()) {
-					if (!diskImage->WriteBackImageToFile()) {
+					if (WriteBackDriveImageInBackground(EDriveNumber(i), diskImage)) {
+						ALOG("writing D%d: to \"%s\" in background", i, diskImage->GetFilename());
+					} else if (!WriteBackDriveImage(EDriveNumber(i), diskImage)) {
 						ALOG("ERROR writing D%d: to \"%s\"", i, diskImage->GetFilename());
 						ok = false;
 					} else {
@@ -632,28 +1203,146 @@ bool DeviceManager::WriteBackImage(EDriveNumber driveno)
 		if (!DriveInUse(driveno)) {
 			return false;
 		}
+		if (DriveIsOverlayImage(driveno)) {
+			AWARN("D%d: is an overlay drive, write it to a new file instead", driveno);
+			return false;
+		}
 		RCPtr<AbstractSIOHandler> absHandler = GetSIOHandler(driveno);
 		RCPtr<DiskImage> diskImage = absHandler->GetDiskImage();
 		if (diskImage->IsVirtualImage() || (!diskImage->GetFilename())) {
 			return false;
 		}
-		if (!diskImage->WriteBackImageToFile()) {
+		if (WriteBackDriveImageInBackground(driveno, diskImage)) {
+			ALOG("writing D%d: to \"%s\" in background", driveno, diskImage->GetFilename());
+			return true;
+		}
+		if (!WriteBackDriveImage(driveno, diskImage)) {
 			return false;
 		}
 	}
 	return ok;
 }
 
+bool DeviceManager::WriteBackDriveImage(EDriveNumber driveno, const RCPtr<DiskImage>& diskImage)
+{
+	RCPtr<SectorJournal> journal = GetSectorJournal(driveno);
+	bool ok;
+
+	if (journal) {
+		journal->SuspendFolding();
+
+		// the folded sectors are still dirty, let the image know
+		// that the changed modification time is ours
+		time_t syncedMTime, foldedMTime;
+		if (journal->GetFoldedMTime(syncedMTime, foldedMTime) && diskImage->IsAtrImage()) {
+			RCPtrStaticCast<AtrImage>(diskImage)->SyncedFileWasUpdated(syncedMTime, foldedMTime);
+		}
+	}
+	ok = diskImage->WriteBackImageToFile();
+	if (journal) {
+		journal->ResumeFolding(ok);
+	} else if (ok) {
+		// image was changed before autosave was enabled
+		AttachSectorJournal(driveno);
+	}
+	return ok;
+}
+
+static bool IsCompressedImageFile(const char* filename)
+{
+	size_t len = strlen(filename);
+
+	// DCM encoding is expensive, too
+	return (len >= 3 && strcasecmp(filename + len - 3, ".gz") == 0)
+		|| (len >= 4 && strcasecmp(filename + len - 4, ".dcm") == 0);
+}
+
+bool DeviceManager::WriteBackDriveImageInBackground(EDriveNumber driveno, const RCPtr<DiskImage>& diskImage)
+{
+	if (!diskImage->IsAtrImage() || !IsCompressedImageFile(diskImage->GetFilename())) {
+		return false;
+	}
+	RCPtr<AtrImage> image = RCPtrStaticCast<AtrImage>(diskImage);
+	if (image->IsAtrOverlayImage()) {
+		return false;
+	}
+	if (!StartImageLoader()) {
+		return false;
+	}
+
+	// the loader thread gets its own copy of the image. It's
+	// owned by the job alone and never put into an RCPtr, as
+	// the reference count isn't thread safe.
+	AtrMemoryImage* snapshot = new AtrMemoryImage;
+	uint8_t buf[8192];
+	unsigned int sector;
+	unsigned int numSectors = image->GetNumberOfSectors();
+	unsigned int count;
+
+	if (!snapshot->CreateImage(image->GetSectorLength(), image->GetSectorsPerTrack(), image->GetTracksPerSide(), image->GetSides())
+	    || snapshot->GetNumberOfSectors() != numSectors) {
+		DPRINTF("creating snapshot of D%d: failed", driveno);
+		delete snapshot;
+		return false;
+	}
+	for (sector = 1; sector <= numSectors; sector += count) {
+		count = sizeof(buf) / image->GetSectorLength();
+		if (count > numSectors - sector + 1) {
+			count = numSectors - sector + 1;
+		}
+		if (!image->ReadSectors(sector, count, buf, sizeof(buf)) || !snapshot->WriteSectors(sector, count, buf, sizeof(buf))) {
+			DPRINTF("copying sectors %d-%d of D%d: failed", sector, sector + count - 1, driveno);
+			delete snapshot;
+			return false;
+		}
+	}
+	snapshot->SetWriteProtect(image->IsWriteProtected());
+
+	WriteBackJob* job = new WriteBackJob(driveno, snapshot, diskImage->GetFilename(), ++fWriteBackSerial);
+
+	// changes made from now on set the flag again
+	image->SetChanged(false);
+	fWriteBacksPending[driveno]++;
+	fDriveWriteBackSerial[driveno] = fWriteBackSerial;
+	fImageLoader->Submit(job);
+	return true;
+}
+
+void DeviceManager::FinishWriteBack(WriteBackJob* job)
+{
+	EDriveNumber driveno = job->fDrive;
+
+	fWriteBacksPending[driveno]--;
+
+	if (job->fOK) {
+		ALOG("wrote D%d: to \"%s\"", driveno, job->fFilename);
+	} else {
+		AERROR("writing D%d: to \"%s\" failed", driveno, job->fFilename);
+
+		// the image may have been unloaded or moved to another
+		// drive, or a later write-back may be pending
+		for (int i=eMinDriveNumber;i<=eMaxDriveNumber;i++) {
+			if (fDriveWriteBackSerial[i] == job->fSerial && DriveInUse(EDriveNumber(i))) {
+				GetSIOHandler(EDriveNumber(i))->GetDiskImage()->SetChanged(true);
+			}
+		}
+	}
+}
+
 bool DeviceManager::WriteBackImagesIfChanged()
 {
 	int i;
 	int ok=true;
 	for (i=eMinDriveNumber;i<=eMaxDriveNumber;i++) {
-		if (DriveInUse(EDriveNumber(i))) {
+		// overlays share the filename of their base image,
+		// which must not be overwritten
+		if (DriveInUse(EDriveNumber(i)) && !DriveIsOverlayImage(EDriveNumber(i))) {
 			RCPtr<AbstractSIOHandler> absHandler = GetSIOHandler((EDriveNumber)i);
 			RCPtr<DiskImage> diskImage = absHandler->GetDiskImage();
 			if (!diskImage->IsVirtualImage() && diskImage->GetFilename() && diskImage->Changed()) {
-				if (!diskImage->WriteBackImageToFile()) {
+				if (WriteBackDriveImageInBackground(EDriveNumber(i), diskImage)) {
+					ALOG("writing D%d: to \"%s\" in background", i, diskImage->GetFilename());
+				} else if (!WriteBackDriveImage(EDriveNumber(i), diskImage)) {
 					ALOG("ERROR writing D%d: to \"%s\"", i, diskImage->GetFilename());
 					ok = false;
 				} else {
@@ -685,6 +1374,9 @@ bool DeviceManager::WriteDiskImage(EDriveNumber driveno, const char* filename)
 	if (absHandler) {
 		RCPtr<DiskImage> diskImage = absHandler->GetDiskImage();
 
+		// the journal belongs to the old image file
+		DetachSectorJournal(driveno);
+
 		bool ok;
 #ifdef ENABLE_ATP
 		int len = strlen(filename);
@@ -735,6 +1427,7 @@ bool DeviceManager::WriteDiskImage(EDriveNumber driveno, const char* filename)
 error:
 #endif
 		if (!ok) {
+			AttachSectorJournal(driveno);
 			return false;
 		} else {
 			if (!diskImage->IsVirtualImage()) {
@@ -745,6 +1438,7 @@ error:
 				}
 				diskImage->SetFilename(absPath);
 				ALOG("wrote D%d: to \"%s\"", driveno, diskImage->GetFilename());
+				AttachSectorJournal(driveno);
 			} else {
 				ALOG("wrote D%d: to \"%s\"", driveno, filename);
 			}
@@ -756,6 +1450,131 @@ error:
 	return true;
 }
 
+bool DeviceManager::EnableSectorStore(bool on)
+{
+	RCPtr<SectorStore> store;
+	bool ret = true;
+
+	if (on == fSectorStore.IsNotNull()) {
+		return true;
+	}
+	if (on) {
+		store = new SectorStore;
+	}
+	fSectorStore = store;
+
+	// move the data of already loaded memory images into/out of the store
+	for (int i=eMinDriveNumber;i<=eMaxDriveNumber;i++) {
+		RCPtr<AtrImage> image = GetAtrImage(EDriveNumber(i));
+		if (image.IsNotNull() && image->IsAtrMemoryImage()) {
+			if (!RCPtrStaticCast<AtrMemoryImage>(image)->SetSectorStore(store)) {
+				AERROR("moving D%d: into sector store failed", i);
+				ret = false;
+			}
+		}
+	}
+	return ret;
+}
+
+bool DeviceManager::EnableAutosave(unsigned int seconds)
+{
+	int i;
+
+	if (fJournalFlusher.IsNotNull() && fJournalFlusher->GetInterval() == seconds) {
+		return true;
+	}
+
+	// journals of the old flusher are folded into the images
+	for (i=eMinDriveNumber;i<=eMaxDriveNumber;i++) {
+		DetachSectorJournal(EDriveNumber(i));
+	}
+	fJournalFlusher = 0;
+
+	if (seconds == 0) {
+		return true;
+	}
+
+	try {
+		fJournalFlusher = new JournalFlusher(seconds);
+	}
+	catch (ErrorObject& err) {
+		AERROR("%s", err.AsCString());
+		return false;
+	}
+
+	for (i=eMinDriveNumber;i<=eMaxDriveNumber;i++) {
+		AttachSectorJournal(EDriveNumber(i));
+	}
+	return true;
+}
+
+RCPtr<SectorJournal> DeviceManager::GetSectorJournal(EDriveNumber driveno) const
+{
+	RCPtr<AbstractSIOHandler> absHandler = GetSIOHandler(driveno);
+
+	if (absHandler.IsNull() || !absHandler->IsAtrSIOHandler()) {
+		return NULL;
+	}
+	return RCPtrStaticCast<AtrSIOHandler>(absHandler)->GetSectorJournal();
+}
+
+void DeviceManager::AttachSectorJournal(EDriveNumber driveno)
+{
+	if (fJournalFlusher.IsNull()) {
+		return;
+	}
+
+	RCPtr<AbstractSIOHandler> absHandler = GetSIOHandler(driveno);
+
+	if (absHandler.IsNull() || !absHandler->IsAtrSIOHandler()) {
+		return;
+	}
+	RCPtr<AtrSIOHandler> handler = RCPtrStaticCast<AtrSIOHandler>(absHandler);
+	if (handler->GetSectorJournal()) {
+		return;
+	}
+
+	// unsaved changes aren't in the journal, autosave starts
+	// after the image has been written back
+	RCPtr<AtrImage> image = handler->GetAtrImage();
+	if (image.IsNull() || image->Changed() || image->IsVirtualImage()) {
+		return;
+	}
+
+	RCPtr<SectorJournal> journal = SectorJournal::Create(image, fJournalFlusher);
+	if (journal.IsNotNull()) {
+		image->SetJournaled(true);
+	}
+	handler->SetSectorJournal(journal);
+}
+
+void DeviceManager::DetachSectorJournal(EDriveNumber driveno, bool commit)
+{
+	RCPtr<AbstractSIOHandler> absHandler = GetSIOHandler(driveno);
+
+	if (absHandler.IsNull() || !absHandler->IsAtrSIOHandler()) {
+		return;
+	}
+	RCPtr<AtrSIOHandler> handler = RCPtrStaticCast<AtrSIOHandler>(absHandler);
+	RCPtr<SectorJournal> journal = handler->GetSectorJournal();
+	if (journal.IsNull()) {
+		return;
+	}
+	if (commit && !journal->Commit()) {
+		AERROR("D%d: writing journal into \"%s\" failed", driveno, journal->GetImageFilename());
+	}
+
+	RCPtr<AtrImage> image = handler->GetAtrImage();
+	if (image.IsNotNull()) {
+		time_t syncedMTime, foldedMTime;
+		if (journal->GetFoldedMTime(syncedMTime, foldedMTime)) {
+			image->SyncedFileWasUpdated(syncedMTime, foldedMTime);
+		}
+		image->SetJournaled(false);
+	}
+	handler->SetSectorJournal(NULL);
+}
+
 bool DeviceManager::ExchangeDrives(EDriveNumber drive1, EDriveNumber drive2)
 {
 	if (!DriveNumberOK(drive1) || !DriveNumberOK(drive2)) {
@@ -765,6 +1584,10 @@ bool DeviceManager::ExchangeDrives(EDriveNumber drive1, EDriveNumber drive2)
 		DPRINTF("exchanging a drive with itself is not allowed!");
 		return false;
 	}
+	if (DriveIsLoading(drive1) || DriveIsLoading(drive2)) {
+		AERROR("cannot exchange drives while an image is loading");
+		return false;
+	}
 	RCPtr<AbstractSIOHandler> h1 (fSIOManager->GetHandler(eSIODriveBase+drive1));
 	RCPtr<AbstractSIOHandler> h2 (fSIOManager->GetHandler(eSIODriveBase+drive2));
 
@@ -773,6 +1596,10 @@ bool DeviceManager::ExchangeDrives(EDriveNumber drive1, EDriveNumber drive2)
 
 	fSIOManager->RegisterHandler(eSIODriveBase+drive1,h2);
 	fSIOManager->RegisterHandler(eSIODriveBase+drive2,h1);
+
+	unsigned int serial = fDriveWriteBackSerial[drive1];
+	fDriveWriteBackSerial[drive1] = fDriveWriteBackSerial[drive2];
+	fDriveWriteBackSerial[drive2] = serial;
 	return true;
 }
 
@@ -829,7 +1656,7 @@ bool DeviceManager::DriveIsChanged(EDriveNumber driveno) const
 			if (img.IsNull()) {
 				DPRINTF("got null image in DriveIsChanged()");
 			} else {
-				if (!img->IsVirtualImage() && img->Changed()) {
+				if (!img->IsVirtualImage() && (img->Changed() || fWriteBacksPending[i])) {
 					return true;
 				}
 			}
@@ -876,7 +1703,12 @@ unsigned int DeviceManager::GetDriveImageSize(EDriveNumber driveno) const
 
 int DeviceManager::DoServing(int otherReadPollDevice)
 {
-	return fSIOManager->DoServing(otherReadPollDevice);
+	int ret = fSIOManager->DoServing(otherReadPollDevice);
+
+	if (ret == 2) {
+		ProcessFinishedJobs();
+	}
+	return ret;
 }
 
 bool DeviceManager::DriveNumberOK(EDriveNumber driveno) const
@@ -24,10 +24,16 @@
 
 #include "SIOManager.h"
 #include "AtrImage.h"
+#include "AtrMemoryImage.h"
 #include "RCPtr.h"
 #include "RefCounted.h"
 #include "PrinterHandler.h"
 #include "CasHandler.h"
+#include "JournalFlusher.h"
+#include "SectorJournal.h"
+#include "SectorStore.h"
+#include "ImageLoader.h"
+#include "VirtualImageObserver.h"
 
 class DeviceManager : public RefCounted {
 public:
@@ -66,6 +72,13 @@ public:
 	static RCPtr<DiskImage> LoadDiskImage(const char* filename, bool beQuiet = false);
 	bool LoadDiskImage(EDriveNumber driveno, const char* filename, bool beQuiet = false, bool forceUnload = false);
 
+	// load the image as read-only base of a copy-on-write overlay,
+	// drives with overlays of the same file share the base image
+	bool LoadOverlayImage(EDriveNumber driveno, const char* filename, bool beQuiet = false, bool forceUnload = false);
+	// throw away all changes of an overlay drive
+	bool ResetOverlayDrive(EDriveNumber driveno);
+	bool DriveIsOverlayImage(EDriveNumber driveno) const;
+
 	bool ReloadDrive(EDriveNumber driveno);
 
 	bool CreateVirtualDrive(
@@ -73,6 +86,16 @@ public:
 	bool CreateVirtualDrive(
 		EDriveNumber driveno, const char* path, ESectorLength density, unsigned int sectors, bool MyDosFormat=true, bool forceUnload = false);
 
+	// load images and create virtual drives in a background thread,
+	// the drive NAKs all commands until loading has finished. The
+	// image is installed in DoServing, it returns 2 in this case.
+	bool LoadDiskImageAsync(EDriveNumber driveno, const char* filename, bool forceUnload = false);
+	bool CreateVirtualDriveAsync(
+		EDriveNumber driveno, const char* path, EDiskFormat format, bool forceUnload = false);
+	bool CreateVirtualDriveAsync(
+		EDriveNumber driveno, const char* path, ESectorLength density, unsigned int sectors, bool MyDosFormat=true, bool forceUnload = false);
+	bool DriveIsLoading(EDriveNumber driveno) const;
+
 	bool CreateAtrMemoryImage(EDriveNumber driveno, EDiskFormat format, bool forceUnload = false);
 	bool CreateAtrMemoryImage(EDriveNumber driveno, ESectorLength density, unsigned int sectors, bool forceUnload = false);
 	bool WriteDiskImage(EDriveNumber driveno, const char* filename);
@@ -115,6 +138,16 @@ public:
 	bool EnableStrictFormatChecking(bool on);
 	bool GetStrictFormatChecking() const;
 
+	// journal sector writes and fold them into the image files
+	// every "seconds" seconds, 0 disables autosave
+	bool EnableAutosave(unsigned int seconds);
+	inline unsigned int GetAutosaveInterval() const;
+
+	// keep sectors of all memory images in a shared store, so
+	// identical sectors are only stored once
+	bool EnableSectorStore(bool on);
+	static inline RCPtr<SectorStore> GetSectorStore();
+
 	int DoServing(int otherReadPollDevice=-1);
 
 	RCPtr<SIOManager> GetSIOManager();
@@ -145,6 +178,50 @@ private:
 	RCPtr<AbstractSIOHandler> GetSIOHandler(EDriveNumber driveno) const;
 	RCPtr<const AbstractSIOHandler> GetConstSIOHandler(EDriveNumber driveno) const;
 
+	RCPtr<ImageLoader> fImageLoader;
+
+	static bool GetImagePath(const char* filename, char* absPath, bool beQuiet);
+	static bool GetVirtualDrivePath(const char* path, char* absPath);
+
+	// empty RAM image, uses the sector store if it's enabled
+	RCPtr<AtrImage> CreateRamImage();
+
+	// these don't touch any shared objects and can be called
+	// from the image loader thread
+	static RCPtr<DiskImage> CreateDiskImage(const char* absPath, bool beQuiet, bool preferMemoryImage);
+	static bool BuildVirtualImage(const char* absPath, ESectorLength density, unsigned int sectors, bool MyDosFormat,
+		RCPtr<AtrMemoryImage>& image, RCPtr<VirtualImageObserver>& observer);
+
+	class DeviceJob;
+	class LoadJob;
+	class WriteBackJob;
+	bool StartImageLoader();
+	bool StartLoadJob(EDriveNumber driveno, LoadJob* job);
+	void CancelLoad(EDriveNumber driveno);
+	void ProcessFinishedJobs();
+	void FinishLoad(LoadJob* job);
+	void FinishWriteBack(WriteBackJob* job);
+
+	static bool GetVirtualDriveGeometry(EDiskFormat format, ESectorLength& density, unsigned int& sectors, bool& MyDosFormat);
+
+	bool InstallDiskImage(EDriveNumber driveno, const RCPtr<DiskImage>& image, bool beQuiet, bool forceUnload);
+
+	RCPtr<const AtrImage> FindOverlayBaseImage(const char* absPath) const;
+
+	void AttachSectorJournal(EDriveNumber driveno);
+	// stop autosaving and write the pending journal records into
+	// the image file. Unloading a drive or quitting discards them
+	// instead, as with any other unsaved change.
+	void DetachSectorJournal(EDriveNumber driveno, bool commit = true);
+	RCPtr<SectorJournal> GetSectorJournal(EDriveNumber driveno) const;
+
+	bool WriteBackDriveImage(EDriveNumber driveno, const RCPtr<DiskImage>& diskImage);
+
+	// compressed images are written by the loader thread, only a
+	// copy of the image data is taken here. Returns false if the
+	// image has to be written synchronously.
+	bool WriteBackDriveImageInBackground(EDriveNumber driveno, const RCPtr<DiskImage>& diskImage);
+
 	bool fUseHighSpeed;
 	SIOWrapper::ESIOTiming fSioTiming;
 
@@ -156,8 +233,28 @@ private:
 	bool fEnableXF551Mode;
 	SIOWrapper::ESIOServerCommandLine fCableType;
 	RCPtr<CasHandler> fCasHandler;
+	RCPtr<JournalFlusher> fJournalFlusher;
+
+	// bumped when a load is started or cancelled, results of
+	// outdated loads are thrown away
+	unsigned int fLoadGeneration[eMaxDriveNumber+1];
+
+	// background write-backs that haven't finished yet
+	unsigned int fWriteBacksPending[eMaxDriveNumber+1];
+	unsigned int fWriteBackSerial;
+	// serial of the last background write-back of the image in
+	// the drive, 0 if there is none
+	unsigned int fDriveWriteBackSerial[eMaxDriveNumber+1];
+
+	// used by the static LoadDiskImage, so it's not per-instance
+	static RCPtr<SectorStore> fSectorStore;
 };
 
+inline RCPtr<SectorStore> DeviceManager::GetSectorStore()
+{
+	return fSectorStore;
+}
+
 inline RCPtr<SIOManager> DeviceManager::GetSIOManager()
 {
 	return fSIOManager;
@@ -208,6 +305,14 @@ inline uint8_t DeviceManager::GetHighSpeedPokeyDivisor() const
 	return fPokeyDivisor;
 }
 
+inline unsigned int DeviceManager::GetAutosaveInterval() const
+{
+	if (fJournalFlusher.IsNull()) {
+		return 0;
+	}
+	return fJournalFlusher->GetInterval();
+}
+
 inline unsigned int DeviceManager::GetTapeSpeedPercent() const
 {
 	return fTapeSpeedPercent;
@@ -33,12 +33,12 @@
 #include "SIOTracer.h"
 
 DirEntry::DirEntry()
-	: fName(0), fType(eUnknown)
+	: fName(0), fType(eUnknown), fImageFormat(-1)
 {
 }
 
 DirEntry::DirEntry(const char* name, EEntryType type, off_t bytesize)
-	: fName(0), fLen(0), fType(type), fByteSize(bytesize)
+	: fName(0), fLen(0), fType(type), fByteSize(bytesize), fImageFormat(-1)
 {
 	SetName(name);
 }
@@ -56,6 +56,9 @@ public:
 	unsigned int fLen;
 	EEntryType fType;
 	off_t fByteSize;
+
+	// image format shown by the file selector, -1 if not probed yet
+	int fImageFormat;
 };
 
 class Directory : public RefCounted {
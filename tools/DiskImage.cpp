@@ -76,3 +76,52 @@ bool DiskImage::IsAtpImage() const
 {
 	return false;
 }
+
+unsigned int DiskImage::GetSectorLength(unsigned int /* sector */) const
+{
+	return GetSectorLength();
+}
+
+bool DiskImage::ReadSectors(unsigned int first, unsigned int count, uint8_t* buffer, size_t buffer_length) const
+{
+	unsigned int sector, len;
+	size_t pos = 0;
+
+	for (sector = first; sector < first + count; sector++) {
+		len = GetSectorLength(sector);
+		if (pos + len > buffer_length) {
+			DPRINTF("buffer too small in ReadSectors [ %d < %d ]", (int)buffer_length, (int)(pos + len));
+			return false;
+		}
+		if (!ReadSector(sector, buffer + pos, len)) {
+			return false;
+		}
+		pos += len;
+	}
+	return true;
+}
+
+bool DiskImage::WriteSectors(unsigned int first, unsigned int count, const uint8_t* buffer, size_t buffer_length)
+{
+	unsigned int sector, len;
+	size_t pos = 0;
+
+	for (sector = first; sector < first + count; sector++) {
+		len = GetSectorLength(sector);
+		if (pos + len > buffer_length) {
+			DPRINTF("buffer too small in WriteSectors [ %d < %d ]", (int)buffer_length, (int)(pos + len));
+			return false;
+		}
+		if (!WriteSector(sector, buffer + pos, len)) {
+			return false;
+		}
+		pos += len;
+	}
+	return true;
+}
+
+const uint8_t* DiskImage::GetSectorPtr(unsigned int /* sector */, unsigned int& length) const
+{
+	length = 0;
+	return 0;
+}
@@ -88,6 +88,8 @@ public:
 	inline bool IsWriteProtected() const;
 
 	virtual ESectorLength GetSectorLength() const = 0;
+	// images with 128 byte boot sectors override this
+	virtual unsigned int GetSectorLength(unsigned int sector) const;
 	virtual unsigned int GetNumberOfSectors() const = 0;
 	virtual size_t GetImageSize() const = 0;
 
@@ -113,6 +115,26 @@ public:
 		const uint8_t* buffer,	
 		unsigned int buffer_length) = 0;
 
+	// read/write "count" consecutive sectors, starting at sector
+	// "first". The sectors are packed into the buffer, which must
+	// be large enough to hold all of them.
+	virtual bool ReadSectors(unsigned int first, unsigned int count,
+		uint8_t* buffer,
+		size_t buffer_length) const;
+
+	virtual bool WriteSectors(unsigned int first, unsigned int count,
+		const uint8_t* buffer,
+		size_t buffer_length);
+
+	// read-only view of the sector data in the image, without
+	// copying. Returns NULL if the image doesn't support this or
+	// the data isn't in memory yet (fall back to ReadSector then),
+	// it's called before the command is ACKed so it must never
+	// decompress. The pointer is only valid until the image is
+	// modified.
+	virtual const uint8_t* GetSectorPtr(unsigned int sector,
+		unsigned int& length) const;
+
 private:
 
 	char* fFilename;
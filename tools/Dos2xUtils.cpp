@@ -995,6 +995,8 @@ RCPtr<Dos2xUtils::Dos2Dir> Dos2xUtils::GetDos2Directory(bool beQuiet, unsigned i
 	unsigned int sector = dirSector;
 	unsigned int fileno;
 	uint8_t secbuf[256];
+	uint8_t dirbuf[8*256];
+	const uint8_t* dirsecbuf;
 	unsigned int seclen;
 	bool done = false;
 	unsigned int i;
@@ -1031,19 +1033,27 @@ RCPtr<Dos2xUtils::Dos2Dir> Dos2xUtils::GetDos2Directory(bool beQuiet, unsigned i
 		}
 	}
 
+	// the directory is read at once, it's always 8 consecutive
+	// sectors of full length
+	if (fImage->GetSectorLength(dirSector) != seclen) {
+		DPRINTF("illegal directory sector %d", dirSector);
+		return dir;
+	}
+	if (!fImage->ReadSectors(dirSector, 8, dirbuf, sizeof(dirbuf))) {
+		DPRINTF("error reading directory sectors %d-%d", dirSector, dirSector + 7);
+		return dir;
+	}
+
 	while (!done) {
-		if (!fImage->ReadSector(sector, secbuf, seclen)) {
-			DPRINTF("error reading directory sector %d", sector);
-			return dir;
-		}
+		dirsecbuf = dirbuf + (sector - dirSector) * seclen;
 		if ( isBigImage && (sector == dirSector) ) {
-			if (secbuf[128] != 0) {
+			if (dirsecbuf[128] != 0) {
 				entriesPerSector = 16;
 			}
 		}
 		fileno = 0;
 		while (fileno < entriesPerSector) {
-			uint8_t stat = secbuf[fileno*16];
+			uint8_t stat = dirsecbuf[fileno*16];
 			if (stat == 0) {
 				done = true;
 				break;
@@ -1052,12 +1062,12 @@ RCPtr<Dos2xUtils::Dos2Dir> Dos2xUtils::GetDos2Directory(bool beQuiet, unsigned i
 				char* str = new char[Dos2Dir::eFileWidth + 1];
 				dir->fFiles[dir->fFileCount] = str;
 				char* rawstr = new char[12];
-				memcpy(rawstr, secbuf+fileno*16+5, 11);
+				memcpy(rawstr, dirsecbuf+fileno*16+5, 11);
 				rawstr[11] = 0;
 				dir->fRawName[dir->fFileCount] = rawstr;
 				dir->fFileStatus[dir->fFileCount] = stat;
-				dir->fStartingSector[dir->fFileCount] = secbuf[fileno*16+3] + (secbuf[fileno*16+4] << 8);
-				dir->fSectorLength[dir->fFileCount] = secbuf[fileno*16+1] + (secbuf[fileno*16+2] << 8);
+				dir->fStartingSector[dir->fFileCount] = dirsecbuf[fileno*16+3] + (dirsecbuf[fileno*16+4] << 8);
+				dir->fSectorLength[dir->fFileCount] = dirsecbuf[fileno*16+1] + (dirsecbuf[fileno*16+2] << 8);
 
 				if (entriesPerSector == 8) {
 					dir->fEntryNumber[dir->fFileCount] = (sector - dirSector) * 8 + fileno;
@@ -1080,7 +1090,7 @@ RCPtr<Dos2xUtils::Dos2Dir> Dos2xUtils::GetDos2Directory(bool beQuiet, unsigned i
 				}
 				
 				for (i=0;i<11;i++) {
-					char tmp = secbuf[fileno*16+5+i] & 0x7f;
+					char tmp = dirsecbuf[fileno*16+5+i] & 0x7f;
 					if (tmp < 32 || tmp > 126) {
 						tmp='.';
 					}
@@ -1092,7 +1102,7 @@ RCPtr<Dos2xUtils::Dos2Dir> Dos2xUtils::GetDos2Directory(bool beQuiet, unsigned i
 					str[13] = ' ';
 				}
 				str[14] = 0;
-				unsigned int sec = secbuf[fileno*16+1] + (secbuf[fileno*16+2] << 8);
+				unsigned int sec = dirsecbuf[fileno*16+1] + (dirsecbuf[fileno*16+2] << 8);
 				if (sec < 10000) {
 					snprintf(str+14, Dos2Dir::eFileWidth-13, "%04d  ", sec);
 				} else {
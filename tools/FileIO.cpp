@@ -19,12 +19,20 @@
 */
 
 #include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#ifndef WINVER
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
 
 #include "FileIO.h"
 #include "AtariDebug.h"
 
 
 FileIO::FileIO()
+	: fReadPtr(0), fReadEnd(0)
 {
 }
 
@@ -32,27 +40,11 @@ FileIO::~FileIO()
 {
 }
 
-bool FileIO::ReadByte(uint8_t& byte)
-{
-	return ReadBlock(&byte, 1) == 1;
-}
-
 bool FileIO::WriteByte(const uint8_t& byte)
 {
 	return WriteBlock(&byte, 1) == 1;
 }
 
-bool FileIO::ReadWord(uint16_t& word)
-{
-	uint8_t buf[2];
-
-	if (ReadBlock(buf,2) != 2) {
-		return false;
-	}
-	word = buf[0] | (buf[1] << 8);
-	return true;
-}
-
 bool FileIO::WriteWord(const uint16_t& word)
 {
 	uint8_t buf[2];
@@ -66,17 +58,6 @@ bool FileIO::WriteWord(const uint16_t& word)
 	return true;
 }
 
-bool FileIO::ReadBigEndianWord(uint16_t& word)
-{
-	uint8_t buf[2];
-
-	if (ReadBlock(buf,2) != 2) {
-		return false;
-	}
-	word = (buf[0] << 8) | buf[1];
-	return true;
-}
-
 bool FileIO::WriteBigEndianWord(const uint16_t& word)
 {
 	uint8_t buf[2];
@@ -90,17 +71,6 @@ bool FileIO::WriteBigEndianWord(const uint16_t& word)
 	return true;
 }
 
-bool FileIO::ReadDWord(uint32_t& word)
-{
-	uint8_t buf[4];
-
-	if (ReadBlock(buf,4) != 4) {
-		return false;
-	}
-	word = buf[0] | (buf[1] << 8) | (buf[2] << 16) | (buf[3] << 24);
-	return true;
-}
-
 bool FileIO::WriteDWord(const uint32_t& word)
 {
 	uint8_t buf[4];
@@ -116,17 +86,6 @@ bool FileIO::WriteDWord(const uint32_t& word)
 	return true;
 }
 
-bool FileIO::ReadBigEndianDWord(uint32_t& word)
-{
-	uint8_t buf[4];
-
-	if (ReadBlock(buf,4) != 4) {
-		return false;
-	}
-	word = (buf[0] << 24) | (buf[1] << 16) | (buf[2] << 8) | buf[3];
-	return true;
-}
-
 bool FileIO::WriteBigEndianDWord(const uint32_t& word)
 {
 	uint8_t buf[4];
@@ -147,6 +106,13 @@ bool FileIO::Unlink(const char* filename)
 	return unlink(filename) == 0;
 }
 
+bool FileIO::IsCompressed() const
+{
+	return false;
+}
+
+#ifdef WINVER
+
 StdFileIO::StdFileIO()
 	: super(), fFile(0)
 {
@@ -252,8 +218,296 @@ bool StdFileIO::IsOpen() const
 	return fFile != 0;
 }
 
+#else // WINVER
+
+StdFileIO::StdFileIO()
+	: super(), fFd(-1), fWriting(false), fBuffer(0), fBufferPos(0), fWriteLength(0)
+{
+}
+
+StdFileIO::~StdFileIO()
+{
+	if (IsOpen()) {
+		Close();
+		AssertMsg(false,"file not closed at ~StdFileIO!");
+	}
+	free(fBuffer);
+}
+
+bool StdFileIO::OpenRead(const char* filename)
+{
+	if (IsOpen()) {
+		Assert(false);
+		return false;
+	}
+
+	if (!fBuffer) {
+		void* buf;
+		if (posix_memalign(&buf, eAlignment, eBufferSize)) {
+			return false;
+		}
+		fBuffer = (uint8_t*) buf;
+	}
+
+	fFd = open(filename, O_RDONLY);
+	if (fFd < 0) {
+		return false;
+	}
+#ifdef POSIX_FADV_SEQUENTIAL
+	posix_fadvise(fFd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+	fWriting = false;
+	fBufferPos = 0;
+	fWriteLength = 0;
+	fReadPtr = fReadEnd = fBuffer;
+	return true;
+}
+
+bool StdFileIO::OpenWrite(const char* filename)
+{
+	if (IsOpen()) {
+		Assert(false);
+		return false;
+	}
+
+	if (!fBuffer) {
+		void* buf;
+		if (posix_memalign(&buf, eAlignment, eBufferSize)) {
+			return false;
+		}
+		fBuffer = (uint8_t*) buf;
+	}
+
+	fFd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fFd < 0) {
+		return false;
+	}
+	fWriting = true;
+	fBufferPos = 0;
+	fWriteLength = 0;
+	fReadPtr = fReadEnd = 0;
+	return true;
+}
+
+bool StdFileIO::Close()
+{
+	if (!IsOpen()) {
+		Assert(false);
+		return false;
+	}
+
+	bool ret = FlushBuffer();
+	if (close(fFd) != 0) {
+		ret = false;
+	}
+	fFd = -1;
+	fReadPtr = fReadEnd = 0;
+	return ret;
+}
+
+bool StdFileIO::FillBuffer()
+{
+	off_t pos = Tell();
+	off_t start = pos & ~(off_t)(eAlignment - 1);
+	ssize_t cnt;
+
+	do {
+		cnt = pread(fFd, fBuffer, eBufferSize, start);
+	} while (cnt < 0 && errno == EINTR);
+
+	if (cnt <= pos - start) {
+		// EOF or error, keep the position
+		fBufferPos = pos;
+		fReadPtr = fReadEnd = fBuffer;
+		return false;
+	}
+	fBufferPos = start;
+	fReadPtr = fBuffer + (pos - start);
+	fReadEnd = fBuffer + cnt;
+	return true;
+}
+
+bool StdFileIO::FlushBuffer()
+{
+	unsigned int pos = 0;
+
+	if (!fWriting) {
+		return true;
+	}
+	while (pos < fWriteLength) {
+		ssize_t cnt = pwrite(fFd, fBuffer + pos, fWriteLength - pos, fBufferPos + pos);
+		if (cnt < 0 && errno == EINTR) {
+			continue;
+		}
+		if (cnt <= 0) {
+			// drop the data, the error was reported to the caller
+			fBufferPos += pos;
+			fWriteLength = 0;
+			return false;
+		}
+		pos += cnt;
+	}
+	fBufferPos += fWriteLength;
+	fWriteLength = 0;
+	return true;
+}
+
+unsigned int StdFileIO::ReadBlock(void* buf, unsigned int len)
+{
+	if (!IsOpen() || fWriting) {
+		Assert(false);
+		return 0;
+	}
+	uint8_t* dest = (uint8_t*) buf;
+	unsigned int total = 0;
+
+	while (total < len) {
+		unsigned int avail = fReadEnd - fReadPtr;
+		if (avail) {
+			if (avail > len - total) {
+				avail = len - total;
+			}
+			memcpy(dest + total, fReadPtr, avail);
+			fReadPtr += avail;
+			total += avail;
+			continue;
+		}
+
+		// read big aligned blocks directly, bypassing the buffer
+		off_t pos = Tell();
+		unsigned int direct = (len - total) & ~(eAlignment - 1);
+		if (direct >= eBufferSize && (pos & (eAlignment - 1)) == 0) {
+			ssize_t cnt = pread(fFd, dest + total, direct, pos);
+			if (cnt < 0 && errno == EINTR) {
+				continue;
+			}
+			if (cnt <= 0) {
+				break;
+			}
+			total += cnt;
+			fBufferPos = pos + cnt;
+			fReadPtr = fReadEnd = fBuffer;
+			if ((unsigned int) cnt < direct) {
+				break;
+			}
+			continue;
+		}
+		if (!FillBuffer()) {
+			break;
+		}
+	}
+	return total;
+}
+
+unsigned int StdFileIO::WriteBlock(const void* buf, unsigned int len)
+{
+	if (!IsOpen() || !fWriting) {
+		Assert(false);
+		return 0;
+	}
+	const uint8_t* src = (const uint8_t*) buf;
+	unsigned int total = 0;
+
+	while (total < len) {
+		unsigned int cnt = eBufferSize - fWriteLength;
+		if (cnt > len - total) {
+			cnt = len - total;
+		}
+		memcpy(fBuffer + fWriteLength, src + total, cnt);
+		fWriteLength += cnt;
+		total += cnt;
+		if (fWriteLength == eBufferSize && !FlushBuffer()) {
+			return 0;
+		}
+	}
+	return total;
+}
+
+off_t StdFileIO::GetFileLength()
+{
+	if (!IsOpen()) {
+		Assert(false);
+		return 0;
+	}
+	struct stat st;
+
+	FlushBuffer();
+	if (fstat(fFd, &st) != 0) {
+		return 0;
+	}
+	return st.st_size;
+}
+
+off_t StdFileIO::Tell()
+{
+	if (!IsOpen()) {
+		Assert(false);
+		return 0;
+	}
+	if (fWriting) {
+		return fBufferPos + fWriteLength;
+	}
+	return fBufferPos + (fReadPtr - fBuffer);
+}
+
+bool StdFileIO::Seek(off_t pos)
+{
+	if (!IsOpen()) {
+		Assert(false);
+		return false;
+	}
+	if (pos < 0) {
+		return false;
+	}
+	if (fWriting) {
+		if (!FlushBuffer()) {
+			return false;
+		}
+		fBufferPos = pos;
+		return true;
+	}
+	// stay in the buffer if possible, eg when rewinding after probing
+	if (pos >= fBufferPos && pos <= fBufferPos + (fReadEnd - fBuffer)) {
+		fReadPtr = fBuffer + (pos - fBufferPos);
+	} else {
+		fBufferPos = pos;
+		fReadPtr = fReadEnd = fBuffer;
+	}
+	return true;
+}
+
+bool StdFileIO::IsOpen() const
+{
+	return fFd >= 0;
+}
+
+#endif // WINVER
+
 #ifdef USE_ZLIB
 
+int GZFileIO::fCompressionLevel = Z_DEFAULT_COMPRESSION;
+int GZFileIO::fCompressionStrategy = Z_DEFAULT_STRATEGY;
+
+bool GZFileIO::SetCompression(int level, int strategy)
+{
+	if (level < Z_DEFAULT_COMPRESSION || level > Z_BEST_COMPRESSION) {
+		return false;
+	}
+	switch (strategy) {
+	case Z_DEFAULT_STRATEGY:
+	case Z_FILTERED:
+	case Z_HUFFMAN_ONLY:
+	case Z_RLE:
+	case Z_FIXED:
+		break;
+	default:
+		return false;
+	}
+	fCompressionLevel = level;
+	fCompressionStrategy = strategy;
+	return true;
+}
+
 GZFileIO::GZFileIO()
 	: super(), fFile(0)
 {
@@ -285,7 +539,22 @@ bool GZFileIO::OpenWrite(const char* filename)
 		return false;
 	}
 
-	fFile = gzopen(filename,"wb");
+	char mode[5] = "wb";
+	char* p = mode + 2;
+
+	if (fCompressionLevel >= 0) {
+		*p++ = '0' + fCompressionLevel;
+	}
+	switch (fCompressionStrategy) {
+	case Z_FILTERED: *p++ = 'f'; break;
+	case Z_HUFFMAN_ONLY: *p++ = 'h'; break;
+	case Z_RLE: *p++ = 'R'; break;
+	case Z_FIXED: *p++ = 'F'; break;
+	default: break;
+	}
+	*p = 0;
+
+	fFile = gzopen(filename, mode);
 	return IsOpen();
 }
 
@@ -367,4 +636,139 @@ bool GZFileIO::IsOpen() const
 	return fFile != 0;
 }
 
+bool GZFileIO::IsCompressed() const
+{
+	return fFile != 0 && !gzdirect(fFile);
+}
+
 #endif
+
+MemoryFileIO::MemoryFileIO()
+	: super(), fData(0), fLength(0), fIsOpen(false)
+{
+}
+
+MemoryFileIO::~MemoryFileIO()
+{
+	if (IsOpen()) {
+		Close();
+		AssertMsg(false,"file not closed at ~MemoryFileIO!");
+	}
+}
+
+bool MemoryFileIO::OpenRead(const char* filename)
+{
+	if (IsOpen()) {
+		Assert(false);
+		return false;
+	}
+
+	RCPtr<FileIO> fileio;
+#ifdef USE_ZLIB
+	fileio = new GZFileIO();
+#else
+	fileio = new StdFileIO();
+#endif
+	if (!fileio->OpenRead(filename)) {
+		return false;
+	}
+
+	size_t size = 0x10000;
+	unsigned int s;
+
+	fData = new uint8_t[size];
+	fLength = 0;
+	while ( (s = fileio->ReadBlock(fData + fLength, size - fLength)) > 0) {
+		fLength += s;
+		if (fLength == size) {
+			uint8_t* tmp = new uint8_t[size * 2];
+			memcpy(tmp, fData, fLength);
+			delete[] fData;
+			fData = tmp;
+			size *= 2;
+		}
+	}
+	fileio->Close();
+
+	fReadPtr = fData;
+	fReadEnd = fData + fLength;
+	fIsOpen = true;
+	return true;
+}
+
+bool MemoryFileIO::OpenWrite(const char*)
+{
+	Assert(false);
+	return false;
+}
+
+bool MemoryFileIO::Close()
+{
+	if (!IsOpen()) {
+		Assert(false);
+		return false;
+	}
+
+	delete[] fData;
+	fData = 0;
+	fLength = 0;
+	fReadPtr = fReadEnd = 0;
+	fIsOpen = false;
+	return true;
+}
+
+unsigned int MemoryFileIO::ReadBlock(void* buf, unsigned int len)
+{
+	if (!IsOpen()) {
+		Assert(false);
+		return 0;
+	}
+	if (len > (size_t)(fReadEnd - fReadPtr)) {
+		len = fReadEnd - fReadPtr;
+	}
+	memcpy(buf, fReadPtr, len);
+	fReadPtr += len;
+	return len;
+}
+
+unsigned int MemoryFileIO::WriteBlock(const void*, unsigned int)
+{
+	Assert(false);
+	return 0;
+}
+
+off_t MemoryFileIO::GetFileLength()
+{
+	if (!IsOpen()) {
+		Assert(false);
+		return 0;
+	}
+	return fLength;
+}
+
+off_t MemoryFileIO::Tell()
+{
+	if (!IsOpen()) {
+		Assert(false);
+		return 0;
+	}
+	return fReadPtr - fData;
+}
+
+bool MemoryFileIO::Seek(off_t pos)
+{
+	if (!IsOpen()) {
+		Assert(false);
+		return false;
+	}
+	if (pos < 0 || (size_t) pos > fLength) {
+		return false;
+	}
+	fReadPtr = fData + pos;
+	return true;
+}
+
+bool MemoryFileIO::IsOpen() const
+{
+	return fIsOpen;
+}
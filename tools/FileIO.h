@@ -49,30 +49,124 @@ public:
 	virtual bool Seek(off_t pos) = 0;
 	virtual off_t Tell() = 0;
 
-	bool ReadByte(uint8_t& byte);
+	inline bool ReadByte(uint8_t& byte);
 	bool WriteByte(const uint8_t& byte);
 
 	/* read/write lo, hi byte */
-	bool ReadWord(uint16_t& word);
+	inline bool ReadWord(uint16_t& word);
 	bool WriteWord(const uint16_t& word);
 
 	/* read/write hi, lo byte */
-	bool ReadBigEndianWord(uint16_t& word);
+	inline bool ReadBigEndianWord(uint16_t& word);
 	bool WriteBigEndianWord(const uint16_t& word);
 
 	/* read/write lo, mid1, mid2, hi byte */
-	bool ReadDWord(uint32_t& word);
+	inline bool ReadDWord(uint32_t& word);
 	bool WriteDWord(const uint32_t& word);
 
 	/* read/write hi, mid2, mid1, lo byte */
-	bool ReadBigEndianDWord(uint32_t& word);
+	inline bool ReadBigEndianDWord(uint32_t& word);
 	bool WriteBigEndianDWord(const uint32_t& word);
 
 	virtual bool Unlink(const char* filename);
 
 	virtual bool IsOpen() const = 0;
+
+	// true if the data read is decompressed (valid after the first read)
+	virtual bool IsCompressed() const;
+
+protected:
+	// Buffered implementations point the read window at the data
+	// following the current file position, the small Read* functions
+	// above are served from there without a virtual call and only
+	// fall back to ReadBlock when the window is exhausted.
+	const uint8_t* fReadPtr;
+	const uint8_t* fReadEnd;
+
+private:
+	// returns a pointer to the next len bytes, either in the
+	// read window or copied to tmp. NULL if they couldn't be read
+	inline const uint8_t* ReadData(uint8_t* tmp, unsigned int len);
 };
 
+inline const uint8_t* FileIO::ReadData(uint8_t* tmp, unsigned int len)
+{
+	if ((size_t)(fReadEnd - fReadPtr) >= len) {
+		const uint8_t* data = fReadPtr;
+		fReadPtr += len;
+		return data;
+	}
+	if (ReadBlock(tmp, len) != len) {
+		return 0;
+	}
+	return tmp;
+}
+
+inline bool FileIO::ReadByte(uint8_t& byte)
+{
+	if (fReadPtr != fReadEnd) {
+		byte = *fReadPtr++;
+		return true;
+	}
+	return ReadBlock(&byte, 1) == 1;
+}
+
+inline bool FileIO::ReadWord(uint16_t& word)
+{
+	uint8_t tmp[2];
+	const uint8_t* buf = ReadData(tmp, 2);
+
+	if (!buf) {
+		return false;
+	}
+	word = buf[0] | (buf[1] << 8);
+	return true;
+}
+
+inline bool FileIO::ReadBigEndianWord(uint16_t& word)
+{
+	uint8_t tmp[2];
+	const uint8_t* buf = ReadData(tmp, 2);
+
+	if (!buf) {
+		return false;
+	}
+	word = (buf[0] << 8) | buf[1];
+	return true;
+}
+
+inline bool FileIO::ReadDWord(uint32_t& word)
+{
+	uint8_t tmp[4];
+	const uint8_t* buf = ReadData(tmp, 4);
+
+	if (!buf) {
+		return false;
+	}
+	word = buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((uint32_t)buf[3] << 24);
+	return true;
+}
+
+inline bool FileIO::ReadBigEndianDWord(uint32_t& word)
+{
+	uint8_t tmp[4];
+	const uint8_t* buf = ReadData(tmp, 4);
+
+	if (!buf) {
+		return false;
+	}
+	word = ((uint32_t)buf[0] << 24) | (buf[1] << 16) | (buf[2] << 8) | buf[3];
+	return true;
+}
+
+/*
+ * Unbuffered file descriptor IO with our own page aligned buffer.
+ * Reads and refills always start at multiples of eAlignment, large
+ * reads go directly into the caller's buffer, and the kernel is told
+ * that files opened for reading are accessed sequentially.
+ *
+ * The windows version uses plain stdio in binary mode.
+ */
 class StdFileIO : public FileIO
 {
 public:
@@ -96,7 +190,28 @@ public:
 private:
 	typedef FileIO super;
 
+#ifdef WINVER
 	FILE* fFile;
+#else
+	enum {
+		eAlignment = 4096,
+		eBufferSize = 0x10000
+	};
+
+	// read the buffer containing the current position
+	bool FillBuffer();
+
+	bool FlushBuffer();
+
+	int fFd;
+	bool fWriting;
+
+	uint8_t* fBuffer;
+	// file offset of the buffer start
+	off_t fBufferPos;
+	// number of bytes in the buffer not written yet
+	unsigned int fWriteLength;
+#endif
 };
 
 #ifdef USE_ZLIB
@@ -121,12 +236,57 @@ public:
 
 	virtual bool IsOpen() const;
 
+	virtual bool IsCompressed() const;
+
+	// compression level (0..9, -1 = zlib default) and strategy
+	// (Z_DEFAULT_STRATEGY, Z_FILTERED, Z_HUFFMAN_ONLY, Z_RLE or
+	// Z_FIXED) used for files opened for writing
+	static bool SetCompression(int level, int strategy);
+
 private:
 	typedef FileIO super;
 
 	gzFile fFile;
+
+	static int fCompressionLevel;
+	static int fCompressionStrategy;
 };
 
 #endif
 
+/*
+ * Read-only, the whole file is read into memory when it's opened
+ * so seeking is cheap. With zlib enabled compressed files are
+ * uncompressed transparently.
+ */
+class MemoryFileIO : public FileIO
+{
+public:
+	MemoryFileIO();
+	virtual ~MemoryFileIO();
+
+	virtual bool OpenRead(const char* filename);
+	virtual bool OpenWrite(const char* filename);
+
+	virtual bool Close();
+
+	virtual unsigned int ReadBlock(void* buf, unsigned int len);
+	virtual unsigned int WriteBlock(const void* buf, unsigned int len);
+
+	virtual off_t GetFileLength();
+	virtual bool Seek(off_t pos);
+	virtual off_t Tell();
+
+	virtual bool IsOpen() const;
+
+private:
+	typedef FileIO super;
+
+	// the read window covers the data from the current position
+	// to the end of the file
+	uint8_t* fData;
+	size_t fLength;
+	bool fIsOpen;
+};
+
 #endif
@@ -27,6 +27,7 @@
 
 #include "OS.h"
 #include "FileSelect.h"
+#include "ImageFormat.h"
 #include "AtariDebug.h"
 #include "MiscUtils.h"
 #include "SIOTracer.h"
@@ -520,6 +521,13 @@ void FileSelect::DisplayDirEntry(unsigned int relativePos, bool highlight)
 					wclrtoeol(fWindow);
 				}
 			}
+			// image format in the last column, if there's room for it
+			if (e->fType == DirEntry::eFile && len + 8 <= fColumns) {
+				const char* tag = GetImageFormatTag(e);
+				if (tag) {
+					mvwaddstr(fWindow, relativePos, fColumns - strlen(tag), tag);
+				}
+			}
 			if (highlight) {
 				wbkgdset(fWindow, fColorStandard | ' ');
 				wattrset(fWindow, fColorStandard);
@@ -567,6 +575,31 @@ DirEntry::EEntryType FileSelect::BuildFilename(char* filename)
 	return DirEntry::eUnknown;
 }
 
+const char* FileSelect::GetImageFormatTag(DirEntry* e)
+{
+	static char tag[16];
+	bool compressed = false;
+
+	// probe each file only once, the directory is cached
+	if (e->fImageFormat < 0) {
+		char filename[PATH_MAX];
+		// only regular files, opening a fifo would block
+		if (e->fType != DirEntry::eFile
+		    || snprintf(filename, PATH_MAX, "%s%c%s", fPath, DIR_SEPARATOR, e->fName) >= PATH_MAX) {
+			e->fImageFormat = ImageFormat::eUnknownFormat * 2;
+		} else {
+			e->fImageFormat = ImageFormat::ProbeFile(filename, compressed) * 2 + (compressed ? 1 : 0);
+		}
+	}
+
+	ImageFormat::EFormat format = ImageFormat::EFormat(e->fImageFormat / 2);
+	if (format == ImageFormat::eUnknownFormat) {
+		return 0;
+	}
+	snprintf(tag, sizeof(tag), "%s%s", ImageFormat::GetFormatName(format), (e->fImageFormat & 1) ? " gz" : "");
+	return tag;
+}
+
 void FileSelect::SetEnableVirtualDriveKey(bool on)
 {
 	fEnableVirtualDriveKey = on;
@@ -60,6 +60,9 @@ private:
 
 	DirEntry::EEntryType BuildFilename(char* filename);
 
+	// short name of the image format, 0 if unknown
+	const char* GetImageFormatTag(DirEntry* e);
+
 	CursesFrontend* fFrontend;
 	WINDOW* fWindow;
 	WINDOW* fInputLineWindow;
@@ -0,0 +1,566 @@
+/*
+   GzIndex.cpp - random access to gzip compressed files via an index
+   of inflate access points (like zran.c from the zlib examples)
+
+   Copyright (C) 2026 Matthias Reichl <hias@horus.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#ifdef USE_ZLIB
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "GzIndex.h"
+#include "Crc32.h"
+#include "SIOTracer.h"
+#include "AtariDebug.h"
+
+// cache file layout, native byte order:
+// header: "AGZI", version, path length, number of access points,
+//         file size, file mtime, uncompressed size
+// followed by the path and the access points:
+//         out, in, bits, has window, [window]
+#define GZINDEX_MAGIC "AGZI"
+#define GZINDEX_VERSION 1
+
+static ssize_t pread_full(int fd, uint8_t* buf, size_t len, off_t pos)
+{
+	size_t done = 0;
+	ssize_t s;
+	while (done < len) {
+		s = pread(fd, buf + done, len - done, pos + done);
+		if (s < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		if (s == 0) {
+			break;
+		}
+		done += s;
+	}
+	return done;
+}
+
+GzIndex::GzIndex()
+	: fFilename(0),
+	  fFd(-1),
+	  fFileSize(0),
+	  fFileMTime(0),
+	  fUncompressedSize(0),
+	  fUseCounter(0)
+{
+}
+
+GzIndex::~GzIndex()
+{
+	ReleaseSpans();
+	FreeIndex();
+	if (fFd >= 0) {
+		close(fFd);
+	}
+	if (fFilename) {
+		free(fFilename);
+	}
+}
+
+RCPtr<GzIndex> GzIndex::Open(const char* filename, bool beQuiet)
+{
+	RCPtr<GzIndex> index(new GzIndex);
+
+	if (!index->OpenFile(filename, beQuiet)) {
+		return RCPtr<GzIndex>();
+	}
+	if (index->LoadIndex()) {
+		return index;
+	}
+	if (!index->BuildIndex()) {
+		if (!beQuiet) {
+			DPRINTF("cannot build gzip index for \"%s\"", filename);
+		}
+		return RCPtr<GzIndex>();
+	}
+	// a single access point means the whole file is inflated
+	// anyway, no need to cache that
+	if (index->fAccessPoints.size() > 1 && !index->SaveIndex()) {
+		DPRINTF("cannot save gzip index for \"%s\"", filename);
+	}
+	return index;
+}
+
+bool GzIndex::OpenFile(const char* filename, bool beQuiet)
+{
+	char absPath[PATH_MAX];
+	struct stat statbuf;
+
+	if (realpath(filename, absPath) == 0) {
+		if (!beQuiet) {
+			AERROR("cannot find \"%s\"", filename);
+		}
+		return false;
+	}
+	fFd = open(absPath, O_RDONLY);
+	if (fFd < 0) {
+		if (!beQuiet) {
+			AERROR("cannot open \"%s\" for reading", absPath);
+		}
+		return false;
+	}
+	if (fstat(fFd, &statbuf) || !S_ISREG(statbuf.st_mode)) {
+		if (!beQuiet) {
+			AERROR("cannot stat \"%s\"", absPath);
+		}
+		return false;
+	}
+	fFilename = strdup(absPath);
+	fFileSize = statbuf.st_size;
+	fFileMTime = statbuf.st_mtime;
+	return true;
+}
+
+void GzIndex::FreeIndex()
+{
+	unsigned int i;
+	for (i = 0; i < fAccessPoints.size(); i++) {
+		delete[] fAccessPoints[i].fWindow;
+	}
+	fAccessPoints.clear();
+	fUncompressedSize = 0;
+}
+
+void GzIndex::ReleaseSpans()
+{
+	SpanMap::iterator iter;
+	for (iter = fSpans.begin(); iter != fSpans.end(); iter++) {
+		delete[] iter->second.fData;
+	}
+	fSpans.clear();
+}
+
+void GzIndex::EvictSpans()
+{
+	SpanMap::iterator iter, oldest;
+
+	while (fSpans.size() >= eMaxCachedSpans) {
+		oldest = fSpans.begin();
+		for (iter = fSpans.begin(); iter != fSpans.end(); iter++) {
+			if (iter->second.fLastUse < oldest->second.fLastUse) {
+				oldest = iter;
+			}
+		}
+		delete[] oldest->second.fData;
+		fSpans.erase(oldest);
+	}
+}
+
+bool GzIndex::AddAccessPoint(unsigned int bits, uint64_t in, uint64_t out,
+	unsigned int left, const uint8_t* window)
+{
+	AccessPoint point;
+
+	point.fOut = out;
+	point.fIn = in;
+	point.fBits = bits;
+	point.fWindow = 0;
+
+	if (out) {
+		// window is a circular buffer, left is the free space at the end
+		point.fWindow = new uint8_t[eWindowSize];
+		if (!point.fWindow) {
+			return false;
+		}
+		if (left) {
+			memcpy(point.fWindow, window + eWindowSize - left, left);
+		}
+		if (left < eWindowSize) {
+			memcpy(point.fWindow + left, window, eWindowSize - left);
+		}
+	}
+	fAccessPoints.push_back(point);
+	return true;
+}
+
+bool GzIndex::BuildIndex()
+{
+	z_stream strm;
+	uint8_t input[eChunkSize];
+	uint8_t window[eWindowSize];
+	uint64_t totin = 0, totout = 0, last = 0;
+	off_t pos = 0;
+	ssize_t s;
+	int ret;
+
+	FreeIndex();
+
+	memset(&strm, 0, sizeof(strm));
+	memset(window, 0, eWindowSize);
+
+	// 15 bit window, +32 for automatic gzip/zlib header detection
+	if (inflateInit2(&strm, 47) != Z_OK) {
+		return false;
+	}
+
+	do {
+		s = pread_full(fFd, input, eChunkSize, pos);
+		if (s <= 0) {
+			// read error or premature end of file
+			goto failure;
+		}
+		pos += s;
+		strm.avail_in = s;
+		strm.next_in = input;
+
+		do {
+			if (strm.avail_out == 0) {
+				strm.avail_out = eWindowSize;
+				strm.next_out = window;
+			}
+			totin += strm.avail_in;
+			totout += strm.avail_out;
+			ret = inflate(&strm, Z_BLOCK);
+			totin -= strm.avail_in;
+			totout -= strm.avail_out;
+
+			if (ret == Z_STREAM_END) {
+				break;
+			}
+			if (ret != Z_OK) {
+				goto failure;
+			}
+			// add access points at block boundaries, but not after the last block
+			if ((strm.data_type & 128) && !(strm.data_type & 64) &&
+			    (totout == 0 || totout - last > eSpan)) {
+				if (!AddAccessPoint(strm.data_type & 7, totin, totout, strm.avail_out, window)) {
+					goto failure;
+				}
+				last = totout;
+			}
+		} while (strm.avail_in != 0);
+	} while (ret != Z_STREAM_END);
+
+	// concatenated gzip members (or trailing garbage) aren't supported
+	if (strm.avail_in != 0 || pos != fFileSize) {
+		goto failure;
+	}
+
+	inflateEnd(&strm);
+	if (fAccessPoints.empty()) {
+		return false;
+	}
+	fUncompressedSize = totout;
+	return true;
+
+failure:
+	inflateEnd(&strm);
+	FreeIndex();
+	return false;
+}
+
+bool GzIndex::GetCacheFilename(char* path, size_t len, bool create) const
+{
+	char dir[PATH_MAX];
+	const char* base = getenv("XDG_CACHE_HOME");
+
+	if (base && *base) {
+		snprintf(dir, PATH_MAX, "%s", base);
+	} else {
+		base = getenv("HOME");
+		if (!base || !*base) {
+			return false;
+		}
+		snprintf(dir, PATH_MAX, "%s/.cache", base);
+	}
+	if (create && mkdir(dir, 0700) && errno != EEXIST) {
+		return false;
+	}
+	strncat(dir, "/atarisio", PATH_MAX - strlen(dir) - 1);
+	if (create && mkdir(dir, 0700) && errno != EEXIST) {
+		return false;
+	}
+
+	// the path is stored in the cache file, so hash collisions are detected
+	snprintf(path, len, "%s/%08lx.gzi", dir,
+		CRC32::CalcCRC32(0, (void*) fFilename, strlen(fFilename)));
+	return true;
+}
+
+bool GzIndex::LoadIndex()
+{
+	char path[PATH_MAX];
+	char magic[4];
+	uint32_t version, pathLen, numPoints, hasWindow;
+	uint64_t fileSize, uncompressedSize;
+	int64_t mtime;
+	char* storedPath = 0;
+	AccessPoint point;
+	uint32_t i;
+	FILE* f;
+
+	if (!GetCacheFilename(path, PATH_MAX, false)) {
+		return false;
+	}
+	f = fopen(path, "rb");
+	if (!f) {
+		return false;
+	}
+
+	FreeIndex();
+
+	if (fread(magic, 4, 1, f) != 1
+	    || memcmp(magic, GZINDEX_MAGIC, 4)
+	    || fread(&version, sizeof(version), 1, f) != 1
+	    || version != GZINDEX_VERSION
+	    || fread(&pathLen, sizeof(pathLen), 1, f) != 1
+	    || pathLen != strlen(fFilename)
+	    || fread(&numPoints, sizeof(numPoints), 1, f) != 1
+	    || numPoints == 0
+	    || fread(&fileSize, sizeof(fileSize), 1, f) != 1
+	    || fileSize != (uint64_t) fFileSize
+	    || fread(&mtime, sizeof(mtime), 1, f) != 1
+	    || mtime != (int64_t) fFileMTime
+	    || fread(&uncompressedSize, sizeof(uncompressedSize), 1, f) != 1) {
+		goto failure;
+	}
+
+	storedPath = new char[pathLen];
+	if (fread(storedPath, pathLen, 1, f) != 1
+	    || memcmp(storedPath, fFilename, pathLen)) {
+		goto failure;
+	}
+
+	for (i = 0; i < numPoints; i++) {
+		point.fWindow = 0;
+		if (fread(&point.fOut, sizeof(point.fOut), 1, f) != 1
+		    || fread(&point.fIn, sizeof(point.fIn), 1, f) != 1
+		    || fread(&point.fBits, sizeof(point.fBits), 1, f) != 1
+		    || fread(&hasWindow, sizeof(hasWindow), 1, f) != 1) {
+			goto failure;
+		}
+		if (point.fBits > 7
+		    || point.fIn > fileSize
+		    || point.fOut > uncompressedSize
+		    || (i > 0 && point.fOut <= fAccessPoints[i-1].fOut)
+		    || (i == 0 && point.fOut != 0)) {
+			goto failure;
+		}
+		if (hasWindow) {
+			point.fWindow = new uint8_t[eWindowSize];
+			if (fread(point.fWindow, eWindowSize, 1, f) != 1) {
+				delete[] point.fWindow;
+				goto failure;
+			}
+		}
+		fAccessPoints.push_back(point);
+	}
+
+	delete[] storedPath;
+	fclose(f);
+	fUncompressedSize = uncompressedSize;
+	return true;
+
+failure:
+	delete[] storedPath;
+	fclose(f);
+	FreeIndex();
+	return false;
+}
+
+bool GzIndex::SaveIndex() const
+{
+	char path[PATH_MAX];
+	char tmpPath[PATH_MAX];
+	uint32_t version = GZINDEX_VERSION;
+	uint32_t pathLen = strlen(fFilename);
+	uint32_t numPoints = fAccessPoints.size();
+	uint64_t fileSize = fFileSize;
+	int64_t mtime = fFileMTime;
+	uint32_t hasWindow;
+	uint32_t i;
+	bool ok;
+	FILE* f;
+
+	if (!GetCacheFilename(path, PATH_MAX, true)) {
+		return false;
+	}
+	if (snprintf(tmpPath, PATH_MAX, "%s.%d", path, (int) getpid()) >= PATH_MAX) {
+		return false;
+	}
+
+	f = fopen(tmpPath, "wb");
+	if (!f) {
+		return false;
+	}
+
+	ok = fwrite(GZINDEX_MAGIC, 4, 1, f) == 1
+	  && fwrite(&version, sizeof(version), 1, f) == 1
+	  && fwrite(&pathLen, sizeof(pathLen), 1, f) == 1
+	  && fwrite(&numPoints, sizeof(numPoints), 1, f) == 1
+	  && fwrite(&fileSize, sizeof(fileSize), 1, f) == 1
+	  && fwrite(&mtime, sizeof(mtime), 1, f) == 1
+	  && fwrite(&fUncompressedSize, sizeof(fUncompressedSize), 1, f) == 1
+	  && fwrite(fFilename, pathLen, 1, f) == 1;
+
+	for (i = 0; ok && i < numPoints; i++) {
+		const AccessPoint& point = fAccessPoints[i];
+		hasWindow = point.fWindow ? 1 : 0;
+		ok = fwrite(&point.fOut, sizeof(point.fOut), 1, f) == 1
+		  && fwrite(&point.fIn, sizeof(point.fIn), 1, f) == 1
+		  && fwrite(&point.fBits, sizeof(point.fBits), 1, f) == 1
+		  && fwrite(&hasWindow, sizeof(hasWindow), 1, f) == 1
+		  && (!hasWindow || fwrite(point.fWindow, eWindowSize, 1, f) == 1);
+	}
+
+	if (fclose(f)) {
+		ok = false;
+	}
+	if (!ok || rename(tmpPath, path)) {
+		unlink(tmpPath);
+		return false;
+	}
+	return true;
+}
+
+uint8_t* GzIndex::GetSpan(unsigned int idx)
+{
+	SpanMap::iterator iter = fSpans.find(idx);
+	if (iter != fSpans.end()) {
+		iter->second.fLastUse = ++fUseCounter;
+		return iter->second.fData;
+	}
+
+	const AccessPoint& point = fAccessPoints[idx];
+	uint64_t end = (idx + 1 < fAccessPoints.size()) ? fAccessPoints[idx+1].fOut : fUncompressedSize;
+	size_t len = end - point.fOut;
+	uint8_t input[eChunkSize];
+	off_t pos = point.fIn;
+	z_stream strm;
+	ssize_t s;
+	int ret;
+
+	EvictSpans();
+
+	uint8_t* span = new uint8_t[len];
+	if (!span) {
+		return 0;
+	}
+
+	memset(&strm, 0, sizeof(strm));
+	if (inflateInit2(&strm, -15) != Z_OK) {
+		delete[] span;
+		return 0;
+	}
+
+	if (point.fBits) {
+		uint8_t c;
+		pos--;
+		if (pread_full(fFd, &c, 1, pos) != 1) {
+			goto failure;
+		}
+		pos++;
+		if (inflatePrime(&strm, point.fBits, c >> (8 - point.fBits)) != Z_OK) {
+			goto failure;
+		}
+	}
+	if (point.fWindow && inflateSetDictionary(&strm, point.fWindow, eWindowSize) != Z_OK) {
+		goto failure;
+	}
+
+	strm.next_out = span;
+	strm.avail_out = len;
+	while (strm.avail_out) {
+		if (strm.avail_in == 0) {
+			s = pread_full(fFd, input, eChunkSize, pos);
+			if (s <= 0) {
+				goto failure;
+			}
+			pos += s;
+			strm.next_in = input;
+			strm.avail_in = s;
+		}
+		ret = inflate(&strm, Z_NO_FLUSH);
+		if (ret == Z_STREAM_END) {
+			break;
+		}
+		if (ret != Z_OK) {
+			goto failure;
+		}
+	}
+	if (strm.avail_out) {
+		goto failure;
+	}
+
+	inflateEnd(&strm);
+	fSpans[idx].fData = span;
+	fSpans[idx].fLastUse = ++fUseCounter;
+	return span;
+
+failure:
+	DPRINTF("inflating \"%s\" at offset %lu failed", fFilename, (unsigned long) point.fOut);
+	inflateEnd(&strm);
+	delete[] span;
+	return 0;
+}
+
+ssize_t GzIndex::Read(size_t offset, uint8_t* buf, size_t len)
+{
+	size_t done = 0;
+
+	if (offset >= fUncompressedSize) {
+		return 0;
+	}
+	if (len > fUncompressedSize - offset) {
+		len = fUncompressedSize - offset;
+	}
+
+	while (done < len) {
+		uint64_t pos = offset + done;
+
+		// find the last access point at or before pos
+		unsigned int lo = 0, hi = fAccessPoints.size();
+		while (hi - lo > 1) {
+			unsigned int mid = (lo + hi) / 2;
+			if (fAccessPoints[mid].fOut <= pos) {
+				lo = mid;
+			} else {
+				hi = mid;
+			}
+		}
+
+		uint8_t* span = GetSpan(lo);
+		if (!span) {
+			return -1;
+		}
+		uint64_t end = (lo + 1 < fAccessPoints.size()) ? fAccessPoints[lo+1].fOut : fUncompressedSize;
+		size_t n = end - pos;
+		if (n > len - done) {
+			n = len - done;
+		}
+		memcpy(buf + done, span + (pos - fAccessPoints[lo].fOut), n);
+		done += n;
+	}
+	return done;
+}
+
+#endif
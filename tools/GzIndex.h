@@ -0,0 +1,128 @@
+#ifndef GZINDEX_H
+#define GZINDEX_H
+
+/*
+   GzIndex.h - random access to gzip compressed files via an index
+   of inflate access points (like zran.c from the zlib examples)
+
+   Copyright (C) 2026 Matthias Reichl <hias@horus.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <time.h>
+#include <map>
+#include <vector>
+
+#include "RefCounted.h"
+#include "RCPtr.h"
+
+/*
+ * The index is built with one pass over the file when it's opened
+ * for the first time and then cached in $XDG_CACHE_HOME/atarisio
+ * (~/.cache/atarisio), so later opens only need to load the cache.
+ *
+ * Decompressed data is cached per span (the data between two access
+ * points), only the eMaxCachedSpans most recently read spans are kept
+ * in memory.
+ */
+
+class GzIndex : public RefCounted {
+public:
+	// returns NULL if the file isn't a single-member gzip file
+	static RCPtr<GzIndex> Open(const char* filename, bool beQuiet = false);
+
+	virtual ~GzIndex();
+
+	inline size_t GetUncompressedSize() const;
+	inline const char* GetFilename() const;
+
+	// reads up to len bytes from offset of the uncompressed data,
+	// returns the number of bytes read or -1 on error
+	ssize_t Read(size_t offset, uint8_t* buf, size_t len);
+
+	// free all decompressed spans
+	void ReleaseSpans();
+
+	inline unsigned int GetNumberOfAccessPoints() const;
+
+private:
+	GzIndex();
+
+	enum {
+		eWindowSize = 32768,
+		eSpan = 262144,
+		eChunkSize = 16384,
+		eMaxCachedSpans = 16
+	};
+
+	struct AccessPoint {
+		uint64_t fOut;		// offset in uncompressed data
+		uint64_t fIn;		// offset in compressed file
+		unsigned int fBits;	// bits of fIn-1 belonging to the block
+		uint8_t* fWindow;	// inflate dictionary, NULL at offset 0
+	};
+
+	bool OpenFile(const char* filename, bool beQuiet);
+
+	bool BuildIndex();
+	bool AddAccessPoint(unsigned int bits, uint64_t in, uint64_t out,
+		unsigned int left, const uint8_t* window);
+	void FreeIndex();
+
+	bool GetCacheFilename(char* path, size_t len, bool create) const;
+	bool LoadIndex();
+	bool SaveIndex() const;
+
+	uint8_t* GetSpan(unsigned int idx);
+	void EvictSpans();
+
+	char* fFilename;
+	int fFd;
+	off_t fFileSize;
+	time_t fFileMTime;
+
+	uint64_t fUncompressedSize;
+
+	std::vector<AccessPoint> fAccessPoints;
+
+	struct Span {
+		uint8_t* fData;
+		unsigned long fLastUse;
+	};
+
+	typedef std::map<unsigned int, Span> SpanMap;
+	SpanMap fSpans;
+	unsigned long fUseCounter;
+};
+
+inline size_t GzIndex::GetUncompressedSize() const
+{
+	return fUncompressedSize;
+}
+
+inline const char* GzIndex::GetFilename() const
+{
+	return fFilename;
+}
+
+inline unsigned int GzIndex::GetNumberOfAccessPoints() const
+{
+	return fAccessPoints.size();
+}
+
+#endif
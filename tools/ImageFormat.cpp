@@ -0,0 +1,207 @@
+/*
+   ImageFormat.cpp - detect image formats from the file header
+
+   Copyright (C) 2026 Matthias Reichl <hias@horus.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include <string.h>
+#include <strings.h>
+#include <vector>
+
+#include "ImageFormat.h"
+#include "AtariDebug.h"
+
+static bool ProbeAtr(const uint8_t* hdr, size_t len)
+{
+	// magic and sector size (128, 256, 512, ... 8k)
+	if (len < 16 || hdr[0] != 0x96 || hdr[1] != 0x02) {
+		return false;
+	}
+	unsigned int seclen = hdr[4] | (hdr[5] << 8);
+	return seclen >= 128 && seclen <= 8192 && (seclen & (seclen - 1)) == 0;
+}
+
+static bool ProbeDcm(const uint8_t* hdr, size_t len)
+{
+	// archive type, then pass number (1-31) and density (0-2)
+	return len >= 2 && (hdr[0] == 0xf9 || hdr[0] == 0xfa)
+		&& (hdr[1] & 0x1f) != 0 && ((hdr[1] >> 5) & 3) != 3;
+}
+
+static bool ProbeDi(const uint8_t* hdr, size_t len)
+{
+	return len >= 4 && hdr[0] == 'D' && hdr[1] == 'I' && hdr[2] == 0x20 && hdr[3] == 0x02;
+}
+
+static bool ProbeAtz(const uint8_t* hdr, size_t len)
+{
+	return len >= 4 && memcmp(hdr, "ATZ1", 4) == 0;
+}
+
+static bool ProbeAtp(const uint8_t* hdr, size_t len)
+{
+	return len >= 12 && memcmp(hdr, "FORM", 4) == 0 && memcmp(hdr + 8, "ATP1", 4) == 0;
+}
+
+static bool ProbeCas(const uint8_t* hdr, size_t len)
+{
+	return len >= 4 && memcmp(hdr, "FUJI", 4) == 0;
+}
+
+namespace {
+
+struct FormatEntry {
+	ImageFormat::EFormat fFormat;
+	const char* fName;
+	ImageFormat::ProbeFunc fProbe;
+};
+
+std::vector<FormatEntry> formatRegistry;
+
+// register the builtin formats at startup
+struct BuiltinFormats {
+	BuiltinFormats()
+	{
+		ImageFormat::RegisterFormat(ImageFormat::eAtrFormat, "ATR", ProbeAtr);
+		ImageFormat::RegisterFormat(ImageFormat::eXfdFormat, "XFD", 0);
+		ImageFormat::RegisterFormat(ImageFormat::eDcmFormat, "DCM", ProbeDcm);
+		ImageFormat::RegisterFormat(ImageFormat::eDiFormat, "DI", ProbeDi);
+		ImageFormat::RegisterFormat(ImageFormat::eAtzFormat, "ATZ", ProbeAtz);
+		ImageFormat::RegisterFormat(ImageFormat::eAtpFormat, "ATP", ProbeAtp);
+		ImageFormat::RegisterFormat(ImageFormat::eCasFormat, "CAS", ProbeCas);
+	}
+} builtinFormats;
+
+}
+
+void ImageFormat::RegisterFormat(EFormat format, const char* name, ProbeFunc probe)
+{
+	FormatEntry entry;
+	entry.fFormat = format;
+	entry.fName = name;
+	entry.fProbe = probe;
+	formatRegistry.push_back(entry);
+}
+
+ImageFormat::EFormat ImageFormat::ProbeHeader(const uint8_t* header, size_t len)
+{
+	std::vector<FormatEntry>::reverse_iterator iter;
+
+	for (iter = formatRegistry.rbegin(); iter != formatRegistry.rend(); iter++) {
+		if (iter->fProbe && iter->fProbe(header, len)) {
+			return iter->fFormat;
+		}
+	}
+	return eUnknownFormat;
+}
+
+ImageFormat::EFormat ImageFormat::GetFormatFromFilename(const char* filename, bool& compressed)
+{
+	static const struct {
+		const char* fExtension;
+		EFormat fFormat;
+	} extensions[] = {
+		{ ".atr", eAtrFormat },
+		{ ".xfd", eXfdFormat },
+		{ ".dcm", eDcmFormat },
+		{ ".di", eDiFormat },
+		{ ".atz", eAtzFormat },
+		{ ".atp", eAtpFormat },
+		{ ".cas", eCasFormat },
+		{ 0, eUnknownFormat }
+	};
+	size_t len = strlen(filename);
+
+	compressed = false;
+	if (len >= 3 && strcasecmp(filename + len - 3, ".gz") == 0) {
+		compressed = true;
+		len -= 3;
+	}
+	for (int i = 0; extensions[i].fExtension; i++) {
+		size_t elen = strlen(extensions[i].fExtension);
+		if (len >= elen && strncasecmp(filename + len - elen, extensions[i].fExtension, elen) == 0) {
+			return extensions[i].fFormat;
+		}
+	}
+	compressed = false;
+	return eUnknownFormat;
+}
+
+ImageFormat::EFormat ImageFormat::ProbeFile(const RCPtr<FileIO>& fileio, const char* filename, bool& compressed)
+{
+	uint8_t header[eProbeSize];
+	unsigned int len;
+	EFormat format;
+	bool extCompressed;
+
+	len = fileio->ReadBlock(header, eProbeSize);
+	compressed = fileio->IsCompressed();
+
+	if (!fileio->Seek(0)) {
+		DPRINTF("rewinding \"%s\" failed", filename);
+	}
+
+	// without zlib we can't look into compressed files
+	if (len >= 2 && header[0] == 0x1f && header[1] == 0x8b) {
+		format = GetFormatFromFilename(filename, extCompressed);
+		compressed = true;
+		return format;
+	}
+
+	if ((format = ProbeHeader(header, len)) != eUnknownFormat) {
+		return format;
+	}
+
+	// the extension must agree with the compression
+	format = GetFormatFromFilename(filename, extCompressed);
+	if (format != eUnknownFormat && extCompressed != compressed) {
+		return eUnknownFormat;
+	}
+	return format;
+}
+
+ImageFormat::EFormat ImageFormat::ProbeFile(const char* filename, bool& compressed)
+{
+	RCPtr<FileIO> fileio;
+	EFormat format;
+
+#ifdef USE_ZLIB
+	fileio = new GZFileIO();
+#else
+	fileio = new StdFileIO();
+#endif
+
+	compressed = false;
+	if (!fileio->OpenRead(filename)) {
+		return eUnknownFormat;
+	}
+	format = ProbeFile(fileio, filename, compressed);
+	fileio->Close();
+	return format;
+}
+
+const char* ImageFormat::GetFormatName(EFormat format)
+{
+	std::vector<FormatEntry>::iterator iter;
+
+	for (iter = formatRegistry.begin(); iter != formatRegistry.end(); iter++) {
+		if (iter->fFormat == format) {
+			return iter->fName;
+		}
+	}
+	return "unknown";
+}
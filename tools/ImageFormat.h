@@ -0,0 +1,73 @@
+#ifndef IMAGEFORMAT_H
+#define IMAGEFORMAT_H
+
+/*
+   ImageFormat.h - detect image formats from the file header
+
+   Copyright (C) 2026 Matthias Reichl <hias@horus.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include <sys/types.h>
+#include <stdint.h>
+
+#include "FileIO.h"
+
+/*
+ * Each format registers a probe function which checks the first
+ * eProbeSize (decompressed) bytes of a file. A single open and read
+ * is enough to pick the decoder, the extension is only used for
+ * formats without a signature (XFD) or if no probe matches.
+ */
+
+class ImageFormat {
+public:
+	enum EFormat {
+		eUnknownFormat = 0,
+		eAtrFormat,
+		eXfdFormat,
+		eDcmFormat,
+		eDiFormat,
+		eAtzFormat,
+		eAtpFormat,
+		eCasFormat
+	};
+
+	enum { eProbeSize = 64 };
+
+	// returns true if the header belongs to the format,
+	// len may be smaller than eProbeSize for short files
+	typedef bool (*ProbeFunc)(const uint8_t* header, size_t len);
+
+	// formats registered later are probed first. Not thread safe,
+	// register additional formats before starting other threads
+	static void RegisterFormat(EFormat format, const char* name, ProbeFunc probe);
+
+	static EFormat ProbeHeader(const uint8_t* header, size_t len);
+
+	// read the header from an opened file and rewind it. Falls
+	// back to the extension of filename if no probe matches.
+	static EFormat ProbeFile(const RCPtr<FileIO>& fileio, const char* filename, bool& compressed);
+
+	// opens the file with GZFileIO (if available) for probing
+	static EFormat ProbeFile(const char* filename, bool& compressed);
+
+	static EFormat GetFormatFromFilename(const char* filename, bool& compressed);
+
+	static const char* GetFormatName(EFormat format);
+};
+
+#endif
@@ -0,0 +1,145 @@
+/*
+   ImageLoader.cpp - background thread for loading disk images
+
+   Copyright (C) 2026 Matthias Reichl <hias@horus.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include <signal.h>
+#include <sched.h>
+
+#include "ImageLoader.h"
+#include "SIOWrapper.h"
+#include "Error.h"
+#include "AtariDebug.h"
+
+ImageLoader::Job::~Job()
+{
+}
+
+bool ImageLoader::Job::MustComplete() const
+{
+	return false;
+}
+
+ImageLoader::ImageLoader(SIOWrapper* wrapper)
+	: fSIOWrapper(wrapper),
+	  fQuit(false)
+{
+	pthread_attr_t attr;
+	struct sched_param param;
+	sigset_t allSignals, oldSignals;
+	int ret;
+
+	pthread_mutex_init(&fMutex, 0);
+	pthread_cond_init(&fCond, 0);
+
+	// don't compete with the (possibly realtime) SIO code
+	pthread_attr_init(&attr);
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+	param.sched_priority = 0;
+	pthread_attr_setschedparam(&attr, &param);
+
+	// signals are handled by the main thread only
+	sigfillset(&allSignals);
+	pthread_sigmask(SIG_SETMASK, &allSignals, &oldSignals);
+	ret = pthread_create(&fThread, &attr, ThreadFunc, this);
+	pthread_sigmask(SIG_SETMASK, &oldSignals, 0);
+
+	pthread_attr_destroy(&attr);
+
+	if (ret) {
+		pthread_cond_destroy(&fCond);
+		pthread_mutex_destroy(&fMutex);
+		throw ErrorObject("cannot start image loader thread");
+	}
+}
+
+ImageLoader::~ImageLoader()
+{
+	std::list<Job*>::iterator iter;
+
+	pthread_mutex_lock(&fMutex);
+	for (iter = fPendingJobs.begin(); iter != fPendingJobs.end(); ) {
+		if ((*iter)->MustComplete()) {
+			iter++;
+		} else {
+			delete *iter;
+			iter = fPendingJobs.erase(iter);
+		}
+	}
+	fQuit = true;
+	pthread_cond_signal(&fCond);
+	pthread_mutex_unlock(&fMutex);
+
+	pthread_join(fThread, 0);
+
+	for (iter = fPendingJobs.begin(); iter != fPendingJobs.end(); iter++) {
+		delete *iter;
+	}
+	for (iter = fFinishedJobs.begin(); iter != fFinishedJobs.end(); iter++) {
+		delete *iter;
+	}
+
+	pthread_cond_destroy(&fCond);
+	pthread_mutex_destroy(&fMutex);
+}
+
+void ImageLoader::Submit(Job* job)
+{
+	pthread_mutex_lock(&fMutex);
+	fPendingJobs.push_back(job);
+	pthread_cond_signal(&fCond);
+	pthread_mutex_unlock(&fMutex);
+}
+
+void ImageLoader::GetFinishedJobs(std::list<Job*>& jobs)
+{
+	pthread_mutex_lock(&fMutex);
+	jobs.splice(jobs.end(), fFinishedJobs);
+	pthread_mutex_unlock(&fMutex);
+}
+
+void* ImageLoader::ThreadFunc(void* arg)
+{
+	((ImageLoader*) arg)->Run();
+	return 0;
+}
+
+void ImageLoader::Run()
+{
+	Job* job;
+
+	pthread_mutex_lock(&fMutex);
+	// on quit only the jobs that must complete are left
+	while (!fQuit || !fPendingJobs.empty()) {
+		if (fPendingJobs.empty()) {
+			pthread_cond_wait(&fCond, &fMutex);
+			continue;
+		}
+		job = fPendingJobs.front();
+		fPendingJobs.pop_front();
+
+		pthread_mutex_unlock(&fMutex);
+		job->Run();
+		pthread_mutex_lock(&fMutex);
+
+		fFinishedJobs.push_back(job);
+		fSIOWrapper->Wakeup();
+	}
+	pthread_mutex_unlock(&fMutex);
+}
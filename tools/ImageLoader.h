@@ -0,0 +1,81 @@
+#ifndef IMAGELOADER_H
+#define IMAGELOADER_H
+
+/*
+   ImageLoader.h - background thread for loading disk images
+
+   Copyright (C) 2026 Matthias Reichl <hias@horus.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include <pthread.h>
+#include <list>
+
+#include "RefCounted.h"
+
+class SIOWrapper;
+
+/*
+ * Jobs are run one after another in the loader thread. Finished
+ * jobs are queued and the SIO wrapper is woken up, so the main
+ * thread can pick them up with GetFinishedJobs.
+ *
+ * RCPtr isn't thread safe, a job must not touch objects that are
+ * shared with the main thread while it's running. Objects created
+ * by the job may only be used by the main thread after the job
+ * has been returned by GetFinishedJobs.
+ */
+
+class ImageLoader : public RefCounted {
+public:
+	class Job {
+	public:
+		virtual ~Job();
+
+		// called in the loader thread
+		virtual void Run() = 0;
+
+		// jobs that must complete are still run when the loader
+		// is destroyed, all others are dropped
+		virtual bool MustComplete() const;
+	};
+
+	// throws ErrorObject if the thread cannot be started
+	ImageLoader(SIOWrapper* wrapper);
+	virtual ~ImageLoader();
+
+	// the loader takes ownership of the job
+	void Submit(Job* job);
+
+	// moves finished jobs to the list, the caller has to delete them
+	void GetFinishedJobs(std::list<Job*>& jobs);
+
+private:
+	static void* ThreadFunc(void* arg);
+	void Run();
+
+	SIOWrapper* fSIOWrapper;
+
+	pthread_t fThread;
+	pthread_mutex_t fMutex;
+	pthread_cond_t fCond;
+	bool fQuit;
+
+	std::list<Job*> fPendingJobs;
+	std::list<Job*> fFinishedJobs;
+};
+
+#endif
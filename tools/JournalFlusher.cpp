@@ -0,0 +1,138 @@
+/*
+   JournalFlusher.cpp - background thread that periodically folds
+   sector journals into their image files
+
+   Copyright (C) 2026 Matthias Reichl <hias@horus.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include <errno.h>
+#include <signal.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "JournalFlusher.h"
+#include "SectorJournal.h"
+#include "Error.h"
+#include "AtariDebug.h"
+
+JournalFlusher::JournalFlusher(unsigned int intervalSeconds)
+	: fInterval(intervalSeconds),
+	  fQuit(false)
+{
+	pthread_attr_t attr;
+	struct sched_param param;
+	sigset_t allSignals, oldSignals;
+	int ret;
+
+	if (fInterval == 0) {
+		fInterval = 1;
+	}
+
+	pthread_mutex_init(&fMutex, 0);
+	pthread_cond_init(&fCond, 0);
+
+	// the SIO code may run with realtime priority, the flusher
+	// must not compete with it
+	pthread_attr_init(&attr);
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+	param.sched_priority = 0;
+	pthread_attr_setschedparam(&attr, &param);
+
+	// signals are handled by the main thread only
+	sigfillset(&allSignals);
+	pthread_sigmask(SIG_SETMASK, &allSignals, &oldSignals);
+	ret = pthread_create(&fThread, &attr, ThreadFunc, this);
+	pthread_sigmask(SIG_SETMASK, &oldSignals, 0);
+
+	pthread_attr_destroy(&attr);
+
+	if (ret) {
+		pthread_cond_destroy(&fCond);
+		pthread_mutex_destroy(&fMutex);
+		throw ErrorObject("cannot start journal flusher thread");
+	}
+}
+
+JournalFlusher::~JournalFlusher()
+{
+	pthread_mutex_lock(&fMutex);
+	fQuit = true;
+	pthread_cond_signal(&fCond);
+	pthread_mutex_unlock(&fMutex);
+
+	pthread_join(fThread, 0);
+
+	if (!fJournals.empty()) {
+		DPRINTF("journal flusher destroyed with %d registered journals",
+			(int)fJournals.size());
+	}
+
+	pthread_cond_destroy(&fCond);
+	pthread_mutex_destroy(&fMutex);
+}
+
+void JournalFlusher::RegisterJournal(SectorJournal* journal)
+{
+	pthread_mutex_lock(&fMutex);
+	fJournals.push_back(journal);
+	pthread_mutex_unlock(&fMutex);
+}
+
+void JournalFlusher::UnregisterJournal(SectorJournal* journal)
+{
+	pthread_mutex_lock(&fMutex);
+	fJournals.remove(journal);
+	pthread_mutex_unlock(&fMutex);
+}
+
+void* JournalFlusher::ThreadFunc(void* arg)
+{
+	((JournalFlusher*) arg)->Run();
+	return 0;
+}
+
+void JournalFlusher::Run()
+{
+	struct timeval now;
+	struct timespec timeout;
+
+	pthread_mutex_lock(&fMutex);
+	while (!fQuit) {
+		gettimeofday(&now, 0);
+		timeout.tv_sec = now.tv_sec + fInterval;
+		timeout.tv_nsec = now.tv_usec * 1000;
+
+		while (!fQuit) {
+			if (pthread_cond_timedwait(&fCond, &fMutex, &timeout) == ETIMEDOUT) {
+				break;
+			}
+		}
+		if (fQuit) {
+			break;
+		}
+
+		// folding is done with the list locked, so journals
+		// cannot vanish while we are working on them
+		std::list<SectorJournal*>::iterator iter;
+		for (iter = fJournals.begin(); iter != fJournals.end(); iter++) {
+			(*iter)->Fold();
+		}
+	}
+	pthread_mutex_unlock(&fMutex);
+}
@@ -0,0 +1,69 @@
+#ifndef JOURNALFLUSHER_H
+#define JOURNALFLUSHER_H
+
+/*
+   JournalFlusher.h - background thread that periodically folds
+   sector journals into their image files
+
+   Copyright (C) 2026 Matthias Reichl <hias@horus.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include <pthread.h>
+#include <list>
+
+#include "RefCounted.h"
+
+class SectorJournal;
+
+/*
+ * RCPtr isn't thread safe, so the flusher thread only keeps plain
+ * pointers to the journals. A journal has to unregister itself before
+ * it is destroyed, this waits until a currently running fold pass
+ * has finished.
+ */
+
+class JournalFlusher : public RefCounted {
+public:
+	// throws ErrorObject if the thread cannot be started
+	JournalFlusher(unsigned int intervalSeconds);
+	virtual ~JournalFlusher();
+
+	void RegisterJournal(SectorJournal* journal);
+	void UnregisterJournal(SectorJournal* journal);
+
+	inline unsigned int GetInterval() const;
+
+private:
+	static void* ThreadFunc(void* arg);
+	void Run();
+
+	unsigned int fInterval;
+
+	pthread_t fThread;
+	pthread_mutex_t fMutex;
+	pthread_cond_t fCond;
+	bool fQuit;
+
+	std::list<SectorJournal*> fJournals;
+};
+
+inline unsigned int JournalFlusher::GetInterval() const
+{
+	return fInterval;
+}
+
+#endif
@@ -26,6 +26,7 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "KernelSIOWrapper.h"
 #include "AtariDebug.h"
@@ -145,15 +146,23 @@ int KernelSIOWrapper::WaitForCommandFrame(int otherReadPollDevice)
 		return -1;
 	} else {
 		int maxfd=fDeviceFileNo;
+		int wakeupfd = GetWakeupFD();
 
 		FD_ZERO(&except_set);
 		FD_SET(fDeviceFileNo, &except_set);
 
+		FD_ZERO(&read_set);
+		if (wakeupfd >= 0) {
+			if (wakeupfd > maxfd) {
+				maxfd = wakeupfd;
+			}
+			FD_SET(wakeupfd, &read_set);
+		}
+
 		if (otherReadPollDevice>=0) {
 			if (otherReadPollDevice > maxfd) {
 				maxfd = otherReadPollDevice;
 			}
-			FD_ZERO(&read_set);
 			FD_SET(otherReadPollDevice, &read_set);
 
 			// timeout for checking printer queue
@@ -173,10 +182,14 @@ int KernelSIOWrapper::WaitForCommandFrame(int otherReadPollDevice)
 			if (FD_ISSET(otherReadPollDevice, &read_set)) {
 				return 1;
 			}
+			if (wakeupfd >= 0 && FD_ISSET(wakeupfd, &read_set)) {
+				ClearWakeup();
+				return 3;
+			}
 			DPRINTF("illegal condition using select!");
 			return -2;
 		} else {
-			ret = select(maxfd+1, NULL, NULL, &except_set, NULL);
+			ret = select(maxfd+1, &read_set, NULL, &except_set, NULL);
 			if (ret == -1) {
 				return 2;
 			}
@@ -186,6 +199,10 @@ int KernelSIOWrapper::WaitForCommandFrame(int otherReadPollDevice)
 			if (FD_ISSET(fDeviceFileNo, &except_set)) {
 				return 0;
 			}
+			if (wakeupfd >= 0 && FD_ISSET(wakeupfd, &read_set)) {
+				ClearWakeup();
+				return 3;
+			}
 			DPRINTF("illegal condition using select!");
 			return -1;
 		}
@@ -301,6 +318,67 @@ int KernelSIOWrapper::SendDataFrame(uint8_t* buf, unsigned int length)
 	return fLastResult;
 }
 
+int KernelSIOWrapper::SendDataFrame(const struct iovec* iov, unsigned int iovcnt)
+{
+	uint8_t buf[eMaxDataLength];
+	unsigned int length = 0;
+
+	// the driver copies the data and calculates the checksum
+	// itself, a single buffer can be passed on as it is
+	if (iovcnt == 1) {
+		return SendDataFrame((uint8_t*) iov[0].iov_base, iov[0].iov_len);
+	}
+
+	for (unsigned int i = 0; i < iovcnt; i++) {
+		if (length + iov[i].iov_len > eMaxDataLength) {
+			fLastResult = EATARISIO_ERROR_BLOCK_TOO_LONG;
+			return fLastResult;
+		}
+		memcpy(buf + length, iov[i].iov_base, iov[i].iov_len);
+		length += iov[i].iov_len;
+	}
+	return SendDataFrame(buf, length);
+}
+
+int KernelSIOWrapper::SendDataFrame(const struct iovec* iov, unsigned int iovcnt, uint8_t /* checksum */)
+{
+	// the driver always calculates the checksum itself
+	return SendDataFrame(iov, iovcnt);
+}
+
+int KernelSIOWrapper::SendResponse(bool ok, MiscUtils::TimestampType completeTime,
+	const struct iovec* iov, unsigned int iovcnt)
+{
+	// the driver already does the timing, so simply send
+	// the parts one after the other
+	if (SendCommandACK()) {
+		return fLastResult;
+	}
+	MiscUtils::TimestampType now = MiscUtils::GetCurrentTime();
+	if (completeTime > now) {
+		struct timespec ts;
+		ts.tv_sec = (completeTime - now) / 1000000;
+		ts.tv_nsec = ((completeTime - now) % 1000000) * 1000;
+		nanosleep(&ts, NULL);
+	}
+	if (ok) {
+		SendComplete();
+	} else {
+		SendError();
+	}
+	if (fLastResult) {
+		return fLastResult;
+	}
+	return SendDataFrame(iov, iovcnt);
+}
+
+int KernelSIOWrapper::SendResponse(bool ok, MiscUtils::TimestampType completeTime,
+	const struct iovec* iov, unsigned int iovcnt, uint8_t /* checksum */)
+{
+	// the driver always calculates the checksum itself
+	return SendResponse(ok, completeTime, iov, iovcnt);
+}
+
 int KernelSIOWrapper::ReceiveDataFrame(uint8_t* buf, unsigned int length)
 {
 	SIO_data_frame frame;
@@ -74,6 +74,12 @@ public:
 	virtual int SendError();
 
 	virtual int SendDataFrame(uint8_t* buf, unsigned int length);
+	virtual int SendDataFrame(const struct iovec* iov, unsigned int iovcnt);
+	virtual int SendDataFrame(const struct iovec* iov, unsigned int iovcnt, uint8_t checksum);
+	virtual int SendResponse(bool ok, MiscUtils::TimestampType completeTime,
+		const struct iovec* iov, unsigned int iovcnt);
+	virtual int SendResponse(bool ok, MiscUtils::TimestampType completeTime,
+		const struct iovec* iov, unsigned int iovcnt, uint8_t checksum);
 	virtual int ReceiveDataFrame(uint8_t* buf, unsigned int length);
 
 	virtual int SendRawFrame(uint8_t* buf, unsigned int length);
@@ -116,6 +122,11 @@ public:
 
 private:
 	typedef SIOWrapper super;
+
+	enum {
+		// IOBUF_LENGTH-2 in the kernel driver
+		eMaxDataLength = 8198
+	};
 };
 
 #endif
@@ -0,0 +1,65 @@
+#ifndef SIOCHECKSUM_H
+#define SIOCHECKSUM_H
+
+/*
+   SIOChecksum.h - calculate SIO frame checksums
+
+   Copyright (C) 2026 Matthias Reichl <hias@horus.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include <stdint.h>
+#include <sys/uio.h>
+
+/*
+ * The SIO checksum is an 8 bit sum with end-around carry. This is
+ * the same as summing up all bytes and folding the carries back in
+ * at the end. The plain summing loop can be vectorized by the
+ * compiler, a 32 bit sum can't overflow for SIO frames.
+ */
+
+inline uint32_t SumSIOChecksumBytes(const uint8_t* buf, unsigned int length)
+{
+	uint32_t sum = 0;
+	for (unsigned int i = 0; i < length; i++) {
+		sum += buf[i];
+	}
+	return sum;
+}
+
+inline uint8_t FoldSIOChecksum(uint32_t sum)
+{
+	while (sum > 0xff) {
+		sum = (sum & 0xff) + (sum >> 8);
+	}
+	return (uint8_t) sum;
+}
+
+inline uint8_t CalculateSIOChecksum(const uint8_t* buf, unsigned int length)
+{
+	return FoldSIOChecksum(SumSIOChecksumBytes(buf, length));
+}
+
+inline uint8_t CalculateSIOChecksum(const struct iovec* iov, unsigned int iovcnt)
+{
+	uint32_t sum = 0;
+	for (unsigned int i = 0; i < iovcnt; i++) {
+		sum += SumSIOChecksumBytes((const uint8_t*) iov[i].iov_base, iov[i].iov_len);
+	}
+	return FoldSIOChecksum(sum);
+}
+
+#endif
@@ -31,6 +31,9 @@
 SIOManager::SIOManager(const RCPtr<SIOWrapper>& wrapper)
 	: fWrapper(wrapper)
 {
+	for (int i=0; i<256; i++) {
+		fDeviceBusy[i] = false;
+	}
 }
 
 SIOManager::~SIOManager()
@@ -79,7 +82,13 @@ int SIOManager::DoServing(int otherReadPollDevice)
 			
 			ret=fWrapper->GetCommandFrame(frame);
 		        if (ret == 0 ) {
-				if (fHandlers[frame.device_id] && fHandlers[frame.device_id]->IsActive()) {
+				if (fDeviceBusy[frame.device_id]) {
+					SIOTracer::GetInstance()->TraceCommandFrame(frame);
+					if (fWrapper->SendCommandNAK()) {
+						LOG_SIO_CMD_NAK_FAILED();
+					}
+					SIOTracer::GetInstance()->TraceCommandError(AbstractSIOHandler::eDeviceBusy);
+				} else if (fHandlers[frame.device_id] && fHandlers[frame.device_id]->IsActive()) {
 					ret = fHandlers[frame.device_id]->ProcessCommandFrame(frame, fWrapper);
 				} else {
 					SIOTracer::GetInstance()->TraceUnhandeledCommandFrame(frame);
@@ -101,6 +110,8 @@ int SIOManager::DoServing(int otherReadPollDevice)
 			return 0;
 		case 2:
 			return 1;
+		case 3:
+			return 2;
 		default:
 			return -1;
 		}
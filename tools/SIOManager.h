@@ -36,17 +36,23 @@ public:
 
 	bool UnregisterHandler(uint8_t device_id);
 
+	// commands to busy devices are NAKed without calling the handler
+	inline void SetDeviceBusy(uint8_t device_id, bool busy);
+	inline bool IsDeviceBusy(uint8_t device_id) const;
+
 	/*
 	 * return:
 	 * -1 = an error occurred
 	 *  0 = specified device has data available
 	 *  1 = error (or signal caught) during select
+	 *  2 = woken up by SIOWrapper::Wakeup()
 	 */
 	int DoServing(int otherReadPollDevice=-1);
 
 private:
 	RCPtr<SIOWrapper> fWrapper;
 	RCPtr<AbstractSIOHandler> fHandlers[256];
+	bool fDeviceBusy[256];
 	
 	// debugging stuff (default = off)
 };
@@ -61,4 +67,14 @@ inline RCPtr<const AbstractSIOHandler> SIOManager::GetConstHandler(uint8_t devic
 	return fHandlers[device_id];
 }
 
+inline void SIOManager::SetDeviceBusy(uint8_t device_id, bool busy)
+{
+	fDeviceBusy[device_id] = busy;
+}
+
+inline bool SIOManager::IsDeviceBusy(uint8_t device_id) const
+{
+	return fDeviceBusy[device_id];
+}
+
 #endif
@@ -19,6 +19,7 @@
 */
 
 #include <stdarg.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "SIOTracer.h"
@@ -34,12 +35,16 @@ SIOTracer* SIOTracer::fInstance = 0;
 
 SIOTracer::SIOTracer()
 	: fTraceGroupsCache(0),
-	  fTracerList(0)
+	  fTracerList(0),
+	  fMainThread(pthread_self())
 {
+	pthread_mutex_init(&fDeferredMutex, 0);
 }
 
 SIOTracer::~SIOTracer()
 {
+	FlushDeferredStrings();
+	pthread_mutex_destroy(&fDeferredMutex);
 	fTracerList = 0;
 }
 
@@ -305,6 +310,10 @@ void SIOTracer::TraceCommandError(int returncode, uint8_t FDC_status)
 			IterTraceErrorString(eTraceCommands, "ERROR:");
 			IterTraceString(eTraceCommands, " illegal remote control frame");
 			break;
+		case AbstractSIOHandler::eDeviceBusy:
+			IterTraceErrorString(eTraceCommands, "ERROR:");
+			IterTraceString(eTraceCommands, " image is still loading");
+			break;
 		default:
 			IterTraceErrorString(eTraceCommands, "ERROR:");
 			snprintf(fString, eMaxStringLength, " %d\n", returncode);
@@ -520,28 +529,67 @@ void SIOTracer::TraceString(ETraceGroup group, const char* format, ...)
 		va_list arg;
 		va_start(arg, format);
 
+		if (!pthread_equal(pthread_self(), fMainThread)) {
+			DeferredString deferred;
+			char buf[eMaxStringLength];
+
+			vsnprintf(buf, eMaxStringLength, format, arg);
+			va_end(arg);
+
+			deferred.fGroup = group;
+			deferred.fString = strdup(buf);
+			if (deferred.fString) {
+				pthread_mutex_lock(&fDeferredMutex);
+				fDeferredStrings.push_back(deferred);
+				pthread_mutex_unlock(&fDeferredMutex);
+			}
+			return;
+		}
+
 		vsnprintf(fString, eMaxStringLength, format, arg);
 
 		va_end(arg);
 
-		IterStartTraceLine(group);
-		switch (group) {
-		case eTraceWarning:
-			IterTraceWarningString(group,"Warning: ");
-			break;
-		case eTraceError:
-			IterTraceErrorString(group,"Error: ");
-			break;
-		case eTraceDebug:
-			IterTraceDebugString(group,"Debug: ");
-			break;
-		default:
-			break;
+		OutputString(group, fString);
+	}
+}
+
+void SIOTracer::FlushDeferredStrings()
+{
+	std::list<DeferredString> strings;
+
+	pthread_mutex_lock(&fDeferredMutex);
+	strings.swap(fDeferredStrings);
+	pthread_mutex_unlock(&fDeferredMutex);
+
+	std::list<DeferredString>::iterator iter;
+	for (iter = strings.begin(); iter != strings.end(); iter++) {
+		if (fTraceGroupsCache & iter->fGroup) {
+			OutputString(iter->fGroup, iter->fString);
 		}
-		IterTraceString(group, fString);
-		IterEndTraceLine(group);
-		IterFlushOutput(group);
+		free(iter->fString);
+	}
+}
+
+void SIOTracer::OutputString(ETraceGroup group, const char* string)
+{
+	IterStartTraceLine(group);
+	switch (group) {
+	case eTraceWarning:
+		IterTraceWarningString(group,"Warning: ");
+		break;
+	case eTraceError:
+		IterTraceErrorString(group,"Error: ");
+		break;
+	case eTraceDebug:
+		IterTraceDebugString(group,"Debug: ");
+		break;
+	default:
+		break;
 	}
+	IterTraceString(group, string);
+	IterEndTraceLine(group);
+	IterFlushOutput(group);
 }
 
 void SIOTracer::IndicateDriveChanged(unsigned int drive)
@@ -29,6 +29,9 @@
 #include "../driver/atarisio.h"
 #endif
 
+#include <pthread.h>
+#include <list>
+
 #include "AbstractTracer.h"
 #include "RefCounted.h"
 #include "RCPtr.h"
@@ -119,9 +122,14 @@ public:
 
 	void TraceAtpDelay(unsigned int delay);
 #endif
+	// strings traced from other threads than the one that created
+	// the tracer are queued until FlushDeferredStrings is called
+	// by the main thread
 	void TraceString(ETraceGroup group, const char* format, ... )
 		__attribute__ ((format (printf, 3, 4))) ;
 
+	void FlushDeferredStrings();
+
 	void IndicateDriveChanged(unsigned int drive);
 	void IndicateDriveFormatted(unsigned int drive);
 	void IndicateCwdChanged();
@@ -148,6 +156,8 @@ private:
 	void IterTraceWarningString(ETraceGroup group, const char* string);
 	void IterTraceErrorString(ETraceGroup group, const char* string);
 
+	void OutputString(ETraceGroup group, const char* string);
+
 	static SIOTracer* fInstance;
 
 	unsigned int fTraceGroupsCache;
@@ -157,6 +167,14 @@ private:
 	enum { eMaxStringLength = 1024 };
 
 	char fString[eMaxStringLength];
+
+	struct DeferredString {
+		ETraceGroup fGroup;
+		char* fString;
+	};
+	pthread_t fMainThread;
+	pthread_mutex_t fDeferredMutex;
+	std::list<DeferredString> fDeferredStrings;
 };
 
 inline SIOTracer* SIOTracer::GetInstance()
@@ -197,6 +215,11 @@ inline void LOG_SIO_SEND_DATA_FAILED()
 	SIOTracer::GetInstance()->TraceString(SIOTracer::eTraceWarning, "send data frame failed");
 }
 
+inline void LOG_SIO_RESPONSE_FAILED()
+{
+	SIOTracer::GetInstance()->TraceString(SIOTracer::eTraceWarning, "send response failed");
+}
+
 inline void LOG_SIO_RECEIVE_DATA_FAILED()
 {
 	SIOTracer::GetInstance()->TraceString(SIOTracer::eTraceWarning, "receive data frame failed");
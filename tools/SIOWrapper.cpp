@@ -73,7 +73,15 @@ SIOWrapper* SIOWrapper::CreateSIOWrapper(const char* devName)
 
 SIOWrapper::SIOWrapper(int fileno)
 	: fDeviceFileNo(fileno), fLastResult(0)
-{ }
+{
+	if (pipe(fWakeupPipe)) {
+		fWakeupPipe[0] = -1;
+		fWakeupPipe[1] = -1;
+	} else {
+		fcntl(fWakeupPipe[0], F_SETFL, O_NONBLOCK);
+		fcntl(fWakeupPipe[1], F_SETFL, O_NONBLOCK);
+	}
+}
 
 SIOWrapper::~SIOWrapper()
 {
@@ -82,6 +90,33 @@ SIOWrapper::~SIOWrapper()
 		fDeviceFileNo=-1;
 		fLastResult=0;
 	}
+	if (fWakeupPipe[0] >= 0) {
+		close(fWakeupPipe[0]);
+		close(fWakeupPipe[1]);
+	}
+}
+
+void SIOWrapper::Wakeup()
+{
+	char c = 0;
+	if (fWakeupPipe[1] >= 0) {
+		// if the pipe is full a wakeup is already pending
+		ssize_t ret = write(fWakeupPipe[1], &c, 1);
+		(void) ret;
+	}
+}
+
+bool SIOWrapper::ClearWakeup()
+{
+	char buf[64];
+	bool ret = false;
+	if (fWakeupPipe[0] < 0) {
+		return false;
+	}
+	while (read(fWakeupPipe[0], buf, sizeof(buf)) > 0) {
+		ret = true;
+	}
+	return ret;
 }
 
 bool SIOWrapper::IsKernelWrapper() const
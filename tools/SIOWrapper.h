@@ -24,11 +24,13 @@
 #include <sys/types.h>
 #include <stdint.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <errno.h>
 
 #include "../driver/atarisio.h"
 #include "RefCounted.h"
 #include "RCPtr.h"
+#include "MiscUtils.h"
 
 class SIOWrapper : public RefCounted {
 public:
@@ -127,8 +129,12 @@ public:
 	 *  0 = command frame is waiting
 	 *  1 = other device has data
 	 *  2 = error in select (or caught signal)
+	 *  3 = woken up by Wakeup()
 	 */
 
+	// make WaitForCommandFrame return 3, can be called from any thread
+	void Wakeup();
+
 	virtual int GetCommandFrame(SIO_command_frame& frame) = 0;
 	virtual int SendCommandACK() = 0;
 	virtual int SendCommandNAK() = 0;
@@ -138,6 +144,23 @@ public:
 	virtual int SendError() = 0;
 
 	virtual int SendDataFrame(uint8_t* buf, unsigned int length) = 0;
+	// send a data frame gathered from several buffers, so data can
+	// be sent directly from an image without copying it first
+	virtual int SendDataFrame(const struct iovec* iov, unsigned int iovcnt) = 0;
+	// same as above, with a precomputed SIO checksum of the data
+	virtual int SendDataFrame(const struct iovec* iov, unsigned int iovcnt, uint8_t checksum) = 0;
+
+	// send the whole response to a read-type command in one call:
+	// command ACK, complete (error if ok is false) and the data
+	// frame. complete is sent no earlier than completeTime (0 means
+	// as soon as possible), so the data has to be ready before the
+	// command is ACKed.
+	virtual int SendResponse(bool ok, MiscUtils::TimestampType completeTime,
+		const struct iovec* iov, unsigned int iovcnt) = 0;
+	// same as above, with a precomputed SIO checksum of the data
+	virtual int SendResponse(bool ok, MiscUtils::TimestampType completeTime,
+		const struct iovec* iov, unsigned int iovcnt, uint8_t checksum) = 0;
+
 	virtual int ReceiveDataFrame(uint8_t* buf, unsigned int length) = 0;
 
 	virtual int SendRawFrame(uint8_t* buf, unsigned int length) = 0;
@@ -196,10 +219,18 @@ protected:
 
 	void InitializeBaudrates();
 
+	// returns true if Wakeup() was called and resets the wakeup state
+	bool ClearWakeup();
+
+	inline int GetWakeupFD() const;
+
 	int fDeviceFileNo;
 	int fLastResult;
 	unsigned int fStandardBaudrate;
 	unsigned int fHighspeedBaudrate;
+
+	// pipe used by Wakeup(), the read end is polled in WaitForCommandFrame
+	int fWakeupPipe[2];
 };
 
 inline int SIOWrapper::GetLastStatus()
@@ -211,4 +242,9 @@ inline int SIOWrapper::GetDeviceFD() const
 {
 	return fDeviceFileNo;
 }
+
+inline int SIOWrapper::GetWakeupFD() const
+{
+	return fWakeupPipe[0];
+}
 #endif
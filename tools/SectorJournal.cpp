@@ -0,0 +1,561 @@
+/*
+   SectorJournal.cpp - write-ahead journal for sector writes to
+   uncompressed ATR/XFD images
+
+   Copyright (C) 2026 Matthias Reichl <hias@horus.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#include "SectorJournal.h"
+#include "Crc32.h"
+#include "SIOTracer.h"
+#include "AtariDebug.h"
+
+/*
+ * journal layout (all values little endian):
+ *
+ * header: "AJRN", version (32 bit), image file size (32 bit), 0 (32 bit)
+ *
+ * records: file offset (32 bit), length (32 bit), type (16 bit), 0 (16 bit),
+ *          data (only for eRecordData), crc32 of all previous record bytes
+ *
+ * Replaying stops at the first incomplete or corrupted record.
+ */
+
+static const uint8_t journalMagic[4] = { 'A', 'J', 'R', 'N' };
+static const uint32_t journalVersion = 1;
+
+static inline void Put16(uint8_t* p, uint16_t val)
+{
+	p[0] = val & 0xff;
+	p[1] = val >> 8;
+}
+
+static inline void Put32(uint8_t* p, uint32_t val)
+{
+	p[0] = val & 0xff;
+	p[1] = (val >> 8) & 0xff;
+	p[2] = (val >> 16) & 0xff;
+	p[3] = val >> 24;
+}
+
+static inline uint16_t Get16(const uint8_t* p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t Get32(const uint8_t* p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// returns the offset of the sector data in the image file, -1 if
+// the file cannot be journaled
+static ssize_t GetDataOffset(const char* filename)
+{
+	size_t len = strlen(filename);
+
+	if (len < 4) {
+		return -1;
+	}
+	if (strcasecmp(filename+len-4,".atr") == 0) {
+		return 16;
+	}
+	if (strcasecmp(filename+len-4,".xfd") == 0) {
+		return 0;
+	}
+	return -1;
+}
+
+static char* MakeFilename(const char* imageFilename, const char* suffix)
+{
+	char* name = (char*) malloc(strlen(imageFilename) + strlen(suffix) + 1);
+	strcpy(name, imageFilename);
+	strcat(name, suffix);
+	return name;
+}
+
+SectorJournal::SectorJournal(const char* imageFilename, const AtrImageConfig& config,
+		size_t dataOffset, const RCPtr<JournalFlusher>& flusher)
+	: fImageConfig(config),
+	  fDataOffset(dataOffset),
+	  fImageFileSize(dataOffset + config.fImageSize),
+	  fFlusher(flusher),
+	  fJournalFd(-1),
+	  fJournalLength(0),
+	  fOldJournalFd(-1),
+	  fCommitFailed(false),
+	  fSyncedMTime(0),
+	  fFoldedMTime(0),
+	  fForeignChange(false)
+{
+	fImageFilename = strdup(imageFilename);
+	fJournalFilename = MakeFilename(imageFilename, ".journal");
+	fOldJournalFilename = MakeFilename(imageFilename, ".journal.1");
+
+	pthread_mutex_init(&fMutex, 0);
+	pthread_mutex_init(&fFoldMutex, 0);
+}
+
+SectorJournal::~SectorJournal()
+{
+	if (fFlusher.IsNotNull()) {
+		fFlusher->UnregisterJournal(this);
+	}
+
+	if (fJournalFd >= 0) {
+		if (fCommitFailed) {
+			AERROR("cannot write journal into \"%s\", keeping \"%s\"",
+				fImageFilename, fJournalFilename);
+		} else {
+			unlink(fJournalFilename);
+		}
+		close(fJournalFd);
+	}
+	if (fOldJournalFd >= 0) {
+		if (!fCommitFailed) {
+			unlink(fOldJournalFilename);
+		}
+		close(fOldJournalFd);
+	}
+
+	pthread_mutex_destroy(&fFoldMutex);
+	pthread_mutex_destroy(&fMutex);
+
+	free(fOldJournalFilename);
+	free(fJournalFilename);
+	free(fImageFilename);
+}
+
+RCPtr<SectorJournal> SectorJournal::Create(const RCPtr<AtrImage>& image, const RCPtr<JournalFlusher>& flusher)
+{
+	RCPtr<SectorJournal> journal;
+	const char* filename;
+	ssize_t dataOffset;
+	struct stat statbuf;
+
+	// overlays must never write into their base image
+	if (image.IsNull() || image->IsVirtualImage() || image->IsAtrOverlayImage()) {
+		return journal;
+	}
+	if ((filename = image->GetFilename()) == 0) {
+		return journal;
+	}
+	if ((dataOffset = GetDataOffset(filename)) < 0) {
+		return journal;
+	}
+	if (stat(filename, &statbuf) || !S_ISREG(statbuf.st_mode)) {
+		return journal;
+	}
+	if ((size_t)statbuf.st_size != dataOffset + image->GetImageSize()) {
+		DPRINTF("size of \"%s\" doesn't match image size", filename);
+		return journal;
+	}
+
+	journal = new SectorJournal(filename, image->GetImageConfig(), dataOffset, flusher);
+	journal->fSyncedMTime = journal->fFoldedMTime = statbuf.st_mtime;
+
+	// a leftover old journal would be overwritten by the next fold
+	if (access(journal->fOldJournalFilename, F_OK) == 0) {
+		AWARN("journal \"%s\" hasn't been recovered", journal->fOldJournalFilename);
+		journal = 0;
+		return journal;
+	}
+
+	if (!journal->OpenJournal()) {
+		AWARN("cannot create journal \"%s\"", journal->fJournalFilename);
+		journal = 0;
+		return journal;
+	}
+
+	// set up the CRC table before the flusher thread uses it
+	CRC32::CalcCRC32(0, journal->fRecordBuffer, 0);
+
+	if (flusher.IsNotNull()) {
+		flusher->RegisterJournal(journal.GetRealPointer());
+	}
+	return journal;
+}
+
+bool SectorJournal::OpenJournal()
+{
+	uint8_t hdr[eHeaderLength];
+	int fd;
+
+	fd = open(fJournalFilename, O_RDWR | O_CREAT, 0666);
+	if (fd < 0) {
+		return false;
+	}
+	// the lock tells Recover() that the journal is in use
+	if (flock(fd, LOCK_EX | LOCK_NB)) {
+		close(fd);
+		return false;
+	}
+
+	memcpy(hdr, journalMagic, 4);
+	Put32(hdr+4, journalVersion);
+	Put32(hdr+8, fImageFileSize);
+	Put32(hdr+12, 0);
+
+	if (ftruncate(fd, 0) || !WriteFully(fd, hdr, eHeaderLength, 0)) {
+		close(fd);
+		return false;
+	}
+
+	fJournalFd = fd;
+	fJournalLength = eHeaderLength;
+	return true;
+}
+
+bool SectorJournal::ReadFully(int fd, uint8_t* buf, size_t len, off_t offset)
+{
+	ssize_t cnt;
+
+	while (len) {
+		cnt = pread(fd, buf, len, offset);
+		if (cnt < 0 && errno == EINTR) {
+			continue;
+		}
+		if (cnt <= 0) {
+			return false;
+		}
+		buf += cnt;
+		len -= cnt;
+		offset += cnt;
+	}
+	return true;
+}
+
+bool SectorJournal::WriteFully(int fd, const uint8_t* buf, size_t len, off_t offset)
+{
+	ssize_t cnt;
+
+	while (len) {
+		cnt = pwrite(fd, buf, len, offset);
+		if (cnt < 0 && errno == EINTR) {
+			continue;
+		}
+		if (cnt <= 0) {
+			return false;
+		}
+		buf += cnt;
+		len -= cnt;
+		offset += cnt;
+	}
+	return true;
+}
+
+bool SectorJournal::AppendRecord(uint16_t type, size_t offset, const uint8_t* buf, unsigned int len)
+{
+	size_t recordLength = eRecordHeaderLength;
+	bool ok;
+
+	Put32(fRecordBuffer, offset);
+	Put32(fRecordBuffer+4, len);
+	Put16(fRecordBuffer+8, type);
+	Put16(fRecordBuffer+10, 0);
+	if (type == eRecordData) {
+		memcpy(fRecordBuffer + eRecordHeaderLength, buf, len);
+		recordLength += len;
+	}
+	Put32(fRecordBuffer + recordLength, CRC32::CalcCRC32(0, fRecordBuffer, recordLength));
+	recordLength += 4;
+
+	pthread_mutex_lock(&fMutex);
+	ok = WriteFully(fJournalFd, fRecordBuffer, recordLength, fJournalLength);
+	if (ok) {
+		fJournalLength += recordLength;
+	} else {
+		// don't leave a partial record behind
+		if (ftruncate(fJournalFd, fJournalLength)) {
+			DPRINTF("truncating journal failed");
+		}
+	}
+	pthread_mutex_unlock(&fMutex);
+
+	return ok;
+}
+
+bool SectorJournal::AppendSector(unsigned int sector, const uint8_t* buf, unsigned int len)
+{
+	ssize_t offset = fImageConfig.CalculateOffset(sector);
+
+	if (offset < 0 || len != fImageConfig.GetSectorLength(sector) || len > eMaxDataLength) {
+		DPRINTF("illegal sector in AppendSector: %d", sector);
+		return false;
+	}
+	return AppendRecord(eRecordData, fDataOffset + offset, buf, len);
+}
+
+bool SectorJournal::AppendClearImage()
+{
+	return AppendRecord(eRecordZero, fDataOffset, 0, fImageConfig.fImageSize);
+}
+
+int SectorJournal::ApplyJournal(int journalFd, int imageFd, off_t imageFileSize)
+{
+	static const uint8_t zeroBuffer[eMaxDataLength] = { 0 };
+	uint8_t buf[eRecordHeaderLength + eMaxDataLength + 4];
+	off_t pos;
+	int count = 0;
+
+	if (!ReadFully(journalFd, buf, eHeaderLength, 0)) {
+		return 0;
+	}
+	if (memcmp(buf, journalMagic, 4) ||
+	    Get32(buf+4) != journalVersion ||
+	    Get32(buf+8) != imageFileSize) {
+		return 0;
+	}
+	pos = eHeaderLength;
+
+	while (ReadFully(journalFd, buf, eRecordHeaderLength, pos)) {
+		off_t offset = Get32(buf);
+		size_t len = Get32(buf+4);
+		uint16_t type = Get16(buf+8);
+		size_t dataLength;
+
+		switch (type) {
+		case eRecordData:
+			dataLength = len;
+			break;
+		case eRecordZero:
+			dataLength = 0;
+			break;
+		default:
+			return count;
+		}
+		if (dataLength > eMaxDataLength || offset + (off_t)len > imageFileSize) {
+			return count;
+		}
+		if (!ReadFully(journalFd, buf + eRecordHeaderLength, dataLength + 4, pos + eRecordHeaderLength)) {
+			return count;
+		}
+		if (Get32(buf + eRecordHeaderLength + dataLength) !=
+		    CRC32::CalcCRC32(0, buf, eRecordHeaderLength + dataLength)) {
+			return count;
+		}
+		pos += eRecordHeaderLength + dataLength + 4;
+
+		if (type == eRecordData) {
+			if (!WriteFully(imageFd, buf + eRecordHeaderLength, len, offset)) {
+				return -1;
+			}
+		} else {
+			while (len) {
+				size_t cnt = len > eMaxDataLength ? (size_t) eMaxDataLength : len;
+				if (!WriteFully(imageFd, zeroBuffer, cnt, offset)) {
+					return -1;
+				}
+				offset += cnt;
+				len -= cnt;
+			}
+		}
+		count++;
+	}
+	return count;
+}
+
+bool SectorJournal::Fold()
+{
+	bool ok = true;
+	int imageFd;
+
+	pthread_mutex_lock(&fFoldMutex);
+
+	if (fOldJournalFd < 0) {
+		// switch to a new journal, the SIO code must only wait
+		// for the renames, not for the image file writes
+		pthread_mutex_lock(&fMutex);
+		if (fJournalLength > eHeaderLength) {
+			int oldFd = fJournalFd;
+			off_t oldLength = fJournalLength;
+
+			if (rename(fJournalFilename, fOldJournalFilename) == 0) {
+				if (OpenJournal()) {
+					fOldJournalFd = oldFd;
+				} else {
+					rename(fOldJournalFilename, fJournalFilename);
+					fJournalFd = oldFd;
+					fJournalLength = oldLength;
+					ok = false;
+				}
+			} else {
+				ok = false;
+			}
+		}
+		pthread_mutex_unlock(&fMutex);
+	}
+
+	if (fOldJournalFd >= 0) {
+		imageFd = open(fImageFilename, O_WRONLY);
+		if (imageFd >= 0) {
+			struct stat statbuf;
+
+			if (fstat(imageFd, &statbuf) || statbuf.st_mtime != fFoldedMTime) {
+				fForeignChange = true;
+			}
+			if (ApplyJournal(fOldJournalFd, imageFd, fImageFileSize) >= 0
+			    && fdatasync(imageFd) == 0) {
+				unlink(fOldJournalFilename);
+				close(fOldJournalFd);
+				fOldJournalFd = -1;
+
+				// lets write-back still only write the dirty sectors
+				if (fstat(imageFd, &statbuf) == 0) {
+					fFoldedMTime = statbuf.st_mtime;
+				} else {
+					fForeignChange = true;
+				}
+			} else {
+				ok = false;
+			}
+			close(imageFd);
+		} else {
+			ok = false;
+		}
+	}
+
+	pthread_mutex_unlock(&fFoldMutex);
+	return ok;
+}
+
+bool SectorJournal::Commit()
+{
+	if (fFlusher.IsNotNull()) {
+		fFlusher->UnregisterJournal(this);
+		fFlusher = 0;
+	}
+
+	// first fold finishes a pending old journal, the second one
+	// the current journal
+	fCommitFailed = !(Fold() && Fold());
+	return !fCommitFailed;
+}
+
+void SectorJournal::SuspendFolding()
+{
+	pthread_mutex_lock(&fFoldMutex);
+}
+
+void SectorJournal::ResumeFolding(bool imageWasWritten)
+{
+	int imageFd;
+
+	if (imageWasWritten) {
+		// the journal may only go once the image is on disk
+		imageFd = open(fImageFilename, O_RDONLY);
+		if (imageFd >= 0) {
+			struct stat statbuf;
+
+			if (fstat(imageFd, &statbuf) == 0) {
+				fSyncedMTime = fFoldedMTime = statbuf.st_mtime;
+				fForeignChange = false;
+			} else {
+				fForeignChange = true;
+			}
+			if (fdatasync(imageFd) == 0) {
+				pthread_mutex_lock(&fMutex);
+				if (ftruncate(fJournalFd, eHeaderLength) == 0) {
+					fJournalLength = eHeaderLength;
+				}
+				pthread_mutex_unlock(&fMutex);
+
+				if (fOldJournalFd >= 0) {
+					unlink(fOldJournalFilename);
+					close(fOldJournalFd);
+					fOldJournalFd = -1;
+				}
+			}
+			close(imageFd);
+		}
+	}
+	pthread_mutex_unlock(&fFoldMutex);
+}
+
+bool SectorJournal::GetFoldedMTime(time_t& syncedMTime, time_t& foldedMTime) const
+{
+	if (fForeignChange) {
+		return false;
+	}
+	syncedMTime = fSyncedMTime;
+	foldedMTime = fFoldedMTime;
+	return true;
+}
+
+bool SectorJournal::Recover(const char* imageFilename)
+{
+	static const char* suffixes[2] = { ".journal.1", ".journal" };
+	struct stat statbuf;
+	bool ok = true;
+
+	if (GetDataOffset(imageFilename) < 0) {
+		return true;
+	}
+	if (stat(imageFilename, &statbuf) || !S_ISREG(statbuf.st_mode)) {
+		return true;
+	}
+
+	// the old journal has to be replayed first
+	for (int i = 0; i < 2 && ok; i++) {
+		char* journalFilename = MakeFilename(imageFilename, suffixes[i]);
+		int journalFd, imageFd;
+		int count;
+
+		journalFd = open(journalFilename, O_RDWR);
+		if (journalFd < 0) {
+			free(journalFilename);
+			continue;
+		}
+		if (flock(journalFd, LOCK_EX | LOCK_NB)) {
+			// journal belongs to an image that's currently loaded
+			close(journalFd);
+			free(journalFilename);
+			break;
+		}
+
+		imageFd = open(imageFilename, O_WRONLY);
+		if (imageFd < 0) {
+			AERROR("cannot open \"%s\" to recover journal", imageFilename);
+			ok = false;
+		} else {
+			count = ApplyJournal(journalFd, imageFd, statbuf.st_size);
+			if (count < 0 || fdatasync(imageFd)) {
+				AERROR("recovering journal \"%s\" failed", journalFilename);
+				ok = false;
+			} else {
+				if (count) {
+					ALOG("recovered %d writes to \"%s\" from journal", count, imageFilename);
+				}
+				unlink(journalFilename);
+			}
+			close(imageFd);
+		}
+		close(journalFd);
+		free(journalFilename);
+	}
+	return ok;
+}
@@ -0,0 +1,153 @@
+#ifndef SECTORJOURNAL_H
+#define SECTORJOURNAL_H
+
+/*
+   SectorJournal.h - write-ahead journal for sector writes to
+   uncompressed ATR/XFD images
+
+   Copyright (C) 2026 Matthias Reichl <hias@horus.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include <pthread.h>
+#include <sys/types.h>
+#include <stdint.h>
+
+#include "AtrImage.h"
+#include "JournalFlusher.h"
+#include "RefCounted.h"
+#include "RCPtr.h"
+
+/*
+ * Every sector written by the Atari is appended to "<image>.journal"
+ * as a (file offset, data, crc32) record. The JournalFlusher thread
+ * periodically renames the journal to "<image>.journal.1", starts a
+ * new one and writes the records of the old one into the image file.
+ * If atariserver dies before that, Recover() replays the leftover
+ * journals the next time the image is loaded.
+ *
+ * Appending a record is a single write() of the record, it never
+ * waits for the disk.
+ *
+ * Records that haven't been folded yet are discarded when the journal
+ * is destroyed (when the drive is unloaded or atariserver quits),
+ * unless Commit() was called before.
+ */
+
+class SectorJournal : public RefCounted {
+public:
+	// returns NULL if the image file cannot be journaled (compressed
+	// or truncated images, journal in use by another drive, ...)
+	static RCPtr<SectorJournal> Create(const RCPtr<AtrImage>& image, const RCPtr<JournalFlusher>& flusher);
+
+	virtual ~SectorJournal();
+
+	// replay leftover journals of a (not yet loaded) image file
+	static bool Recover(const char* imageFilename);
+
+	bool AppendSector(unsigned int sector, const uint8_t* buf, unsigned int len);
+
+	// the Atari formatted the disk, layout must be unchanged
+	bool AppendClearImage();
+
+	// write all records into the image file, called by the flusher
+	bool Fold();
+
+	// write all pending records into the image file, used when
+	// autosave is switched off or the image is written to a new file
+	bool Commit();
+
+	// the image is written back by the main thread: stop folding
+	// and discard the journal if writing was successful
+	void SuspendFolding();
+	void ResumeFolding(bool imageWasWritten);
+
+	// call with folding suspended: returns false if somebody else
+	// modified the image file since the journal was created or the
+	// image was written back (at syncedMTime). Otherwise folding
+	// left the image file at foldedMTime.
+	bool GetFoldedMTime(time_t& syncedMTime, time_t& foldedMTime) const;
+
+	inline const AtrImageConfig& GetImageConfig() const;
+	inline const char* GetImageFilename() const;
+
+private:
+	SectorJournal(const char* imageFilename, const AtrImageConfig& config,
+		size_t dataOffset, const RCPtr<JournalFlusher>& flusher);
+
+	enum {
+		eHeaderLength = 16,
+		eRecordHeaderLength = 12,
+		eMaxDataLength = 8192,
+		eRecordData = 1,
+		eRecordZero = 2
+	};
+
+	bool OpenJournal();
+	bool AppendRecord(uint16_t type, size_t offset, const uint8_t* buf, unsigned int len);
+
+	// returns the number of records written into the image file,
+	// -1 on write errors
+	static int ApplyJournal(int journalFd, int imageFd, off_t imageFileSize);
+
+	static bool ReadFully(int fd, uint8_t* buf, size_t len, off_t offset);
+	static bool WriteFully(int fd, const uint8_t* buf, size_t len, off_t offset);
+
+	char* fImageFilename;
+	char* fJournalFilename;
+	char* fOldJournalFilename;
+
+	AtrImageConfig fImageConfig;
+	size_t fDataOffset;
+	off_t fImageFileSize;
+
+	RCPtr<JournalFlusher> fFlusher;
+
+	// fMutex protects fJournalFd and fJournalLength, it's only
+	// held for a single append or while switching journals.
+	pthread_mutex_t fMutex;
+	// fFoldMutex serializes folding and writing back the image
+	pthread_mutex_t fFoldMutex;
+
+	int fJournalFd;
+	off_t fJournalLength;
+
+	// renamed journal that hasn't been folded yet
+	int fOldJournalFd;
+
+	// keep the journal files for recovery
+	bool fCommitFailed;
+
+	// modification time of the image file when it was last in
+	// sync with the image and after the last fold
+	time_t fSyncedMTime;
+	time_t fFoldedMTime;
+	bool fForeignChange;
+
+	uint8_t fRecordBuffer[eRecordHeaderLength + eMaxDataLength + 4];
+};
+
+inline const AtrImageConfig& SectorJournal::GetImageConfig() const
+{
+	return fImageConfig;
+}
+
+inline const char* SectorJournal::GetImageFilename() const
+{
+	return fImageFilename;
+}
+
+#endif
@@ -0,0 +1,139 @@
+/*
+   SectorStore.cpp - content addressed store for sector data, identical
+   sectors of all images are only kept once
+
+   Copyright (C) 2026 Matthias Reichl <hias@horus.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "SectorStore.h"
+#include "Crc32.h"
+#include "AtariDebug.h"
+
+SectorStore::SectorStore()
+	: fNumberOfReferences(0),
+	  fReferencedBytes(0),
+	  fStoredBytes(0)
+{
+#ifndef WINVER
+	pthread_mutex_init(&fMutex, 0);
+#endif
+}
+
+SectorStore::~SectorStore()
+{
+	if (fNumberOfReferences) {
+		DPRINTF("sector store destroyed with %d references", fNumberOfReferences);
+	}
+	EntryMap::iterator iter;
+	for (iter = fEntries.begin(); iter != fEntries.end(); iter++) {
+		free(iter->second);
+	}
+#ifndef WINVER
+	pthread_mutex_destroy(&fMutex);
+#endif
+}
+
+inline uint8_t* SectorStore::EntryData(Entry* entry)
+{
+	return (uint8_t*) (entry + 1);
+}
+
+inline SectorStore::Entry* SectorStore::DataEntry(const uint8_t* data)
+{
+	return ((Entry*) data) - 1;
+}
+
+const uint8_t* SectorStore::Intern(const uint8_t* data, unsigned int len)
+{
+	uint32_t hash = CRC32::CalcCRC32(0, (void*) data, len);
+	Entry* entry;
+
+	Lock();
+
+	std::pair<EntryMap::iterator, EntryMap::iterator> range = fEntries.equal_range(hash);
+	EntryMap::iterator iter;
+	for (iter = range.first; iter != range.second; iter++) {
+		entry = iter->second;
+		if (entry->fLength == len && memcmp(EntryData(entry), data, len) == 0) {
+			entry->fRefCount++;
+			fNumberOfReferences++;
+			fReferencedBytes += len;
+			Unlock();
+			return EntryData(entry);
+		}
+	}
+
+	entry = (Entry*) malloc(sizeof(Entry) + len);
+	if (!entry) {
+		Unlock();
+		return 0;
+	}
+	entry->fHash = hash;
+	entry->fRefCount = 1;
+	entry->fLength = len;
+	memcpy(EntryData(entry), data, len);
+	fEntries.insert(range.second, EntryMap::value_type(hash, entry));
+
+	fNumberOfReferences++;
+	fReferencedBytes += len;
+	fStoredBytes += len;
+
+	Unlock();
+	return EntryData(entry);
+}
+
+void SectorStore::Release(const uint8_t* data)
+{
+	if (!data) {
+		return;
+	}
+
+	Entry* entry = DataEntry(data);
+
+	Lock();
+
+	fNumberOfReferences--;
+	fReferencedBytes -= entry->fLength;
+
+	if (--entry->fRefCount) {
+		Unlock();
+		return;
+	}
+
+	std::pair<EntryMap::iterator, EntryMap::iterator> range = fEntries.equal_range(entry->fHash);
+	EntryMap::iterator iter;
+	for (iter = range.first; iter != range.second; iter++) {
+		if (iter->second == entry) {
+			fEntries.erase(iter);
+			break;
+		}
+	}
+	fStoredBytes -= entry->fLength;
+	Unlock();
+	free(entry);
+}
+
+double SectorStore::GetDedupRatio() const
+{
+	if (fStoredBytes == 0) {
+		return 1.0;
+	}
+	return (double) fReferencedBytes / (double) fStoredBytes;
+}
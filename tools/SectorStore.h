@@ -0,0 +1,119 @@
+#ifndef SECTORSTORE_H
+#define SECTORSTORE_H
+
+/*
+   SectorStore.h - content addressed store for sector data, identical
+   sectors of all images are only kept once
+
+   Copyright (C) 2026 Matthias Reichl <hias@horus.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <map>
+#ifndef WINVER
+#include <pthread.h>
+#endif
+
+#include "RefCounted.h"
+
+class SectorStore : public RefCounted {
+public:
+	SectorStore();
+	virtual ~SectorStore();
+
+	// returns a pointer to the shared copy of the data, the
+	// reference count of the data is incremented. Intern and
+	// Release may also be called from the image loader thread.
+	const uint8_t* Intern(const uint8_t* data, unsigned int len);
+
+	// decrements the reference count of data returned by Intern
+	void Release(const uint8_t* data);
+
+	// number of Intern() references (sectors of all images)
+	inline unsigned int GetNumberOfReferences() const;
+	// number of distinct sectors actually stored
+	inline unsigned int GetNumberOfEntries() const;
+
+	inline size_t GetReferencedBytes() const;
+	inline size_t GetStoredBytes() const;
+
+	// referenced bytes / stored bytes, 1.0 if nothing is stored
+	double GetDedupRatio() const;
+
+private:
+	struct Entry {
+		uint32_t fHash;
+		unsigned int fRefCount;
+		unsigned int fLength;
+		// followed by the sector data
+	};
+
+	static inline uint8_t* EntryData(Entry* entry);
+	static inline Entry* DataEntry(const uint8_t* data);
+
+	inline void Lock();
+	inline void Unlock();
+
+	typedef std::multimap<uint32_t, Entry*> EntryMap;
+	EntryMap fEntries;
+
+#ifndef WINVER
+	// protects the entries and the statistics
+	pthread_mutex_t fMutex;
+#endif
+
+	unsigned int fNumberOfReferences;
+	size_t fReferencedBytes;
+	size_t fStoredBytes;
+};
+
+inline void SectorStore::Lock()
+{
+#ifndef WINVER
+	pthread_mutex_lock(&fMutex);
+#endif
+}
+
+inline void SectorStore::Unlock()
+{
+#ifndef WINVER
+	pthread_mutex_unlock(&fMutex);
+#endif
+}
+
+inline unsigned int SectorStore::GetNumberOfReferences() const
+{
+	return fNumberOfReferences;
+}
+
+inline unsigned int SectorStore::GetNumberOfEntries() const
+{
+	return fEntries.size();
+}
+
+inline size_t SectorStore::GetReferencedBytes() const
+{
+	return fReferencedBytes;
+}
+
+inline size_t SectorStore::GetStoredBytes() const
+{
+	return fStoredBytes;
+}
+
+#endif
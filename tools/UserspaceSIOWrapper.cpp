@@ -22,15 +22,20 @@
 #include <sys/stat.h>
 #include <sys/ioctl.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <sched.h>
 #include <linux/serial.h>
 
 #include "UserspaceSIOWrapper.h"
+#include "SIOChecksum.h"
 #include "Termios2.h"
 #include "AtariDebug.h"
 #include "Error.h"
@@ -140,13 +145,38 @@ bool UserspaceSIOWrapper::InitSerialDevice()
 
 UserspaceSIOWrapper::UserspaceSIOWrapper(int fileno)
 	: super(fileno),
+	  fHaveCommandLine(false),
 	  fTapeBaudrate(ATARISIO_TAPE_BAUDRATE),
 	  fBaudrate(0),
 	  fDoAutobaud(false),
 	  fSioTiming(SIOWrapper::eRelaxedTiming),
 	  fRestoreOriginalTermiosOnExit(true),
-	  fLastCommandOK(true)
-{
+	  fLastCommandOK(true),
+	  fModemEventThreadRunning(false),
+	  fModemEventQuit(false),
+	  fModemEventDone(false),
+	  fModemEventMask(0),
+	  fLastEdgeTime(0),
+	  fEdgeLatencyCount(0),
+	  fEdgeLatencySum(0),
+	  fEdgeLatencyMax(0),
+	  fFskDelays(0),
+	  fFskNumBits(0),
+	  fFskResult(0),
+	  fFskEdgeCount(0),
+	  fFskJitterSum(0),
+	  fFskJitterMax(0),
+	  fEnableTimestamps(false),
+	  fGotSendTimestamp(false),
+	  fTimestampOffset(0),
+	  fHaveAdapterProfile(false),
+	  fOutputLatency(0),
+	  fPollInterval(100)
+{
+	memset(&fTimestamps, 0, sizeof(fTimestamps));
+	fModemEventPipe[0] = -1;
+	fModemEventPipe[1] = -1;
+
 	if (ioctl(fDeviceFileNo, TCGETS, &fOriginalTermios)) {
 		fDeviceFileNo = -1;
 		throw DeviceInitError("cannot get current serial port settings");
@@ -161,10 +191,84 @@ UserspaceSIOWrapper::UserspaceSIOWrapper(int fileno)
 		throw DeviceInitError("cannot set standard baudrate");
 	}
 	tcflush(fDeviceFileNo, TCIOFLUSH);
+
+	std::string key;
+	if (AdapterProfile::GetDeviceKey(fDeviceFileNo, key) && fAdapterProfile.Load(key)) {
+		if (fAdapterProfile.fBaudrate) {
+			ALOG("using timing profile for %s (calibrated at %u baud)",
+				key.c_str(), fAdapterProfile.fBaudrate);
+		} else {
+			AWARN("timing profile for %s doesn't record the baudrate, please recalibrate", key.c_str());
+		}
+		fHaveAdapterProfile = true;
+		ApplyAdapterProfile();
+	}
+}
+
+void UserspaceSIOWrapper::ApplyAdapterProfile()
+{
+	// the loopback latency includes the way back, use half of
+	// the best case as estimate for the output latency
+	fOutputLatency = 0;
+	if (HaveAdapterTiming()) {
+		fOutputLatency = fAdapterProfile.fLoopbackLatencyMin / 2;
+	}
+
+	// polling faster than TIOCMGET returns makes no sense
+	fPollInterval = 100;
+	if (fAdapterProfile.fModemGetCost > fPollInterval) {
+		fPollInterval = fAdapterProfile.fModemGetCost;
+	}
+}
+
+int UserspaceSIOWrapper::CalibrateAdapter(bool loopback)
+{
+	std::string key;
+	AdapterProfile profile;
+
+	if (!AdapterProfile::GetDeviceKey(fDeviceFileNo, key)) {
+		AERROR("cannot determine adapter ID");
+		fLastResult = ENODEV;
+		return fLastResult;
+	}
+	if (!profile.Measure(fDeviceFileNo, loopback ? fDeviceFileNo : -1, fBaudrate)) {
+		fLastResult = EIO;
+		return fLastResult;
+	}
+	tcflush(fDeviceFileNo, TCIOFLUSH);
+
+	// keep a previously measured loopback latency
+	if (!loopback && HaveAdapterTiming()) {
+		profile.fLoopbackLatencyMin = fAdapterProfile.fLoopbackLatencyMin;
+		profile.fLoopbackLatencyAvg = fAdapterProfile.fLoopbackLatencyAvg;
+		profile.fLoopbackLatencyMax = fAdapterProfile.fLoopbackLatencyMax;
+	}
+	if (!profile.Save(key)) {
+		AERROR("saving timing profile for %s failed", key.c_str());
+		fLastResult = EIO;
+		return fLastResult;
+	}
+	ALOG("saved timing profile for %s", key.c_str());
+
+	fAdapterProfile = profile;
+	fHaveAdapterProfile = true;
+	ApplyAdapterProfile();
+
+	fLastResult = 0;
+	return fLastResult;
+}
+
+void UserspaceSIOWrapper::DelayBeforeSend(unsigned long usec)
+{
+	if (usec > fOutputLatency) {
+		MicroSleep(usec - fOutputLatency);
+	}
 }
 
 UserspaceSIOWrapper::~UserspaceSIOWrapper()
 {
+	StopModemEventThread();
+
 	if (fDeviceFileNo >= 0 && fRestoreOriginalTermiosOnExit) {
 		ioctl(fDeviceFileNo, TCSETS, &fOriginalTermios);
 	}
@@ -181,26 +285,14 @@ bool UserspaceSIOWrapper::IsUserspaceWrapper() const
 	return true;
 }
 
-uint8_t UserspaceSIOWrapper::CalculateChecksum(uint8_t* buf, unsigned int length)
-{
-	uint16_t cksum = 0;
-	for (unsigned int i = 0; i < length; i++) {
-		cksum += buf[i];
-		if (cksum >= 0x100) {
-			cksum = (cksum & 0xff) + 1;
-		}
-	}
-	return (uint8_t) cksum;
-}
-
 bool UserspaceSIOWrapper::CmdBufChecksumOK()
 {
-	return fCmdBuf[eCmdLength] == CalculateChecksum(fCmdBuf, eCmdLength);
+	return fCmdBuf[eCmdLength] == CalculateSIOChecksum(fCmdBuf, eCmdLength);
 }
 
 bool UserspaceSIOWrapper::BufChecksumOK(unsigned int length)
 {
-	return fBuf[length] == CalculateChecksum(fBuf, length);
+	return fBuf[length] == CalculateSIOChecksum(fBuf, length);
 }
 
 bool UserspaceSIOWrapper::SetCommandLine(bool asserted)
@@ -227,6 +319,8 @@ bool UserspaceSIOWrapper::SetCommandLine(bool asserted)
 
 int UserspaceSIOWrapper::Set1050CableType(E1050CableType type)
 {
+	StopModemEventThread();
+
 	fCommandLineMask = ~(TIOCM_RTS | TIOCM_DTR);
 
 	fLastResult = 0;
@@ -323,9 +417,185 @@ int UserspaceSIOWrapper::SetSIOServerMode(ESIOServerCommandLine cmdLine)
 	ClearControlLines();
 	SetWaitCommandIdleState();
 
+	StopModemEventThread();
+	if (fHaveCommandLine && !StartModemEventThread()) {
+		AWARN("cannot start modem event thread, polling command line");
+	}
+
 	return fLastResult;
 }
 
+static void modem_event_sig_handler(int)
+{
+	// only used to interrupt TIOCMIWAIT
+}
+
+uint64_t UserspaceSIOWrapper::GetMonotonicUsec()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+bool UserspaceSIOWrapper::StartModemEventThread()
+{
+	struct sigaction sa;
+	sigset_t allSignals, oldSignals;
+	int ret;
+
+	if (fModemEventThreadRunning) {
+		return true;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = modem_event_sig_handler;
+	sigemptyset(&sa.sa_mask);
+	// no SA_RESTART, the blocking ioctl has to return EINTR
+	sa.sa_flags = 0;
+	if (sigaction(SIGUSR2, &sa, 0)) {
+		return false;
+	}
+
+	if (pipe(fModemEventPipe)) {
+		fModemEventPipe[0] = -1;
+		fModemEventPipe[1] = -1;
+		return false;
+	}
+	fcntl(fModemEventPipe[0], F_SETFL, O_NONBLOCK);
+
+	fModemEventMask = fCommandLineMask;
+	fModemEventQuit = false;
+	fModemEventDone = false;
+	fLastEdgeTime = 0;
+
+	// the thread keeps our (possibly realtime) scheduling so it
+	// can stamp edges without delay. It unblocks SIGUSR2 itself
+	sigfillset(&allSignals);
+	pthread_sigmask(SIG_SETMASK, &allSignals, &oldSignals);
+	ret = pthread_create(&fModemEventThread, 0, ModemEventThreadFunc, this);
+	pthread_sigmask(SIG_SETMASK, &oldSignals, 0);
+
+	if (ret) {
+		close(fModemEventPipe[0]);
+		close(fModemEventPipe[1]);
+		fModemEventPipe[0] = -1;
+		fModemEventPipe[1] = -1;
+		return false;
+	}
+	fModemEventThreadRunning = true;
+	return true;
+}
+
+void UserspaceSIOWrapper::StopModemEventThread()
+{
+	if (!fModemEventThreadRunning) {
+		return;
+	}
+	fModemEventQuit = true;
+	// the signal could arrive just before the thread enters the
+	// ioctl, so repeat it until the thread noticed the quit flag
+	while (!fModemEventDone) {
+		pthread_kill(fModemEventThread, SIGUSR2);
+		MilliSleep(1);
+	}
+	pthread_join(fModemEventThread, 0);
+	fModemEventThreadRunning = false;
+
+	close(fModemEventPipe[0]);
+	close(fModemEventPipe[1]);
+	fModemEventPipe[0] = -1;
+	fModemEventPipe[1] = -1;
+	fLastEdgeTime = 0;
+}
+
+void* UserspaceSIOWrapper::ModemEventThreadFunc(void* arg)
+{
+	UserspaceSIOWrapper* wrapper = static_cast<UserspaceSIOWrapper*>(arg);
+	sigset_t usr2;
+
+	sigemptyset(&usr2);
+	sigaddset(&usr2, SIGUSR2);
+	pthread_sigmask(SIG_UNBLOCK, &usr2, 0);
+
+	wrapper->ModemEventLoop();
+	wrapper->fModemEventDone = true;
+	return 0;
+}
+
+void UserspaceSIOWrapper::ModemEventLoop()
+{
+	struct serial_icounter_struct icount;
+	bool haveCount;
+	int lastCount = 0;
+	uint64_t timestamp;
+	ssize_t ret;
+
+	// TIOCMIWAIT only reports edges after it was entered, use the
+	// interrupt counters (if available) to catch edges in between
+	haveCount = ioctl(fDeviceFileNo, TIOCGICOUNT, &icount) == 0;
+	if (haveCount) {
+		lastCount = icount.rng + icount.dsr + icount.cts;
+	}
+
+	while (!fModemEventQuit) {
+		if (haveCount && ioctl(fDeviceFileNo, TIOCGICOUNT, &icount) == 0
+		    && icount.rng + icount.dsr + icount.cts != lastCount) {
+			lastCount = icount.rng + icount.dsr + icount.cts;
+		} else {
+			if (ioctl(fDeviceFileNo, TIOCMIWAIT, fModemEventMask)) {
+				if (errno == EINTR) {
+					continue;
+				}
+				// not supported by the driver, tell the main thread
+				timestamp = 0;
+				ret = write(fModemEventPipe[1], &timestamp, sizeof(timestamp));
+				(void) ret;
+				return;
+			}
+			if (haveCount && ioctl(fDeviceFileNo, TIOCGICOUNT, &icount) == 0) {
+				lastCount = icount.rng + icount.dsr + icount.cts;
+			}
+		}
+		timestamp = GetMonotonicUsec();
+		ret = write(fModemEventPipe[1], &timestamp, sizeof(timestamp));
+		(void) ret;
+	}
+}
+
+bool UserspaceSIOWrapper::ReadModemEvents()
+{
+	uint64_t timestamps[16];
+	ssize_t len;
+
+	while ((len = read(fModemEventPipe[0], timestamps, sizeof(timestamps))) > 0) {
+		unsigned int count = len / sizeof(uint64_t);
+		for (unsigned int i = 0; i < count; i++) {
+			if (timestamps[i] == 0) {
+				return false;
+			}
+		}
+		if (count) {
+			fLastEdgeTime = timestamps[count - 1];
+		}
+	}
+	return true;
+}
+
+void UserspaceSIOWrapper::RecordEdgeLatency()
+{
+	if (!fLastEdgeTime) {
+		return;
+	}
+	uint64_t latency = GetMonotonicUsec() - fLastEdgeTime;
+
+	fEdgeLatencyCount++;
+	fEdgeLatencySum += latency;
+	if (latency > fEdgeLatencyMax) {
+		fEdgeLatencyMax = latency;
+	}
+	fLastEdgeTime = 0;
+}
+
 int UserspaceSIOWrapper::DirectSIO(SIO_parameters& /* params */)
 {
 	TODO
@@ -346,7 +616,9 @@ int UserspaceSIOWrapper::ExtSIO(Ext_SIO_parameters& params)
 		break;
 	};
 
+	TimestampBegin();
 	fLastResult = InternalExtSIO(params);
+	TimestampEnd();
 	return fLastResult;
 }
 
@@ -411,6 +683,7 @@ int UserspaceSIOWrapper::WaitForCommandFrame(int otherReadPollDevice)
 	int flags;
 	int sel;
 	int cnt;
+	int wakeupfd = GetWakeupFD();
 	MiscUtils::TimestampType printerTimeout = MiscUtils::GetCurrentTimePlusSec(15);
 	MiscUtils::TimestampType now;
 
@@ -418,7 +691,7 @@ int UserspaceSIOWrapper::WaitForCommandFrame(int otherReadPollDevice)
 		now = MiscUtils::GetCurrentTime();
 
 		tv.tv_sec = 0;
-		tv.tv_usec = 100;
+		tv.tv_usec = fPollInterval;
 
 		FD_ZERO(&read_set);
 		FD_SET(fDeviceFileNo, &read_set);
@@ -430,6 +703,20 @@ int UserspaceSIOWrapper::WaitForCommandFrame(int otherReadPollDevice)
 			}
 			FD_SET(otherReadPollDevice, &read_set);
 		}
+		if (wakeupfd >= 0) {
+			if (wakeupfd > maxfd) {
+				maxfd = wakeupfd;
+			}
+			FD_SET(wakeupfd, &read_set);
+		}
+		if (fModemEventThreadRunning) {
+			if (fModemEventPipe[0] > maxfd) {
+				maxfd = fModemEventPipe[0];
+			}
+			FD_SET(fModemEventPipe[0], &read_set);
+			// edges wake us up, no need to poll the line
+			tv.tv_usec = eModemEventTimeout;
+		}
 
 		switch (fCommandReceiveState) {
 		case eCommandSoftError:
@@ -474,6 +761,7 @@ int UserspaceSIOWrapper::WaitForCommandFrame(int otherReadPollDevice)
 				}
 
 				if (flags & fCommandLineMask) {
+					RecordEdgeLatency();
 					SetReceiveCommandState();
 					continue;
 				} else {
@@ -523,6 +811,7 @@ int UserspaceSIOWrapper::WaitForCommandFrame(int otherReadPollDevice)
 					break;
 				}
 				if (!(flags & fCommandLineMask)) {
+					fLastEdgeTime = 0;
 					SetCommandOKState();
 					return 0;
 				}
@@ -582,9 +871,19 @@ int UserspaceSIOWrapper::WaitForCommandFrame(int otherReadPollDevice)
 					break;
 				}
 			}
+			if (fModemEventThreadRunning && FD_ISSET(fModemEventPipe[0], &read_set)) {
+				if (!ReadModemEvents()) {
+					AWARN("TIOCMIWAIT failed, polling command line");
+					StopModemEventThread();
+				}
+			}
 			if (otherReadPollDevice >= 0 && FD_ISSET(otherReadPollDevice, &read_set)) {
 				return 1;
 			}
+			if (wakeupfd >= 0 && FD_ISSET(wakeupfd, &read_set)) {
+				ClearWakeup();
+				return 3;
+			}
 		}
 
 		if (printerTimeout && now > printerTimeout) {
@@ -636,27 +935,40 @@ void UserspaceSIOWrapper::WaitTransmitComplete(unsigned int bytes)
 	// to transmit, so wait a short time before calling it.
 
 	MiscUtils::TimestampType delay;
-	switch (fSioTiming) {
-	case eStrictTiming:
-		delay = 100 + TimeForBytes(bytes) * 105 / 100;
-		break;
-	default:
-		delay = 200 + TimeForBytes(bytes) * 15/10;
-		if (delay < 500) {
-			delay = 500;
+	if (HaveAdapterTiming() && fAdapterProfile.fDrainOvershootMax <= eMaxDrainOvershoot) {
+		// measured: tcdrain returns in time with this adapter
+		delay = 0;
+	} else if (HaveAdapterTiming() && fAdapterProfile.fLoopbackLatencyMax) {
+		// wait until the data should have left the adapter
+		delay = TimeForBytes(bytes) + fAdapterProfile.fLoopbackLatencyMax / 2;
+	} else {
+		switch (fSioTiming) {
+		case eStrictTiming:
+			delay = 100 + TimeForBytes(bytes) * 105 / 100;
+			break;
+		default:
+			delay = 200 + TimeForBytes(bytes) * 15/10;
+			if (delay < 500) {
+				delay = 500;
+			}
+			break;
 		}
-		break;
 	}
 
 	if (delay > 5000) {
 		delay = 5000;
 	}
 
-	MicroSleep(delay);
+	if (delay) {
+		MicroSleep(delay);
+	}
 
 	UTRACE_WAIT_TRANSMIT("tcdrain start");
 	tcdrain(fDeviceFileNo);
 	UTRACE_WAIT_TRANSMIT("tcdrain finished");
+	if (fEnableTimestamps) {
+		fTimestamps.transmission_wakeup = GetTimestamp();
+	}
 
 	// tcdrain should handle that, but better check it
 	cnt = 0;
@@ -670,6 +982,9 @@ void UserspaceSIOWrapper::WaitTransmitComplete(unsigned int bytes)
 		NanoSleep(100000);
 	}
 	UTRACE_WAIT_TRANSMIT("checked lsr %d times", cnt);
+	if (fEnableTimestamps) {
+		fTimestamps.uart_finished = GetTimestamp();
+	}
 
 	switch (fSioTiming) {
 	case eStrictTiming:
@@ -681,8 +996,32 @@ void UserspaceSIOWrapper::WaitTransmitComplete(unsigned int bytes)
 	UTRACE_WAIT_TRANSMIT("end WaitTransmitComplete");
 }
 
+MiscUtils::TimestampType UserspaceSIOWrapper::PacedTransmitTime(unsigned int bytes)
+{
+	switch (fSioTiming) {
+	case eStrictTiming:
+		return TimeForBytes(bytes) * 105 / 100;
+	default:
+		// one byte could still be in the transmitter holding register
+		return 200 + TimeForBytes(bytes + 1) * 15 / 10;
+	}
+}
+
 int UserspaceSIOWrapper::TransmitBuf(uint8_t* buf, unsigned int length, bool waitTransmit)
 {
+	struct iovec iov;
+	iov.iov_base = buf;
+	iov.iov_len = length;
+	return TransmitIovec(&iov, 1, waitTransmit);
+}
+
+int UserspaceSIOWrapper::TransmitIovec(struct iovec* iov, unsigned int iovcnt, bool waitTransmit)
+{
+	unsigned int length = 0;
+	for (unsigned int i = 0; i < iovcnt; i++) {
+		length += iov[i].iov_len;
+	}
+
 	// timeout with 20% margin
 	MiscUtils::TimestampType to = TimeForBytes(length) * 12 / 10 + eDelayT3Max + eSendHeadroom;
 
@@ -698,6 +1037,10 @@ int UserspaceSIOWrapper::TransmitBuf(uint8_t* buf, unsigned int length, bool wai
 
 	UTRACE_TRANSMIT("begin TransmitBuf %d", length);
 
+	if (fEnableTimestamps) {
+		fTimestamps.transmission_start = GetTimestamp();
+	}
+
 	while (pos < length) {
 		FD_ZERO(&write_set);
 		FD_SET(fDeviceFileNo, &write_set);
@@ -713,12 +1056,35 @@ int UserspaceSIOWrapper::TransmitBuf(uint8_t* buf, unsigned int length, bool wai
 			return EATARISIO_UNKNOWN_ERROR;
 		}
 		if (sel == 1) {
-			cnt = write(fDeviceFileNo, buf + pos, length - pos);
+			cnt = writev(fDeviceFileNo, iov, iovcnt);
 			if (cnt < 0) {
 				UTRACE_TRANSMIT_BUF("write failed in TransmitBuf(%d): %d", length, errno);
 				return EATARISIO_UNKNOWN_ERROR;
 			}
 			pos += cnt;
+
+			if (fEnableTimestamps) {
+				// there's no send interrupt in userspace, use the
+				// time the first data was accepted by the driver
+				if (!fGotSendTimestamp) {
+					fTimestamps.transmission_send_irq = GetTimestamp();
+					fGotSendTimestamp = true;
+				}
+				if (pos == length) {
+					fTimestamps.transmission_end = GetTimestamp();
+				}
+			}
+
+			// skip the part that has already been written
+			while (iovcnt && (unsigned int) cnt >= iov->iov_len) {
+				cnt -= iov->iov_len;
+				iov++;
+				iovcnt--;
+			}
+			if (iovcnt) {
+				iov->iov_base = (uint8_t*) iov->iov_base + cnt;
+				iov->iov_len -= cnt;
+			}
 		}
 	}
 
@@ -781,6 +1147,10 @@ int UserspaceSIOWrapper::ReceiveBuf(uint8_t* buf, unsigned int length, unsigned
 			pos += cnt;
 		}
 	}
+	// receive only operations report when the data was complete
+	if (fEnableTimestamps && !fGotSendTimestamp) {
+		fTimestamps.transmission_wakeup = GetTimestamp();
+	}
 	return 0;
 }
 
@@ -810,8 +1180,10 @@ int UserspaceSIOWrapper::SendCommandACK()
 		fLastResult = EATARISIO_COMMAND_TIMEOUT;
 	} else {
 		UTRACE_SIO_BEGIN("SendCommandACK");
-		MicroSleep(eDelayT2Min);
+		TimestampBegin();
+		DelayBeforeSend(eDelayT2Min);
 		fLastResult = TransmitByte(cAckByte, true);
+		TimestampEnd();
 		UTRACE_SIO_END("SendCommandACK");
 	}
 	return fLastResult;
@@ -826,8 +1198,10 @@ int UserspaceSIOWrapper::SendCommandNAK()
 		fLastResult = EATARISIO_COMMAND_TIMEOUT;
 	} else {
 		UTRACE_SIO_BEGIN("SendCommandNAK");
-		MicroSleep(eDelayT2Min);
+		TimestampBegin();
+		DelayBeforeSend(eDelayT2Min);
 		fLastResult = TransmitByte(cNakByte);
+		TimestampEnd();
 		UTRACE_SIO_END("SendCommandNAK");
 	}
 	return fLastResult;
@@ -836,8 +1210,10 @@ int UserspaceSIOWrapper::SendCommandNAK()
 int UserspaceSIOWrapper::SendDataACK()
 {
 	UTRACE_SIO_BEGIN("SendDataACK");
-	MicroSleep(eDelayT4);
+	TimestampBegin();
+	DelayBeforeSend(eDelayT4);
 	fLastResult = TransmitByte(cAckByte, true);
+	TimestampEnd();
 	UTRACE_SIO_END("SendDataACK");
 	return fLastResult;
 }
@@ -845,8 +1221,10 @@ int UserspaceSIOWrapper::SendDataACK()
 int UserspaceSIOWrapper::SendDataNAK()
 {
 	UTRACE_SIO_BEGIN("SendDataNAK");
-	MicroSleep(eDelayT4);
+	TimestampBegin();
+	DelayBeforeSend(eDelayT4);
 	fLastResult = TransmitByte(cNakByte);
+	TimestampEnd();
 	UTRACE_SIO_END("SendDataNAK");
 	return fLastResult;
 }
@@ -854,8 +1232,10 @@ int UserspaceSIOWrapper::SendDataNAK()
 int UserspaceSIOWrapper::SendComplete()
 {
 	UTRACE_SIO_BEGIN("SendComplete");
-	MicroSleep(eDelayT5);
+	TimestampBegin();
+	DelayBeforeSend(eDelayT5);
 	fLastResult = TransmitByte(cCompleteByte);
+	TimestampEnd();
 	UTRACE_SIO_END("SendComplete");
 	return fLastResult;
 }
@@ -863,35 +1243,160 @@ int UserspaceSIOWrapper::SendComplete()
 int UserspaceSIOWrapper::SendError()
 {
 	UTRACE_SIO_BEGIN("SendError");
-	MicroSleep(eDelayT5);
+	TimestampBegin();
+	DelayBeforeSend(eDelayT5);
 	fLastResult = TransmitByte(cErrorByte);
+	TimestampEnd();
 	UTRACE_SIO_END("SendError");
 	return fLastResult;
 }
 
 int UserspaceSIOWrapper::SendDataFrame(uint8_t* buf, unsigned int length)
 {
+	struct iovec iov;
+	iov.iov_base = buf;
+	iov.iov_len = length;
+	return SendDataFrame(&iov, 1);
+}
+
+int UserspaceSIOWrapper::SendDataFrame(const struct iovec* iov, unsigned int iovcnt)
+{
+	return SendDataFrame(iov, iovcnt, CalculateSIOChecksum(iov, iovcnt));
+}
+
+int UserspaceSIOWrapper::SendDataFrame(const struct iovec* iov, unsigned int iovcnt, uint8_t checksum)
+{
+	struct iovec out[eMaxIovecs + 1];
+	unsigned int length = 0;
+
+	if (iovcnt > eMaxIovecs) {
+		fLastResult = EATARISIO_UNKNOWN_ERROR;
+		return fLastResult;
+	}
+	for (unsigned int i = 0; i < iovcnt; i++) {
+		length += iov[i].iov_len;
+		out[i] = iov[i];
+	}
 	if (length > eMaxDataLength) {
 		fLastResult = EATARISIO_ERROR_BLOCK_TOO_LONG;
 		return fLastResult;
 	}
 	UTRACE_SIO_BEGIN("SendDataFrame");
-	memcpy(fBuf, buf, length);
-	fBuf[length] = CalculateChecksum(fBuf, length);
+	TimestampBegin();
+
+	// the checksum is sent from a separate buffer, so the data
+	// doesn't have to be copied
+	out[iovcnt].iov_base = &checksum;
+	out[iovcnt].iov_len = 1;
 
 	// wait for complete to be transmitted
 	WaitTransmitComplete(1);
 
-	MicroSleep(eDataDelay);
-	fLastResult = TransmitBuf(fBuf, length+1);
+	DelayBeforeSend(eDataDelay);
+	fLastResult = TransmitIovec(out, iovcnt + 1);
+	TimestampEnd();
 	UTRACE_SIO_END("SendDataFrame");
 	return fLastResult;
 }
 
+int UserspaceSIOWrapper::SendResponse(bool ok, MiscUtils::TimestampType completeTime,
+	const struct iovec* iov, unsigned int iovcnt)
+{
+	return SendResponse(ok, completeTime, iov, iovcnt, CalculateSIOChecksum(iov, iovcnt));
+}
+
+int UserspaceSIOWrapper::SendResponse(bool ok, MiscUtils::TimestampType completeTime,
+	const struct iovec* iov, unsigned int iovcnt, uint8_t checksum)
+{
+	struct iovec out[eMaxIovecs + 1];
+	unsigned int length = 0;
+	uint64_t written, next;
+	// pacing is only safe if we know how much the adapter latency varies
+	bool paced = HaveAdapterTiming() && fAdapterProfile.fLoopbackLatencyMax;
+	MiscUtils::TimestampType jitter = 0;
+
+	if (iovcnt > eMaxIovecs) {
+		fLastResult = EATARISIO_UNKNOWN_ERROR;
+		return fLastResult;
+	}
+	for (unsigned int i = 0; i < iovcnt; i++) {
+		length += iov[i].iov_len;
+		out[i] = iov[i];
+	}
+	if (length > eMaxDataLength) {
+		fLastResult = EATARISIO_ERROR_BLOCK_TOO_LONG;
+		return fLastResult;
+	}
+	out[iovcnt].iov_base = &checksum;
+	out[iovcnt].iov_len = 1;
+
+	MiscUtils::TimestampType now = MiscUtils::GetCurrentTime();
+	if (now >= fCommandFrameTimestamp + eCommandExpire) {
+		UTRACE_CMD_ERROR("SendResponse: command frame is too old (%lu usec)",
+			(unsigned long) (now - fCommandFrameTimestamp));
+		fLastResult = EATARISIO_COMMAND_TIMEOUT;
+		return fLastResult;
+	}
+
+	UTRACE_SIO_BEGIN("SendResponse");
+	TimestampBegin();
+
+	// With a calibrated adapter write the next part when the
+	// previous one should have been sent rather than waiting for
+	// each byte with tcdrain. The latency cancels out, except for
+	// its variation: the previous part could be held back by the
+	// maximum latency and the next one go out with the minimum,
+	// possibly in the same USB packet.
+	// Without a profile we don't know that, so wait for the ACK
+	// to be transmitted before starting T5.
+	if (paced) {
+		jitter = fAdapterProfile.fLoopbackLatencyMax - fAdapterProfile.fLoopbackLatencyMin;
+	}
+	DelayBeforeSend(eDelayT2Min);
+	written = GetMonotonicUsec();
+	fLastResult = TransmitByte(cAckByte, !paced);
+	if (!fLastResult) {
+		if (paced) {
+			next = written + PacedTransmitTime(1) + jitter + eDelayT5;
+		} else {
+			// same as DelayBeforeSend(eDelayT5)
+			next = GetMonotonicUsec();
+			if (eDelayT5 > fOutputLatency) {
+				next += eDelayT5 - fOutputLatency;
+			}
+		}
+		now = MiscUtils::GetCurrentTime();
+		if (completeTime > now + fOutputLatency) {
+			uint64_t t = GetMonotonicUsec() + (completeTime - now - fOutputLatency);
+			if (t > next) {
+				next = t;
+			}
+		}
+		WaitUntilMonotonic(next);
+		written = GetMonotonicUsec();
+		fLastResult = TransmitByte(ok ? cCompleteByte : cErrorByte);
+	}
+	if (!fLastResult) {
+		if (paced) {
+			WaitUntilMonotonic(written + PacedTransmitTime(1) + jitter + eDataDelay);
+		} else {
+			WaitTransmitComplete(1);
+			DelayBeforeSend(eDataDelay);
+		}
+		fLastResult = TransmitIovec(out, iovcnt + 1);
+	}
+
+	TimestampEnd();
+	UTRACE_SIO_END("SendResponse");
+	return fLastResult;
+}
+
 int UserspaceSIOWrapper::ReceiveDataFrame(uint8_t* buf, unsigned int length)
 {
 	UTRACE_SIO_BEGIN("ReceiveDataFrame");
+	TimestampBegin();
 	fLastResult = ReceiveBuf(length+1, eDelayT3Max + eReceiveHeadroom);
+	TimestampEnd();
 	UTRACE_SIO_END("ReceiveDataFrame");
 	// DPRINTF("ReceiveBuf(%d): %d", length+1, fLastResult);
 
@@ -910,13 +1415,19 @@ int UserspaceSIOWrapper::ReceiveDataFrame(uint8_t* buf, unsigned int length)
 
 int UserspaceSIOWrapper::SendRawFrame(uint8_t* buf, unsigned int length)
 {
-	fLastResult = TransmitBuf(buf, length);
+	TimestampBegin();
+	// the transmission end is only known after waiting for it,
+	// keep returning early if nobody needs the timestamps
+	fLastResult = TransmitBuf(buf, length, fEnableTimestamps);
+	TimestampEnd();
 	return fLastResult;
 }
 
 int UserspaceSIOWrapper::ReceiveRawFrame(uint8_t* buf, unsigned int length)
 {
+	TimestampBegin();
 	fLastResult = ReceiveBuf(buf, length, eDelayT3Max + eReceiveHeadroom);
+	TimestampEnd();
 	return fLastResult;
 }
 
@@ -1003,6 +1514,8 @@ int UserspaceSIOWrapper::SetBaudrate(unsigned int baudrate, bool now)
 
 	if (!fLastResult) {
 		fBaudrate = baudrate;
+		// the measured latencies only apply at the calibration baudrate
+		ApplyAdapterProfile();
 	}
 	return fLastResult;
 }
@@ -1127,27 +1640,183 @@ int UserspaceSIOWrapper::FlushWriteBuffer()
 	return fLastResult;
 }
 
-int UserspaceSIOWrapper::SendFskData(uint16_t* /* bit_delays */, unsigned int /* num_bits */)
+int UserspaceSIOWrapper::SendFskData(uint16_t* bit_delays, unsigned int num_bits)
 {
-	TODO
+	pthread_t thread;
+	pthread_attr_t attr;
+	struct sched_param param;
+	sigset_t allSignals, oldSignals;
+	int ret;
+
+	if (num_bits == 0) {
+		fLastResult = EINVAL;
+		return fLastResult;
+	}
+
+	// finish pending tape data before toggling break
+	WaitTransmitComplete();
+
+	fFskDelays = bit_delays;
+	fFskNumBits = num_bits;
+	fFskResult = 0;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+	param.sched_priority = sched_get_priority_max(SCHED_FIFO);
+	pthread_attr_setschedparam(&attr, &param);
+
+	// signals are handled by the main thread only
+	sigfillset(&allSignals);
+	pthread_sigmask(SIG_SETMASK, &allSignals, &oldSignals);
+	ret = pthread_create(&thread, &attr, FskThreadFunc, this);
+	if (ret) {
+		// no permission for realtime scheduling, use our own
+		ret = pthread_create(&thread, 0, FskThreadFunc, this);
+	}
+	pthread_sigmask(SIG_SETMASK, &oldSignals, 0);
+	pthread_attr_destroy(&attr);
+
+	if (ret) {
+		TransmitFsk();
+	} else {
+		pthread_join(thread, 0);
+	}
+
+	fLastResult = fFskResult;
+	return fLastResult;
+}
+
+void* UserspaceSIOWrapper::FskThreadFunc(void* arg)
+{
+	static_cast<UserspaceSIOWrapper*>(arg)->TransmitFsk();
+	return 0;
+}
+
+void UserspaceSIOWrapper::WaitUntilMonotonic(uint64_t usec)
+{
+	uint64_t now = GetMonotonicUsec();
+
+	if (now + eFskBusyWait < usec) {
+		struct timespec ts;
+		uint64_t wakeup = usec - eFskBusyWait;
+		ts.tv_sec = wakeup / 1000000;
+		ts.tv_nsec = (wakeup % 1000000) * 1000;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0) == EINTR) {
+		}
+	}
+	while (GetMonotonicUsec() < usec) {
+	}
+}
+
+void UserspaceSIOWrapper::TransmitFsk()
+{
+	bool space = false;
+	uint64_t edgeTime = GetMonotonicUsec();
+
+	// same as the kernel driver: the first bit is a space (break
+	// on), delays are in units of 100usec
+	for (unsigned int i = 0; i < fFskNumBits; i++) {
+		space = !space;
+		if (ioctl(fDeviceFileNo, space ? TIOCSBRK : TIOCCBRK)) {
+			fFskResult = errno;
+			break;
+		}
+
+		uint64_t now = GetMonotonicUsec();
+		uint64_t jitter = (now > edgeTime) ? now - edgeTime : edgeTime - now;
+		fFskEdgeCount++;
+		fFskJitterSum += jitter;
+		if (jitter > fFskJitterMax) {
+			fFskJitterMax = jitter;
+		}
+
+		edgeTime += (uint64_t) fFskDelays[i] * 100;
+		WaitUntilMonotonic(edgeTime);
+	}
+	if (ioctl(fDeviceFileNo, TIOCCBRK) && !fFskResult) {
+		fFskResult = errno;
+	}
 }
 
 
 int UserspaceSIOWrapper::DebugKernelStatus()
 {
-	// NOP
+	if (fFskEdgeCount) {
+		ALOG("FSK: edge jitter avg %lu max %lu usec (%lu edges)",
+			(unsigned long) (fFskJitterSum / fFskEdgeCount),
+			(unsigned long) fFskJitterMax,
+			fFskEdgeCount);
+	}
+	if (!fHaveCommandLine) {
+		return 0;
+	}
+	if (!fModemEventThreadRunning) {
+		ALOG("command line: polling");
+		return 0;
+	}
+	if (fEdgeLatencyCount) {
+		ALOG("command line: TIOCMIWAIT, edge to read latency avg %lu max %lu usec (%lu commands)",
+			(unsigned long) (fEdgeLatencySum / fEdgeLatencyCount),
+			(unsigned long) fEdgeLatencyMax,
+			fEdgeLatencyCount);
+	} else {
+		ALOG("command line: TIOCMIWAIT");
+	}
 	return 0;
 }
 
-int UserspaceSIOWrapper::EnableTimestampRecording(unsigned int /* on */)
+int UserspaceSIOWrapper::EnableTimestampRecording(unsigned int on)
 {
-	// NOP
-	return 1;
+	fEnableTimestamps = on;
+	fLastResult = 0;
+	return fLastResult;
 }
 
-int UserspaceSIOWrapper::GetTimestamps(SIO_timestamps& /* timestamps */)
+int UserspaceSIOWrapper::GetTimestamps(SIO_timestamps& timestamps)
 {
-	TODO
+	if (!fEnableTimestamps) {
+		fLastResult = EINVAL;
+	} else {
+		timestamps = fTimestamps;
+		fLastResult = 0;
+	}
+	return fLastResult;
+}
+
+uint64_t UserspaceSIOWrapper::GetTimestamp() const
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000 + fTimestampOffset;
+}
+
+void UserspaceSIOWrapper::TimestampBegin()
+{
+	if (!fEnableTimestamps) {
+		return;
+	}
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	uint64_t now = MiscUtils::GetCurrentTime();
+	fTimestampOffset = (int64_t)now - (int64_t)((uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+
+	// fields that aren't used by an operation keep the start time
+	fTimestamps.system_entering = now;
+	fTimestamps.transmission_start = now;
+	fTimestamps.transmission_send_irq = now;
+	fTimestamps.transmission_end = now;
+	fTimestamps.transmission_wakeup = now;
+	fTimestamps.uart_finished = now;
+	fTimestamps.system_leaving = now;
+	fGotSendTimestamp = false;
+}
+
+void UserspaceSIOWrapper::TimestampEnd()
+{
+	if (fEnableTimestamps) {
+		fTimestamps.system_leaving = GetTimestamp();
+	}
 }
 
 unsigned int UserspaceSIOWrapper::GetBaudrateForPokeyDivisor(unsigned int divisor)
@@ -1218,7 +1887,7 @@ int UserspaceSIOWrapper::SendCommandFrame(Ext_SIO_parameters& params)
 		break;
 	}
 
-	fCmdBuf[4] = CalculateChecksum(fCmdBuf, 4);
+	fCmdBuf[4] = CalculateSIOChecksum(fCmdBuf, 4);
 
 	while (retry < eCommandFrameRetries) {
 		if (params.highspeed_mode == ATARISIO_EXTSIO_SPEED_ULTRA) {
@@ -1305,7 +1974,7 @@ int UserspaceSIOWrapper::InternalExtSIO(Ext_SIO_parameters& params)
 		if ((params.data_length > 0) &&
 		    (params.direction & ATARISIO_EXTSIO_DIR_SEND)) {
 			memcpy(fBuf, params.data_buffer, params.data_length);
-			fBuf[params.data_length] = CalculateChecksum(fBuf, params.data_length);
+			fBuf[params.data_length] = CalculateSIOChecksum(fBuf, params.data_length);
 			MicroSleep(eDelayT3Min);
 			ret = TransmitBuf(fBuf, params.data_length+1, true);
 			UTRACE_1050_2_PC("Sending %d data bytes returned %d",
@@ -22,8 +22,10 @@
 */
 
 #include <termios.h>
+#include <pthread.h>
 #include "SIOWrapper.h"
 #include "MiscUtils.h"
+#include "AdapterProfile.h"
 
 class UserspaceSIOWrapper : public SIOWrapper {
 public:
@@ -73,6 +75,12 @@ public:
 	virtual int SendError();
 
 	virtual int SendDataFrame(uint8_t* buf, unsigned int length);
+	virtual int SendDataFrame(const struct iovec* iov, unsigned int iovcnt);
+	virtual int SendDataFrame(const struct iovec* iov, unsigned int iovcnt, uint8_t checksum);
+	virtual int SendResponse(bool ok, MiscUtils::TimestampType completeTime,
+		const struct iovec* iov, unsigned int iovcnt);
+	virtual int SendResponse(bool ok, MiscUtils::TimestampType completeTime,
+		const struct iovec* iov, unsigned int iovcnt, uint8_t checksum);
 	virtual int ReceiveDataFrame(uint8_t* buf, unsigned int length);
 
 	virtual int SendRawFrame(uint8_t* buf, unsigned int length);
@@ -113,6 +121,13 @@ public:
 
 	virtual unsigned int GetBaudrateForPokeyDivisor(unsigned int pokey_div);
 
+	// measure the timing of the adapter at the current baudrate and
+	// store it as profile for this adapter. The loopback latency is
+	// only measured with a loopback plug (TX connected to RX).
+	int CalibrateAdapter(bool loopback);
+
+	inline const AdapterProfile& GetAdapterProfile() const;
+
 private:
 	typedef SIOWrapper super;
 
@@ -125,18 +140,23 @@ private:
 
 	int SetBaudrateIfDifferent(unsigned int baudrate, bool now = true);
 
-	uint8_t CalculateChecksum(uint8_t* buf, unsigned int length);
 	bool CmdBufChecksumOK();
 	bool BufChecksumOK(unsigned int length);
 
 	MiscUtils::TimestampType TimeForBytes(unsigned int length);
 	
 	int TransmitBuf(uint8_t* buf, unsigned int length, bool waitTransmit = false);
+	// note: modifies the iovec array
+	int TransmitIovec(struct iovec* iov, unsigned int iovcnt, bool waitTransmit = false);
 	int TransmitBuf(unsigned int length, bool waitTransmit = false);
 	int TransmitByte(uint8_t byte, bool waitTransmit = false);
 
 	void WaitTransmitComplete(unsigned int bytes = 0);
 
+	// time from writing bytes to the idle port until the next
+	// byte may follow, with the same margins as WaitTransmitComplete
+	MiscUtils::TimestampType PacedTransmitTime(unsigned int bytes);
+
 	int ReceiveBuf(uint8_t* buf, unsigned int length, unsigned int additionalTimeout = 0);
 	int ReceiveBuf(unsigned int length, unsigned int additionalTimeout = 0);
 
@@ -145,6 +165,14 @@ private:
 
 	bool NanoSleep(unsigned long nsec);
 
+	// sleep before sending a byte, minus the time the adapter
+	// needs to get it out (if known)
+	void DelayBeforeSend(unsigned long usec);
+
+	void ApplyAdapterProfile();
+	// adapter profile with drain and latency times valid at fBaudrate
+	inline bool HaveAdapterTiming() const;
+
 	inline bool MicroSleep(unsigned long usec)
 	{
 		return NanoSleep(usec * 1000);
@@ -159,6 +187,40 @@ private:
 
 	int InternalExtSIO(Ext_SIO_parameters& params);
 
+	// In server mode a helper thread blocks in TIOCMIWAIT and sends
+	// the CLOCK_MONOTONIC timestamp (in usec) of each command line
+	// edge through fModemEventPipe, so WaitForCommandFrame can sleep
+	// in select instead of polling the line state. A zero timestamp
+	// means the driver doesn't support TIOCMIWAIT, then we fall
+	// back to polling.
+	bool StartModemEventThread();
+	void StopModemEventThread();
+
+	static void* ModemEventThreadFunc(void* arg);
+	void ModemEventLoop();
+
+	// returns false if the driver doesn't support TIOCMIWAIT
+	bool ReadModemEvents();
+
+	void RecordEdgeLatency();
+
+	static uint64_t GetMonotonicUsec();
+
+	// FSK bits are sent by toggling break on a (if possible)
+	// SCHED_FIFO thread, it sleeps with clock_nanosleep until shortly
+	// before each edge and busy waits for the rest
+	static void* FskThreadFunc(void* arg);
+	void TransmitFsk();
+
+	static void WaitUntilMonotonic(uint64_t usec);
+
+	// Timestamps are taken from CLOCK_MONOTONIC_RAW but reported
+	// relative to gettimeofday at the start of the operation, like
+	// the timestamps of the kernel driver.
+	void TimestampBegin();
+	void TimestampEnd();
+	uint64_t GetTimestamp() const;
+
 	bool fHaveCommandLine;
 	int fCommandLineMask;
 	int fCommandLineLow;
@@ -196,6 +258,7 @@ private:
 		eCmdRawLength = 5,
 		eCmdBufLength = 20,
 		eMaxDataLength = 8199,
+		eMaxIovecs = 8,
 		eBufLength = 8200
 	};
 	uint8_t fCmdBuf[eCmdBufLength];
@@ -219,6 +282,12 @@ private:
 	void SetCommandSoftErrorState();
 	void SetCommandHardErrorState();
 
+	enum {
+		// select timeout when waiting for modem events, in case
+		// an edge slipped in between two TIOCMIWAIT calls
+		eModemEventTimeout = 10000
+	};
+
 	enum {
 		eCommandFrameReceiveTimeout = 15000,
 		eNoCommandLineIdleTimeout = 15000,
@@ -245,6 +314,64 @@ private:
 		eSIORetries = 2
 	};
 
+	pthread_t fModemEventThread;
+	bool fModemEventThreadRunning;
+	volatile bool fModemEventQuit;
+	volatile bool fModemEventDone;
+	int fModemEventPipe[2];
+	int fModemEventMask;
+
+	// timestamp of the last edge that was not handled yet, 0 = none
+	uint64_t fLastEdgeTime;
+
+	// edge to command frame reception latency statistics, in usec
+	unsigned long fEdgeLatencyCount;
+	uint64_t fEdgeLatencySum;
+	uint64_t fEdgeLatencyMax;
+
+	enum {
+		// busy wait for the last part of each FSK bit, in usec
+		eFskBusyWait = 200
+	};
+
+	uint16_t* fFskDelays;
+	unsigned int fFskNumBits;
+	int fFskResult;
+
+	// deviation of the achieved from the requested FSK edge
+	// times, in usec
+	unsigned long fFskEdgeCount;
+	uint64_t fFskJitterSum;
+	uint64_t fFskJitterMax;
+
+	bool fEnableTimestamps;
+	bool fGotSendTimestamp;
+	SIO_timestamps fTimestamps;
+	// gettimeofday minus CLOCK_MONOTONIC_RAW, in usec
+	int64_t fTimestampOffset;
+
+	AdapterProfile fAdapterProfile;
+	bool fHaveAdapterProfile;
+	// estimated time from write until a byte is sent, in usec
+	unsigned int fOutputLatency;
+	// command line poll interval without TIOCMIWAIT, in usec
+	unsigned int fPollInterval;
+
+	enum {
+		// skip the wait before tcdrain if it doesn't overshoot more
+		eMaxDrainOvershoot = 200
+	};
+
 };
 
+inline const AdapterProfile& UserspaceSIOWrapper::GetAdapterProfile() const
+{
+	return fAdapterProfile;
+}
+
+inline bool UserspaceSIOWrapper::HaveAdapterTiming() const
+{
+	return fHaveAdapterProfile && fAdapterProfile.fBaudrate == fBaudrate;
+}
+
 #endif
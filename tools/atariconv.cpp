@@ -0,0 +1,565 @@
+/*
+   atariconv - convert and verify disk images in bulk
+
+   Copyright (C) 2026 Matthias Reichl <hias@horus.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <string>
+#include <vector>
+#include <set>
+#include <utility>
+
+#include "AtrMemoryImage.h"
+#include "Directory.h"
+#include "SIOTracer.h"
+#include "FileTracer.h"
+#include "OS.h"
+#include "Version.h"
+
+#define MAX_THREADS 64
+
+// longer extensions first, so ".atr.gz" isn't taken for ".gz"
+static const char* formatNames[] = {
+	"atr.gz", "xfd.gz", "dcm.gz", "di.gz",
+	"atr", "xfd", "dcm", "di", "atz",
+	NULL
+};
+
+enum { eNumFormats = 9 };
+
+struct Job {
+	std::string fSource;
+	std::string fDest;	// empty in verify-only mode
+	int fSourceFormat;
+	int fDestFormat;
+};
+
+struct Result {
+	bool fOK;
+	bool fSkipped;
+	off_t fSourceSize;
+	off_t fDestSize;
+	double fReadTime;
+	double fWriteTime;
+	double fVerifyTime;
+};
+
+struct FormatStats {
+	unsigned int fRead;
+	off_t fReadBytes;
+	double fReadTime;
+	unsigned int fWritten;
+	off_t fWrittenBytes;
+	double fWriteTime;
+};
+
+static std::vector<Job> jobs;
+static std::vector<Result> results;
+
+static bool verifyOutput = false;
+static bool overwrite = false;
+static bool verbose = false;
+
+static pthread_mutex_t jobMutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int nextJob = 0;
+static unsigned int finishedJobs = 0;
+
+static double GetTime()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static int GetFormat(const char* filename)
+{
+	size_t len = strlen(filename);
+	size_t extlen;
+
+	for (int i = 0; formatNames[i]; i++) {
+		extlen = strlen(formatNames[i]);
+		if (len > extlen + 1 && filename[len - extlen - 1] == '.'
+		    && strcasecmp(filename + len - extlen, formatNames[i]) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static int GetFormatFromName(const char* name)
+{
+	if (*name == '.') {
+		name++;
+	}
+	for (int i = 0; formatNames[i]; i++) {
+		if (strcasecmp(name, formatNames[i]) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static off_t GetFileSize(const char* filename)
+{
+	struct stat statbuf;
+	if (stat(filename, &statbuf)) {
+		return 0;
+	}
+	return statbuf.st_size;
+}
+
+// create all missing parent directories of a file
+static bool CreateParentDirectories(const std::string& path)
+{
+	size_t pos = 0;
+
+	while ((pos = path.find(DIR_SEPARATOR, pos + 1)) != std::string::npos) {
+		std::string dir = path.substr(0, pos);
+		if (mkdir(dir.c_str(), 0777) && errno != EEXIST) {
+			AERROR("cannot create directory \"%s\"", dir.c_str());
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool CompareImages(const RCPtr<AtrMemoryImage>& a, const RCPtr<AtrMemoryImage>& b)
+{
+	unsigned int numSectors = a->GetNumberOfSectors();
+	unsigned int sector, count;
+	uint8_t bufa[8192], bufb[8192];
+	size_t len;
+
+	if (b->GetNumberOfSectors() != numSectors || b->GetSectorLength() != a->GetSectorLength()) {
+		return false;
+	}
+	for (sector = 1; sector <= numSectors; sector += count) {
+		count = sizeof(bufa) / a->GetSectorLength();
+		if (count > numSectors - sector + 1) {
+			count = numSectors - sector + 1;
+		}
+		len = 0;
+		for (unsigned int s = sector; s < sector + count; s++) {
+			len += a->GetSectorLength(s);
+		}
+		if (!a->ReadSectors(sector, count, bufa, sizeof(bufa))
+		    || !b->ReadSectors(sector, count, bufb, sizeof(bufb))
+		    || memcmp(bufa, bufb, len)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void ProcessJob(const Job& job, Result& result, unsigned int worker)
+{
+	RCPtr<AtrMemoryImage> image = new AtrMemoryImage;
+	double start;
+
+	result.fSourceSize = GetFileSize(job.fSource.c_str());
+
+	start = GetTime();
+	if (!image->ReadImageFromFile(job.fSource.c_str(), true)) {
+		AERROR("reading \"%s\" failed", job.fSource.c_str());
+		return;
+	}
+	result.fReadTime = GetTime() - start;
+
+	if (job.fDest.empty()) {
+		result.fOK = true;
+		return;
+	}
+
+	if (!overwrite && access(job.fDest.c_str(), F_OK) == 0) {
+		result.fOK = true;
+		result.fSkipped = true;
+		return;
+	}
+
+	if (!CreateParentDirectories(job.fDest)) {
+		return;
+	}
+
+	// write to a temporary file (with the same extension) in the
+	// destination directory and rename it when it's complete
+	std::string tmpPath;
+	size_t slash = job.fDest.rfind(DIR_SEPARATOR);
+	size_t baseStart = (slash == std::string::npos) ? 0 : slash + 1;
+	char prefix[32];
+	snprintf(prefix, sizeof(prefix), ".tmp%d-%u-", (int) getpid(), worker);
+	tmpPath = job.fDest.substr(0, baseStart) + prefix + job.fDest.substr(baseStart);
+
+	start = GetTime();
+	if (!image->WriteImageToFile(tmpPath.c_str())) {
+		AERROR("writing \"%s\" failed", job.fDest.c_str());
+		unlink(tmpPath.c_str());
+		return;
+	}
+	result.fWriteTime = GetTime() - start;
+
+	if (verifyOutput) {
+		RCPtr<AtrMemoryImage> check = new AtrMemoryImage;
+		start = GetTime();
+		if (!check->ReadImageFromFile(tmpPath.c_str(), true) || !CompareImages(image, check)) {
+			AERROR("verifying \"%s\" failed", job.fDest.c_str());
+			unlink(tmpPath.c_str());
+			return;
+		}
+		result.fVerifyTime = GetTime() - start;
+	}
+
+	if (rename(tmpPath.c_str(), job.fDest.c_str())) {
+		AERROR("cannot rename \"%s\" to \"%s\"", tmpPath.c_str(), job.fDest.c_str());
+		unlink(tmpPath.c_str());
+		return;
+	}
+	result.fDestSize = GetFileSize(job.fDest.c_str());
+	result.fOK = true;
+}
+
+static void* WorkerThread(void* arg)
+{
+	unsigned int worker = (unsigned int) (long) arg;
+	unsigned int idx;
+
+	for (;;) {
+		pthread_mutex_lock(&jobMutex);
+		idx = nextJob;
+		if (idx < jobs.size()) {
+			nextJob++;
+		}
+		pthread_mutex_unlock(&jobMutex);
+
+		if (idx >= jobs.size()) {
+			break;
+		}
+
+		ProcessJob(jobs[idx], results[idx], worker);
+
+		pthread_mutex_lock(&jobMutex);
+		finishedJobs++;
+		pthread_mutex_unlock(&jobMutex);
+	}
+	return 0;
+}
+
+static void AddJob(const std::string& source, const std::string& relPath,
+	const char* outDir, int destFormat)
+{
+	Job job;
+
+	job.fSource = source;
+	job.fSourceFormat = GetFormat(source.c_str());
+	job.fDestFormat = destFormat;
+
+	if (destFormat >= 0) {
+		std::string base;
+		if (outDir) {
+			base = std::string(outDir) + DIR_SEPARATOR + relPath;
+		} else {
+			base = source;
+		}
+		base.resize(base.size() - strlen(formatNames[job.fSourceFormat]));
+		job.fDest = base + formatNames[destFormat];
+
+		if (!outDir && job.fSourceFormat == destFormat) {
+			// nothing to convert
+			return;
+		}
+	}
+	jobs.push_back(job);
+}
+
+static void ScanDirectory(const std::string& path, const std::string& relPath,
+	const char* outDir, int destFormat, std::set<std::pair<dev_t, ino_t> >& visited)
+{
+	struct stat statbuf;
+
+	// don't loop on symlinked directories
+	if (stat(path.c_str(), &statbuf) ||
+	    !visited.insert(std::make_pair(statbuf.st_dev, statbuf.st_ino)).second) {
+		return;
+	}
+
+	RCPtr<Directory> dir = new Directory;
+	if (dir->ReadDirectory(path.c_str(), true) < 0) {
+		AERROR("cannot read directory \"%s\"", path.c_str());
+		return;
+	}
+	for (unsigned int i = 0; i < dir->Size(); i++) {
+		DirEntry* entry = dir->Get(i);
+		if (entry->fType == DirEntry::eParentDirectory || entry->fName[0] == '.') {
+			continue;
+		}
+		std::string sub = path + DIR_SEPARATOR + entry->fName;
+		std::string subRel = relPath.empty() ? std::string(entry->fName) : relPath + DIR_SEPARATOR + entry->fName;
+		if (entry->fType == DirEntry::eDirectory) {
+			ScanDirectory(sub, subRel, outDir, destFormat, visited);
+		} else if (entry->fType == DirEntry::eFile && GetFormat(entry->fName) >= 0) {
+			AddJob(sub, subRel, outDir, destFormat);
+		}
+	}
+}
+
+static void PrintStatistics(double elapsed, int destFormat)
+{
+	FormatStats stats[eNumFormats];
+	unsigned int ok = 0, failed = 0, skipped = 0;
+	off_t totalBytes = 0;
+	double verifyTime = 0;
+	unsigned int i;
+
+	memset(stats, 0, sizeof(stats));
+
+	for (i = 0; i < jobs.size(); i++) {
+		const Result& r = results[i];
+		if (!r.fOK) {
+			failed++;
+			continue;
+		}
+		if (r.fSkipped) {
+			skipped++;
+			continue;
+		}
+		ok++;
+		totalBytes += r.fSourceSize;
+		verifyTime += r.fVerifyTime;
+
+		FormatStats& src = stats[jobs[i].fSourceFormat];
+		src.fRead++;
+		src.fReadBytes += r.fSourceSize;
+		src.fReadTime += r.fReadTime;
+
+		if (jobs[i].fDestFormat >= 0) {
+			FormatStats& dst = stats[jobs[i].fDestFormat];
+			dst.fWritten++;
+			dst.fWrittenBytes += r.fDestSize;
+			dst.fWriteTime += r.fWriteTime;
+		}
+	}
+
+	printf("\nformat   read: images        MB      sec   write: images        MB      sec\n");
+	for (i = 0; i < eNumFormats; i++) {
+		if (stats[i].fRead == 0 && stats[i].fWritten == 0) {
+			continue;
+		}
+		printf("%-8s %13u %9.1f %8.2f %14u %9.1f %8.2f\n",
+			formatNames[i],
+			stats[i].fRead, stats[i].fReadBytes / 1048576.0, stats[i].fReadTime,
+			stats[i].fWritten, stats[i].fWrittenBytes / 1048576.0, stats[i].fWriteTime);
+	}
+	if (verifyOutput && destFormat >= 0) {
+		printf("verify: %.2f sec\n", verifyTime);
+	}
+	printf("\n%u images processed, %u failed, %u skipped in %.2f sec\n",
+		ok, failed, skipped, elapsed);
+	if (elapsed > 0) {
+		printf("throughput: %.1f images/sec, %.1f MB/sec\n",
+			ok / elapsed, totalBytes / 1048576.0 / elapsed);
+	}
+	if (verbose) {
+		for (i = 0; i < jobs.size(); i++) {
+			if (!results[i].fOK) {
+				printf("failed: %s\n", jobs[i].fSource.c_str());
+			}
+		}
+	}
+}
+
+#ifdef ALL_IN_ONE
+int atariconv_main(int argc, char**argv)
+#else
+int main(int argc, char**argv)
+#endif
+{
+	int c;
+	int destFormat = -1;
+	char* outDir = 0;
+	long numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+	pthread_t threads[MAX_THREADS];
+	std::set<std::pair<dev_t, ino_t> > visited;
+	unsigned int i, done, lastDone;
+	long t;
+	double start;
+	bool failed = false;
+
+	SIOTracer* sioTracer = SIOTracer::GetInstance();
+	{
+		RCPtr<FileTracer> tracer(new FileTracer(stderr));
+		sioTracer->AddTracer(tracer);
+		sioTracer->SetTraceGroup(SIOTracer::eTraceInfo, true, tracer);
+		sioTracer->SetTraceGroup(SIOTracer::eTraceWarning, true, tracer);
+		sioTracer->SetTraceGroup(SIOTracer::eTraceError, true, tracer);
+	}
+
+	while ((c = getopt(argc, argv, "t:o:j:cfv")) != -1) {
+		switch(c) {
+		case 't':
+			destFormat = GetFormatFromName(optarg);
+			if (destFormat < 0) {
+				printf("unknown image format \"%s\"\n", optarg);
+				goto usage;
+			}
+			break;
+		case 'o':
+			outDir = optarg;
+			break;
+		case 'j':
+			numThreads = atoi(optarg);
+			if (numThreads < 1 || numThreads > MAX_THREADS) {
+				printf("number of threads must be 1..%d\n", MAX_THREADS);
+				goto usage;
+			}
+			break;
+		case 'c':
+			verifyOutput = true;
+			break;
+		case 'f':
+			overwrite = true;
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind >= argc) {
+		goto usage;
+	}
+	if (outDir && destFormat < 0) {
+		printf("-o requires -t\n");
+		goto usage;
+	}
+	if (numThreads < 1) {
+		numThreads = 1;
+	} else if (numThreads > MAX_THREADS) {
+		numThreads = MAX_THREADS;
+	}
+
+	for (; optind < argc; optind++) {
+		struct stat statbuf;
+		std::string path(argv[optind]);
+
+		while (path.size() > 1 && path[path.size() - 1] == DIR_SEPARATOR) {
+			path.resize(path.size() - 1);
+		}
+		if (stat(path.c_str(), &statbuf)) {
+			AERROR("cannot stat \"%s\"", path.c_str());
+			failed = true;
+			continue;
+		}
+		if (S_ISDIR(statbuf.st_mode)) {
+			ScanDirectory(path, std::string(), outDir, destFormat, visited);
+		} else if (GetFormat(path.c_str()) >= 0) {
+			size_t slash = path.rfind(DIR_SEPARATOR);
+			AddJob(path, slash == std::string::npos ? path : path.substr(slash + 1), outDir, destFormat);
+		} else {
+			AERROR("unknown image format of \"%s\"", path.c_str());
+			failed = true;
+		}
+	}
+	sioTracer->FlushDeferredStrings();
+
+	if (jobs.empty()) {
+		printf("no images found\n");
+		sioTracer->RemoveAllTracers();
+		return failed ? 1 : 0;
+	}
+
+	{
+		Result empty;
+		memset(&empty, 0, sizeof(empty));
+		results.assign(jobs.size(), empty);
+	}
+	if ((unsigned long) numThreads > jobs.size()) {
+		numThreads = jobs.size();
+	}
+
+	printf("%s %d images using %ld threads\n",
+		destFormat >= 0 ? "converting" : "verifying",
+		(int) jobs.size(), numThreads);
+
+	start = GetTime();
+	for (t = 0; t < numThreads; t++) {
+		if (pthread_create(&threads[t], 0, WorkerThread, (void*) t)) {
+			AERROR("cannot create worker thread");
+			numThreads = t;
+			break;
+		}
+	}
+	if (numThreads == 0) {
+		sioTracer->RemoveAllTracers();
+		return 1;
+	}
+
+	// worker threads only queue their messages, print them here
+	lastDone = 0;
+	do {
+		usleep(100000);
+		pthread_mutex_lock(&jobMutex);
+		done = finishedJobs;
+		pthread_mutex_unlock(&jobMutex);
+		sioTracer->FlushDeferredStrings();
+		if (verbose && done != lastDone) {
+			printf("%u/%d\n", done, (int) jobs.size());
+			lastDone = done;
+		}
+	} while (done < jobs.size());
+
+	for (t = 0; t < numThreads; t++) {
+		pthread_join(threads[t], 0);
+	}
+	sioTracer->FlushDeferredStrings();
+
+	PrintStatistics(GetTime() - start, destFormat);
+
+	for (i = 0; i < jobs.size(); i++) {
+		if (!results[i].fOK) {
+			failed = true;
+		}
+	}
+	sioTracer->RemoveAllTracers();
+	return failed ? 1 : 0;
+
+usage:
+	printf("atariconv %s\n", VERSION_STRING);
+	printf("(c) 2026 Matthias Reichl <hias@horus.com>\n");
+	printf("usage: atariconv [-t format] [-o dir] [-j threads] [-cfv] file|directory...\n");
+	printf("  -t format  convert images to format (atr, xfd, dcm, di, atz,\n");
+	printf("             atr.gz, xfd.gz, dcm.gz, di.gz). Without -t the\n");
+	printf("             images are only read to check them\n");
+	printf("  -o dir     write converted images to dir (default: next to\n");
+	printf("             the source image)\n");
+	printf("  -j num     number of worker threads (default: number of CPUs)\n");
+	printf("  -c         re-read converted images and compare them\n");
+	printf("  -f         overwrite existing files\n");
+	printf("  -v         show progress and list failed images\n");
+	sioTracer->RemoveAllTracers();
+	return 1;
+}
@@ -29,6 +29,7 @@
 #include "MiscUtils.h"
 #include "Version.h"
 #include "RemoteControlHandler.h"
+#include "FileIO.h"
 
 #include <iostream>
 #include <signal.h>
@@ -36,6 +37,7 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 
 static CursesFrontend* frontend= NULL;
 
@@ -73,6 +75,7 @@ static const char* cas_filename = 0;
 static void process_args(RCPtr<DeviceManager>& manager, CursesFrontend* frontend, int argc, char** argv)
 {
 	bool write_protect_next = false;
+	bool overlay_next = false;
 	EDiskFormat virtual_format = e130kDisk;
 	ESectorLength virtual_sector_length = e128BytesPerSector;
 	int virtual_sector_count = 1040;
@@ -118,6 +121,20 @@ static void process_args(RCPtr<DeviceManager>& manager, CursesFrontend* frontend
 						AERROR("-B needs a parameter!");
 					}
 					break;
+				case 'A':
+					if (i + 1 < argc) {
+						i++;
+						char* end;
+						long secs = strtol(argv[i], &end, 10);
+						if (end == argv[i] || *end || secs < 0 || secs > INT_MAX) {
+							AERROR("invalid parameter for -A: use seconds (0 = off)");
+						} else if (manager->EnableAutosave(secs) && secs) {
+							ALOG("autosaving images every %ld seconds", secs);
+						}
+					} else {
+						AERROR("-A needs a parameter!");
+					}
+					break;
 				case 's':
 					if (i + 1 < argc) {
 						i++;
@@ -176,6 +193,47 @@ static void process_args(RCPtr<DeviceManager>& manager, CursesFrontend* frontend
 						AERROR("-T needs a parameter!");
 					}
 					break;
+#ifdef USE_ZLIB
+				case 'Z':
+					if (i + 1 < argc) {
+						i++;
+						char* end;
+						int level = strtol(argv[i], &end, 10);
+						int strategy = Z_DEFAULT_STRATEGY;
+						const char* strategyName = "default";
+						if (*end == ',') {
+							strategyName = end + 1;
+							if (strcmp(strategyName, "default") == 0) {
+								strategy = Z_DEFAULT_STRATEGY;
+							} else if (strcmp(strategyName, "filtered") == 0) {
+								strategy = Z_FILTERED;
+							} else if (strcmp(strategyName, "huffman") == 0) {
+								strategy = Z_HUFFMAN_ONLY;
+							} else if (strcmp(strategyName, "rle") == 0) {
+								strategy = Z_RLE;
+							} else if (strcmp(strategyName, "fixed") == 0) {
+								strategy = Z_FIXED;
+							} else {
+								strategy = -1;
+							}
+						} else if (*end) {
+							strategy = -1;
+						}
+						if (end != argv[i] && GZFileIO::SetCompression(level, strategy)) {
+							ALOG("using gzip compression level %d, strategy %s", level, strategyName);
+						} else {
+							AERROR("invalid parameter for -Z: use level[,strategy]");
+						}
+					} else {
+						AERROR("-Z needs a parameter!");
+					}
+					break;
+#endif
+				case 'M':
+					if (manager->EnableSectorStore(true)) {
+						ALOG("sharing identical sectors of memory images");
+					}
+					break;
 				case 'X':
 					manager->EnableXF551Mode(true);
 					ALOG("enabling XF551 commands");
@@ -199,6 +257,9 @@ static void process_args(RCPtr<DeviceManager>& manager, CursesFrontend* frontend
 				case 'p':
 					write_protect_next = true;
 					break;
+				case 'O':
+					overlay_next = true;
+					break;
 				case 'P':
 					i++;
 					if (i + 1 < argc) {
@@ -331,7 +392,14 @@ illegal_option:
 						if (manager->DriveInUse(driveNo)) {
 							AERROR("drive D%d: already assigned!", drive);
 						}
-						if (!manager->LoadDiskImage(driveNo, argv[i])) {
+						bool loaded;
+						if (overlay_next) {
+							loaded = manager->LoadOverlayImage(driveNo, argv[i]);
+							overlay_next = false;
+						} else {
+							loaded = manager->LoadDiskImage(driveNo, argv[i]);
+						}
+						if (!loaded) {
 							AERROR("cannot load \"%s\" into D%d:", argv[i], drive);
 						} else {
 							if (write_protect_next) {
@@ -378,11 +446,18 @@ void usage()
 	printf("-X            enable XF551 commands\n");
 	printf("-t            increase SIO trace level (default:0, max:3)\n");
 	printf("-B percent    set tape baudrate to x%% of nominal speed (1-200)\n");
+	printf("-A seconds    journal sector writes and autosave images every <seconds>\n");
+	printf("-M            store identical sectors of all images only once\n");
+#ifdef USE_ZLIB
+	printf("-Z lvl[,str]  gzip compression level (0-9) and strategy used for writing\n");
+	printf("              .atr.gz images: default|filtered|huffman|rle|fixed\n");
+#endif
 	printf("-P mode file  install printer handler\n");
 	printf("              mode sets EOL conversion: r=raw/none, l=LF, c=CR, b=CR+LF\n");
 	printf("              path is either a filename or |print-command, eg |lpr\n");
 	printf("-Q            ask before quitting atariserver\n");
 	printf("-p            write protect the next image\n");
+	printf("-O            load the next image as copy-on-write overlay\n");
 	printf("-1..-8        set drive number for next image / virtual drive\n"); 
 	printf("-V dens dir   create virtual drive of given density, the second parameter\n");
 	printf("              specifies the directory. dens is s|e|d|(<number>s|d)|S|D\n");
@@ -576,6 +651,9 @@ int main(int argc, char** argv)
 		case 'l':
 			frontend->ProcessLoadDrive();
 			break;
+		case 'M':
+			frontend->ProcessShowSectorStoreStatistics();
+			break;
 		case 'p':
 			frontend->ProcessWriteProtectDrive();
 			break;
@@ -590,6 +668,9 @@ int main(int argc, char** argv)
 		case 'r':
 			frontend->ProcessReloadDrive();
 			break;
+		case 'R':
+			frontend->ProcessResetOverlayDrive();
+			break;
 		case 's':
 			frontend->ProcessSetHighSpeed();
 			break;
@@ -32,6 +32,7 @@
 #include <signal.h>
 
 #include "AtrMemoryImage.h"
+#include "DCMCodec.h"
 #include "SIOWrapper.h"
 #include "SIOTracer.h"
 #include "FileTracer.h"
@@ -701,7 +702,7 @@ int main(int argc, char** argv)
 	printf("atarixfer %s\n", VERSION_STRING);
 	printf("(c) 2002-%d Matthias Reichl <hias@horus.com>\n", CURRENT_YEAR);
 	while(!finished) {
-		c = getopt(argc, argv, "lprw12345678def:F:R:s:T:xuq");
+		c = getopt(argc, argv, "lprw12345678def:F:mR:s:T:xuq");
 		if (c == -1) {
 			break;
 		}
@@ -758,6 +759,9 @@ int main(int argc, char** argv)
 			force_sector_length = SectorLength(force_disk_format);
 			force_number_of_sectors = NumberOfSectors(force_disk_format);
 			break;
+		case 'm':
+			DCMCodec::SetMaxCompression(true);
+			break;
 		case '1':
 		case '2':
 		case '3':
@@ -886,13 +890,14 @@ usage:
 	printf("usage: [-f device ] [options] -r|-w imagefile\n\n");
         printf("options:\n");
 	printf("  -f device     use alternative AtariSIO device (default: /dev/atarisio0)\n");
-	printf("  -r imagefile  create ATR/XFD/DCM image of disk\n");
-	printf("  -w imagefile  write given ATR/XFD/DCM image to disk\n");
+	printf("  -r imagefile  create ATR/XFD/DCM/ATZ image of disk\n");
+	printf("  -w imagefile  write given ATR/XFD/DCM/ATZ image to disk\n");
 	printf("  -d            enable debugging\n");
 	printf("  -e            continue on errors\n");
 	printf("  -p            use APE prosystem cable (default: 1050-2-PC cable)\n");
 	printf("  -l            use early rev Lotharek 1050-2-PC USB cable\n");
 	printf("  -F s|e|d|q    force SD/ED/DD/QD disk format\n");
+	printf("  -m            maximum DCM compression (slower)\n");
 	printf("  -R num        retry failed sector I/O 'num' times (0..100)\n");
 	printf("  -s mode       high speed: 0 = off, 1 = XF551/Warp, 2 = Ultra/Turbo, 3 = all\n");
 	printf("  -T timing     SIO timing: s = strict, r = relaxed\n");
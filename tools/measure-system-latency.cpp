@@ -29,10 +29,14 @@
 #include <string.h>
 #include <signal.h>
 #include <getopt.h>
+#include <fcntl.h>
+#include <termios.h>
 
 #include "AtrMemoryImage.h"
 #include "SIOWrapper.h"
 #include "KernelSIOWrapper.h"
+#include "UserspaceSIOWrapper.h"
+#include "AdapterProfile.h"
 #include "SIOTracer.h"
 #include "FileTracer.h"
 #include "Error.h"
@@ -369,6 +373,57 @@ bool CalcTiming(unsigned long t1, unsigned long t2,
 }
 
 
+static void print_adapter_profile(const AdapterProfile& profile)
+{
+	if (profile.fModemGetCost) {
+		printf("TIOCMGET cost:         %6u usec\n", profile.fModemGetCost);
+	}
+	printf("tcdrain overshoot: avg %6u max %6u usec\n",
+		profile.fDrainOvershootAvg, profile.fDrainOvershootMax);
+	if (profile.fLoopbackLatencyMax) {
+		printf("loopback latency:  min %6u avg %6u max %6u usec\n",
+			profile.fLoopbackLatencyMin,
+			profile.fLoopbackLatencyAvg,
+			profile.fLoopbackLatencyMax);
+	}
+}
+
+// measure the software part of the latency (tty layer) through a pty
+static int measure_pty_latency()
+{
+	struct termios tio;
+	AdapterProfile profile;
+	int master, slave;
+
+	master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (master < 0 || grantpt(master) || unlockpt(master)) {
+		printf("cannot create pty\n");
+		return 1;
+	}
+	slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+	if (slave < 0) {
+		printf("cannot open pty\n");
+		close(master);
+		return 1;
+	}
+	tcgetattr(slave, &tio);
+	cfmakeraw(&tio);
+	tcsetattr(slave, TCSANOW, &tio);
+	tcgetattr(master, &tio);
+	cfmakeraw(&tio);
+	tcsetattr(master, TCSANOW, &tio);
+
+	// ptys don't have a baudrate, don't subtract transmission times
+	if (profile.Measure(slave, master, 1000000000)) {
+		print_adapter_profile(profile);
+	} else {
+		printf("measuring pty latency failed\n");
+	}
+	close(slave);
+	close(master);
+	return 0;
+}
+
 int main(int argc, char** argv)
 {
 	sioTracer = SIOTracer::GetInstance();
@@ -385,14 +440,24 @@ int main(int argc, char** argv)
 	bool calcLatencyParameters = false;
 	bool highspeedMode = false;
 	bool slowMode = false;
+	int calibrate = 0;
 
 	const char* siodev = 0;
 
 	unsigned int highbaud = 57600;
 
 	int c;
-	while ((c = getopt(argc, argv, "vglhsd:b:")) > 0) {
+	while ((c = getopt(argc, argv, "vglhscCpd:b:")) > 0) {
 		switch(c) {
+		case 'c':
+			// with loopback plug
+			calibrate = 2;
+			break;
+		case 'C':
+			calibrate = 1;
+			break;
+		case 'p':
+			return measure_pty_latency();
 		case 'b': 
 			highbaud = atoi(optarg);
 			printf("using highspeed baudrate %d\n", highbaud);
@@ -460,6 +525,22 @@ int main(int argc, char** argv)
 		return 1;
 	}
 
+	if (calibrate) {
+		if (!SIO->IsUserspaceWrapper()) {
+			printf("calibration is only used by the userspace driver\n");
+			return 1;
+		}
+		RCPtr<UserspaceSIOWrapper> usio = RCPtrStaticCast<UserspaceSIOWrapper>(SIO);
+		if (usio->CalibrateAdapter(calibrate == 2)) {
+			printf("calibration failed\n");
+			return 1;
+		}
+		printf("calibrated at %u baud\n", usio->GetAdapterProfile().fBaudrate);
+		print_adapter_profile(usio->GetAdapterProfile());
+		sioTracer->RemoveAllTracers();
+		return 0;
+	}
+
 	if (calcLatencyParameters) {
 		// calculate latency and transmission speed
 		unsigned int b1 = 130;
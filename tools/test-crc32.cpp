@@ -0,0 +1,131 @@
+/*
+   test-crc32 - cross-check and benchmark the CRC32 engines
+
+   Copyright (C) 2026 Matthias Reichl <hias@horus.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "Crc32.h"
+
+#define MAX_CHECK_LEN 4200
+#define BENCH_LEN (16*1024*1024)
+
+using namespace CRC32;
+
+static double GetTime()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static bool CheckEngine(EEngine engine, const uint8_t* data)
+{
+	unsigned long crc, ref, split;
+	unsigned int ofs, len, i;
+
+	// standard check value
+	crc = CalcCRC32WithEngine(engine, 0, "123456789", 9);
+	if (crc != 0xcbf43926) {
+		printf("%s: check value %08lx != cbf43926\n", GetEngineName(engine), crc);
+		return false;
+	}
+
+	// all lengths at all alignments within a 16 byte block
+	for (ofs = 0; ofs < 16; ofs++) {
+		for (len = 0; len <= MAX_CHECK_LEN; len++) {
+			ref = CalcCRC32WithEngine(eEngineBytewise, ofs, data + ofs, len);
+			crc = CalcCRC32WithEngine(engine, ofs, data + ofs, len);
+			if (crc != ref) {
+				printf("%s: mismatch at offset %d length %d: %08lx != %08lx\n",
+					GetEngineName(engine), ofs, len, crc, ref);
+				return false;
+			}
+		}
+	}
+
+	// chained calculation must match the one-shot result
+	for (i = 0; i < 1000; i++) {
+		len = rand() % MAX_CHECK_LEN;
+		ofs = len ? rand() % len : 0;
+		ref = CalcCRC32WithEngine(eEngineBytewise, 0, data, len);
+		split = CalcCRC32WithEngine(engine, 0, data, ofs);
+		crc = CalcCRC32WithEngine(engine, split, data + ofs, len - ofs);
+		if (crc != ref) {
+			printf("%s: chained mismatch at split %d length %d: %08lx != %08lx\n",
+				GetEngineName(engine), ofs, len, crc, ref);
+			return false;
+		}
+	}
+	return true;
+}
+
+static void BenchmarkEngine(EEngine engine, const uint8_t* data)
+{
+	unsigned int rounds = 0;
+	unsigned long crc = 0;
+	double start, elapsed;
+
+	start = GetTime();
+	do {
+		crc = CalcCRC32WithEngine(engine, crc, data, BENCH_LEN);
+		rounds++;
+		elapsed = GetTime() - start;
+	} while (elapsed < 0.5);
+
+	printf("%-12s %8.1f MB/s (crc %08lx)\n", GetEngineName(engine),
+		(double) rounds * BENCH_LEN / elapsed / (1024 * 1024), crc);
+}
+
+int main(int argc, char** argv)
+{
+	bool bench = (argc > 1 && strcmp(argv[1], "-b") == 0);
+	bool ok = true;
+	unsigned int len = bench ? BENCH_LEN : MAX_CHECK_LEN + 16;
+	unsigned int i;
+	int e;
+
+	uint8_t* data = new uint8_t[len];
+	srand(0x1234);
+	for (i = 0; i < len; i++) {
+		data[i] = rand();
+	}
+
+	printf("default engine: %s\n", GetEngineName(GetDefaultEngine()));
+
+	for (e = 0; e < eNumEngines; e++) {
+		EEngine engine = (EEngine) e;
+		if (!EngineAvailable(engine)) {
+			printf("%-12s not available\n", GetEngineName(engine));
+			continue;
+		}
+		if (bench) {
+			BenchmarkEngine(engine, data);
+		} else if (CheckEngine(engine, data)) {
+			printf("%-12s OK\n", GetEngineName(engine));
+		} else {
+			ok = false;
+		}
+	}
+
+	delete[] data;
+	return ok ? 0 : 1;
+}